@@ -0,0 +1,25 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+/* Prints the table of MIDI control changes, doc/midi_cc_table.txt, or with the
+ * argument nrpn the table of high resolution controls,
+ * doc/midi_nrpn_table.txt, from the lists the firmware is built from. Run
+ * make doc/midi_cc_table.txt doc/midi_nrpn_table.txt to remake them. */
+
+#include <stdio.h>
+#include <string.h>
+#include "synth_midi_cc_table.h"
+
+#define PRINT_CC(cc,func,note,pitch,desc,notes) \
+    printf(" %d | %s | %s \n", cc, desc, notes);
+
+int main (int argc, char **argv)
+{
+    if ((argc > 1) && (strcmp(argv[1],"nrpn") == 0)) {
+        printf(" Parameter number | Description | Notes \n");
+        SYNTH_MIDI_NRPN_TABLE(PRINT_CC)
+    } else {
+        printf(" Control change number | Description | Notes \n");
+        SYNTH_MIDI_CC_TABLE(PRINT_CC)
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#ifndef HOST_CORE_CM4_H
+#define HOST_CORE_CM4_H
+
+/* Stands in for the CMSIS Cortex-M4 core header in the host build (see
+ * "make host"). inc/stm32f4xx.h includes this instead of the real one because
+ * host/ comes first in the include path. Only the parts of the core the engine
+ * uses are here: the cycle counter reads the host's clock and interrupts are
+ * never disabled because there is only one thread. The peripherals in
+ * stm32f4xx.h are still fixed addresses, so the files that touch them are
+ * replaced by host/host_hal.c. */
+
+#include <stdint.h>
+
+#define __I  volatile const
+#define __O  volatile
+#define __IO volatile
+#define __IM volatile const
+#define __OM volatile
+#define __IOM volatile
+#define __ASM __asm
+#define __INLINE inline
+#define __STATIC_INLINE static inline
+
+typedef struct {
+    __IO uint32_t CTRL;
+    __IO uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct {
+    __IO uint32_t DHCSR;
+    __IO uint32_t DCRSR;
+    __IO uint32_t DCRDR;
+    __IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+#define DWT_CTRL_CYCCNTENA_Msk     (1UL)
+
+/* Each read of DWT->CYCCNT gives the time since the program started in cycles
+ * of a SystemCoreClock (see get_SystemCoreClock) core */
+DWT_Type *host_dwt(void);
+extern CoreDebug_Type host_core_debug;
+#define DWT       (host_dwt())
+#define CoreDebug (&host_core_debug)
+
+static inline void NVIC_EnableIRQ(IRQn_Type irq) { (void)irq; }
+static inline void NVIC_DisableIRQ(IRQn_Type irq) { (void)irq; }
+static inline void NVIC_ClearPendingIRQ(IRQn_Type irq) { (void)irq; }
+static inline void NVIC_SetPendingIRQ(IRQn_Type irq) { (void)irq; }
+static inline void NVIC_SetPriority(IRQn_Type irq, uint32_t priority)
+{
+    (void)irq;
+    (void)priority;
+}
+
+static inline void __disable_irq(void) {}
+static inline void __enable_irq(void) {}
+static inline uint32_t __get_PRIMASK(void) { return 0; }
+static inline void __set_PRIMASK(uint32_t primask) { (void)primask; }
+static inline void __DSB(void) {}
+static inline void __DMB(void) {}
+static inline void __ISB(void) {}
+
+/* Nothing interrupts anything so the store always succeeds */
+static inline uint32_t __LDREXW(volatile uint32_t *addr) { return *addr; }
+static inline uint32_t __STREXW(uint32_t value, volatile uint32_t *addr)
+{
+    *addr = value;
+    return 0;
+}
+static inline void __CLREX(void) {}
+
+#endif /* HOST_CORE_CM4_H */
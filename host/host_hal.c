@@ -0,0 +1,510 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "host_hal.h"
+#include "audio_setup.h"
+#include "midi_setup.h"
+#include "adc.h"
+#include "switches.h"
+#include "leds.h"
+#include "presets_lowlevel.h"
+#include "recording_flash.h"
+#include "telemetry.h"
+#include "midi_clock_out.h"
+#include "system_init.h"
+#include "flash_commanding.h"
+
+/* The board's core clock. The cycle counter counts at this rate so the times
+ * the engine works out are in the same units as on the board. */
+#define HOST_CORE_CLOCK 180000000
+/* Room for the presets, more than they take up */
+#define HOST_PRESETS_SIZE (64*1024)
+
+/* Core */
+
+static DWT_Type host_dwt_regs;
+CoreDebug_Type host_core_debug;
+
+DWT_Type *host_dwt(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    host_dwt_regs.CYCCNT = (uint32_t)(((uint64_t)ts.tv_sec * 1000000000ULL
+                + ts.tv_nsec) * (HOST_CORE_CLOCK / 1000000) / 1000);
+    return &host_dwt_regs;
+}
+
+uint32_t get_SystemCoreClock(void)
+{
+    return HOST_CORE_CLOCK;
+}
+
+void HardFault_Handler(void)
+{
+    fprintf(stderr,"The engine threw an error.\n");
+    abort();
+}
+
+/* Audio */
+
+static uint64_t host_sample = 0;
+static audio_hw_io_t host_audio_io;
+
+audio_hw_err_t audio_hw_setup(audio_hw_setup_t *params)
+{
+    return 0;
+}
+
+audio_hw_err_t audio_hw_start(audio_hw_setup_t *params)
+{
+    return 0;
+}
+
+unsigned int audio_hw_get_sample_rate(void *data)
+{
+    return CODEC_SAMPLE_RATE;
+}
+
+unsigned int audio_hw_get_block_size(void *data)
+{
+    return CODEC_DMA_BUF_LEN/CODEC_NUM_CHANNELS;
+}
+
+unsigned int audio_hw_get_num_input_channels(void *data)
+{
+    return CODEC_NUM_CHANNELS;
+}
+
+unsigned int audio_hw_get_num_output_channels(void *data)
+{
+    return CODEC_NUM_CHANNELS;
+}
+
+unsigned int i2s_get_n_underruns(void)
+{
+    return 0;
+}
+
+unsigned int i2s_get_n_resyncs(void)
+{
+    return 0;
+}
+
+void i2s_get_resync_stats(i2s_resync_stats_t *stats)
+{
+    memset(stats,0,sizeof(i2s_resync_stats_t));
+}
+
+uint32_t i2s_get_sample_position(void)
+{
+    return (uint32_t)host_sample;
+}
+
+uint32_t i2s_get_block_sample(void)
+{
+    return (uint32_t)host_sample;
+}
+
+void host_audio_block(audio_hw_sample_t *in, audio_hw_sample_t *out)
+{
+    host_audio_io.in = in;
+    host_audio_io.out = out;
+    host_audio_io.length = audio_hw_get_block_size(NULL);
+    host_audio_io.nchans_in = audio_hw_get_num_input_channels(NULL);
+    host_audio_io.nchans_out = audio_hw_get_num_output_channels(NULL);
+    audio_hw_io(&host_audio_io);
+    host_sample += host_audio_io.length;
+}
+
+uint64_t host_get_sample(void)
+{
+    return host_sample;
+}
+
+/* MIDI */
+
+/* Received bytes waiting to be handled and the sample each is received at */
+static char host_midi_bytes[HOST_MIDI_IN_SIZE];
+static uint64_t host_midi_samples[HOST_MIDI_IN_SIZE];
+static uint32_t host_midi_head = 0, host_midi_tail = 0;
+static uint32_t host_midi_offset = 0;
+static uint32_t host_midi_time = 0;
+static uint32_t host_midi_out_count = 0;
+
+midi_hw_tx_stats_t midi_hw_tx_stats;
+
+int host_midi_in(uint64_t sample, const char *bytes, uint32_t n)
+{
+    if ((host_midi_head + n) > HOST_MIDI_IN_SIZE) {
+        return -1;
+    }
+    while (n--) {
+        host_midi_samples[host_midi_head] = sample;
+        host_midi_bytes[host_midi_head++] = *bytes++;
+    }
+    return 0;
+}
+
+midi_hw_err_t midi_hw_setup(midi_hw_setup_t *params)
+{
+    return 0;
+}
+
+midi_hw_err_t midi_hw_cleanup(midi_hw_cleanup_t *params)
+{
+    return 0;
+}
+
+/* Handles the bytes received before the end of this block. Unlike on the board
+ * they are not a block late, each takes effect at the sample it was queued
+ * at. */
+void midi_hw_process_input(midi_hw_process_t *params)
+{
+    uint64_t end = host_sample + audio_hw_get_block_size(NULL);
+    host_midi_time = DWT->CYCCNT;
+    while ((host_midi_tail < host_midi_head)
+            && (host_midi_samples[host_midi_tail] < end)) {
+        host_midi_offset = host_midi_samples[host_midi_tail] > host_sample ?
+            (uint32_t)(host_midi_samples[host_midi_tail] - host_sample) : 0;
+        midi_hw_process_byte(host_midi_bytes[host_midi_tail++]);
+    }
+    host_midi_offset = 0;
+}
+
+uint32_t midi_hw_get_msg_offset(void)
+{
+    return host_midi_offset;
+}
+
+uint32_t midi_hw_get_msg_time(void)
+{
+    return host_midi_time;
+}
+
+/* What is sent is only counted */
+int midi_hw_tx_begin(midi_hw_tx_t *tx, uint32_t n)
+{
+    tx->pos = 0;
+    tx->end = n;
+    return 0;
+}
+
+void midi_hw_tx_put(midi_hw_tx_t *tx, char byte)
+{
+    if (tx->pos < tx->end) {
+        tx->pos++;
+        host_midi_out_count++;
+    }
+}
+
+void midi_hw_tx_end(midi_hw_tx_t *tx)
+{
+}
+
+int midi_hw_send_bytes(const char *bytes, int n)
+{
+    host_midi_out_count += n;
+    return 0;
+}
+
+int midi_hw_send_realtime(char byte)
+{
+    host_midi_out_count++;
+    return 0;
+}
+
+int midi_hw_get_tx_space(void)
+{
+    return MIDI_TX_BUF_SIZE;
+}
+
+uint32_t midi_hw_get_tx_wait_cycles(void)
+{
+    return 0;
+}
+
+uint32_t host_get_midi_out_count(void)
+{
+    return host_midi_out_count;
+}
+
+/* Sending MIDI clock needs TIM5, it is never turned on */
+midi_clock_out_stats_t midi_clock_out_stats;
+
+void midi_clock_out_setup(void)
+{
+}
+
+void midi_clock_out_set_enabled(int enabled)
+{
+}
+
+int midi_clock_out_get_enabled(void)
+{
+    return 0;
+}
+
+void midi_clock_out_mark_block(void)
+{
+}
+
+void midi_clock_out_block(void)
+{
+}
+
+/* Knobs, the DMA never writes any scans so they stay at 0 */
+
+static uint16_t volatile host_adc_values[TOTAL_NUM_ADC_CHANNELS*ADC_AVG_SIZE];
+static uint32_t volatile host_adc_scan_count = 0;
+uint16_t volatile *adc_data_starts[TOTAL_NUM_ADC_CHANNELS];
+uint32_t adc_raw_value_strides[TOTAL_NUM_ADC_CHANNELS];
+uint32_t volatile *adc_scan_counts[TOTAL_NUM_ADC_CHANNELS];
+
+void adc_setup_dma_scan(adc_mode_t mode)
+{
+    int n;
+    for (n = 0; n < TOTAL_NUM_ADC_CHANNELS; n++) {
+        adc_data_starts[n] = &host_adc_values[n];
+        adc_raw_value_strides[n] = TOTAL_NUM_ADC_CHANNELS;
+        adc_scan_counts[n] = &host_adc_scan_count;
+    }
+}
+
+void adc_start_conversion(void)
+{
+}
+
+int adc_get_adc_ready(void)
+{
+    return 0;
+}
+
+void adc_clear_adc_ready(void)
+{
+}
+
+/* Switches, like on the board a bit that is low means the switch is closed */
+
+typedef struct {
+    const char *name;
+    uint32_t word;
+    uint32_t bit;
+    /* The footswitch whose presses are timestamped or switches_edge_N */
+    switches_edge_sw_t edge;
+} host_switch_t;
+
+typedef struct {
+    uint64_t sample;
+    const host_switch_t *sw;
+    int closed;
+} host_switch_change_t;
+
+#define HOST_SWITCH(name,addr,bit,edge) \
+    { name, (uint32_t)((addr) - switches_debounced), bit, edge }
+
+static const host_switch_t host_switches[] = {
+    HOST_SWITCH("fsw1",FSW1_DB_ADDR,FSW1_DB_BIT,switches_edge_FSW1),
+    HOST_SWITCH("fsw2",FSW2_DB_ADDR,FSW2_DB_BIT,switches_edge_FSW2),
+    HOST_SWITCH("sw1_top",SW1_TOP_DB_ADDR,SW1_TOP_DB_BIT,switches_edge_N),
+    HOST_SWITCH("sw1_btm",SW1_BTM_DB_ADDR,SW1_BTM_DB_BIT,switches_edge_N),
+    HOST_SWITCH("sw2_top",SW2_TOP_DB_ADDR,SW2_TOP_DB_BIT,switches_edge_N),
+    HOST_SWITCH("sw2_btm",SW2_BTM_DB_ADDR,SW2_BTM_DB_BIT,switches_edge_N),
+    HOST_SWITCH("sw3_top",SW3_TOP_DB_ADDR,SW3_TOP_DB_BIT,switches_edge_N),
+    HOST_SWITCH("sw3_btm",SW3_BTM_DB_ADDR,SW3_BTM_DB_BIT,switches_edge_N),
+    HOST_SWITCH("sw4_top",SW4_TOP_DB_ADDR,SW4_TOP_DB_BIT,switches_edge_N),
+    HOST_SWITCH("sw4_btm",SW4_BTM_DB_ADDR,SW4_BTM_DB_BIT,switches_edge_N),
+    HOST_SWITCH("sw5_top",SW5_TOP_DB_ADDR,SW5_TOP_DB_BIT,switches_edge_N),
+    HOST_SWITCH("sw5_btm",SW5_BTM_DB_ADDR,SW5_BTM_DB_BIT,switches_edge_N),
+    HOST_SWITCH("sw6_top",SW6_TOP_DB_ADDR,SW6_TOP_DB_BIT,switches_edge_N),
+    HOST_SWITCH("sw6_btm",SW6_BTM_DB_ADDR,SW6_BTM_DB_BIT,switches_edge_N),
+    HOST_SWITCH("sw7_top",SW7_TOP_DB_ADDR,SW7_TOP_DB_BIT,switches_edge_N),
+    HOST_SWITCH("sw7_btm",SW7_BTM_DB_ADDR,SW7_BTM_DB_BIT,switches_edge_N),
+    HOST_SWITCH("sw8_top",SW8_TOP_DB_ADDR,SW8_TOP_DB_BIT,switches_edge_N),
+    HOST_SWITCH("sw8_btm",SW8_BTM_DB_ADDR,SW8_BTM_DB_BIT,switches_edge_N),
+    HOST_SWITCH("msw3_top",MSW3_TOP_DB_ADDR,MSW3_TOP_DB_BIT,switches_edge_N),
+    HOST_SWITCH("msw3_btm",MSW3_BTM_DB_ADDR,MSW3_BTM_DB_BIT,switches_edge_N),
+    HOST_SWITCH("msw7_top",MSW7_TOP_DB_ADDR,MSW7_TOP_DB_BIT,switches_edge_N),
+    HOST_SWITCH("msw1_top",MSW1_TOP_DB_ADDR,MSW1_TOP_DB_BIT,switches_edge_N),
+};
+
+#define HOST_N_SWITCHES (sizeof(host_switches)/sizeof(host_switches[0]))
+
+volatile uint32_t sw_toggle_states = 0;
+volatile uint32_t switches_debounced[SWITCHES_N_WORDS];
+static host_switch_change_t host_switch_changes[HOST_SWITCH_IN_SIZE];
+static uint32_t host_switch_head = 0, host_switch_tail = 0;
+static switches_edge_t host_switch_edges[switches_edge_N];
+
+int host_switch_in(uint64_t sample, const char *name, int closed)
+{
+    int n;
+    if (host_switch_head == HOST_SWITCH_IN_SIZE) {
+        return -1;
+    }
+    for (n = 0; n < HOST_N_SWITCHES; n++) {
+        if (!strcmp(host_switches[n].name,name)) {
+            host_switch_changes[host_switch_head].sample = sample;
+            host_switch_changes[host_switch_head].sw = &host_switches[n];
+            host_switch_changes[host_switch_head++].closed = closed;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void switches_setup(void)
+{
+    memset((void*)switches_debounced,0xff,sizeof(switches_debounced));
+    memset(host_switch_edges,0,sizeof(host_switch_edges));
+    sw_toggle_states = 0;
+}
+
+uint32_t expsw_get_state(void)
+{
+    return 0;
+}
+
+/* Makes the changes that have been debounced by the start of this block */
+uint32_t switches_scan(uint32_t *changes)
+{
+    uint32_t w, any = 0, mask, was_closed;
+    uint64_t delay = SWITCHES_DEBOUNCE_SCANS * audio_hw_get_block_size(NULL);
+    host_switch_change_t *c;
+    memset(changes,0,sizeof(uint32_t)*SWITCHES_N_WORDS);
+    while ((host_switch_tail < host_switch_head)
+            && ((host_switch_changes[host_switch_tail].sample + delay)
+                <= host_sample)) {
+        c = &host_switch_changes[host_switch_tail++];
+        mask = 0x1 << c->sw->bit;
+        was_closed = !(switches_debounced[c->sw->word] & mask);
+        if (!was_closed == !c->closed) {
+            continue;
+        }
+        switches_debounced[c->sw->word] ^= mask;
+        changes[c->sw->word] ^= mask;
+        if (c->closed && (c->sw->edge != switches_edge_N)) {
+            host_switch_edges[c->sw->edge].cycles = DWT->CYCCNT;
+            host_switch_edges[c->sw->edge].sample = (uint32_t)c->sample;
+            host_switch_edges[c->sw->edge].pending = 1;
+        }
+    }
+    for (w = 0; w < SWITCHES_N_WORDS; w++) {
+        any |= changes[w];
+    }
+    return any;
+}
+
+int switches_take_edge(switches_edge_sw_t sw, switches_edge_t *edge)
+{
+    if (!host_switch_edges[sw].pending) {
+        return -1;
+    }
+    *edge = host_switch_edges[sw];
+    host_switch_edges[sw].pending = 0;
+    return 0;
+}
+
+void reset_sw_toggle_states(void)
+{
+    sw_toggle_states = 0;
+}
+
+/* LEDs */
+
+static uint32_t host_leds_brightness[leds_N];
+
+void leds_setup(void)
+{
+}
+
+void leds_set_brightness(leds_led_t led, uint32_t brightness)
+{
+    host_leds_brightness[led] = brightness;
+}
+
+uint32_t leds_get_brightness(leds_led_t led)
+{
+    return host_leds_brightness[led];
+}
+
+void leds_set_pattern(leds_led_t led, uint32_t pattern, uint32_t n_steps)
+{
+}
+
+void led1_set(void) {}
+void led1_reset(void) {}
+void led3_set(void) {}
+void led3_reset(void) {}
+void led5_set(void) {}
+void led5_reset(void) {}
+void led7_set(void) {}
+void led7_reset(void) {}
+void led1_tog(void) {}
+void led3_tog(void) {}
+void led5_tog(void) {}
+void led7_tog(void) {}
+
+/* Flash, the presets are kept in memory that starts erased */
+
+volatile uint32_t flash_state = 0;
+static uint8_t host_presets[HOST_PRESETS_SIZE];
+static presets_lowlevel_handle_t host_presets_handle;
+
+presets_lowlevel_err_t presets_lowlevel_init(presets_lowlevel_handle_t
+        **handle,void *opt)
+{
+    memset(host_presets,0xff,HOST_PRESETS_SIZE);
+    *handle = &host_presets_handle;
+    return(0);
+}
+
+presets_lowlevel_err_t presets_lowlevel_read(presets_lowlevel_handle_t *handle,
+        void *dest, uint32_t size, void *opt)
+{
+    if (size > HOST_PRESETS_SIZE) {
+        return(-1);
+    }
+    memcpy(dest,host_presets,size);
+    return(0);
+}
+
+presets_lowlevel_err_t presets_lowlevel_update(presets_lowlevel_handle_t *handle,
+        void *src, uint32_t size, uint32_t offset, uint32_t len, void *opt)
+{
+    if ((size > HOST_PRESETS_SIZE) || ((offset + len) > size)) {
+        return(-1);
+    }
+    memcpy(host_presets + offset,(uint8_t*)src + offset,len);
+    return(0);
+}
+
+presets_lowlevel_err_t presets_lowlevel_write(presets_lowlevel_handle_t *handle,
+        void *src, uint32_t size, void *opt)
+{
+    return presets_lowlevel_update(handle,src,size,0,size,opt);
+}
+
+/* Recordings can't be saved */
+int recording_flash_save(void)
+{
+    return -1;
+}
+
+/* Telemetry goes out over MIDI, which isn't sent anywhere */
+
+void telemetry_set_enabled(int enabled)
+{
+}
+
+void telemetry_end_block(uint32_t block,
+                         uint32_t cycles,
+                         uint32_t block_period)
+{
+}
+
+void telemetry_midi_clock(uint32_t time)
+{
+}
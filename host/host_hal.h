@@ -0,0 +1,47 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#ifndef HOST_HAL_H
+#define HOST_HAL_H
+
+#include <stdint.h>
+#include "audio_setup.h"
+
+/* Stand-ins for the hardware the engine uses so that it can be run on a
+ * computer (see "make host"). The audio is given and taken one block at a time
+ * by host_audio_block. MIDI is queued with host_midi_in and handled in the
+ * block it falls in, at the sample it falls on. Switches are opened and closed
+ * with host_switch_in and otherwise rest open. The knobs rest at 0, presets are
+ * kept in memory and nothing is sent out over MIDI. */
+
+/* Most MIDI bytes that can be waiting to be handled */
+#define HOST_MIDI_IN_SIZE 65536
+/* Most switch changes that can be waiting to be made */
+#define HOST_SWITCH_IN_SIZE 4096
+
+/* Set up the engine like main does before it starts the audio, with the MIDI
+ * channel (-1 for the one stored in the presets). The load governor sheds no
+ * work unless governor is non-zero, so what is rendered doesn't depend on how
+ * fast the computer is. */
+void host_setup(int midi_channel, int governor);
+/* Queue n bytes of MIDI to be received at sample, counted from the start.
+ * Must be called in order of sample. Returns 0 on success and -1 if there's no
+ * room. */
+int host_midi_in(uint64_t sample, const char *bytes, uint32_t n);
+/* Queue a switch to be closed (closed non-zero) or opened at sample. The name is
+ * that of the switch in switches.h in lower case, e.g., "fsw1", "sw3_top" or
+ * "msw7_top". Like on the board, the change is seen once it is debounced, by
+ * the first block that starts SWITCHES_DEBOUNCE_SCANS blocks or more after
+ * sample, and a footswitch's press is timestamped at sample.
+ * Must be called in order of sample. Returns 0 on success and -1 if the name is
+ * unknown or there's no room. */
+int host_switch_in(uint64_t sample, const char *name, int closed);
+/* Process one block. in holds the interleaved input frames and out receives
+ * the output frames, each audio_hw_get_block_size(NULL) frames of
+ * CODEC_NUM_CHANNELS samples. */
+void host_audio_block(audio_hw_sample_t *in, audio_hw_sample_t *out);
+/* The number of the first sample of the next block */
+uint64_t host_get_sample(void);
+/* The number of bytes the engine has sent out over MIDI */
+uint32_t host_get_midi_out_count(void);
+
+#endif /* HOST_HAL_H */
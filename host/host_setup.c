@@ -0,0 +1,57 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#include <stdint.h>
+#include "host_hal.h"
+#include "audio_setup.h"
+#include "midi_setup.h"
+#include "wavetables.h"
+#include "signal_chain.h"
+#include "synth_control.h"
+#include "synth_control_presets.h"
+#include "scheduling.h"
+#include "adc.h"
+#include "adc_channel.h"
+#include "switches.h"
+#include "synth_adc_control.h"
+#include "synth_switch_control.h"
+#include "synth_midi_control.h"
+#include "cycle_profiler.h"
+#include "load_governor.h"
+#include "xrun_history.h"
+#include "midi_bulk.h"
+
+/* The same as main does before starting the audio */
+void host_setup(int midi_channel, int governor)
+{
+    audio_setup(NULL);
+    midi_setup(NULL);
+    SampleTable_init();
+    signal_chain_setup();
+    synth_control_setup();
+    scheduler_setup();
+    switches_setup();
+    adc_setup_dma_scan(adc_mode_TIM);
+    adc_channel_setup();
+    synth_adc_control_setup();
+    sc_presets_init(0,&midi_channel);
+    synth_switch_control_setup();
+    synth_midi_control_setup(midi_channel);
+    cycle_profiler_setup();
+    cycle_profiler_attach_sigchain(&sigChain);
+    load_governor_setup();
+    if (!governor) {
+        load_governor_config_t config = {
+            .shed_pct = UINT32_MAX,
+            .restore_pct = LOAD_GOVERNOR_RESTORE_PCT,
+            .shed_blocks = LOAD_GOVERNOR_SHED_BLOCKS,
+            .hold_blocks = LOAD_GOVERNOR_HOLD_BLOCKS,
+            .restore_blocks = LOAD_GOVERNOR_RESTORE_BLOCKS,
+            .reduced_voices = LOAD_GOVERNOR_REDUCED_VOICES,
+        };
+        load_governor_set_config(&config);
+    }
+    xrun_history_setup();
+    midi_bulk_setup();
+    audio_start();
+    SampleTable_zero_start();
+}
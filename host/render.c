@@ -0,0 +1,382 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+/* Renders what the synth would play given an input sound and MIDI, on a
+ * computer and as fast as it can, and reports how long each block took. Built
+ * with "make host".
+ *
+ * render [-i in.wav] [-m script] [-l seconds] [-c channel] [-t timing.csv] [-g]
+ *        -o out.wav
+ *
+ * in.wav is 16-bit PCM, its first channel goes into the codec's input. It is
+ * not resampled, it should be at CODEC_SAMPLE_RATE. out.wav is the codec's
+ * output, mono 16-bit at CODEC_SAMPLE_RATE.
+ *
+ * Each line of the script is a time in seconds followed by the MIDI bytes
+ * received at that time in hexadecimal, e.g.,
+ *
+ *   0.5 b0 45 7f   # a control change
+ *   1.0 90 3c 64
+ *
+ * A line can instead close (1) or open (0) a switch, named as in switches.h in
+ * lower case, e.g.,
+ *
+ *   2.0 sw fsw1 1  # start recording
+ *   2.1 sw fsw1 0
+ *
+ * Lines must be in order of time. Anything after a # is ignored.
+ *
+ * The rendering goes until -l seconds (1 by default) after the end of the input
+ * or the last line of the script. The load governor doesn't shed any work unless -g is given,
+ * so the output doesn't depend on how fast the computer is. -t writes the
+ * microseconds each block and each stage of it took, one line per block. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include "host_hal.h"
+#include "audio_setup.h"
+#include "cycle_profiler.h"
+#include "midi_bulk.h"
+#include "system_init.h"
+
+#define RENDER_MAX_LINE 1024
+
+static const char *render_stage_names[cycle_profiler_stage_N] = {
+    "switches",
+    "adc",
+    "midi",
+    "leds",
+    "scheduler",
+    "sigchain",
+    "saturate",
+    "io_conv",
+    "total",
+};
+
+static void render_usage(void)
+{
+    fprintf(stderr,
+        "usage: render [-i in.wav] [-m script] [-l seconds] [-c channel]\n"
+        "              [-t timing.csv] [-g] -o out.wav\n");
+}
+
+static uint32_t render_le32(const unsigned char *b)
+{
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static uint16_t render_le16(const unsigned char *b)
+{
+    return b[0] | (b[1] << 8);
+}
+
+/* Reads the first channel of a 16-bit PCM WAV file into *samples (allocated).
+ * Returns the number of frames or -1 on error. */
+static long render_read_wav(const char *path, int16_t **samples)
+{
+    FILE *f;
+    unsigned char hdr[12], chunk[8], fmt[16];
+    uint32_t size, rate = 0;
+    uint16_t channels = 0, bits = 0, format = 0;
+    long n, n_frames = -1;
+    int16_t *frame;
+    if (!(f = fopen(path,"rb"))) {
+        perror(path);
+        return -1;
+    }
+    if ((fread(hdr,1,12,f) != 12) || memcmp(hdr,"RIFF",4)
+            || memcmp(hdr + 8,"WAVE",4)) {
+        fprintf(stderr,"%s: not a WAV file\n",path);
+        goto done;
+    }
+    while (fread(chunk,1,8,f) == 8) {
+        size = render_le32(chunk + 4);
+        if (!memcmp(chunk,"fmt ",4) && (size >= 16)) {
+            if (fread(fmt,1,16,f) != 16) {
+                break;
+            }
+            format = render_le16(fmt);
+            channels = render_le16(fmt + 2);
+            rate = render_le32(fmt + 4);
+            bits = render_le16(fmt + 14);
+            fseek(f,(size - 16) + (size & 1),SEEK_CUR);
+        } else if (!memcmp(chunk,"data",4)) {
+            if ((format != 1) || (bits != 16) || (channels == 0)) {
+                fprintf(stderr,"%s: only 16-bit PCM is read\n",path);
+                goto done;
+            }
+            if (rate != CODEC_SAMPLE_RATE) {
+                fprintf(stderr,"%s: sample rate is %u, it is played at %u\n",
+                        path,rate,CODEC_SAMPLE_RATE);
+            }
+            n_frames = size / (2 * channels);
+            *samples = malloc(sizeof(int16_t) * (n_frames + 1));
+            frame = malloc(sizeof(int16_t) * channels);
+            for (n = 0; n < n_frames; n++) {
+                if (fread(frame,2 * channels,1,f) != 1) {
+                    break;
+                }
+                /* WAV files are little-endian like the host */
+                (*samples)[n] = frame[0];
+            }
+            n_frames = n;
+            free(frame);
+            goto done;
+        } else {
+            fseek(f,size + (size & 1),SEEK_CUR);
+        }
+    }
+    fprintf(stderr,"%s: no audio found\n",path);
+done:
+    fclose(f);
+    return n_frames;
+}
+
+static void render_put_le32(FILE *f, uint32_t x)
+{
+    unsigned char b[4] = { x, x >> 8, x >> 16, x >> 24 };
+    fwrite(b,1,4,f);
+}
+
+static void render_put_le16(FILE *f, uint16_t x)
+{
+    unsigned char b[2] = { x, x >> 8 };
+    fwrite(b,1,2,f);
+}
+
+/* Writes the header of a mono 16-bit WAV file of n_frames */
+static void render_write_wav_header(FILE *f, uint32_t n_frames)
+{
+    fwrite("RIFF",1,4,f);
+    render_put_le32(f,36 + n_frames * 2);
+    fwrite("WAVEfmt ",1,8,f);
+    render_put_le32(f,16);
+    render_put_le16(f,1);
+    render_put_le16(f,1);
+    render_put_le32(f,CODEC_SAMPLE_RATE);
+    render_put_le32(f,CODEC_SAMPLE_RATE * 2);
+    render_put_le16(f,2);
+    render_put_le16(f,16);
+    fwrite("data",1,4,f);
+    render_put_le32(f,n_frames * 2);
+}
+
+/* Queues the MIDI and switch changes in the script. Returns the sample of the
+ * last line or -1 on error. */
+static int64_t render_read_script(const char *path)
+{
+    FILE *f;
+    char line[RENDER_MAX_LINE], *p, *end, bytes[RENDER_MAX_LINE],
+         name[RENDER_MAX_LINE];
+    double seconds;
+    int closed, n_chars;
+    int64_t sample, last = 0;
+    uint32_t n_bytes, line_no = 0;
+    unsigned long byte;
+    if (!(f = fopen(path,"r"))) {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line,sizeof(line),f)) {
+        line_no++;
+        if ((p = strchr(line,'#'))) {
+            *p = '\0';
+        }
+        p = line;
+        while (isspace((unsigned char)*p)) {
+            p++;
+        }
+        if (*p == '\0') {
+            continue;
+        }
+        seconds = strtod(p,&end);
+        if ((end == p) || (seconds < 0)) {
+            fprintf(stderr,"%s:%u: expected a time\n",path,line_no);
+            goto fail;
+        }
+        sample = (int64_t)(seconds * CODEC_SAMPLE_RATE + 0.5);
+        if (sample < last) {
+            fprintf(stderr,"%s:%u: out of order\n",path,line_no);
+            goto fail;
+        }
+        p = end;
+        if (sscanf(p," sw %s %d %n",name,&closed,&n_chars) == 2) {
+            if (p[n_chars] != '\0') {
+                fprintf(stderr,"%s:%u: expected sw name 0 or 1\n",path,line_no);
+                goto fail;
+            }
+            if (host_switch_in(sample,name,closed)) {
+                fprintf(stderr,"%s:%u: no switch %s or too many changes\n",
+                        path,line_no,name);
+                goto fail;
+            }
+            last = sample;
+            continue;
+        }
+        n_bytes = 0;
+        while (1) {
+            byte = strtoul(p,&end,16);
+            if (end == p) {
+                break;
+            }
+            if (byte > 0xff) {
+                fprintf(stderr,"%s:%u: not a byte\n",path,line_no);
+                goto fail;
+            }
+            bytes[n_bytes++] = (char)byte;
+            p = end;
+        }
+        while (isspace((unsigned char)*p)) {
+            p++;
+        }
+        if (*p != '\0') {
+            fprintf(stderr,"%s:%u: expected hexadecimal bytes\n",path,
+                    line_no);
+            goto fail;
+        }
+        if (host_midi_in(sample,bytes,n_bytes)) {
+            fprintf(stderr,"%s: too much MIDI\n",path);
+            goto fail;
+        }
+        last = sample;
+    }
+    fclose(f);
+    return last;
+fail:
+    fclose(f);
+    return -1;
+}
+
+static uint64_t render_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double render_cycles_to_us(uint32_t cycles)
+{
+    return (double)cycles * 1e6 / get_SystemCoreClock();
+}
+
+int main(int argc, char **argv)
+{
+    const char *in_path = NULL, *script_path = NULL, *out_path = NULL,
+               *timing_path = NULL;
+    double tail_sec = 1.;
+    int opt, midi_channel = -1, governor = 0, s;
+    int16_t *input = NULL;
+    long n_input = 0;
+    int64_t last_event = 0;
+    uint32_t block_size, n_blocks, b, n, n_late = 0;
+    uint64_t t, dt, dt_min = UINT64_MAX, dt_max = 0, dt_total = 0, n_frames;
+    audio_hw_sample_t *in, *out;
+    int16_t *mono;
+    FILE *out_file, *timing_file = NULL;
+    while ((opt = getopt(argc,argv,"i:m:o:l:c:t:g")) != -1) {
+        switch (opt) {
+        case 'i': in_path = optarg; break;
+        case 'm': script_path = optarg; break;
+        case 'o': out_path = optarg; break;
+        case 'l': tail_sec = atof(optarg); break;
+        case 'c': midi_channel = atoi(optarg); break;
+        case 't': timing_path = optarg; break;
+        case 'g': governor = 1; break;
+        default: render_usage(); return 1;
+        }
+    }
+    if (!out_path || (midi_channel > 15) || (tail_sec < 0)) {
+        render_usage();
+        return 1;
+    }
+    if (in_path && ((n_input = render_read_wav(in_path,&input)) < 0)) {
+        return 1;
+    }
+    if (script_path && ((last_event = render_read_script(script_path)) < 0)) {
+        return 1;
+    }
+    host_setup(midi_channel,governor);
+    block_size = audio_hw_get_block_size(NULL);
+    n_frames = (uint64_t)(n_input > last_event ? n_input : last_event)
+        + (uint64_t)(tail_sec * CODEC_SAMPLE_RATE);
+    n_blocks = (n_frames + block_size - 1) / block_size;
+    in = calloc(block_size * CODEC_NUM_CHANNELS,sizeof(audio_hw_sample_t));
+    out = calloc(block_size * CODEC_NUM_CHANNELS,sizeof(audio_hw_sample_t));
+    mono = malloc(block_size * sizeof(int16_t));
+    if (!(out_file = fopen(out_path,"wb"))) {
+        perror(out_path);
+        return 1;
+    }
+    render_write_wav_header(out_file,n_blocks * block_size);
+    if (timing_path) {
+        if (!(timing_file = fopen(timing_path,"w"))) {
+            perror(timing_path);
+            return 1;
+        }
+        fprintf(timing_file,"block,wall_us");
+        for (s = 0; s < cycle_profiler_stage_N; s++) {
+            fprintf(timing_file,",%s_us",render_stage_names[s]);
+        }
+        fprintf(timing_file,"\n");
+    }
+    for (b = 0; b < n_blocks; b++) {
+        for (n = 0; n < block_size; n++) {
+            uint64_t i = (uint64_t)b * block_size + n;
+            in[n * CODEC_NUM_CHANNELS] = i < (uint64_t)n_input ? input[i] : 0;
+        }
+        t = render_now_ns();
+        host_audio_block(in,out);
+        dt = render_now_ns() - t;
+        /* What main does between blocks */
+        midi_bulk_poll();
+        dt_total += dt;
+        dt_min = dt < dt_min ? dt : dt_min;
+        dt_max = dt > dt_max ? dt : dt_max;
+        if (dt > (uint64_t)block_size * 1000000000ULL / CODEC_SAMPLE_RATE) {
+            n_late++;
+        }
+        for (n = 0; n < block_size; n++) {
+            mono[n] = out[n * CODEC_NUM_CHANNELS];
+        }
+        fwrite(mono,sizeof(int16_t),block_size,out_file);
+        if (timing_file) {
+            fprintf(timing_file,"%u,%.2f",b,dt / 1000.);
+            for (s = 0; s < cycle_profiler_stage_N; s++) {
+                fprintf(timing_file,",%.2f",render_cycles_to_us(
+                            cycle_profiler_get_stage(s)->last));
+            }
+            fprintf(timing_file,"\n");
+        }
+    }
+    fclose(out_file);
+    if (timing_file) {
+        fclose(timing_file);
+    }
+    printf("%u blocks of %u samples, %.1f us each in real time\n",
+           n_blocks,block_size,block_size * 1e6 / CODEC_SAMPLE_RATE);
+    if (n_blocks) {
+        printf("block us: min %.2f avg %.2f max %.2f, %u over real time\n",
+               dt_min / 1000.,dt_total / 1000. / n_blocks,dt_max / 1000.,
+               n_late);
+        printf("%.1f times faster than real time\n",
+               (double)n_blocks * block_size * 1e9 / CODEC_SAMPLE_RATE
+               / (dt_total ? dt_total : 1));
+    }
+    printf("%-10s %10s %10s %10s\n","stage","min us","avg us","max us");
+    for (s = 0; s < cycle_profiler_stage_N; s++) {
+        const cycle_profiler_stat_t *st = cycle_profiler_get_stage(s);
+        printf("%-10s %10.2f %10.2f %10.2f\n",render_stage_names[s],
+               render_cycles_to_us(st->min),render_cycles_to_us(st->avg),
+               render_cycles_to_us(st->max));
+    }
+    printf("MIDI bytes sent: %u\n",host_get_midi_out_count());
+    free(input);
+    free(in);
+    free(out);
+    free(mono);
+    return 0;
+}
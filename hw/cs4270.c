@@ -1,10 +1,15 @@
 #include <stdint.h>
 #include "i2s_lowlevel.h"
+#include "codec_i2c.h"
 #include "stm32f4xx.h"
 
 #define CS4270_CODEC_ADDR  ((uint8_t)0x90) 
 
 static uint16_t all_codec_reg[8];
+/* Registers read back by codec_config_via_i2c to be checked by
+ * codec_config_check */
+static uint16_t config_reg_chip_id;
+static uint16_t config_reg_readback[5];
 
 void i2s_gpio_disable(void)
 {
@@ -53,17 +58,25 @@ void i2s_port_setup(uint32_t sr)
     GPIOE->ODR &= ~((0x1 << 2) | (0x1 << 3) | (0x1 << 4));
 }
 
-void i2s_codec_start(void)
+/* Returns 0 once the codec reads back that it is powered up, -1 if it still
+ * doesn't after a retry. */
+int i2s_codec_start(void)
 {
-    /* Reset DAC, ADC power down bits to start sound */
-    codec_prog_reg_i2c(CS4270_CODEC_ADDR,0x02,0x00);
-    uint16_t reg=0xff;
-    codec_read_reg_i2c(CS4270_CODEC_ADDR,0x02,&reg);
-    while (reg != 0x00);
+    uint16_t reg;
     uint8_t n;
-    for (n=1;n<=8;n++) {
-        codec_read_reg_i2c(CS4270_CODEC_ADDR,n,&all_codec_reg[n-1]);
+    int tries;
+    for (tries = 0; tries < 2; tries++) {
+        /* Reset DAC, ADC power down bits to start sound */
+        codec_i2c_queue_write(CS4270_CODEC_ADDR,0x02,0x00);
+        codec_i2c_queue_read(CS4270_CODEC_ADDR,0x02,&reg);
+        for (n=1;n<=8;n++) {
+            codec_i2c_queue_read(CS4270_CODEC_ADDR,n,&all_codec_reg[n-1]);
+        }
+        if ((codec_i2c_wait() == codec_i2c_err_NONE) && (reg == 0x00)) {
+            return 0;
+        }
     }
+    return -1;
 }
 
 void i2s_codec_correct_frame_error(void)
@@ -77,51 +90,56 @@ uint32_t codec_format_reg_addr(uint8_t reg_addr, uint16_t reg_val)
     return reg_addr;
 }
 
-void __attribute__((optimize("O0")))
-codec_config_via_i2c(void) 
+#if defined(CODEC_DIGITAL_LOOPBACK)
+ #define CS4270_REG_04 0x29
+#else
+ #define CS4270_REG_04 0x09
+#endif
+
+/* Queue the configuration, this returns before the codec has been programmed
+ * (see codec_config_check). */
+void codec_config_via_i2c(void) 
 {
     /* Set ADC, DAC to I2S 16-bit */
     /* Chip reset should be asserted, deassert to allow programming */
     GPIOE->ODR |= (0x1 << 5);
-    ///* Set power down bit to confirm software control */
-    //codec_prog_reg_i2c(CS4270_CODEC_ADDR,0x02,0x01);
-    ///* Wait */
-    //int j = 1000000;
-    //while (j--);
-    uint16_t reg;
     /* Reset power down bit, power down ADC, DAC */
-    codec_prog_reg_i2c(CS4270_CODEC_ADDR,0x02,0x23);
+    codec_i2c_queue_write(CS4270_CODEC_ADDR,0x02,0x23);
     /* Read register contents */
-    codec_read_reg_i2c(CS4270_CODEC_ADDR,0x01,&reg);
-    /* Check correct value */
-    while ((reg & 0xf0) != 0xc0);
+    config_reg_chip_id = 0;
+    codec_i2c_queue_read(CS4270_CODEC_ADDR,0x01,&config_reg_chip_id);
     /* Set pop-suppression, slave mode */
-    codec_prog_reg_i2c(CS4270_CODEC_ADDR,0x03,0x31);
+    codec_i2c_queue_write(CS4270_CODEC_ADDR,0x03,0x31);
     /* Set DAC, ADC to I2S mode */
-#if defined(CODEC_DIGITAL_LOOPBACK)
-    codec_prog_reg_i2c(CS4270_CODEC_ADDR,0x04,0x29);
-#else
-    codec_prog_reg_i2c(CS4270_CODEC_ADDR,0x04,0x09);
-#endif
+    codec_i2c_queue_write(CS4270_CODEC_ADDR,0x04,CS4270_REG_04);
     /* Set single DAC volume */
-    codec_prog_reg_i2c(CS4270_CODEC_ADDR,0x05,0x80);
+    codec_i2c_queue_write(CS4270_CODEC_ADDR,0x05,0x80);
     /* Set DAC volume to 0dB (no attenuation) */
-    codec_prog_reg_i2c(CS4270_CODEC_ADDR,0x07,0x00);
+    codec_i2c_queue_write(CS4270_CODEC_ADDR,0x07,0x00);
     /* Read register contents */
-    /* Check correct values */
-    reg=0;codec_read_reg_i2c(CS4270_CODEC_ADDR,0x02,&reg);
-    while (reg != 0x23);
-    reg=0;codec_read_reg_i2c(CS4270_CODEC_ADDR,0x03,&reg);
-    while (reg != 0x31);
-    reg=0;codec_read_reg_i2c(CS4270_CODEC_ADDR,0x04,&reg);
-#if defined(CODEC_DIGITAL_LOOPBACK)
-    while (reg != 0x29);
-#else
-    while (reg != 0x09);
-#endif
-    reg=0;codec_read_reg_i2c(CS4270_CODEC_ADDR,0x05,&reg);
-    while (reg != 0x80);
-    reg=1;codec_read_reg_i2c(CS4270_CODEC_ADDR,0x07,&reg);
-    while (reg != 0x00);
+    config_reg_readback[0]=0;
+    codec_i2c_queue_read(CS4270_CODEC_ADDR,0x02,&config_reg_readback[0]);
+    config_reg_readback[1]=0;
+    codec_i2c_queue_read(CS4270_CODEC_ADDR,0x03,&config_reg_readback[1]);
+    config_reg_readback[2]=0;
+    codec_i2c_queue_read(CS4270_CODEC_ADDR,0x04,&config_reg_readback[2]);
+    config_reg_readback[3]=0;
+    codec_i2c_queue_read(CS4270_CODEC_ADDR,0x05,&config_reg_readback[3]);
+    config_reg_readback[4]=1;
+    codec_i2c_queue_read(CS4270_CODEC_ADDR,0x07,&config_reg_readback[4]);
+}
 
+/* Call once the transactions queued by codec_config_via_i2c are done. Returns
+ * 0 if the codec reads back what was written, -1 otherwise. */
+int codec_config_check(void)
+{
+    if (((config_reg_chip_id & 0xf0) != 0xc0)
+            || (config_reg_readback[0] != 0x23)
+            || (config_reg_readback[1] != 0x31)
+            || (config_reg_readback[2] != CS4270_REG_04)
+            || (config_reg_readback[3] != 0x80)
+            || (config_reg_readback[4] != 0x00)) {
+        return -1;
+    }
+    return 0;
 }
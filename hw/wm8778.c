@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include "i2s_lowlevel.h"
+#include "codec_i2c.h"
 #include "stm32f4xx.h"
 
 /* the address is 0x34 because the CE pin is pulled low (see i2s_lowlevel.c) */
@@ -39,9 +40,10 @@ void i2s_port_setup(uint32_t sr)
     GPIOC->AFR[1] |= ((0x6 << 8) | (0x5 << 12) | (0x6 << 16));
 }
 
-void i2s_codec_start(void)
+int i2s_codec_start(void)
 {
     /* this codec needs nothing to start */
+    return 0;
 }
 
 void i2s_codec_correct_frame_error(void)
@@ -54,13 +56,14 @@ uint32_t codec_format_reg_addr(uint8_t reg_addr, uint16_t reg_val)
     return (reg_addr << 1) | ((reg_val >> 8) & (0x1));
 }
 
-void __attribute__((optimize("O0")))
-codec_config_via_i2c(void) 
+/* Queue the configuration, this returns before the codec has been programmed
+ * (see codec_config_check). */
+void codec_config_via_i2c(void) 
 {
-    codec_prog_reg_i2c(WM8778_CODEC_ADDR,0x17,0x0000);
-    codec_prog_reg_i2c(WM8778_CODEC_ADDR,0xa,0x0002);
-    codec_prog_reg_i2c(WM8778_CODEC_ADDR,0xb,0x0042);
-    codec_prog_reg_i2c(WM8778_CODEC_ADDR,0x5,0x00ff);
+    codec_i2c_queue_write(WM8778_CODEC_ADDR,0x17,0x0000);
+    codec_i2c_queue_write(WM8778_CODEC_ADDR,0xa,0x0002);
+    codec_i2c_queue_write(WM8778_CODEC_ADDR,0xb,0x0042);
+    codec_i2c_queue_write(WM8778_CODEC_ADDR,0x5,0x00ff);
 
 #ifdef CODEC_ANALOG_DIGITAL_MIX 
     /*
@@ -68,7 +71,14 @@ codec_config_via_i2c(void)
     buffering circuit
     */
  #if (!defined(AUDIO_HW_TEST_THROUGHPUT)) && (!defined(AUDIO_HW_TEST_WET_DRY_MIX))
-    codec_prog_reg_i2c(WM8778_CODEC_ADDR,0x16,0x5);
+    codec_i2c_queue_write(WM8778_CODEC_ADDR,0x16,0x5);
  #endif  
 #endif  
 }
+
+/* This codec's registers can't be read back so there's nothing to check
+ * beyond the transactions having been acknowledged. */
+int codec_config_check(void)
+{
+    return 0;
+}
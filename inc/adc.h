@@ -12,7 +12,12 @@
 /* With an audio sampling rate of 32000 Hz, and a block size of 128 samples, you
  * can get ~16 ADC samples in one block tick on one ADC channel of a group
  * of 8 channels running at sampling rate of 5680 Hz */
+/* Must be a power of 2 */
 #define ADC_AVG_SIZE 128
+/* Scans per second in adc_mode_TIM. A scan of 5 channels at 480 cycles each
+ * takes about 110us with the ADC clock at 22.5MHz. At 4000Hz, 32 scans are
+ * written per block of 256 samples at 32KHz and ADC_AVG_SIZE scans span 32ms. */
+#define ADC_SCAN_RATE 4000
 
 #if defined(BOARD_V1)
  /* There are 4 ADC channels per ADC */
@@ -43,7 +48,12 @@ typedef enum {
      * pauses. The application must restart conversion. This is so the
      * application can check the values knowing they will not change, and then
      * request new values when it is done with them. */
-    adc_mode_1SHOT
+    adc_mode_1SHOT,
+    /* In timer mode, a timer starts a scan of the channels at ADC_SCAN_RATE
+     * and the DMA writes them circularly. The ready flag is set every half of
+     * the buffer. The application only needs to call adc_start_conversion once
+     * and never touches the ADC after that. */
+    adc_mode_TIM
 } adc_mode_t;
 
 extern uint16_t volatile *adc_data_starts[];
@@ -53,6 +63,11 @@ extern uint16_t volatile *adc_data_starts[];
  * before reading the next value on the same channel.
  */
 extern uint32_t adc_raw_value_strides[];
+/* Array of length TOTAL_NUM_ADC_CHANNELS where the nth index points to the
+ * total number of scans (one conversion of every channel on the ADC) that the
+ * DMA has written for the ADC which adc_data_starts refers to. This lets
+ * channels only look at values that are new since they last looked. */
+extern uint32_t volatile *adc_scan_counts[];
 void adc_setup_dma_scan(adc_mode_t mode);
 void adc_start_conversion(void);
 int  adc_get_adc_ready(void);
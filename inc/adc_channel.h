@@ -28,6 +28,16 @@ typedef struct __adc_channel {
     uint32_t n_raw_vals;
     /* The function that is used to calculate cur_val from raw_vals */
     void (*update) (struct __adc_channel *); 
+    /* Total number of scans the DMA has written, see adc_scan_counts */
+    volatile uint32_t *scan_count;
+    /* Value of *scan_count when the channel was last updated. This modulo
+     * n_raw_vals is the index of the next raw value to add to the sum. */
+    uint32_t scans_read;
+    /* Sum of the raw values in hist */
+    uint32_t sum;
+    /* Copies of the raw values in the sum, so that they can be subtracted once
+     * the DMA has written over them */
+    adc_channel_datatype_t hist[ADC_AVG_SIZE];
 } adc_channel_t;
 
 typedef enum {
@@ -76,7 +86,10 @@ void adc_channel_do_all_sets(void);
 void adc_channel_init(adc_channel_t *chan,
                       volatile adc_channel_datatype_t *raw_vals,
                       uint32_t raw_val_stride,
-                      uint32_t nraw_vals);
+                      uint32_t nraw_vals,
+                      volatile uint32_t *scan_count);
+void adc_channel_update_avg(adc_channel_t *chan);
+void adc_channel_update_running_sum(adc_channel_t *chan);
 void adc_channel_setup(void);
 void adc_channel_do_data_init(adc_channel_do_data_t *data,
                               adc_channel_do_style_t style,
@@ -6,6 +6,8 @@
 
 #define audio_start() audio_hw_start(NULL) 
 int audio_setup(void *data);
+uint32_t audio_get_block_count(void);
+void audio_io_convert(audio_hw_io_t *params);
 extern int audio_ready;
 
 #endif /* AUDIO_SETUP_H */
@@ -0,0 +1,49 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#ifndef CODEC_I2C_H
+#define CODEC_I2C_H
+
+#include <stdint.h>
+
+/* Interrupt driven queue of register reads and writes to the codec over I2C2.
+ * Transactions are queued and carried out by the I2C interrupts so that the
+ * codec can be programmed while the rest of the system is being set up. Each
+ * transaction is retried if the codec doesn't acknowledge or the bus errors
+ * and is given up on if it does not finish in time. */
+
+/* Number of transactions that can be queued, must be a power of 2 */
+#define CODEC_I2C_QUEUE_SIZE 32
+/* Longest a transaction may take, in CPU cycles, before the peripheral is
+ * reset and the transaction tried again (about 5.5ms at 180MHz, a
+ * transaction takes about 1ms at 50KHz). */
+#define CODEC_I2C_TIMEOUT  ((uint32_t)1000000)
+/* Number of times a transaction is tried again before giving up on it */
+#define CODEC_I2C_RETRIES 3
+
+typedef enum {
+    codec_i2c_err_NONE = 0,
+    codec_i2c_err_QUEUE_FULL = -1,
+    codec_i2c_err_FAILED = -2,
+} codec_i2c_err_t;
+
+typedef struct {
+    /* number of transactions done, tried again and given up on */
+    uint32_t n_done;
+    uint32_t n_retries;
+    uint32_t n_timeouts;
+    uint32_t n_failed;
+} codec_i2c_stats_t;
+
+/* Provided by the codec's file in hw/ */
+extern uint32_t codec_format_reg_addr(uint8_t reg_addr, uint16_t reg_val);
+
+void codec_i2c_setup(void);
+void codec_i2c_disable(void);
+int codec_i2c_queue_write(uint8_t addr, uint8_t reg_addr, uint16_t reg_val);
+int codec_i2c_queue_read(uint8_t addr, uint8_t reg_addr, uint16_t *reg_val);
+void codec_i2c_poll(void);
+int codec_i2c_busy(void);
+int codec_i2c_wait(void);
+void codec_i2c_get_stats(codec_i2c_stats_t *stats);
+
+#endif /* CODEC_I2C_H */
@@ -0,0 +1,88 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#ifndef CYCLE_PROFILER_H
+#define CYCLE_PROFILER_H
+
+#include <stdint.h>
+#include "stm32f4xx.h"
+#include "mm_sigchain.h"
+
+/* Measures how many CPU cycles each part of the audio interrupt takes using
+ * the DWT cycle counter. Reading the counter is a single load, so this is left
+ * on in normal builds. Define NO_CYCLE_PROFILER to compile it out. */
+
+/* The stages of audio_hw_io that are timed. cycle_profiler_stage_TOTAL is the
+ * whole of audio_hw_io. */
+typedef enum {
+    cycle_profiler_stage_SWITCHES,
+    cycle_profiler_stage_ADC,
+    cycle_profiler_stage_MIDI,
+    cycle_profiler_stage_LEDS,
+    cycle_profiler_stage_SCHEDULER,
+    cycle_profiler_stage_SIGCHAIN,
+    cycle_profiler_stage_SATURATE,
+    cycle_profiler_stage_IO_CONV,
+    cycle_profiler_stage_TOTAL,
+    cycle_profiler_stage_N
+} cycle_profiler_stage_t;
+
+/* Maximum number of MMSigProcs in sigChain that can be timed individually.
+ * Those past this are still counted in cycle_profiler_stage_SIGCHAIN. */
+#define CYCLE_PROFILER_MAX_SIGPROCS 32
+/* Number of blocks over which the average is computed. Power of 2. */
+#define CYCLE_PROFILER_AVG_BLOCKS   64
+
+typedef struct {
+    /* cycles taken in the most recent block */
+    uint32_t last;
+    uint32_t min;
+    uint32_t max;
+    /* average over the last CYCLE_PROFILER_AVG_BLOCKS blocks */
+    uint32_t avg;
+    /* accumulator for the average being computed */
+    uint32_t acc;
+} cycle_profiler_stat_t;
+
+typedef struct {
+    cycle_profiler_stat_t stat;
+    /* the profiled MMSigProc and its original tick function */
+    MMSigProc *sp;
+    void (*tick)(MMSigProc *);
+} cycle_profiler_sigproc_t;
+
+#ifndef NO_CYCLE_PROFILER
+
+#define cycle_profiler_now() (DWT->CYCCNT)
+/* Declare a local to hold the start time of a stage and mark the start. */
+#define CYCLE_PROFILER_START(t) uint32_t t = cycle_profiler_now()
+/* Mark the end of a stage started with CYCLE_PROFILER_START and restart t so
+ * consecutive stages can be timed with a single counter read each. */
+#define CYCLE_PROFILER_LAP(t,stage) \
+    do { \
+        uint32_t _cp_now = cycle_profiler_now(); \
+        cycle_profiler_record(stage, _cp_now - t); \
+        t = _cp_now; \
+    } while (0)
+
+void cycle_profiler_setup(void);
+void cycle_profiler_attach_sigchain(MMSigChain *sc);
+void cycle_profiler_record(cycle_profiler_stage_t stage, uint32_t cycles);
+void cycle_profiler_end_block(void);
+void cycle_profiler_reset(void);
+const cycle_profiler_stat_t *cycle_profiler_get_stage(cycle_profiler_stage_t stage);
+const cycle_profiler_sigproc_t *cycle_profiler_get_sigprocs(int *n);
+uint32_t cycle_profiler_get_block_period(void);
+float cycle_profiler_get_utilization_avg(void);
+float cycle_profiler_get_utilization_max(void);
+
+#else
+
+#define CYCLE_PROFILER_START(t)
+#define CYCLE_PROFILER_LAP(t,stage)
+#define cycle_profiler_setup()
+#define cycle_profiler_attach_sigchain(sc)
+#define cycle_profiler_end_block()
+
+#endif /* NO_CYCLE_PROFILER */
+
+#endif /* CYCLE_PROFILER_H */
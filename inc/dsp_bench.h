@@ -0,0 +1,23 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#ifndef DSP_BENCH_H
+#define DSP_BENCH_H
+
+#include <stdint.h>
+
+/* See test/dsp_bench.c */
+
+/* Blocks each kernel is timed for and blocks it is run before that */
+#define DSP_BENCH_BLOCKS 1000
+#define DSP_BENCH_WARMUP_BLOCKS 10
+/* Room for the results */
+#define DSP_BENCH_CSV_SIZE 1024
+
+/* The results as CSV, dsp_bench_csv_len characters long */
+extern char dsp_bench_csv[];
+extern uint32_t dsp_bench_csv_len;
+
+void dsp_bench_run(void);
+void dsp_bench_done(void);
+
+#endif /* DSP_BENCH_H */
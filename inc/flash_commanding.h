@@ -5,9 +5,17 @@
 #include <stdint.h>
 #include <stddef.h> 
 
-#define FLASH_START_ADDR 0x0810c000
-#define FLASH_END_ADDR   0x08110000 
-#define FLASH_SECTOR     15
+/* The two 16KB sectors of bank 2 the presets log is kept in */
+#define FLASH_PRESETS_SECTOR0       14
+#define FLASH_PRESETS_SECTOR0_ADDR  0x08108000
+#define FLASH_PRESETS_SECTOR1       15
+#define FLASH_PRESETS_SECTOR1_ADDR  0x0810c000
+#define FLASH_PRESETS_SECTOR_SIZE   0x4000
+/* The rest of bank 2 (sectors 16 to 23) that recordings are saved into */
+#define FLASH_RECORDING_FIRST_SECTOR 16
+#define FLASH_RECORDING_LAST_SECTOR  23
+#define FLASH_RECORDING_ADDR         0x08110000
+#define FLASH_RECORDING_END_ADDR     0x08200000
 /* Number of bytes that can be written or read at one time */
 #define FLASH_ACCESS_SIZE 4
 
@@ -20,8 +28,34 @@
             |FLASH_CMD_ERASE_REQUEST\
             |FLASH_CMD_WRITE_IN_PROGRESS\
             |FLASH_CMD_ERASE_IN_PROGRESS)
-            
+
+typedef enum {
+    flash_cmd_type_ERASE,
+    flash_cmd_type_PROGRAM,
+} flash_cmd_type_t;
+
+typedef struct __flash_cmd_t flash_cmd_t;
+
+/* A sector erase or a program of some words. These are queued and carried out
+ * one after the other by the flash and DMA interrupts. The caller owns the
+ * structure and must not change it until done is called. */
+struct __flash_cmd_t {
+    flash_cmd_type_t type;
+    /* ERASE: the sector number */
+    uint32_t sector;
+    /* PROGRAM: where to write, what to write and the number of bytes (all
+     * multiples of FLASH_ACCESS_SIZE). The locations must have been erased. */
+    uint32_t addr;
+    const void *src;
+    uint32_t size;
+    /* Called from the interrupt when finished, err is 0 on success or -1 if
+     * the flash reported an error. Can submit more commands. */
+    void (*done)(flash_cmd_t *cmd, int err);
+    void *data;
+    flash_cmd_t *next;
+};
+
 extern volatile uint32_t flash_state;
-void flash_request_write(char *what, uint32_t length);
+void flash_cmd_submit(flash_cmd_t *cmd);
 
 #endif /* FLASH_COMMANDING_H */
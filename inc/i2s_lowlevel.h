@@ -34,13 +34,37 @@ typedef uint32_t audio_hw_setup_t;
 #define INT16_TO_FLOAT(x) ((float)x/(float)32768)
 #define FLOAT_TO_INT16(x) ((int16_t)(x * 32768))
 
-void codec_prog_reg_i2c(uint8_t addr,
+/* These wait for the transaction to finish, see codec_i2c.h to queue them
+ * instead */
+int codec_prog_reg_i2c(uint8_t addr,
                                uint8_t reg_addr,
                                uint16_t reg_val);
-void codec_read_reg_i2c(uint8_t addr,
+int codec_read_reg_i2c(uint8_t addr,
                                uint8_t reg_addr,
                                uint16_t *reg_val);
 
+/* The longest to wait for any one step of a fast resynchronization, about 4
+ * frames at 32KHz */
+#define I2S_RESYNC_TIMEOUT_CYCLES 22500
+/* If another frame error happens within this many blocks of a fast
+ * resynchronization, do the full reset instead */
+#define I2S_RESYNC_ESCALATE_BLOCKS 4
+
+typedef struct {
+    /* number of times the fast and full resynchronizations were done */
+    uint32_t n_fast;
+    uint32_t n_full;
+    /* samples from the frame error until audio was running again */
+    uint32_t last_samples;
+    uint32_t max_samples;
+} i2s_resync_stats_t;
+
+void i2s_get_resync_stats(i2s_resync_stats_t *stats);
+unsigned int i2s_get_n_underruns(void);
+unsigned int i2s_get_n_resyncs(void);
+uint32_t i2s_get_sample_position(void);
+uint32_t i2s_get_block_sample(void);
+
 #include "audio_hw.h" 
 
 #endif /* I2S_LOWLEVEL_H */
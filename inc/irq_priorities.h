@@ -0,0 +1,23 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#ifndef IRQ_PRIORITIES_H
+#define IRQ_PRIORITIES_H 
+
+/* The priorities of the interrupts, lower numbers interrupt higher ones.
+ * irq_priorities_setup gives every interrupt IRQ_PRIORITY_DEFAULT and each
+ * that needs another sets it with NVIC_SetPriority where it is enabled. */
+
+/* The MIDI clock timer and the MIDI transmit DMA, so the clock goes out on
+ * time even while the audio is being computed */
+#define IRQ_PRIORITY_MIDI_OUT   0
+/* The MIDI receive DMA and USART, which note when the bytes came in, so they
+ * mustn't wait for the audio */
+#define IRQ_PRIORITY_MIDI_IN    1
+/* The I2S DMA and frame errors */
+#define IRQ_PRIORITY_AUDIO      2
+/* Everything else, e.g., the LEDs, ADC, codec I2C, timers and flash */
+#define IRQ_PRIORITY_DEFAULT    3
+
+void irq_priorities_setup(void);
+
+#endif /* IRQ_PRIORITIES_H */
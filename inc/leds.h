@@ -46,8 +46,57 @@
 
 #endif  
 
+/* The LEDs are driven by DMA writing a table of words to the ports' BSRR
+ * registers, one word each time TIM8 updates. Each LED is in the table of its
+ * port. */
+#if defined(BOARD_V1)
+
+#define LEDS_N_FRAMES               1
+#define LEDS_FRAME0_PORT            GPIOE
+#define LED1_FRAME                  0
+#define LED3_FRAME                  0
+#define LED5_FRAME                  0
+#define LED7_FRAME                  0
+
+#elif defined(BOARD_V2)
+
+#define LEDS_N_FRAMES               2
+#define LEDS_FRAME0_PORT            GPIOA
+#define LEDS_FRAME1_PORT            GPIOC
+#define LED1_FRAME                  0
+#define LED3_FRAME                  1
+#define LED5_FRAME                  1
+#define LED7_FRAME                  0
+
+#endif  
+
+/* Brightness goes from 0 (off) to LEDS_PWM_STEPS (fully on) */
+#define LEDS_PWM_STEPS              32
+/* The rate at which the LEDs are switched on and off to dim them */
+#define LEDS_PWM_FREQ               500
+/* PWM periods in each half of the table. The table half just written is
+ * updated (if necessary) by the DMA interrupt, so this sets how often that
+ * happens (every 8ms). */
+#define LEDS_PERIODS_PER_HALF       4
+#define LEDS_HALF_LEN               (LEDS_PWM_STEPS*LEDS_PERIODS_PER_HALF)
+/* Blink patterns are 32 bits, each bit lasting this many table halves (32ms) */
+#define LEDS_PATTERN_STEP_HALVES    4
+/* Pattern that is always on */
+#define LEDS_PATTERN_SOLID          0xffffffff
+
+typedef enum {
+    leds_LED1 = 0,
+    leds_LED3,
+    leds_LED5,
+    leds_LED7,
+    leds_N
+} leds_led_t;
 
 void leds_setup(void);
+void leds_set_brightness(leds_led_t led, uint32_t brightness);
+uint32_t leds_get_brightness(leds_led_t led);
+void leds_set_pattern(leds_led_t led, uint32_t pattern, uint32_t n_steps);
+
 void led1_set(void);
 void led1_reset(void);
 void led3_set(void);
@@ -0,0 +1,55 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#ifndef LOAD_GOVERNOR_H
+#define LOAD_GOVERNOR_H
+
+#include <stdint.h>
+
+/* Sheds work from the audio interrupt when it gets close to taking longer than
+ * a block, before an underrun happens. Work is shed one level at a time in the
+ * order below and restored in the reverse order once the load has stayed low
+ * for a while. */
+typedef enum {
+    /* Everything on */
+    load_governor_level_FULL,
+    /* Sample players use linear instead of cubic interpolation */
+    load_governor_level_LINEAR_INTERP,
+    /* Fewer voices can play at once */
+    load_governor_level_FEWER_VOICES,
+    /* The feedback path is taken out of the signal chain. This stops N1 being
+     * fed back to the recorder, so it isn't done while recording and is
+     * undone when a recording starts. */
+    load_governor_level_NO_FEEDBACK,
+    load_governor_level_N
+} load_governor_level_t;
+
+/* Default thresholds, in percent of the block period */
+#define LOAD_GOVERNOR_SHED_PCT      85
+#define LOAD_GOVERNOR_RESTORE_PCT   65
+/* Consecutive blocks that have to go over the shed threshold to shed a level,
+ * so one block held up by other interrupts doesn't */
+#define LOAD_GOVERNOR_SHED_BLOCKS   4
+/* Blocks to wait after changing level before shedding more */
+#define LOAD_GOVERNOR_HOLD_BLOCKS   8
+/* Blocks the load has to stay under the restore threshold to restore a level */
+#define LOAD_GOVERNOR_RESTORE_BLOCKS 250
+/* The maximum number of voices at load_governor_level_FEWER_VOICES */
+#define LOAD_GOVERNOR_REDUCED_VOICES (NUM_NOTES/2)
+
+typedef struct {
+    /* Shed a level if a block takes more than this percent of the period */
+    uint32_t shed_pct;
+    /* Restore a level if blocks take less than this percent of the period */
+    uint32_t restore_pct;
+    uint32_t shed_blocks;
+    uint32_t hold_blocks;
+    uint32_t restore_blocks;
+    int reduced_voices;
+} load_governor_config_t;
+
+void load_governor_setup(void);
+void load_governor_set_config(load_governor_config_t *config);
+void load_governor_update(uint32_t block_cycles, uint32_t block_period);
+load_governor_level_t load_governor_get_level(void);
+
+#endif /* LOAD_GOVERNOR_H */
@@ -0,0 +1,76 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#ifndef MIDI_BULK_H
+#define MIDI_BULK_H
+
+#include <stdint.h>
+
+/* Sends the bank of presets or the sound being played over MIDI in system
+ * exclusive messages (see midi_sysex.h) and loads a bank of presets sent
+ * back. The messages are only taken and queued by the audio interrupt, the
+ * work is done by midi_bulk_poll from the main loop one packet at a time, so
+ * no more than a packet is ever buffered.
+ *
+ * The payloads, before packing into 7-bit bytes, are (little-endian):
+ *
+ * BULK_DUMP_REQUEST  what
+ * BULK_DATA          what, offset (4), up to MIDI_BULK_PACKET_SIZE bytes
+ * BULK_END           what, status, total bytes (4), sum of the bytes (4),
+ *                    milliseconds the transfer took (4), sample rate (4)
+ * BULK_ACK           what, status, offset of the next packet expected (4)
+ *
+ * A dump is a BULK_DATA for each packet then a BULK_END. The sound is sent
+ * as 16-bit signed samples.
+ *
+ * To load a bank of presets, send a BULK_DATA and wait for its BULK_ACK before
+ * sending the next, starting from offset 0. Then send a BULK_END with the
+ * total and the sum (the rest of it is ignored). Its BULK_ACK says whether the
+ * bank was stored in flash. A packet that isn't acknowledged can be sent
+ * again. */
+
+/* The most bytes of data in a BULK_DATA packet */
+#define MIDI_BULK_PACKET_SIZE 64
+/* Bytes before the data in a BULK_DATA packet */
+#define MIDI_BULK_DATA_HDR_SIZE 5
+
+typedef enum {
+    midi_bulk_what_PRESETS  = 0,
+    midi_bulk_what_SAMPLE   = 1,
+} midi_bulk_what_t;
+
+typedef enum {
+    midi_bulk_status_OK             = 0,
+    /* Another transfer is going on */
+    midi_bulk_status_BUSY           = 1,
+    /* A packet wasn't the one expected */
+    midi_bulk_status_BAD_OFFSET     = 2,
+    /* The total or the sum at the end didn't match */
+    midi_bulk_status_BAD_CHECKSUM   = 3,
+    /* The loaded bank isn't a bank of presets, or the sound changed while it
+     * was being sent */
+    midi_bulk_status_FAILED         = 4,
+    /* Can't be loaded or dumped */
+    midi_bulk_status_UNSUPPORTED    = 5,
+} midi_bulk_status_t;
+
+typedef struct {
+    /* Bytes of data in the last transfer and bytes that went over MIDI for
+     * them, including the packing and the other messages */
+    uint32_t data_bytes;
+    uint32_t wire_bytes;
+    /* Milliseconds the last transfer took and the data bytes per second */
+    uint32_t ms;
+    uint32_t bytes_per_sec;
+    /* Status of the last transfer */
+    uint32_t status;
+    /* Messages that came while the last one was still being handled, they
+     * are not acknowledged */
+    uint32_t dropped;
+} midi_bulk_stats_t;
+
+extern midi_bulk_stats_t midi_bulk_stats;
+
+void midi_bulk_setup(void);
+void midi_bulk_poll(void);
+
+#endif /* MIDI_BULK_H */
@@ -0,0 +1,52 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#ifndef MIDI_CLOCK_OUT_H
+#define MIDI_CLOCK_OUT_H
+
+#include <stdint.h>
+
+/* Sends MIDI clock at the tempo of the scheduler while it is advanced
+ * internally and turned on with control change 69, with start when the
+ * scheduler starts playing measures and stop when it stops.
+ *
+ * The audio interrupt works out where in the block each clock falls (see
+ * scheduler_get_clock_offsets) and TIM5 sends each one exactly one block period
+ * after the sample it falls on, the same delay as the audio. TIM5 and the MIDI
+ * transmit DMA are the only interrupts that can interrupt the audio interrupt
+ * so a long block doesn't delay the clocks. Each clock goes ahead of anything
+ * queued to be sent (see midi_hw_send_realtime). Look at midi_clock_out_stats
+ * in gdb to see how even they are. */
+
+/* The rate TIM5 counts at */
+#define MIDI_CLOCK_OUT_TIMER_HZ 1000000
+/* The most clocks that can fall in one block */
+#define MIDI_CLOCK_OUT_MAX_PER_BLOCK 8
+/* Number of clocks that can be waiting to be sent, must be a power of 2 */
+#define MIDI_CLOCK_OUT_QUEUE_SIZE 16
+/* Clocks further apart than this are taken as the clock having stopped */
+#define MIDI_CLOCK_OUT_MAX_INTERVAL_US 1000000
+
+typedef struct {
+    /* Clocks sent */
+    uint32_t clocks;
+    /* Clocks not sent because too many were waiting */
+    uint32_t missed;
+    /* The longest a clock was sent after when it should have been, in
+     * microseconds */
+    uint32_t late_max_us;
+    /* The time between the last two clocks and the shortest and longest
+     * time between two clocks, in microseconds */
+    uint32_t interval_us;
+    uint32_t interval_min_us;
+    uint32_t interval_max_us;
+} midi_clock_out_stats_t;
+
+extern midi_clock_out_stats_t midi_clock_out_stats;
+
+void midi_clock_out_setup(void);
+void midi_clock_out_set_enabled(int enabled);
+void midi_clock_out_mark_block(void);
+void midi_clock_out_block(void);
+int midi_clock_out_get_enabled(void);
+
+#endif /* MIDI_CLOCK_OUT_H */
@@ -5,8 +5,22 @@
 #include "uart_midi_lowlevel.h"
 #include "mm_midirouter_standard.h" 
 
+typedef struct {
+    /* Messages sent out again and messages that weren't because there was no
+     * room */
+    uint32_t msgs;
+    uint32_t dropped;
+    /* Cycles from when the last byte of a message was received to when it
+     * would start being sent, of the last message, on average and at most */
+    uint32_t latency;
+    uint32_t latency_avg;
+    uint32_t latency_max;
+} midi_thru_stats_t;
+
 extern MIDI_Router_Standard midiRouter;
+extern midi_thru_stats_t midi_thru_stats;
 
 int midi_setup(void *data);
+void midi_thru_set_enabled(int enabled);
 
 #endif /* MIDI_SETUP_H */
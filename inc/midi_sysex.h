@@ -0,0 +1,58 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#ifndef MIDI_SYSEX_H
+#define MIDI_SYSEX_H
+
+#include <stdint.h>
+
+/* System exclusive messages to and from the device look like
+ * F0 <MIDI_SYSEX_MANUFACTURER_ID> <MIDI_SYSEX_DEVICE_ID> <cmd> <payload> F7
+ * where payload is 8-bit data packed into 7-bit bytes: each group of up to 7
+ * bytes is preceded by a byte holding their most significant bits, the MSB of
+ * the first byte of the group in bit 0. */
+
+#define MIDI_SYSEX_START            0xf0
+#define MIDI_SYSEX_END              0xf7
+/* The manufacturer ID reserved for non-commercial use */
+#define MIDI_SYSEX_MANUFACTURER_ID  0x7d
+#define MIDI_SYSEX_DEVICE_ID        0x56
+/* Incoming messages longer than this (not counting F0 and F7) are dropped. A
+ * bulk data packet (see midi_bulk.h) has to fit. */
+#define MIDI_SYSEX_RX_BUF_SIZE      96
+/* The number of 7-bit bytes needed to hold n 8-bit bytes */
+#define MIDI_SYSEX_PACKED_LEN(n)    ((n) + ((n) + 6)/7)
+
+typedef enum {
+    /* Request the deadline miss history, no payload */
+    midi_sysex_cmd_XRUN_HISTORY_REQUEST = 0x01,
+    /* Reply carrying the deadline miss history, see xrun_history.h */
+    midi_sysex_cmd_XRUN_HISTORY_REPLY   = 0x02,
+    /* Clear the deadline miss history, no payload */
+    midi_sysex_cmd_XRUN_HISTORY_CLEAR   = 0x03,
+    /* Ask for a bulk dump, the payload is a midi_bulk_what_t byte */
+    midi_sysex_cmd_BULK_DUMP_REQUEST    = 0x04,
+    /* A packet of a bulk dump or load, see midi_bulk.h */
+    midi_sysex_cmd_BULK_DATA            = 0x05,
+    /* The end of a bulk dump or load */
+    midi_sysex_cmd_BULK_END             = 0x06,
+    /* Reply to each packet and to the end of a bulk load */
+    midi_sysex_cmd_BULK_ACK             = 0x07,
+    /* Sent periodically when turned on, see telemetry.h */
+    midi_sysex_cmd_TELEMETRY            = 0x08,
+} midi_sysex_cmd_t;
+
+typedef struct midi_sysex_handler_t {
+    uint8_t cmd;
+    /* Called with the payload, still packed, of each message whose command is
+     * cmd. */
+    void (*func)(void *data, const uint8_t *payload, uint32_t len);
+    void *data;
+    struct midi_sysex_handler_t *next;
+} midi_sysex_handler_t;
+
+void midi_sysex_handler_add(midi_sysex_handler_t *h);
+uint32_t midi_sysex_pack7(const uint8_t *in, uint32_t len, uint8_t *out);
+uint32_t midi_sysex_unpack7(const uint8_t *in, uint32_t len, uint8_t *out);
+int midi_sysex_send(uint8_t cmd, const uint8_t *payload, uint32_t len);
+
+#endif /* MIDI_SYSEX_H */
@@ -2,5 +2,7 @@
 #define MIDI_UTIL_H 
 
 float midi_util_map_midpoint_exact(float mdata, float x0, float x1);
+float midi_util_map_midpoint_exact_14bit(float mdata, float x0, float x1);
+int midi_util_msg_length(char status);
 
 #endif /* MIDI_UTIL_H */
@@ -11,6 +11,9 @@ extern uint32_t voiceAllocator;
 void pm_yield_params_to_allocator(void *allocator, void *params);
 void pm_claim_params_from_allocator(void *allocator, void *params);
 int pm_get_next_free_voice_number(void);
+void pm_set_max_voices(int n);
+int pm_get_max_voices(void);
+int pm_get_n_busy_voices(void);
 void pm_do_for_each_busy_voice(void *allocator, void (*voice_cb)(void *params));
 
 #endif /* POLY_MANAGEMENT_H */
@@ -13,4 +13,8 @@ presets_lowlevel_err_t presets_lowlevel_read(presets_lowlevel_handle_t *handle,
         void *dest, uint32_t size, void *opt);
 presets_lowlevel_err_t presets_lowlevel_write(presets_lowlevel_handle_t *handle,
         void *src, uint32_t size, void *opt);
+/* Store only len bytes starting offset bytes into src, which is size bytes
+ * long in total. src must stay valid, it is read when the storing happens. */
+presets_lowlevel_err_t presets_lowlevel_update(presets_lowlevel_handle_t *handle,
+        void *src, uint32_t size, uint32_t offset, uint32_t len, void *opt);
 #endif /* PRESETS_LOWLEVEL_H */
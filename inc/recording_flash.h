@@ -0,0 +1,53 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#ifndef RECORDING_FLASH_H
+#define RECORDING_FLASH_H
+#include <stdint.h>
+
+/* Saves the sound being played into bank 2 of the flash compressed with
+ * IMA-ADPCM (4 bits per sample) and puts it back into the sample table at
+ * boot. The compressing is done by recording_flash_poll from the main loop
+ * and the flash is programmed by DMA, so the audio interrupt never waits for
+ * it. The programs run from bank 1, which can still be read while bank 2 is
+ * being erased or programmed. */
+
+/* Samples in each compressed block. Each block starts with the decoder's
+ * state so blocks can be decoded on their own. */
+#define RECORDING_FLASH_BLOCK_SAMPLES 1024
+/* Bytes in each compressed block: predictor, step index, padding, nibbles */
+#define RECORDING_FLASH_BLOCK_SIZE (4 + RECORDING_FLASH_BLOCK_SAMPLES/2)
+/* Blocks compressed into each buffer given to the flash to program */
+#define RECORDING_FLASH_BLOCKS_PER_BUF 2
+
+typedef enum {
+    recording_flash_state_IDLE,
+    recording_flash_state_ERASING,
+    recording_flash_state_WRITING,
+    recording_flash_state_HEADER,
+} recording_flash_state_t;
+
+typedef struct {
+    /* CPU cycles compressing the last save took, including any interrupts
+     * that came during it, and the number of samples */
+    uint32_t compress_cycles;
+    uint32_t compress_samples;
+    /* CPU cycles from asking to save until the save was finished */
+    uint32_t save_cycles;
+    /* Number of times the audio missed its deadline while saving (see
+     * xrun_history.h), should always be 0 */
+    uint32_t save_xruns;
+    /* Non-zero if the last save failed */
+    uint32_t save_failed;
+    /* CPU cycles the restore at boot took and the number of samples */
+    uint32_t restore_cycles;
+    uint32_t restore_samples;
+} recording_flash_stats_t;
+
+extern recording_flash_stats_t recording_flash_stats;
+
+int recording_flash_save(void);
+void recording_flash_poll(void);
+int recording_flash_restore(void);
+recording_flash_state_t recording_flash_get_state(void);
+
+#endif /* RECORDING_FLASH_H */
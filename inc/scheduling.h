@@ -11,18 +11,17 @@
 /* Amplitude below which playback is not triggered */
 #define SCHEDULING_AMP_FLOOR 3.05E-5 /* ~ 2^-15 */
 
-#define MEASURE_LED_SET() led7_set()
-#define MEASURE_LED_RESET() led7_reset()
+#define MEASURE_LED leds_LED7
 /* The fraction of the measure from the beginning of the measure at which time
  * the LED will be turned off. 4 is quarter of the measure, 3 is third, etc. */
 #define MEASURE_LED_LENGTH_SCALAR (16ULL)
+/* The most notes that can be asked for with scheduler_one_shot in one block */
+#define SCHED_MAX_ONE_SHOTS 8
 
 typedef struct __NoteOnEvent NoteOnEvent;
 typedef struct __NoteSchedEvent NoteSchedEvent;
-typedef struct __MeasureLEDOffEvent MeasureLEDOffEvent;
 typedef struct __NoteOnEventListNode NoteOnEventListNode;
 typedef struct __NoteSchedEventListNode NoteSchedEventListNode;
-typedef struct __MeasureLEDOffEventListNode MeasureLEDOffEventListNode;
 
 struct __NoteOnEventListNode {
     MMDLList head;
@@ -34,11 +33,6 @@ struct __NoteSchedEventListNode {
     NoteSchedEvent *child;
 };
 
-struct __MeasureLEDOffEventListNode {
-    MMDLList head;
-    MeasureLEDOffEvent *child;
-};
-
 typedef enum {
     sched_advance_mode_INTERNAL,
     sched_advance_mode_MIDI,
@@ -48,19 +42,21 @@ typedef enum {
 extern MMSeq *sequence;
 extern NoteOnEventListNode noteOnEventListHead[];
 extern NoteSchedEventListNode noteSchedEventListHead;
-extern MeasureLEDOffEventListNode measureLEDOffEventListHead;
 extern int noteOnEventCount[];
 sched_advance_mode_t scheduler_get_advance_mode(void);
+int scheduler_get_n_pending_events(void);
+float scheduler_get_measure_phase(void);
+void scheduler_measure_stop(void);
 void scheduler_advance_mode_cycle(void);
 void scheduler_setup(void);
 void schedule_noteOn_event(MMTime timeFromNow, NoteOnEvent *ev);
 void scheduler_incTimeAndDoEvents(void);
 void scheduler_incTimeAndDoEvents_midiclock(void);
+int scheduler_get_clock_offsets(uint32_t *offsets, int max);
 void set_noteOnEvents_active(NoteOnEventListNode *head);
 void set_noteOnEvents_inactive(NoteOnEventListNode *head);
 void set_noteSchedEvents_active(NoteSchedEventListNode *head);
 void set_noteSchedEvents_inactive(NoteSchedEventListNode *head);
-void set_measureLEDOffEvents_inactive(MeasureLEDOffEventListNode *head);
 void schedule_noteSched_event(uint64_t timeFromNow, NoteSchedEvent *ev);
 NoteSchedEvent *NoteSchedEvent_new(int active);
 NoteOnEvent *NoteOnEvent_new(int active,
@@ -77,5 +73,9 @@ void NoteSchedEvent_set_pitch_offset(NoteSchedEvent *nse, MMSample pitch);
 void NoteSchedEvent_set_pitch_mode(NoteSchedEvent *nse, SynthControlPitchMode pitch_mode);
 void NoteSchedEvent_set_amplitude_scalar(NoteSchedEvent *nse, MMSample amp);
 void NoteSchedEvent_set_one_shot(NoteSchedEvent *nse, int one_shot);
+void scheduler_set_event_offset(uint32_t offset);
+void scheduler_one_shot(MMSample pitch_offset,
+                        MMSample amplitude,
+                        SynthControlPitchMode pitch_mode);
 
 #endif /* SCHEDULING_H */
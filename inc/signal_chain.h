@@ -15,6 +15,15 @@
  #define NUM_NOTES 10
 #endif
 
+/* Number of blocks before the current one that a recording can be started
+ * from, enough to cover the footswitch debouncing (see switches.h) */
+#define SIG_CHAIN_RECORDER_PREROLL_BLOCKS 8
+#define SIG_CHAIN_RECORDER_PREROLL_LEN \
+    (SIG_CHAIN_RECORDER_PREROLL_BLOCKS * BUFFER_SIZE)
+/* inBus is filled after the chain is ticked (see audio_hw_io), so what the
+ * recorder gets is this many samples behind the block being processed */
+#define SIG_CHAIN_INPUT_LAG BUFFER_SIZE
+
 extern MMBus *inBus, *outBus, *fbBus;
 extern MMSigChain sigChain;
 extern MMTrapEnvedSamplePlayer spsps[NUM_NOTES];
@@ -25,6 +34,10 @@ extern MMBusSplitter fbBusSplitter;
 extern MMSigProc *fbOffNode; 
 /* Insert the fbBusSplitter after this node to turn it on */
 extern MMSigProc *fbOnNode;
+/* The limiter and DC blocker on the output and the gate on the feedback */
+extern struct limiter_ir_af *audio_limiter;
+extern struct dc_notch_filter_1_pole *dc_blocker;
+extern struct signal_gate *fbk_signal_gate;
 
 void signal_chain_setup(void);
 void fbk_signal_gate_pass(void);
@@ -32,5 +45,9 @@ void fbk_signal_gate_block(void);
 void n1_fbk_signal_gate_pass(void);
 void n1_fbk_signal_gate_block(void);
 MMBus * signal_chain_get_n1fbBus(void);
+void signal_chain_set_interp(MMInterpMethod interp);
+void signal_chain_feedback_path_bypass(int bypass);
+uint32_t signal_chain_recorder_preroll(uint32_t n);
+void signal_chain_voice_delay(int voice, uint32_t delay);
 
 #endif /* SIGNAL_CHAIN_H */
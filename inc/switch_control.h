@@ -4,6 +4,7 @@
 #define SWITCH_CONTROL_H 
 
 #include <stdint.h> 
+#include "switches.h" 
 
 typedef struct __switch_control_t {
     /* The address of the GPIO port that toggles */
@@ -16,6 +17,10 @@ typedef struct __switch_control_t {
     void (*func)(struct __switch_control_t *);
     /* Some auxiliary data that func can have access to */
     void *data;
+    /* The bits of switches_debounced that func looks at. If any are set, func
+     * is only called when one of these bits changes, otherwise it is called
+     * every time switch_control_do_all is. See switch_control_watch. */
+    uint32_t watch[SWITCHES_N_WORDS];
     /* The next one in the list. This should be NULL if last in the list. */
     struct __switch_control_t *next;
 } switch_control_t;
@@ -66,11 +71,19 @@ void switch_control_init(switch_control_t *sc,
                          void (*func)(switch_control_t*),
                          void *data);
 void switch_control_add(switch_control_t *sc);
+void switch_control_watch(switch_control_t *sc,
+                          volatile uint32_t *db_addr,
+                          uint32_t db_bit);
 
 typedef enum {
     switch_debouncer_style_A = 0,
     switch_debouncer_style_B,
-    switch_debouncer_style_C
+    switch_debouncer_style_C,
+    /* These use the debounced pin (the mom_state's pin_state_addr should be
+     * in switches_debounced) and call the function when it changes to pressed
+     * or released. */
+    switch_debouncer_style_PRESS,
+    switch_debouncer_style_RELEASE
 } switch_debouncer_style_t;
 
 void switch_control_debounce_init(switch_control_t *sc,
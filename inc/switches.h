@@ -132,6 +132,78 @@
 #define MSW7_TOP_TOG_ADDR       (&sw_toggle_states)
 #define MSW1_TOP_TOG_ADDR       (&sw_toggle_states)
 
+/* The input data registers of the switches' ports are read together once per
+ * scan and packed two ports to a word (see switches_scan). These give the word
+ * and the shift of each port. */
+#define SWITCHES_N_WORDS        3
+#define SWITCHES_GPIOB_WORD     0
+#define SWITCHES_GPIOB_SHIFT    0
+#define SWITCHES_GPIOC_WORD     0
+#define SWITCHES_GPIOC_SHIFT    16
+#define SWITCHES_GPIOD_WORD     1
+#define SWITCHES_GPIOD_SHIFT    0
+#define SWITCHES_GPIOE_WORD     1
+#define SWITCHES_GPIOE_SHIFT    16
+#define SWITCHES_GPIOF_WORD     2
+#define SWITCHES_GPIOF_SHIFT    0
+#define SWITCHES_GPIOG_WORD     2
+#define SWITCHES_GPIOG_SHIFT    16
+/* Number of consecutive scans a switch must read differently before its
+ * debounced state changes (given by the 2-bit vertical counters) */
+#define SWITCHES_DEBOUNCE_SCANS 4
+
+/* Where the debounced state of each switch is. Like the port, a bit that is
+ * low means the switch is closed. */
+#define FSW1_DB_ADDR            (&switches_debounced[SWITCHES_GPIOB_WORD])
+#define FSW1_DB_BIT             (FSW1_PORT_PIN + SWITCHES_GPIOB_SHIFT)
+#define FSW2_DB_ADDR            (&switches_debounced[SWITCHES_GPIOE_WORD])
+#define FSW2_DB_BIT             (FSW2_PORT_PIN + SWITCHES_GPIOE_SHIFT)
+#define SW1_TOP_DB_ADDR         (&switches_debounced[SWITCHES_GPIOG_WORD])
+#define SW1_TOP_DB_BIT          (SW1_TOP_PORT_PIN + SWITCHES_GPIOG_SHIFT)
+#define SW1_BTM_DB_ADDR         (&switches_debounced[SWITCHES_GPIOG_WORD])
+#define SW1_BTM_DB_BIT          (SW1_BTM_PORT_PIN + SWITCHES_GPIOG_SHIFT)
+#define SW2_TOP_DB_ADDR         (&switches_debounced[SWITCHES_GPIOD_WORD])
+#define SW2_TOP_DB_BIT          (SW2_TOP_PORT_PIN + SWITCHES_GPIOD_SHIFT)
+#define SW2_BTM_DB_ADDR         (&switches_debounced[SWITCHES_GPIOD_WORD])
+#define SW2_BTM_DB_BIT          (SW2_BTM_PORT_PIN + SWITCHES_GPIOD_SHIFT)
+#define SW3_TOP_DB_ADDR         (&switches_debounced[SWITCHES_GPIOD_WORD])
+#define SW3_TOP_DB_BIT          (SW3_TOP_PORT_PIN + SWITCHES_GPIOD_SHIFT)
+#define SW3_BTM_DB_ADDR         (&switches_debounced[SWITCHES_GPIOB_WORD])
+#define SW3_BTM_DB_BIT          (SW3_BTM_PORT_PIN + SWITCHES_GPIOB_SHIFT)
+#define SW4_TOP_DB_ADDR         (&switches_debounced[SWITCHES_GPIOB_WORD])
+#define SW4_TOP_DB_BIT          (SW4_TOP_PORT_PIN + SWITCHES_GPIOB_SHIFT)
+#define SW4_BTM_DB_ADDR         (&switches_debounced[SWITCHES_GPIOB_WORD])
+#define SW4_BTM_DB_BIT          (SW4_BTM_PORT_PIN + SWITCHES_GPIOB_SHIFT)
+#define SW5_TOP_DB_ADDR         (&switches_debounced[SWITCHES_GPIOB_WORD])
+#define SW5_TOP_DB_BIT          (SW5_TOP_PORT_PIN + SWITCHES_GPIOB_SHIFT)
+#define SW5_BTM_DB_ADDR         (&switches_debounced[SWITCHES_GPIOD_WORD])
+#define SW5_BTM_DB_BIT          (SW5_BTM_PORT_PIN + SWITCHES_GPIOD_SHIFT)
+#define SW6_TOP_DB_ADDR         (&switches_debounced[SWITCHES_GPIOD_WORD])
+#define SW6_TOP_DB_BIT          (SW6_TOP_PORT_PIN + SWITCHES_GPIOD_SHIFT)
+#define SW6_BTM_DB_ADDR         (&switches_debounced[SWITCHES_GPIOD_WORD])
+#define SW6_BTM_DB_BIT          (SW6_BTM_PORT_PIN + SWITCHES_GPIOD_SHIFT)
+#define SW7_TOP_DB_ADDR         (&switches_debounced[SWITCHES_GPIOD_WORD])
+#define SW7_TOP_DB_BIT          (SW7_TOP_PORT_PIN + SWITCHES_GPIOD_SHIFT)
+#define SW7_BTM_DB_ADDR         (&switches_debounced[SWITCHES_GPIOC_WORD])
+#define SW7_BTM_DB_BIT          (SW7_BTM_PORT_PIN + SWITCHES_GPIOC_SHIFT)
+#define SW8_TOP_DB_ADDR         (&switches_debounced[SWITCHES_GPIOB_WORD])
+#define SW8_TOP_DB_BIT          (SW8_TOP_PORT_PIN + SWITCHES_GPIOB_SHIFT)
+#define SW8_BTM_DB_ADDR         (&switches_debounced[SWITCHES_GPIOC_WORD])
+#define SW8_BTM_DB_BIT          (SW8_BTM_PORT_PIN + SWITCHES_GPIOC_SHIFT)
+#if defined(BOARD_V2)
+#define EXPSW_DB_ADDR           (&switches_debounced[SWITCHES_GPIOF_WORD])
+#define EXPSW_DB_BIT            (EXPSW_PORT_PIN + SWITCHES_GPIOF_SHIFT)
+#endif /* defined(BOARD_V2) */
+
+#define MSW3_TOP_DB_ADDR        SW3_TOP_DB_ADDR
+#define MSW3_TOP_DB_BIT         SW3_TOP_DB_BIT
+#define MSW3_BTM_DB_ADDR        SW3_BTM_DB_ADDR
+#define MSW3_BTM_DB_BIT         SW3_BTM_DB_BIT
+#define MSW7_TOP_DB_ADDR        SW7_TOP_DB_ADDR
+#define MSW7_TOP_DB_BIT         SW7_TOP_DB_BIT
+#define MSW1_TOP_DB_ADDR        SW1_TOP_DB_ADDR
+#define MSW1_TOP_DB_BIT         SW1_TOP_DB_BIT
+
 #define FSW1_EXTICR             SYSCFG->EXTICR[1] 
 #define FSW2_EXTICR             SYSCFG->EXTICR[1] 
 #define MSW3_TOP_EXTICR         SYSCFG->EXTICR[2] 
@@ -198,7 +270,28 @@
  #define MSW1_TOP_FSW2_EXTI     EXTI
 #endif  
 
+/* When a footswitch is pressed, the first falling edge is timestamped by its
+ * EXTI interrupt. Edges older than this many blocks are not used because they
+ * were not confirmed by the debouncing (e.g., noise). */
+#define SWITCHES_EDGE_MAX_AGE_BLOCKS (SWITCHES_DEBOUNCE_SCANS + 2)
+
+typedef enum {
+    switches_edge_FSW1 = 0,
+    switches_edge_FSW2,
+    switches_edge_N
+} switches_edge_sw_t;
+
+typedef struct {
+    /* DWT cycle count and input sample position (see
+     * i2s_get_sample_position) of the edge */
+    uint32_t cycles;
+    uint32_t sample;
+    /* Non-zero if there's an edge that hasn't been taken */
+    uint32_t pending;
+} switches_edge_t;
+
 extern volatile uint32_t sw_toggle_states;
+extern volatile uint32_t switches_debounced[SWITCHES_N_WORDS];
 
 void switches_setup(void);
 uint32_t fsw1_get_state(void);
@@ -221,6 +314,8 @@ uint32_t sw8_top_get_state(void);
 uint32_t sw8_btm_get_state(void);
 uint32_t expsw_get_state(void);
 void get_switch_states(uint32_t *states);
+uint32_t switches_scan(uint32_t *changes);
+int switches_take_edge(switches_edge_sw_t sw, switches_edge_t *edge);
 void reset_sw_toggle_states(void);
 
 #endif /* SWITCHES_H */
@@ -213,8 +213,11 @@ typedef enum {
 
 
 
-/* Stuff that could be saved in a preset */
-extern NoteParamSet                 noteParamSets[];
+/* Stuff that could be saved in a preset. The scheduler and the notes read
+ * noteParamSets, the controls write noteParamSetsStaging, which becomes
+ * noteParamSets when synth_control_publish_param_sets is called each block. */
+extern NoteParamSet                 *noteParamSets;
+extern NoteParamSet                 *noteParamSetsStaging;
 extern SynthControlDeltaButtonMode  deltaButtonMode;
 extern SynthControlGainMode         gainMode;
 extern SynthControlRecMode          recMode;
@@ -230,6 +233,7 @@ void autorelease_on_done(MMEnvedSamplePlayer * esp);
 void synth_control_record_stop_helper(scrsh_source_t origin);
 void synth_control_record_start_helper(void);
 void synth_control_record_tog(void);
+void synth_control_set_record_edge(uint32_t sample);
 void synth_control_schedulerState_tog(void);
 void synth_control_presetStore_tog(void);
 void synth_control_presetRecall_tog(void);
@@ -276,6 +280,9 @@ void synth_control_set_editing_which_pitch(int _param);
 int synth_control_get_editing_which_pitch(void);
 void synth_control_pitch_reset_tog(void);
 void synth_control_reset_noteOnEventCounts(void);
+void synth_control_publish_param_sets(void);
+void synth_control_param_sets_write_begin(void);
+void synth_control_param_sets_write_end(void);
 void synth_control_set_posMode_onChange_curParams(SynthControlPosMode posMode_param,
                                         SynthControlPosMode *last_posMode_param);
 void synth_control_set_posMode_onChange(SynthControlPosMode posMode_param,
@@ -305,6 +312,9 @@ void synth_control_set_pitch_chrom_quant_curParams(float param);
 void synth_control_set_pitch_fine_quant(float param, 
                                         int which_pitch,
                                         int note_param_idx);
+void synth_control_set_pitch_fine(float param,
+                                  int which_pitch,
+                                  int note_param_idx);
 void synth_control_set_pitch_fine_curParams(float param);
 void synth_control_set_startPoint(float startPoint_param,
                                   int note_params_idx);
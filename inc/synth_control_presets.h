@@ -2,11 +2,17 @@
 
 #ifndef SYNTH_CONTROL_PRESETS_H
 #define SYNTH_CONTROL_PRESETS_H 
+#include <stdint.h> 
 
 #define NUM_SYNTH_CONTROL_PRESETS 3 
 #define SCP_FIRST_READ_KW 0x42069A55
 void sc_presets_init(int reset_request, int *midi_channel);
 void sc_presets_store(int npreset);
 void sc_presets_recall(int npreset);
+/* For sending the whole bank of presets over MIDI, see midi_bulk.h */
+uint32_t sc_presets_get_bank_size(void);
+int sc_presets_read_bank(uint32_t offset, void *dest, uint32_t len);
+int sc_presets_write_bank(uint32_t offset, const void *src, uint32_t len);
+int sc_presets_store_bank(void);
 
 #endif /* SYNTH_CONTROL_PRESETS_H */
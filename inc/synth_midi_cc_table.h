@@ -0,0 +1,405 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#ifndef SYNTH_MIDI_CC_TABLE_H
+#define SYNTH_MIDI_CC_TABLE_H 
+
+/* The MIDI control changes. Each is
+ * X(control change number, handler, note, pitch, description, notes)
+ * where note is the parameter set and pitch the index in its pitch table the
+ * handler changes, or -1 if it doesn't use them. The handlers are in
+ * synth_midi_control.c. This list is also used to make doc/midi_cc_table.txt,
+ * see doc/gen_midi_cc_table.c. */
+#define SYNTH_MIDI_CC_TABLE(X) \
+    X(0, synth_midi_cc_pitch_fine_control, 0, 0, \
+      "N1/BAR Pitch 1 control (fine)", \
+      "Adjust pitch of 1st, 4th, ... notes in arpeggio from -100 cents to " \
+      "+100 cents (hundreths of a semitone).") \
+    X(1, synth_midi_cc_pitch_fine_control, 0, 1, \
+      "N1/BAR Pitch 2 control (fine)", \
+      "Adjust pitch of 2nd, 5th, ... notes in arpeggio from -100 cents to " \
+      "+100 cents (hundreths of a semitone).") \
+    X(2, synth_midi_cc_pitch_fine_control, 0, 2, \
+      "N1/BAR Pitch 3 control (fine)", \
+      "Adjust pitch of 3rd, 6th, ... notes in arpeggio from -100 cents to " \
+      "+100 cents (hundreths of a semitone).") \
+    X(3, synth_midi_cc_env_control, 0, -1, \
+      "N1/BAR Envelope control", \
+      "Control the amplitude envelope of the notes just as the ENV knob " \
+      "does.") \
+    X(4, synth_midi_cc_sus_control, 0, -1, \
+      "N1/BAR Length control", \
+      "Control the length of the notes just as the LEN knob does.") \
+    X(5, synth_midi_cc_pitch_control, 0, 0, \
+      "N1/BAR Pitch 1 control", \
+      "Adjust pitch of 1st, 4th, ... notes in arpeggio according to the " \
+      "control change value. 60 is no transposition, 48 is an octave " \
+      "below, 72 an octave above, etc. Note that this is more range than " \
+      "is available on the physical interface.") \
+    X(6, synth_midi_cc_pitch_control, 0, 1, \
+      "N1/BAR Pitch 2 control", \
+      "Adjust pitch of 2nd, 5th, ... notes in arpeggio according to the " \
+      "control change value. 60 is no transposition, 48 is an octave " \
+      "below, 72 an octave above, etc. Note that this is more range than " \
+      "is available on the physical interface.") \
+    X(7, synth_midi_cc_pitch_control, 0, 2, \
+      "N1/BAR Pitch 3 control", \
+      "Adjust pitch of 3rd, 6th, ... notes in arpeggio according to the " \
+      "control change value. 60 is no transposition, 48 is an octave " \
+      "below, 72 an octave above, etc. Note that this is more range than " \
+      "is available on the physical interface.") \
+    X(8, synth_midi_cc_gain_control, 0, -1, \
+      "N1/BAR Gain control", \
+      "Control the gain just as the GAIN knob does with the " \
+      "FADE/GAIN/(FBK) switch in the middle position.") \
+    X(9, synth_midi_cc_pos_control, 0, -1, \
+      "N1/BAR Position control", \
+      "Adjust the position just as the POS knob does with the " \
+      "STRIDE/ABS/(UNI) switch in the middle position.") \
+    X(10, synth_midi_cc_stride_control, 0, -1, \
+      "N1/BAR Stride control", \
+      "Adjust the position advancement just as the POS knob does with the " \
+      "STRIDE/ABS/(UNI) switch in the upward position.") \
+    X(11, synth_midi_cc_offset_control, 0, -1, \
+      "N1/BAR Offset control", \
+      "Adjust the playback offset just as the OFST knob does.") \
+    X(12, synth_midi_cc_fbk_rate_control, 0, -1, \
+      "N1/BAR Fade control", \
+      "Adjust the fade just as the GAIN knob does with the " \
+      "FADE/GAIN/(FBK) switch in the upward position.") \
+    X(13, synth_midi_cc_event_delta_control, 0, -1, \
+      "N1/BAR Free &#x394; control", \
+      "Adjust the time between notes just as the &#x394; knob does with " \
+      "the FREE/QUANT/SKIP switch in the upward position. *") \
+    X(14, synth_midi_cc_num_reps_control, 0, -1, \
+      "N1/BAR Number of repeats control", \
+      "Adjust the number of repeats (the number of notes in the arpeggio) " \
+      "just as the TMPO/REP knob does. *") \
+    X(15, synth_midi_cc_stride_reset, 0, -1, \
+      "N1/BAR Stride state", \
+      "If non-zero (1-127), enables playback offset advancement, " \
+      "otherwise if 0, disable playback offset advancement. This cannot " \
+      "be in conflict with the STIDE/ABS/(UNI) switch. That means you " \
+      "cannot control this parameter over MIDI when the note whose " \
+      "parameters you are adjusting is selected with the N1/BAR/N2/N3 " \
+      "switch, in this case the N1/BAR note.") \
+    X(16, synth_midi_cc_interm_control, 0, -1, \
+      "N1/BAR skip control", \
+      "Control how often the arpeggio plays just like the &#x394; knob " \
+      "does with the FREE/QUANT/SKIP switch in the downward position.") \
+    X(17, synth_midi_cc_swing_control, 0, -1, \
+      "N1/BAR swing control", \
+      "Control the swing factor for the time between repeats of notes.") \
+    X(18, synth_midi_cc_pitch_fine_control, 1, 0, \
+      "N2 Pitch 1 control (fine)", \
+      "Adjust pitch of 1st, 4th, ... notes in arpeggio from -100 cents to " \
+      "+100 cents (hundreths of a semitone).") \
+    X(19, synth_midi_cc_pitch_fine_control, 1, 1, \
+      "N2 Pitch 2 control (fine)", \
+      "Adjust pitch of 2nd, 5th, ... notes in arpeggio from -100 cents to " \
+      "+100 cents (hundreths of a semitone).") \
+    X(20, synth_midi_cc_pitch_fine_control, 1, 2, \
+      "N2 Pitch 3 control (fine)", \
+      "Adjust pitch of 3rd, 6th, ... notes in arpeggio from -100 cents to " \
+      "+100 cents (hundreths of a semitone).") \
+    X(21, synth_midi_cc_env_control, 1, -1, \
+      "N2 Envelope control", \
+      "Control the amplitude envelope of the notes just as the ENV knob " \
+      "does.") \
+    X(22, synth_midi_cc_sus_control, 1, -1, \
+      "N2 Length control", \
+      "Control the length of the notes just as the LEN knob does.") \
+    X(23, synth_midi_cc_pitch_control, 1, 0, \
+      "N2 Pitch 1 control", \
+      "Adjust pitch of 1st, 4th, ... notes in arpeggio according to the " \
+      "control change value. 60 is no transposition, 48 is an octave " \
+      "below, 72 an octave above, etc. Note that this is more range than " \
+      "is available on the physical interface.") \
+    X(24, synth_midi_cc_pitch_control, 1, 1, \
+      "N2 Pitch 2 control", \
+      "Adjust pitch of 2nd, 5th, ... notes in arpeggio according to the " \
+      "control change value. 60 is no transposition, 48 is an octave " \
+      "below, 72 an octave above, etc. Note that this is more range than " \
+      "is available on the physical interface.") \
+    X(25, synth_midi_cc_pitch_control, 1, 2, \
+      "N2 Pitch 3 control", \
+      "Adjust pitch of 3rd, 6th, ... notes in arpeggio according to the " \
+      "control change value. 60 is no transposition, 48 is an octave " \
+      "below, 72 an octave above, etc. Note that this is more range than " \
+      "is available on the physical interface.") \
+    X(26, synth_midi_cc_gain_control, 1, -1, \
+      "N2 Gain control", \
+      "Control the gain just as the GAIN knob does with the " \
+      "FADE/GAIN/(FBK) switch in the middle position.") \
+    X(27, synth_midi_cc_pos_control, 1, -1, \
+      "N2 Position control", \
+      "Adjust the position just as the POS knob does with the " \
+      "STRIDE/ABS/(UNI) switch in the middle position.") \
+    X(28, synth_midi_cc_stride_control, 1, -1, \
+      "N2 Stride control", \
+      "Adjust the position advancement just as the POS knob does with the " \
+      "STRIDE/ABS/(UNI) switch in the upward position.") \
+    X(29, synth_midi_cc_offset_control, 1, -1, \
+      "N2 Offset control", \
+      "Adjust the playback offset just as the OFST knob does.") \
+    X(30, synth_midi_cc_fbk_rate_control, 1, -1, \
+      "N2 Fade control", \
+      "Adjust the fade just as the GAIN knob does with the " \
+      "FADE/GAIN/(FBK) switch in the upward position.") \
+    X(31, synth_midi_cc_event_delta_control, 1, -1, \
+      "N2 Free &#x394; control", \
+      "Adjust the time between notes just as the &#x394; knob does with " \
+      "the FREE/QUANT/SKIP switch in the upward position. *") \
+    X(32, synth_midi_cc_num_reps_control, 1, -1, \
+      "N2 Number of repeats control", \
+      "Adjust the number of repeats (the number of notes in the arpeggio) " \
+      "just as the TMPO/REP knob does. *") \
+    X(33, synth_midi_cc_stride_reset, 1, -1, \
+      "N2 Stride state", \
+      "If non-zero (1-127), enables playback offset advancement, " \
+      "otherwise if 0, disable playback offset advancement. This cannot " \
+      "be in conflict with the STIDE/ABS/(UNI) switch. That means you " \
+      "cannot control this parameter over MIDI when the note whose " \
+      "parameters you are adjusting is selected with the N1/BAR/N2/N3 " \
+      "switch, in this case the N1/BAR note.") \
+    X(34, synth_midi_cc_interm_control, 1, -1, \
+      "N2 skip control", \
+      "Control how often the arpeggio plays just like the &#x394; knob " \
+      "does with the FREE/QUANT/SKIP switch in the downward position.") \
+    X(35, synth_midi_cc_swing_control, 1, -1, \
+      "N2 swing control", \
+      "Control the swing factor for the time between repeats of notes.") \
+    X(36, synth_midi_cc_pitch_fine_control, 2, 0, \
+      "N3 Pitch 1 control (fine)", \
+      "Adjust pitch of 1st, 4th, ... notes in arpeggio from -100 cents to " \
+      "+100 cents (hundreths of a semitone).") \
+    X(37, synth_midi_cc_pitch_fine_control, 2, 1, \
+      "N3 Pitch 2 control (fine)", \
+      "Adjust pitch of 2nd, 5th, ... notes in arpeggio from -100 cents to " \
+      "+100 cents (hundreths of a semitone).") \
+    X(38, synth_midi_cc_pitch_fine_control, 2, 2, \
+      "N3 Pitch 3 control (fine)", \
+      "Adjust pitch of 3rd, 6th, ... notes in arpeggio from -100 cents to " \
+      "+100 cents (hundreths of a semitone).") \
+    X(39, synth_midi_cc_env_control, 2, -1, \
+      "N3 Envelope control", \
+      "Control the amplitude envelope of the notes just as the ENV knob " \
+      "does.") \
+    X(40, synth_midi_cc_sus_control, 2, -1, \
+      "N3 Length control", \
+      "Control the length of the notes just as the LEN knob does.") \
+    X(41, synth_midi_cc_pitch_control, 2, 0, \
+      "N3 Pitch 1 control", \
+      "Adjust pitch of 1st, 4th, ... notes in arpeggio according to the " \
+      "control change value. 60 is no transposition, 48 is an octave " \
+      "below, 72 an octave above, etc. Note that this is more range than " \
+      "is available on the physical interface.") \
+    X(42, synth_midi_cc_pitch_control, 2, 1, \
+      "N3 Pitch 2 control", \
+      "Adjust pitch of 2nd, 5th, ... notes in arpeggio according to the " \
+      "control change value. 60 is no transposition, 48 is an octave " \
+      "below, 72 an octave above, etc. Note that this is more range than " \
+      "is available on the physical interface.") \
+    X(43, synth_midi_cc_pitch_control, 2, 2, \
+      "N3 Pitch 3 control", \
+      "Adjust pitch of 3rd, 6th, ... notes in arpeggio according to the " \
+      "control change value. 60 is no transposition, 48 is an octave " \
+      "below, 72 an octave above, etc. Note that this is more range than " \
+      "is available on the physical interface.") \
+    X(44, synth_midi_cc_gain_control, 2, -1, \
+      "N3 Gain control", \
+      "Control the gain just as the GAIN knob does with the " \
+      "FADE/GAIN/(FBK) switch in the middle position.") \
+    X(45, synth_midi_cc_pos_control, 2, -1, \
+      "N3 Position control", \
+      "Adjust the position just as the POS knob does with the " \
+      "STRIDE/ABS/(UNI) switch in the middle position.") \
+    X(46, synth_midi_cc_stride_control, 2, -1, \
+      "N3 Stride control", \
+      "Adjust the position advancement just as the POS knob does with the " \
+      "STRIDE/ABS/(UNI) switch in the upward position.") \
+    X(47, synth_midi_cc_offset_control, 2, -1, \
+      "N3 Offset control", \
+      "Adjust the playback offset just as the OFST knob does.") \
+    X(48, synth_midi_cc_fbk_rate_control, 2, -1, \
+      "N3 Fade control", \
+      "Adjust the fade just as the GAIN knob does with the " \
+      "FADE/GAIN/(FBK) switch in the upward position.") \
+    X(49, synth_midi_cc_event_delta_control, 2, -1, \
+      "N3 Free &#x394; control", \
+      "Adjust the time between notes just as the &#x394; knob does with " \
+      "the FREE/QUANT/SKIP switch in the upward position. *") \
+    X(50, synth_midi_cc_num_reps_control, 2, -1, \
+      "N3 Number of repeats control", \
+      "Adjust the number of repeats (the number of notes in the arpeggio) " \
+      "just as the TMPO/REP knob does. *") \
+    X(51, synth_midi_cc_stride_reset, 2, -1, \
+      "N3 Stride state", \
+      "If non-zero (1-127), enables playback offset advancement, " \
+      "otherwise if 0, disable playback offset advancement. This cannot " \
+      "be in conflict with the STIDE/ABS/(UNI) switch. That means you " \
+      "cannot control this parameter over MIDI when the note whose " \
+      "parameters you are adjusting is selected with the N3/N2/N3 switch, " \
+      "in this case the N3 note.") \
+    X(52, synth_midi_cc_interm_control, 2, -1, \
+      "N3 skip control", \
+      "Control how often the arpeggio plays just like the &#x394; knob " \
+      "does with the FREE/QUANT/SKIP switch in the downward position.") \
+    X(53, synth_midi_cc_swing_control, 2, -1, \
+      "N3 swing control", \
+      "Control the swing factor for the time between repeats of notes.") \
+    X(54, synth_midi_cc_tempo_coarse_control, -1, -1, \
+      "Coarse tempo control", \
+      "Control how often the sequence plays in beats per minute (BPM) " \
+      "from 40 BPM to 240 BPM.") \
+    X(55, synth_midi_cc_tempo_fine_control, -1, -1, \
+      "Fine tempo control", \
+      "Control how often the sequence plays by adding to the current " \
+      "tempo -10 to +10 BPM.") \
+    X(56, synth_midi_cc_tempo_scale_control, -1, -1, \
+      "Tempo scaling", \
+      "Scale the tempo like the &#x394; knob with N1/BAR/N2/N3 in the " \
+      "upward position and FREE/QUANT/SKIP in the middle position.") \
+    X(57, synth_midi_cc_tempo_nudge_control, -1, -1, \
+      "Tempo nudge", \
+      "Slightly adjust the tempo like the TMPO/REP knob with N1/BAR/N2/N3 " \
+      "in the upward position and FREE/R=B/AREC in the middle position.") \
+    X(58, synth_midi_cc_preset_store_control, -1, -1, \
+      "Preset store", \
+      "Store the current settings in a specified register. The message " \
+      "value of 0 stores in the PRE1 register, a value of 1 stores in the " \
+      "PRE2 register and a value of 2 stores in the PRE3 register. If " \
+      "greater than 2, stores in the PRE3 register.") \
+    X(59, synth_midi_cc_preset_recall_control, -1, -1, \
+      "Preset recall", \
+      "Recall the current settings from a specified register. The message " \
+      "value of 0 recalls from the PRE1 register, a value of 1 recalls " \
+      "from the PRE2 register and a value of 2 recalls from the PRE3 " \
+      "register.  If greater than 2, recalls from the PRE3 register.") \
+    X(60, synth_midi_cc_rec_control, -1, -1, \
+      "Record enable/disable", \
+      "Start/stop recording. A message value of 0 stops recording. A " \
+      "message value greater than 0 starts or restarts recording " \
+      "depending on whether or not recording is already going on.") \
+    X(61, synth_midi_cc_play_control, -1, -1, \
+      "Play start", \
+      "Start/stop playback. A message value of 0 disables all playback. A " \
+      "message value greater than 0 starts playback. If playback is " \
+      "already going on it will start a new set of notes along side the " \
+      "already playing set.") \
+    X(62, synth_midi_cc_rec_mode_control, -1, -1, \
+      "Record mode", \
+      "Sets the record mode just like the FREE/R=B/AREC switch. A message " \
+      "value of 0 sets the FREE record mode, a value of 1 sets the R=B " \
+      "mode and a value of 2 sets the AREC mode. A value greater than 2 " \
+      "sets the AREC mode.") \
+    X(63, synth_midi_cc_fbk_state_control, -1, -1, \
+      "Feedback state", \
+      "Sets the feedback state just like the bottom position of the " \
+      "FADE/GAIN/(FBK) switch. A non-zero value turns feedback on, a zero " \
+      "value turns it off. Note feedback is disabled (cannot be turned " \
+      "on) in AREC mode.") \
+    X(64, synth_midi_cc_note_stride_control, 0, -1, \
+      "N1/BAR Note stride", \
+      "Adjust how far the starting position of the note moves each time " \
+      "the sequence starts it again.") \
+    X(65, synth_midi_cc_note_stride_control, 1, -1, \
+      "N2 Note stride", \
+      "Adjust how far the starting position of the note moves each time " \
+      "the sequence starts it again.") \
+    X(66, synth_midi_cc_note_stride_control, 2, -1, \
+      "N3 Note stride", \
+      "Adjust how far the starting position of the note moves each time " \
+      "the sequence starts it again.") \
+    X(67, synth_midi_cc_recording_save_control, -1, -1, \
+      "Recording save", \
+      "Save the sound being played so it is played again after the power " \
+      "is turned off and on. Any message value starts saving, which takes " \
+      "a few seconds and doesn't interrupt the audio.") \
+    X(68, synth_midi_cc_telemetry_control, -1, -1, \
+      "Telemetry", \
+      "If non-zero (1-127), send a system exclusive message saying how " \
+      "loaded the processor is every 250 ms, otherwise if 0, stop " \
+      "sending them. Decode them with scripts/telemetry_decode.py.") \
+    X(69, synth_midi_cc_clock_out_control, -1, -1, \
+      "MIDI clock out", \
+      "If non-zero (1-127), send MIDI clock at the tempo of the sequencer " \
+      "and start and stop when it is turned on and off, otherwise if 0, " \
+      "stop sending them. Nothing is sent while following MIDI clock.") \
+    X(70, synth_midi_cc_thru_control, -1, -1, \
+      "MIDI thru", \
+      "If non-zero (1-127), send the messages received out again, mixed " \
+      "in with the clock, otherwise if 0, don't. System exclusive " \
+      "messages aren't sent, nor are clock, start and stop received while " \
+      "MIDI clock out is on.")
+
+/* The high resolution controls, set by NRPN (non-registered parameter number)
+ * messages. Each is
+ * X(parameter number, handler, note, pitch, description, notes)
+ * like above. The parameter number of each is the control change number of the
+ * control it is a finer version of. The handler is passed the 14-bit value. */
+#define SYNTH_MIDI_NRPN_TABLE(X) \
+    X(0, synth_midi_nrpn_pitch_fine_control, 0, 0, \
+      "N1/BAR Pitch 1 control (fine)", \
+      "Like control change 0 in steps of about 0.006 cents.") \
+    X(1, synth_midi_nrpn_pitch_fine_control, 0, 1, \
+      "N1/BAR Pitch 2 control (fine)", \
+      "Like control change 1 in steps of about 0.006 cents.") \
+    X(2, synth_midi_nrpn_pitch_fine_control, 0, 2, \
+      "N1/BAR Pitch 3 control (fine)", \
+      "Like control change 2 in steps of about 0.006 cents.") \
+    X(9, synth_midi_nrpn_pos_control, 0, -1, \
+      "N1/BAR Position control", \
+      "Like control change 9 in 16384 steps.") \
+    X(10, synth_midi_nrpn_stride_control, 0, -1, \
+      "N1/BAR Stride control", \
+      "Like control change 10 in 16384 steps, 8192 is no stride.") \
+    X(18, synth_midi_nrpn_pitch_fine_control, 1, 0, \
+      "N2 Pitch 1 control (fine)", \
+      "Like control change 18 in steps of about 0.006 cents.") \
+    X(19, synth_midi_nrpn_pitch_fine_control, 1, 1, \
+      "N2 Pitch 2 control (fine)", \
+      "Like control change 19 in steps of about 0.006 cents.") \
+    X(20, synth_midi_nrpn_pitch_fine_control, 1, 2, \
+      "N2 Pitch 3 control (fine)", \
+      "Like control change 20 in steps of about 0.006 cents.") \
+    X(27, synth_midi_nrpn_pos_control, 1, -1, \
+      "N2 Position control", \
+      "Like control change 27 in 16384 steps.") \
+    X(28, synth_midi_nrpn_stride_control, 1, -1, \
+      "N2 Stride control", \
+      "Like control change 28 in 16384 steps, 8192 is no stride.") \
+    X(36, synth_midi_nrpn_pitch_fine_control, 2, 0, \
+      "N3 Pitch 1 control (fine)", \
+      "Like control change 36 in steps of about 0.006 cents.") \
+    X(37, synth_midi_nrpn_pitch_fine_control, 2, 1, \
+      "N3 Pitch 2 control (fine)", \
+      "Like control change 37 in steps of about 0.006 cents.") \
+    X(38, synth_midi_nrpn_pitch_fine_control, 2, 2, \
+      "N3 Pitch 3 control (fine)", \
+      "Like control change 38 in steps of about 0.006 cents.") \
+    X(45, synth_midi_nrpn_pos_control, 2, -1, \
+      "N3 Position control", \
+      "Like control change 45 in 16384 steps.") \
+    X(46, synth_midi_nrpn_stride_control, 2, -1, \
+      "N3 Stride control", \
+      "Like control change 46 in 16384 steps, 8192 is no stride.") \
+    X(54, synth_midi_nrpn_tempo_coarse_control, -1, -1, \
+      "Coarse tempo control", \
+      "Like control change 54 in 16384 steps.") \
+    X(55, synth_midi_nrpn_tempo_fine_control, -1, -1, \
+      "Fine tempo control", \
+      "Like control change 55 in 16384 steps, 8192 adds nothing.") \
+    X(57, synth_midi_nrpn_tempo_nudge_control, -1, -1, \
+      "Tempo nudge", \
+      "Like control change 57 in 16384 steps.") \
+    X(64, synth_midi_nrpn_note_stride_control, 0, -1, \
+      "N1/BAR Note stride", \
+      "Like control change 64 in 16384 steps, 8192 is no stride.") \
+    X(65, synth_midi_nrpn_note_stride_control, 1, -1, \
+      "N2 Note stride", \
+      "Like control change 65 in 16384 steps, 8192 is no stride.") \
+    X(66, synth_midi_nrpn_note_stride_control, 2, -1, \
+      "N3 Note stride", \
+      "Like control change 66 in 16384 steps, 8192 is no stride.")
+
+#endif /* SYNTH_MIDI_CC_TABLE_H */
@@ -14,12 +14,42 @@
                                 * NUM_NOTE_PARAM_SETS \
                                 + SYNTH_MIDI_NUM_GLOBAL_PARAMS
 
+/* The number of control change numbers */
+#define SYNTH_MIDI_NUM_CCS 128 
+
+/* What a control change calls, see synth_midi_cc_table.h. The handler is
+ * passed its entry as the data argument. */
+typedef struct {
+    void (*func)(void*,MIDIMsg*);
+    int note;
+    int pitch;
+} synth_midi_cc_entry_t;
+
+/* Control changes selecting a non-registered or registered parameter and
+ * entering its value */
+#define SYNTH_MIDI_CC_DATA_ENTRY_MSB 6 
+#define SYNTH_MIDI_CC_DATA_ENTRY_LSB 38 
+#define SYNTH_MIDI_CC_NRPN_LSB 98 
+#define SYNTH_MIDI_CC_NRPN_MSB 99 
+#define SYNTH_MIDI_CC_RPN_LSB 100 
+#define SYNTH_MIDI_CC_RPN_MSB 101 
+/* The parameter number that deselects the parameter */
+#define SYNTH_MIDI_NRPN_NULL 0x3fff 
+
+/* What a high resolution control calls, see synth_midi_cc_table.h */
+typedef struct {
+    uint32_t nrpn;
+    void (*func)(void*,uint32_t);
+    int note;
+    int pitch;
+} synth_midi_nrpn_entry_t;
+
 void synth_midi_control_setup(int midi_channel);
+int synth_midi_control_handle_cc(MIDIMsg *msg);
+void synth_midi_control_apply_nrpns(void);
 
-/* For debugging */
-typedef struct synth_midi_control_params_t synth_midi_control_params_t;
-const synth_midi_control_params_t ** synth_midi_control_get_midi_cc_controls();
-synth_midi_control_params_t * synth_midi_control_get_p_midi_contols_end();
+/* For debugging, the table indexed by control change number */
+const synth_midi_cc_entry_t * synth_midi_control_get_midi_cc_controls(void);
 
 
 #endif /* SYNTH_MIDI_CONTROL_H */
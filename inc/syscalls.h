@@ -0,0 +1,10 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#ifndef SYSCALLS_H
+#define SYSCALLS_H
+
+#include <stdint.h>
+
+uint32_t syscalls_get_heap_used(void);
+
+#endif /* SYSCALLS_H */
@@ -0,0 +1,58 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+
+/* Sends how loaded the audio interrupt is in a TELEMETRY system exclusive
+ * message (see midi_sysex.h) every TELEMETRY_PERIOD_MS while turned on with
+ * control change 68. The audio interrupt only keeps some counts, the message
+ * is made and queued by telemetry_poll from the main loop and sent by the
+ * DMA. Decode it with scripts/telemetry_decode.py.
+ *
+ * The payload, before packing into 7-bit bytes, is (little-endian):
+ *
+ * version (1), load governor level (1), block number (4),
+ * cycles of the shortest, average and longest block (4 each),
+ * cycles in a block period (4),
+ * busy voices now and at most (2 each),
+ * pending scheduler events now and at most (2 each),
+ * heap and stack high-water marks in bytes (4 each),
+ * deadline misses so far (4),
+ * times between MIDI clocks measured, the shortest and longest of them in
+ * microseconds (2, 4, 4)
+ *
+ * The counts that are "at most" are over the blocks since the last message.
+ * */
+
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_PERIOD_MS 250
+#define TELEMETRY_PAYLOAD_SIZE 52
+
+typedef struct {
+    uint32_t block;
+    uint32_t cycles_min;
+    uint32_t cycles_avg;
+    uint32_t cycles_max;
+    uint32_t block_period;
+    uint16_t voices;
+    uint16_t voices_max;
+    uint16_t sched_events;
+    uint16_t sched_events_max;
+    uint32_t midi_clocks;
+    uint32_t midi_clock_min;
+    uint32_t midi_clock_max;
+} telemetry_frame_t;
+
+void telemetry_stack_paint(void);
+void telemetry_setup(void);
+void telemetry_set_enabled(int enabled);
+void telemetry_end_block(uint32_t block,
+                         uint32_t cycles,
+                         uint32_t block_period);
+void telemetry_midi_clock(uint32_t time);
+void telemetry_poll(void);
+uint32_t telemetry_get_stack_used(void);
+
+#endif /* TELEMETRY_H */
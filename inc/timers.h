@@ -4,20 +4,38 @@
 #define TIMERS_H 
 #include <stdint.h> 
 
+/* Define to have TIM7 interrupt only when the next event times out rather
+ * than every tick. */
+//#define TIMERS_TICKLESS
+
+/* Timer counts per tick when tickless (TIM7 counts at 10KHz) */
+#define TIMERS_TICKLESS_COUNTS_PER_TICK 10
+/* The longest TIM7 is programmed to wait when tickless, in ticks. Must fit in
+ * its 16-bit auto-reload register. */
+#define TIMERS_TICKLESS_MAX_TICKS 6000
+
 typedef struct __timer_event_t timer_event_t;
 
 struct __timer_event_t {
-    /* the next event in the list of events */
+    /* the next event in the list of events, used by the timer interrupt */
     timer_event_t *next;
-    /* is event active ? */
+    /* the next event waiting to be put in the list */
+    timer_event_t *add_next;
+    /* is event active ? Set to 0 to cancel it. */
     uint32_t active;
-    /* The number of ticks remaining before timeout. See timers.c for period of
-     * one tick. */
+    /* The number of ticks from timer_events_add_event before timeout. See
+     * timers.c for period of one tick. */
     uint32_t time_rem;
     /* What should happen on timeout */
     void (*on_timeout)(timer_event_t*);
     /* Stuff that can be used on timeout */
     void *data;
+    /* Ticks after the previous event in the list that this one times out */
+    uint32_t delta;
+    /* Non-zero if in the list */
+    uint32_t queued;
+    /* Non-zero if waiting to be put in the list */
+    volatile uint32_t add_pending;
 };
 
 void timers_setup(void);
@@ -27,6 +45,4 @@ void timer_events_add_event(timer_event_t *ev);
 void timer_event_init(timer_event_t *ev);
 int timers_get_state(void);
 
-#define TIMER_EVENT_TIMED_OUT(ev) ((ev)->time_rem == 0) 
-
 #endif /* TIMERS_H */
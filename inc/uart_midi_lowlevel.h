@@ -20,6 +20,23 @@
 #define MIDI_BUF_SIZE ((uint32_t)(2 * (MIDI_BAUD_RATE / 1000 / 8 + 1) *\
             MIDI_TIMER_PERIOD_MS))
 
+/* Number of receive timestamps that can be waiting, must be a power of 2 */
+#define MIDI_RX_MARKS 16 
+
+/* Size of the transmit queue, must be a power of 2 */
+#define MIDI_TX_BUF_SIZE 512 
+/* The most bytes the DMA sends at once. A real-time message waits for at
+ * most this many bytes (320us each) to be sent before it goes. */
+#define MIDI_TX_MAX_RUN 4 
+
+/* The real-time messages that can go ahead of the transmit queue, see
+ * midi_hw_send_realtime */
+#define MIDI_HW_RT_CLOCK    0xf8
+#define MIDI_HW_RT_START    0xfa
+#define MIDI_HW_RT_CONTINUE 0xfb
+#define MIDI_HW_RT_STOP     0xfc
+#define MIDI_HW_NUM_RT      4
+
 typedef int midi_hw_err_t;
 
 typedef int midi_hw_process_t;
@@ -31,4 +48,32 @@ typedef midi_hw_setup_t midi_hw_cleanup_t;
 
 #include "midi_hw.h" 
 
+/* A message being written into the transmit queue */
+typedef struct {
+    uint32_t pos;
+    uint32_t end;
+} midi_hw_tx_t;
+
+typedef struct {
+    /* Cycles the last real-time message waited to be sent and the most any
+     * has waited */
+    uint32_t rt_wait_cycles;
+    uint32_t rt_wait_cycles_max;
+    /* Real-time messages not sent because the last one of the same kind
+     * hadn't been sent yet */
+    uint32_t rt_dropped;
+} midi_hw_tx_stats_t;
+
+extern midi_hw_tx_stats_t midi_hw_tx_stats;
+
+int midi_hw_tx_begin(midi_hw_tx_t *tx, uint32_t n);
+void midi_hw_tx_put(midi_hw_tx_t *tx, char byte);
+void midi_hw_tx_end(midi_hw_tx_t *tx);
+int midi_hw_send_bytes(const char *bytes, int n);
+int midi_hw_send_realtime(char byte);
+int midi_hw_get_tx_space(void);
+uint32_t midi_hw_get_tx_wait_cycles(void);
+uint32_t midi_hw_get_msg_offset(void);
+uint32_t midi_hw_get_msg_time(void);
+
 #endif /* UART_MIDI_LOWLEVEL_H */
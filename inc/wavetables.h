@@ -25,6 +25,9 @@ extern size_t       hannWindowTableLength;
 extern size_t       zeroxSearchMaxLength;
 
 void SampleTable_init(void);
+void SampleTable_zero_start(void);
+void SampleTable_zero_stop(void);
+int SampleTable_zeroing(MMWavTab *table);
 void HannWindowTable_init(MMSample len_sec);
 void ZeroxSearch_init(MMSample len_sec);
 
@@ -0,0 +1,53 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#ifndef XRUN_HISTORY_H
+#define XRUN_HISTORY_H
+
+#include <stdint.h>
+
+/* Keeps the last few times the audio interrupt missed its deadline along with
+ * what was going on at the time. Look at it in gdb with
+ * source scripts/xrun_history.gdb
+ * print_xrun_history
+ * or request it with the XRUN_HISTORY_REQUEST system exclusive message. */
+
+/* Number of entries kept, must be a power of 2 */
+#define XRUN_HISTORY_SIZE 16
+
+/* The audio interrupt took longer than one block period */
+#define XRUN_FLAG_DEADLINE      0x01
+/* The DMA got to the half of the buffer that was being processed */
+#define XRUN_FLAG_DMA_UNDERRUN  0x02
+/* audio_hw_io was entered again before it returned */
+#define XRUN_FLAG_REENTERED     0x04
+/* A flash erase or write was requested or in progress */
+#define XRUN_FLAG_FLASH_BUSY    0x08
+/* The codec was resynchronized after a frame error during this block */
+#define XRUN_FLAG_CODEC_RESYNC  0x10
+/* Flags that mean a deadline was missed (the others are context) */
+#define XRUN_FLAG_MISSES (XRUN_FLAG_DEADLINE \
+        | XRUN_FLAG_DMA_UNDERRUN \
+        | XRUN_FLAG_REENTERED)
+
+/* This is also the layout of each entry in the system exclusive reply,
+ * little-endian, after a 4-byte total count. */
+typedef struct {
+    /* the number of the block in which it happened */
+    uint32_t block;
+    /* cycles audio_hw_io took that block */
+    uint32_t isr_cycles;
+    uint16_t active_voices;
+    uint16_t sched_events;
+    uint32_t flags;
+} xrun_history_entry_t;
+
+void xrun_history_setup(void);
+void xrun_history_end_block(uint32_t block,
+                            uint32_t isr_cycles,
+                            uint32_t block_period,
+                            uint32_t flags);
+uint32_t xrun_history_get_count(void);
+int xrun_history_get(uint32_t n_back, xrun_history_entry_t *entry);
+void xrun_history_clear(void);
+
+#endif /* XRUN_HISTORY_H */
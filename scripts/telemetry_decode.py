@@ -0,0 +1,81 @@
+# Decode the telemetry system exclusive messages sent when control change 68
+# is turned on (see inc/telemetry.h). Reads the hex dump printed by amidi, e.g.
+#
+# send_midi_cc 68 127
+# amidi -p $MIDIDEV -d | python3 scripts/telemetry_decode.py
+#
+# and prints a line per message.
+
+import struct
+import sys
+
+SYSEX_START=0xf0
+SYSEX_END=0xf7
+MANUFACTURER_ID=0x7d
+DEVICE_ID=0x56
+CMD_TELEMETRY=0x08
+TELEMETRY_VERSION=1
+# See the payload in inc/telemetry.h
+TELEMETRY_FORMAT='<BBIIIIIHHHHIIIHII'
+TELEMETRY_FIELDS=['version','level','block','cycles_min','cycles_avg',
+    'cycles_max','block_period','voices','voices_max','sched_events',
+    'sched_events_max','heap','stack','xruns','midi_clocks','midi_clock_min',
+    'midi_clock_max']
+LEVELS=['FULL','LINEAR_INTERP','FEWER_VOICES','NO_FEEDBACK']
+
+def unpack7(data):
+    """ Undo midi_sysex_pack7 """
+    out=bytearray()
+    for n in range(0,len(data),8):
+        msbs=data[n]
+        for m,b in enumerate(data[n+1:n+8]):
+            out.append(b | (((msbs >> m) & 1) << 7))
+    return bytes(out)
+
+def messages(f):
+    """ Yield the payload of each telemetry message in the hex dump read from
+    f """
+    msg=None
+    for line in f:
+        for tok in line.split():
+            try:
+                b=int(tok,16)
+            except ValueError:
+                continue
+            if b == SYSEX_START:
+                msg=[]
+            elif b == SYSEX_END:
+                if ((msg is not None) and (len(msg) > 3)
+                        and (msg[:3] == [MANUFACTURER_ID,DEVICE_ID,
+                            CMD_TELEMETRY])):
+                    yield unpack7(bytes(msg[3:]))
+                msg=None
+            elif msg is not None:
+                msg.append(b)
+
+def pct(cycles,period):
+    return 100.*cycles/period if period else 0.
+
+size=struct.calcsize(TELEMETRY_FORMAT)
+for payload in messages(sys.stdin):
+    if len(payload) < size:
+        print('short message (%d bytes)' % (len(payload),))
+        continue
+    t=dict(zip(TELEMETRY_FIELDS,struct.unpack(TELEMETRY_FORMAT,payload[:size])))
+    if t['version'] != TELEMETRY_VERSION:
+        print('unknown version %d' % (t['version'],))
+        continue
+    s=('block %d load min/avg/max %.1f/%.1f/%.1f%% %s voices %d (max %d) '
+        'events %d (max %d) heap %d stack %d xruns %d') % (
+        t['block'],
+        pct(t['cycles_min'],t['block_period']),
+        pct(t['cycles_avg'],t['block_period']),
+        pct(t['cycles_max'],t['block_period']),
+        LEVELS[t['level']] if t['level'] < len(LEVELS) else str(t['level']),
+        t['voices'],t['voices_max'],t['sched_events'],t['sched_events_max'],
+        t['heap'],t['stack'],t['xruns'])
+    if t['midi_clocks']:
+        s+=' clock %d-%d us (jitter %d us)' % (t['midi_clock_min'],
+            t['midi_clock_max'],t['midi_clock_max']-t['midi_clock_min'])
+    print(s)
+    sys.stdout.flush()
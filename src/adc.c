@@ -8,8 +8,17 @@ static volatile uint16_t adc3_values[ADC3_DMA_NUM_VALS_TRANS];
 /* Stores the address of the first datum converted on the ADC channels */
 uint16_t volatile *adc_data_starts[TOTAL_NUM_ADC_CHANNELS];
 uint32_t adc_raw_value_strides[TOTAL_NUM_ADC_CHANNELS];
+/* Number of scans written by the DMA for each ADC */
+static volatile uint32_t adc1_scan_count = 0;
+static volatile uint32_t adc3_scan_count = 0;
+uint32_t volatile *adc_scan_counts[TOTAL_NUM_ADC_CHANNELS];
 /* Flag indicating whether ADC values are good to read. */
 static volatile uint32_t adc_ready_flg = 0;
+static adc_mode_t adc_mode = adc_mode_1SHOT;
+/* Set once the trigger timer has been started in adc_mode_TIM */
+static int adc_tim_running = 0;
+/* Number of times an ADC overran and its DMA had to be restarted */
+volatile uint32_t adc_n_overruns = 0;
 
 /* Set up the ADC. See the mode enumeration to see the meanings of the different
  * modes.
@@ -36,17 +45,30 @@ static volatile uint32_t adc_ready_flg = 0;
  *   completed, a flag is set which the application can check to see if new
  *   values are available. When the application wants new values, if must call
  *   adc_start_conversion() again.
+ * If in timer triggered mode:
+ * - TIM2 triggers one scan of each ADC at ADC_SCAN_RATE. As every scan is
+ *   started by the hardware from the first channel in the sequence, the DMA
+ *   cannot become misaligned as described above.
+ * - The DMA is in circular mode and the DDS bit is set. Interrupts at the half
+ *   and end of the memory space count the scans written (see adc_scan_counts)
+ *   and set the ready flag.
+ * - adc_start_conversion() starts the timer the first time it is called and
+ *   does nothing after that, so the ADCs are never touched while running.
  */
 void __attribute__((optimize("O0"))) adc_setup_dma_scan(adc_mode_t mode)
 {
     /* Clear data buffers */
     uint32_t _n;
+    adc_mode = mode;
+    adc_tim_running = 0;
     for (_n = 0; _n < ADC1_DMA_NUM_VALS_TRANS; _n++) {
         adc1_values[_n] = 0;
     }
     for (_n = 0; _n < ADC3_DMA_NUM_VALS_TRANS; _n++) {
         adc3_values[_n] = 0;
     }
+    adc1_scan_count = 0;
+    adc3_scan_count = 0;
 
     /* Enable ADC 1 and 3 Clock */
     RCC->APB2ENR |= RCC_APB2ENR_ADC3EN | RCC_APB2ENR_ADC1EN;
@@ -71,6 +93,7 @@ void __attribute__((optimize("O0"))) adc_setup_dma_scan(adc_mode_t mode)
     ADC1->SQR3 |= 6 << (0*5);
     /* First datum of this ADC goes at... */
     adc_data_starts[0] = &adc1_values[0];
+    adc_scan_counts[0] = &adc1_scan_count;
 #if defined(BOARD_V1)
     adc_raw_value_strides[0] = NUM_CHANNELS_PER_ADC;
 #elif defined(BOARD_V2)
@@ -87,6 +110,7 @@ void __attribute__((optimize("O0"))) adc_setup_dma_scan(adc_mode_t mode)
     ADC1->SQR3 &= ~ADC_SQR3_SQ2;
     ADC1->SQR3 |= 4 << (1*5);
     adc_data_starts[1] = &adc1_values[1];
+    adc_scan_counts[1] = &adc1_scan_count;
 #if defined(BOARD_V1)
     adc_raw_value_strides[1] = NUM_CHANNELS_PER_ADC;
 #elif defined(BOARD_V2)
@@ -103,6 +127,7 @@ void __attribute__((optimize("O0"))) adc_setup_dma_scan(adc_mode_t mode)
     ADC1->SQR3 &= ~ADC_SQR3_SQ3;
     ADC1->SQR3 |= 5 << (2*5);
     adc_data_starts[2] = &adc1_values[2];
+    adc_scan_counts[2] = &adc1_scan_count;
 #if defined(BOARD_V1)
     adc_raw_value_strides[2] = NUM_CHANNELS_PER_ADC;
 #elif defined(BOARD_V2)
@@ -119,6 +144,7 @@ void __attribute__((optimize("O0"))) adc_setup_dma_scan(adc_mode_t mode)
     ADC1->SQR3 &= ~ADC_SQR3_SQ4;
     ADC1->SQR3 |= 3 << (3*5);
     adc_data_starts[3] = &adc1_values[3];
+    adc_scan_counts[3] = &adc1_scan_count;
 #if defined(BOARD_V1)
     adc_raw_value_strides[3] = NUM_CHANNELS_PER_ADC;
 #elif defined(BOARD_V2)
@@ -146,6 +172,7 @@ void __attribute__((optimize("O0"))) adc_setup_dma_scan(adc_mode_t mode)
     ADC3->SQR3 &= ~ADC_SQR3_SQ1;
     ADC3->SQR3 |= 12 << (0*5);
     adc_data_starts[4] = &adc3_values[0];
+    adc_scan_counts[4] = &adc3_scan_count;
 #if defined(BOARD_V1)
     adc_raw_value_strides[4] = NUM_CHANNELS_PER_ADC;
 #elif defined(BOARD_V2)
@@ -162,6 +189,7 @@ void __attribute__((optimize("O0"))) adc_setup_dma_scan(adc_mode_t mode)
     ADC3->SQR3 &= ~ADC_SQR3_SQ2;
     ADC3->SQR3 |= 13 << (1*5);
     adc_data_starts[5] = &adc3_values[1];
+    adc_scan_counts[5] = &adc3_scan_count;
 #if defined(BOARD_V1)
     adc_raw_value_strides[5] = NUM_CHANNELS_PER_ADC;
 #elif defined(BOARD_V2)
@@ -179,6 +207,7 @@ void __attribute__((optimize("O0"))) adc_setup_dma_scan(adc_mode_t mode)
     ADC3->SQR3 &= ~ADC_SQR3_SQ3;
     ADC3->SQR3 |= 8 << (2*5);
     adc_data_starts[6] = &adc3_values[2];
+    adc_scan_counts[6] = &adc3_scan_count;
 #if defined(BOARD_V1)
     adc_raw_value_strides[6] = NUM_CHANNELS_PER_ADC;
 #elif defined(BOARD_V2)
@@ -195,6 +224,7 @@ void __attribute__((optimize("O0"))) adc_setup_dma_scan(adc_mode_t mode)
     ADC3->SQR3 &= ~ADC_SQR3_SQ4;
     ADC3->SQR3 |= 4 << (3*5);
     adc_data_starts[7] = &adc3_values[3];
+    adc_scan_counts[7] = &adc3_scan_count;
 #if defined(BOARD_V1)
     adc_raw_value_strides[7] = NUM_CHANNELS_PER_ADC;
 #elif defined(BOARD_V2)
@@ -212,6 +242,7 @@ void __attribute__((optimize("O0"))) adc_setup_dma_scan(adc_mode_t mode)
     ADC3->SQR3 &= ~ADC_SQR3_SQ5;
     ADC3->SQR3 |= 5 << (4*5);
     adc_data_starts[8] = &adc3_values[4];
+    adc_scan_counts[8] = &adc3_scan_count;
     adc_raw_value_strides[8] = NUM_CHANNELS_ADC3;
 #endif
 
@@ -219,8 +250,17 @@ void __attribute__((optimize("O0"))) adc_setup_dma_scan(adc_mode_t mode)
     /* ADC 1 */
     /* Don't set end of conversion flag after every conversion */
     ADC1->CR2 &= ~ADC_CR2_EOCS;
-    /* Set continuous conversion */
-    ADC1->CR2 |= ADC_CR2_CONT;
+    if (mode == adc_mode_TIM) {
+        /* One scan per rising edge of TIM2's TRGO */
+        ADC1->CR2 &= ~(ADC_CR2_CONT | ADC_CR2_EXTEN | ADC_CR2_EXTSEL);
+        ADC1->CR2 |= (0x1 << 28) | (0x6 << 24);
+        ADC1->CR2 |= ADC_CR2_DDS;
+        /* Interrupt on overrun so the DMA can be restarted */
+        ADC1->CR1 |= ADC_CR1_OVRIE;
+    } else {
+        /* Set continuous conversion */
+        ADC1->CR2 |= ADC_CR2_CONT;
+    }
     if (mode == adc_mode_CONT) {
         /* Continue requesting DMA as long as DMA enabled */
         ADC1->CR2 |= ADC_CR2_DDS;
@@ -235,8 +275,17 @@ void __attribute__((optimize("O0"))) adc_setup_dma_scan(adc_mode_t mode)
     /* ADC 3 */
     /* Don't set end of conversion flag after every conversion */
     ADC3->CR2 &= ~ADC_CR2_EOCS;
-    /* Set continuous conversion */
-    ADC3->CR2 |= ADC_CR2_CONT;
+    if (mode == adc_mode_TIM) {
+        /* One scan per rising edge of TIM2's TRGO */
+        ADC3->CR2 &= ~(ADC_CR2_CONT | ADC_CR2_EXTEN | ADC_CR2_EXTSEL);
+        ADC3->CR2 |= (0x1 << 28) | (0x6 << 24);
+        ADC3->CR2 |= ADC_CR2_DDS;
+        /* Interrupt on overrun so the DMA can be restarted */
+        ADC3->CR1 |= ADC_CR1_OVRIE;
+    } else {
+        /* Set continuous conversion */
+        ADC3->CR2 |= ADC_CR2_CONT;
+    }
     if (mode == adc_mode_CONT) {
         /* Continue requesting DMA as long as DMA enabled */
         ADC3->CR2 |= ADC_CR2_DDS;
@@ -266,10 +315,14 @@ void __attribute__((optimize("O0"))) adc_setup_dma_scan(adc_mode_t mode)
     tmpreg |= (0x1 << 13);
     tmpreg |= (0x1 << 11);
     tmpreg |= (0x1 << 10);
-    if (mode == adc_mode_CONT) {
+    if ((mode == adc_mode_CONT) || (mode == adc_mode_TIM)) {
      /* circular mode */
         tmpreg |= (0x1 << 8);
     }
+    if (mode == adc_mode_TIM) {
+        /* half transfer interrupt enable */
+        tmpreg |= (0x1 << 3);
+    }
     tmpreg |= (0x1 << 4);
     DMA2_Stream4->CR = tmpreg;
 
@@ -280,7 +333,7 @@ void __attribute__((optimize("O0"))) adc_setup_dma_scan(adc_mode_t mode)
     /* Set number of items to transfer */
     DMA2_Stream4->NDTR = ADC1_DMA_NUM_VALS_TRANS;
 
-    if (mode == adc_mode_1SHOT) {
+    if ((mode == adc_mode_1SHOT) || (mode == adc_mode_TIM)) {
         /* Enable DMA2_Stream4 interrupt */
         NVIC_EnableIRQ(DMA2_Stream4_IRQn);
     }
@@ -307,10 +360,14 @@ void __attribute__((optimize("O0"))) adc_setup_dma_scan(adc_mode_t mode)
     tmpreg |= (0x1 << 13);
     tmpreg |= (0x1 << 11);
     tmpreg |= (0x1 << 10);
-    if (mode == adc_mode_CONT) {
+    if ((mode == adc_mode_CONT) || (mode == adc_mode_TIM)) {
      /* circular mode */
         tmpreg |= (0x1 << 8);
     }
+    if (mode == adc_mode_TIM) {
+        /* half transfer interrupt enable */
+        tmpreg |= (0x1 << 3);
+    }
     tmpreg |= (0x1 << 4);
     DMA2_Stream0->CR = tmpreg;
     /* Set peripheral address to ADC3's data register */
@@ -320,7 +377,7 @@ void __attribute__((optimize("O0"))) adc_setup_dma_scan(adc_mode_t mode)
     /* Set number of items to transfer */
     DMA2_Stream0->NDTR = ADC3_DMA_NUM_VALS_TRANS;
     
-    if (mode == adc_mode_1SHOT) {
+    if ((mode == adc_mode_1SHOT) || (mode == adc_mode_TIM)) {
         /* Enable DMA2_Stream0 interrupt */
         NVIC_EnableIRQ(DMA2_Stream0_IRQn);
     }
@@ -332,6 +389,18 @@ void __attribute__((optimize("O0"))) adc_setup_dma_scan(adc_mode_t mode)
         /* Start conversion */
         ADC3->CR2 |= ADC_CR2_SWSTART;
     }
+
+    if (mode == adc_mode_TIM) {
+        /* TIM2 counts at 90MHz (APB1 clock of 45MHz and a timer prescalar of
+         * 2, see timers.c) and updates at ADC_SCAN_RATE */
+        RCC->APB1ENR |= RCC_APB1ENR_TIM2EN;
+        TIM2->CR1 = 0;
+        TIM2->PSC = 0;
+        TIM2->ARR = (90000000 / ADC_SCAN_RATE) - 1;
+        /* TRGO on update */
+        TIM2->CR2 = (0x2 << 4);
+        NVIC_EnableIRQ(ADC_IRQn);
+    }
 }
 
 static void start_adc3_conversion(void)
@@ -366,6 +435,15 @@ void adc_clear_adc_ready(void)
 
 void adc_start_conversion(void)
 {
+    if (adc_mode == adc_mode_TIM) {
+        if (!adc_tim_running) {
+            DMA2_Stream4->CR |= DMA_SxCR_EN;
+            DMA2_Stream0->CR |= DMA_SxCR_EN;
+            TIM2->CR1 |= TIM_CR1_CEN;
+            adc_tim_running = 1;
+        }
+        return;
+    }
     start_adc1_conversion();
     start_adc3_conversion();
 }
@@ -376,29 +454,86 @@ int adc_get_adc_ready(void)
 }
 
 /* "ADC 3's" DMA handler */
-void __attribute__((optimize("O0"))) DMA2_Stream0_IRQHandler(void)
+void DMA2_Stream0_IRQHandler(void)
 {
     NVIC_ClearPendingIRQ(DMA2_Stream0_IRQn);
-    if (DMA2->LISR & DMA_LISR_TCIF0) {
+    uint32_t lisr = DMA2->LISR;
+    if ((adc_mode == adc_mode_TIM) && (lisr & DMA_LISR_HTIF0)) {
+        DMA2->LIFCR |= DMA_LIFCR_CHTIF0;
+        adc3_scan_count += ADC_AVG_SIZE/2;
+        adc_ready_flg |= (1 << ADC3_READY_BIT);
+    }
+    if (lisr & DMA_LISR_TCIF0) {
         /* Clear interrupt */
         DMA2->LIFCR |= DMA_LIFCR_CTCIF0;
-        /* Turn off ADC */
-        ADC3->CR2 &= ~ADC_CR2_ADON;
+        if (adc_mode == adc_mode_TIM) {
+            adc3_scan_count += ADC_AVG_SIZE/2;
+        } else {
+            /* Turn off ADC */
+            ADC3->CR2 &= ~ADC_CR2_ADON;
+            adc3_scan_count += ADC_AVG_SIZE;
+        }
         /* Data are good to read, set ready bit */
         adc_ready_flg |= (1 << ADC3_READY_BIT);
     }
 }
 
 /* "ADC 1's" DMA Handler */
-void __attribute__((optimize("O0"))) DMA2_Stream4_IRQHandler(void)
+void DMA2_Stream4_IRQHandler(void)
 {
     NVIC_ClearPendingIRQ(DMA2_Stream4_IRQn);
-    if (DMA2->HISR & DMA_HISR_TCIF4) {
+    uint32_t hisr = DMA2->HISR;
+    if ((adc_mode == adc_mode_TIM) && (hisr & DMA_HISR_HTIF4)) {
+        DMA2->HIFCR |= DMA_HIFCR_CHTIF4;
+        adc1_scan_count += ADC_AVG_SIZE/2;
+        adc_ready_flg |= (1 << ADC1_READY_BIT);
+    }
+    if (hisr & DMA_HISR_TCIF4) {
         /* Clear interrupt */
         DMA2->HIFCR |= DMA_HIFCR_CTCIF4;
-        /* Turn off ADC */
-        ADC1->CR2 &= ~ADC_CR2_ADON;
+        if (adc_mode == adc_mode_TIM) {
+            adc1_scan_count += ADC_AVG_SIZE/2;
+        } else {
+            /* Turn off ADC */
+            ADC1->CR2 &= ~ADC_CR2_ADON;
+            adc1_scan_count += ADC_AVG_SIZE;
+        }
         /* Data are good to read, set ready bit */
         adc_ready_flg |= (1 << ADC1_READY_BIT);
     }
 }
+
+/* Restart the DMA from the beginning of the buffer after an overrun. The scan
+ * count is moved to the next whole buffer so that channels take all the values
+ * as new and then continue from the beginning of the buffer, with the DMA. */
+static void
+restart_adc_dma(ADC_TypeDef *adc,
+                DMA_Stream_TypeDef *stream,
+                uint32_t ndtr,
+                volatile uint32_t *scan_count)
+{
+    stream->CR &= ~DMA_SxCR_EN;
+    while (stream->CR & DMA_SxCR_EN);
+    stream->NDTR = ndtr;
+    adc->SR &= ~ADC_SR_OVR;
+    adc->CR2 &= ~ADC_CR2_DMA;
+    adc->CR2 |= ADC_CR2_DMA;
+    stream->CR |= DMA_SxCR_EN;
+    *scan_count = (*scan_count + 2*ADC_AVG_SIZE - 1) & ~(ADC_AVG_SIZE - 1);
+    adc_n_overruns++;
+}
+
+void ADC_IRQHandler(void)
+{
+    NVIC_ClearPendingIRQ(ADC_IRQn);
+    if (ADC1->SR & ADC_SR_OVR) {
+        DMA2->HIFCR |= DMA_HIFCR_CHTIF4 | DMA_HIFCR_CTCIF4;
+        restart_adc_dma(ADC1,DMA2_Stream4,ADC1_DMA_NUM_VALS_TRANS,
+                &adc1_scan_count);
+    }
+    if (ADC3->SR & ADC_SR_OVR) {
+        DMA2->LIFCR |= DMA_LIFCR_CHTIF0 | DMA_LIFCR_CTCIF0;
+        restart_adc_dma(ADC3,DMA2_Stream0,ADC3_DMA_NUM_VALS_TRANS,
+                &adc3_scan_count);
+    }
+}
@@ -48,18 +48,52 @@ void adc_channel_update_avg(adc_channel_t *chan)
     chan->cur_val = (adc_channel_datatype_t)(result / chan->n_raw_vals);
 }
 
-/* Inititalizes adc_channel struct. By default given the averaging update
- * function. */
+/* Keeps a running sum of the last n_raw_vals values, only looking at the values
+ * the DMA has written since the last update. Gives the same result as
+ * adc_channel_update_avg once the DMA has written all the values. */
+void adc_channel_update_running_sum(adc_channel_t *chan)
+{
+    uint32_t count = *chan->scan_count,
+             n_new = count - chan->scans_read,
+             idx = chan->scans_read % chan->n_raw_vals;
+    if (n_new > chan->n_raw_vals) {
+        /* Every value has been written since last time */
+        n_new = chan->n_raw_vals;
+    }
+    while (n_new--) {
+        adc_channel_datatype_t x = chan->raw_vals[idx*chan->raw_val_stride];
+        chan->sum += x;
+        chan->sum -= chan->hist[idx];
+        chan->hist[idx] = x;
+        if (++idx == chan->n_raw_vals) {
+            idx = 0;
+        }
+    }
+    chan->scans_read = count;
+    chan->cur_val = (adc_channel_datatype_t)(chan->sum / chan->n_raw_vals);
+}
+
+/* Inititalizes adc_channel struct. By default given the running sum update
+ * function. nraw_vals must be no more than ADC_AVG_SIZE. */
 void adc_channel_init(adc_channel_t *chan,
                       volatile adc_channel_datatype_t *raw_vals,
                       uint32_t raw_val_stride,
-                      uint32_t nraw_vals)
+                      uint32_t nraw_vals,
+                      volatile uint32_t *scan_count)
 {
+    uint32_t n;
     chan->cur_val = 0;
     chan->raw_vals = raw_vals;
     chan->raw_val_stride = raw_val_stride;
     chan->n_raw_vals = nraw_vals;
-    chan->update = adc_channel_update_avg;
+    chan->update = adc_channel_update_running_sum;
+    chan->scan_count = scan_count;
+    chan->scans_read = *scan_count;
+    chan->sum = 0;
+    for (n = 0; n < nraw_vals; n++) {
+        chan->hist[n] = raw_vals[n*raw_val_stride];
+        chan->sum += chan->hist[n];
+    }
 }
 
 void adc_channel_setup(void)
@@ -55,7 +55,8 @@ void adc_channel_test_setup(void)
         adc_channel_init(&adc_test_channels[n],
                          adc_data_starts[n],
                          adc_raw_value_strides[n],
-                         ADC_AVG_SIZE);
+                         ADC_AVG_SIZE,
+                         adc_scan_counts[n]);
         adc_channel_do_set_init(&adc_channel_do_sets[n],
                                 &adc_test_channels[n],
                                 adc_channel_test_do_func,
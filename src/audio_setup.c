@@ -9,9 +9,15 @@
 #include <stdint.h> 
 #include "synth_control.h" 
 #include "scheduling.h" 
+#include "synth_midi_control.h" 
 #include "switch_control.h" 
 #include "adc_channel.h" 
 #include "led_status.h" 
+#include "cycle_profiler.h" 
+#include "load_governor.h" 
+#include "xrun_history.h" 
+#include "telemetry.h" 
+#include "midi_clock_out.h" 
 
 #define CODEC_LIVE_INPUT_CHANNEL 0
 #define CODEC_LIVE_OUTPUT_CHANNEL 0
@@ -48,18 +54,58 @@ static void saturate_output(audio_hw_io_t *params)
     }
 }
 
+/* Write the output bus to the codec's output and the codec's input to the
+ * input bus. Only the first channel is written/read. */
+void audio_io_convert(audio_hw_io_t *params)
+{
+    int n;
+    for (n = 0; n < params->length; n++) {
+#if defined(BOARD_V1)
+        params->out[n*params->nchans_out+CODEC_LIVE_OUTPUT_CHANNEL] =
+            outBus->data[outBus->channels*n] * AUDIO_HW_SAMPLE_T_MAX;
+        inBus->data[n*inBus->channels] = 
+            ((MMSample)params->in[n*params->nchans_in+CODEC_LIVE_INPUT_CHANNEL])
+            /AUDIO_HW_SAMPLE_T_MAX;
+#elif defined(BOARD_V2)
+#if defined(AUDIO_HW_TEST_WET_DRY_MIX)
+        params->out[n*params->nchans_out+CODEC_LIVE_OUTPUT_CHANNEL] =
+            params->in[n*params->nchans_in+CODEC_LIVE_INPUT_CHANNEL];
+#else
+#if defined(AUDIO_HW_WET_DRY_MIX_SOFTWARE)
+        params->out[n*params->nchans_out+CODEC_LIVE_OUTPUT_CHANNEL] = __SADD16(
+            outBus->data[outBus->channels*n] * AUDIO_HW_SAMPLE_T_MAX,
+            params->in[n*params->nchans_in+CODEC_LIVE_INPUT_CHANNEL]);
+#else
+        params->out[n*params->nchans_out+CODEC_LIVE_OUTPUT_CHANNEL] =
+            outBus->data[outBus->channels*n] * AUDIO_HW_SAMPLE_T_MAX;
+#endif
+#endif
+        inBus->data[n*inBus->channels] = 
+            ((MMSample)params->in[n*params->nchans_in+CODEC_LIVE_INPUT_CHANNEL])
+            /AUDIO_HW_SAMPLE_T_MAX;
+#endif
+    }
+}
+
 /* If this is greater than 1, we have a buffer underrun */
 static volatile int n_audio_interrupts = 0;
 static volatile int underrun_occurred = 0;
+/* The number of blocks processed since starting */
+static volatile uint32_t audio_block_count = 0;
+
+uint32_t audio_get_block_count(void)
+{
+    return audio_block_count;
+}
 
 void audio_hw_io(audio_hw_io_t *params)
 {
-    int n;
     n_audio_interrupts++;
     if (n_audio_interrupts > 1) {
         underrun_occurred = 1;
     }
 #ifdef AUDIO_HW_TEST_THROUGHPUT
+    int n;
 #if defined(BOARD_V1)
     for (n = 0; n < params->length; n++) {
         params->out[n*params->nchans_out+CODEC_LIVE_OUTPUT_CHANNEL] =
@@ -72,6 +118,7 @@ void audio_hw_io(audio_hw_io_t *params)
     }
 #endif
 #elif defined(AUDIO_HW_TEST_OUTPUT)
+    int n;
 #if defined(AUDIO_HW_TEST_OUTPUT_RAMP)
     static int16_t _rampval = 0;
     for (n = 0; n < params->length; n++) {
@@ -86,51 +133,63 @@ void audio_hw_io(audio_hw_io_t *params)
     }
 #endif
 #else
+    midi_clock_out_mark_block();
+    CYCLE_PROFILER_START(cp_block_start);
+    CYCLE_PROFILER_START(cp_t);
     /* Process switches. MIDI trumps switches if messages present */
     switch_control_do_all();
+    CYCLE_PROFILER_LAP(cp_t,cycle_profiler_stage_SWITCHES);
     /* Process knobs. MIDI trumps knobs if messages present. */
     if (adc_get_adc_ready()) {
+        /* Clear first so values written while updating aren't missed. In
+         * adc_mode_TIM these only touch memory. */
+        adc_clear_adc_ready();
         adc_channels_update();
         adc_channel_do_all_sets();
-        adc_clear_adc_ready();
         adc_start_conversion();
     }
+    CYCLE_PROFILER_LAP(cp_t,cycle_profiler_stage_ADC);
     /* Process MIDI once every audioblock */
     midi_hw_process_input(NULL);
+    synth_midi_control_apply_nrpns();
+    CYCLE_PROFILER_LAP(cp_t,cycle_profiler_stage_MIDI);
     /* Update LEDs */
     led_status_update();
+    CYCLE_PROFILER_LAP(cp_t,cycle_profiler_stage_LEDS);
+    /* Use what the controls changed for the rest of the block */
+    synth_control_publish_param_sets();
     /* Increment scheduler and do pending events */
     scheduler_incTimeAndDoEvents();
+    /* Send MIDI clocks at the tempo the scheduler just advanced by */
+    midi_clock_out_block();
+    CYCLE_PROFILER_LAP(cp_t,cycle_profiler_stage_SCHEDULER);
     /* Process audio */
     MMSigProc_tick(&sigChain);
+    CYCLE_PROFILER_LAP(cp_t,cycle_profiler_stage_SIGCHAIN);
     saturate_output(params);
-    for (n = 0; n < params->length; n++) {
-        /* Only the first channel is written/read */
-#if defined(BOARD_V1)
-        params->out[n*params->nchans_out+CODEC_LIVE_OUTPUT_CHANNEL] =
-            outBus->data[outBus->channels*n] * AUDIO_HW_SAMPLE_T_MAX;
-        inBus->data[n*inBus->channels] = 
-            ((MMSample)params->in[n*params->nchans_in+CODEC_LIVE_INPUT_CHANNEL])
-            /AUDIO_HW_SAMPLE_T_MAX;
-#elif defined(BOARD_V2)
-#if defined(AUDIO_HW_TEST_WET_DRY_MIX)
-        params->out[n*params->nchans_out+CODEC_LIVE_OUTPUT_CHANNEL] =
-            params->in[n*params->nchans_in+CODEC_LIVE_INPUT_CHANNEL];
-#else
-#if defined(AUDIO_HW_WET_DRY_MIX_SOFTWARE)
-        params->out[n*params->nchasrc/audio_setup.cns_out+CODEC_LIVE_OUTPUT_CHANNEL] = __SADD16(
-            outBus->data[outBus->channels*n] * AUDIO_HW_SAMPLE_T_MAX,
-            params->in[n*params->nchans_in+CODEC_LIVE_INPUT_CHANNEL]);
+    CYCLE_PROFILER_LAP(cp_t,cycle_profiler_stage_SATURATE);
+    audio_io_convert(params);
+    CYCLE_PROFILER_LAP(cp_t,cycle_profiler_stage_IO_CONV);
+    CYCLE_PROFILER_LAP(cp_block_start,cycle_profiler_stage_TOTAL);
+    cycle_profiler_end_block();
+#ifndef NO_CYCLE_PROFILER
+    /* Shed or restore work depending on how long this block took */
+    load_governor_update(
+        cycle_profiler_get_stage(cycle_profiler_stage_TOTAL)->last,
+        cycle_profiler_get_block_period());
+    xrun_history_end_block(audio_block_count,
+        cycle_profiler_get_stage(cycle_profiler_stage_TOTAL)->last,
+        cycle_profiler_get_block_period(),
+        n_audio_interrupts > 1 ? XRUN_FLAG_REENTERED : 0);
+    telemetry_end_block(audio_block_count,
+        cycle_profiler_get_stage(cycle_profiler_stage_TOTAL)->last,
+        cycle_profiler_get_block_period());
 #else
-        params->out[n*params->nchans_out+CODEC_LIVE_OUTPUT_CHANNEL] =
-            outBus->data[outBus->channels*n] * AUDIO_HW_SAMPLE_T_MAX;
-#endif
+    xrun_history_end_block(audio_block_count, 0, 0,
+        n_audio_interrupts > 1 ? XRUN_FLAG_REENTERED : 0);
+    telemetry_end_block(audio_block_count, 0, 0);
 #endif
-        inBus->data[n*inBus->channels] = 
-            ((MMSample)params->in[n*params->nchans_in+CODEC_LIVE_INPUT_CHANNEL])
-            /AUDIO_HW_SAMPLE_T_MAX;
-#endif
-    }
 #endif /* AUDIO_HW_TEST_THROUGHPUT */
+    audio_block_count++;
     n_audio_interrupts--;
 }
@@ -0,0 +1,405 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#include "codec_i2c.h"
+#include "i2s_lowlevel.h"
+#include "stm32f4xx.h"
+
+typedef enum {
+    codec_i2c_state_IDLE,
+    /* Writing the register address (and value) */
+    codec_i2c_state_WRITE_SB,
+    codec_i2c_state_WRITE_ADDR,
+    codec_i2c_state_WRITE_DATA,
+    /* Reading back the register value after a repeated start */
+    codec_i2c_state_READ_SB,
+    codec_i2c_state_READ_ADDR,
+    codec_i2c_state_READ_DATA,
+} codec_i2c_state_t;
+
+typedef struct {
+    uint8_t addr;
+    uint8_t bytes[2];
+    /* Number of bytes to write before reading (if read_val is not NULL) or
+     * stopping */
+    uint8_t n_bytes;
+    uint8_t n_tries;
+    uint16_t *read_val;
+} codec_i2c_txn_t;
+
+static codec_i2c_txn_t txns[CODEC_I2C_QUEUE_SIZE];
+/* Transactions are added at head and carried out from tail */
+static volatile uint32_t txn_head = 0;
+static volatile uint32_t txn_tail = 0;
+static volatile codec_i2c_state_t state = codec_i2c_state_IDLE;
+/* Number of bytes of the current transaction written */
+static uint32_t n_written = 0;
+/* DWT cycle count when the current try started */
+static uint32_t txn_start_cycles = 0;
+/* Set if a transaction was given up on since codec_i2c_wait last returned */
+static volatile int failed_since_wait = 0;
+/* Global so it can be looked at in gdb */
+codec_i2c_stats_t codec_i2c_stats;
+
+static void
+periph_init(void)
+{
+    /* Disable peripheral */
+    I2C2->CR1 &= ~I2C_CR1_PE;
+    /* Reset peripheral */
+    I2C2->CR1 |= I2C_CR1_SWRST;
+    I2C2->CR1 &= ~I2C_CR1_SWRST;
+    /* Set clock equal to APB1 clock */
+    I2C2->CR2 &= ~(0x1f);
+    I2C2->CR2 |= (uint32_t)45; /* 45Mhz */
+    /* Set up rise time based on clock and codec's I2C characteristics. */
+    I2C2->TRISE &= ~(0xf3);
+    /* no more than 14 clocks fit into the minimum rise time */
+    I2C2->TRISE |= (uint32_t)14; /* See p. 853 STM32F429 reference manual. */
+    /* Set clock control register (see p. 852 ibid)*/
+    I2C2->CCR = (uint32_t)452; /* SCL is about 50Khz */
+    /* Event and error interrupts, the buffer interrupt is only enabled while
+     * bytes are being transferred */
+    I2C2->CR2 |= I2C_CR2_ITEVTEN | I2C_CR2_ITERREN;
+    /* Enable peripheral */
+    I2C2->CR1 |= I2C_CR1_PE;
+}
+
+/* The peripheral clears STOP once the stop condition is on the bus, the next
+ * start can't be requested before that. This takes about a bit period. */
+static void
+wait_stop(void)
+{
+    uint32_t t0 = DWT->CYCCNT;
+    while ((I2C2->CR1 & I2C_CR1_STOP)
+            && ((DWT->CYCCNT - t0) < CODEC_I2C_TIMEOUT));
+}
+
+static void
+start_txn(void)
+{
+    n_written = 0;
+    txn_start_cycles = DWT->CYCCNT;
+    state = codec_i2c_state_WRITE_SB;
+    I2C2->CR1 |= I2C_CR1_START;
+}
+
+/* Move on to the next transaction, if there is one */
+static void
+next_txn(void)
+{
+    txn_tail++;
+    state = codec_i2c_state_IDLE;
+    if (txn_tail != txn_head) {
+        start_txn();
+    }
+}
+
+static void
+finish_txn(void)
+{
+    codec_i2c_stats.n_done++;
+    wait_stop();
+    next_txn();
+}
+
+/* Try the current transaction again or give up on it if it has been tried
+ * enough. */
+static void
+retry_txn(void)
+{
+    codec_i2c_txn_t *t = &txns[txn_tail & (CODEC_I2C_QUEUE_SIZE - 1)];
+    I2C2->CR2 &= ~I2C_CR2_ITBUFEN;
+    wait_stop();
+    if (++t->n_tries > CODEC_I2C_RETRIES) {
+        codec_i2c_stats.n_failed++;
+        failed_since_wait = 1;
+        next_txn();
+        return;
+    }
+    codec_i2c_stats.n_retries++;
+    start_txn();
+}
+
+/* Advance the transaction in progress according to the event flags. Called
+ * from the event interrupt or, with interrupts disabled, by codec_i2c_poll. */
+static void
+service_events(void)
+{
+    uint16_t sr1 = I2C2->SR1;
+    codec_i2c_txn_t *t = &txns[txn_tail & (CODEC_I2C_QUEUE_SIZE - 1)];
+    switch (state) {
+        case codec_i2c_state_WRITE_SB:
+            if (sr1 & I2C_SR1_SB) {
+                I2C2->DR = t->addr;
+                state = codec_i2c_state_WRITE_ADDR;
+            }
+            break;
+        case codec_i2c_state_WRITE_ADDR:
+            if (sr1 & I2C_SR1_ADDR) {
+                /* Reading SR2 after SR1 clears ADDR */
+                (void)I2C2->SR2;
+                I2C2->DR = t->bytes[n_written++];
+                I2C2->CR2 |= I2C_CR2_ITBUFEN;
+                state = codec_i2c_state_WRITE_DATA;
+            }
+            break;
+        case codec_i2c_state_WRITE_DATA:
+            if ((sr1 & I2C_SR1_TXE) && (n_written < t->n_bytes)) {
+                I2C2->DR = t->bytes[n_written++];
+            } else if (n_written >= t->n_bytes) {
+                /* Wait for the last byte to leave with BTF rather than
+                 * interrupting on TXE */
+                I2C2->CR2 &= ~I2C_CR2_ITBUFEN;
+                if (sr1 & I2C_SR1_BTF) {
+                    if (t->read_val) {
+                        I2C2->CR1 |= I2C_CR1_START;
+                        state = codec_i2c_state_READ_SB;
+                    } else {
+                        I2C2->CR1 |= I2C_CR1_STOP;
+                        finish_txn();
+                    }
+                }
+            }
+            break;
+        case codec_i2c_state_READ_SB:
+            if (sr1 & I2C_SR1_SB) {
+                I2C2->DR = t->addr | 0x1;
+                state = codec_i2c_state_READ_ADDR;
+            }
+            break;
+        case codec_i2c_state_READ_ADDR:
+            if (sr1 & I2C_SR1_ADDR) {
+                /* Only one byte is read so NACK it and stop as soon as the
+                 * address is acknowledged */
+                I2C2->CR1 &= ~I2C_CR1_ACK;
+                (void)I2C2->SR2;
+                I2C2->CR1 |= I2C_CR1_STOP;
+                I2C2->CR2 |= I2C_CR2_ITBUFEN;
+                state = codec_i2c_state_READ_DATA;
+            }
+            break;
+        case codec_i2c_state_READ_DATA:
+            if (sr1 & I2C_SR1_RXNE) {
+                *t->read_val = (uint16_t)(I2C2->DR & 0xff);
+                I2C2->CR2 &= ~I2C_CR2_ITBUFEN;
+                finish_txn();
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/* Called from the error interrupt or, with interrupts disabled, by
+ * codec_i2c_poll. */
+static void
+service_errors(void)
+{
+    uint16_t sr1 = I2C2->SR1;
+    if (!(sr1 & (I2C_SR1_AF | I2C_SR1_BERR | I2C_SR1_ARLO))) {
+        return;
+    }
+    I2C2->SR1 = ~(I2C_SR1_AF | I2C_SR1_BERR | I2C_SR1_ARLO);
+    if (state == codec_i2c_state_IDLE) {
+        return;
+    }
+    if (sr1 & I2C_SR1_AF) {
+        /* Not acknowledged, release the bus */
+        I2C2->CR1 |= I2C_CR1_STOP;
+    } else {
+        /* Misplaced start or stop or arbitration lost, the peripheral is
+         * in an unknown state */
+        periph_init();
+    }
+    retry_txn();
+}
+
+void I2C2_EV_IRQHandler(void)
+{
+    NVIC_ClearPendingIRQ(I2C2_EV_IRQn);
+    service_events();
+}
+
+void I2C2_ER_IRQHandler(void)
+{
+    NVIC_ClearPendingIRQ(I2C2_ER_IRQn);
+    service_errors();
+}
+
+/* Carry out transactions without relying on the interrupts (which may not be
+ * able to preempt the caller) and check that the current one hasn't taken too
+ * long. */
+void codec_i2c_poll(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    service_errors();
+    service_events();
+    if ((state != codec_i2c_state_IDLE)
+            && ((DWT->CYCCNT - txn_start_cycles) > CODEC_I2C_TIMEOUT)) {
+        codec_i2c_stats.n_timeouts++;
+        periph_init();
+        retry_txn();
+    }
+    if (!primask) {
+        __enable_irq();
+    }
+}
+
+static int
+queue_txn(codec_i2c_txn_t *t)
+{
+    uint32_t primask = __get_PRIMASK();
+    int ret = codec_i2c_err_NONE;
+    __disable_irq();
+    if ((txn_head - txn_tail) >= CODEC_I2C_QUEUE_SIZE) {
+        ret = codec_i2c_err_QUEUE_FULL;
+    } else {
+        txns[txn_head & (CODEC_I2C_QUEUE_SIZE - 1)] = *t;
+        txn_head++;
+        if (state == codec_i2c_state_IDLE) {
+            start_txn();
+        }
+    }
+    if (!primask) {
+        __enable_irq();
+    }
+    return ret;
+}
+
+/* Queue writing reg_val to register reg_addr of the codec at addr. Returns
+ * immediately. */
+int codec_i2c_queue_write(uint8_t addr, uint8_t reg_addr, uint16_t reg_val)
+{
+    codec_i2c_txn_t t = {
+        .addr = addr,
+        .bytes = {
+            (uint8_t)codec_format_reg_addr(reg_addr,reg_val),
+            (uint8_t)(reg_val & 0xff)
+        },
+        .n_bytes = 2,
+        .read_val = NULL,
+    };
+    return queue_txn(&t);
+}
+
+/* Queue reading register reg_addr of the codec at addr into *reg_val. Returns
+ * immediately, *reg_val is written when the transaction is done and is left
+ * alone if it fails. */
+int codec_i2c_queue_read(uint8_t addr, uint8_t reg_addr, uint16_t *reg_val)
+{
+    codec_i2c_txn_t t = {
+        .addr = addr,
+        .bytes = { (uint8_t)codec_format_reg_addr(reg_addr,*reg_val) },
+        .n_bytes = 1,
+        .read_val = reg_val,
+    };
+    return queue_txn(&t);
+}
+
+int codec_i2c_busy(void)
+{
+    return txn_head != txn_tail;
+}
+
+/* Wait until all the queued transactions are done or given up on. Returns
+ * codec_i2c_err_FAILED if any were given up on since this was last called.
+ * Always returns because each try of each transaction is bounded by
+ * CODEC_I2C_TIMEOUT. */
+int codec_i2c_wait(void)
+{
+    int ret;
+    while (codec_i2c_busy()) {
+        codec_i2c_poll();
+    }
+    ret = failed_since_wait ? codec_i2c_err_FAILED : codec_i2c_err_NONE;
+    failed_since_wait = 0;
+    return ret;
+}
+
+void codec_i2c_get_stats(codec_i2c_stats_t *stats)
+{
+    *stats = codec_i2c_stats;
+}
+
+int codec_prog_reg_i2c(uint8_t addr,
+                               uint8_t reg_addr,
+                               uint16_t reg_val)
+{
+    if (codec_i2c_queue_write(addr,reg_addr,reg_val)) {
+        return codec_i2c_err_QUEUE_FULL;
+    }
+    return codec_i2c_wait();
+}
+
+int codec_read_reg_i2c(uint8_t addr,
+                               uint8_t reg_addr,
+                               uint16_t *reg_val)
+{
+    if (codec_i2c_queue_read(addr,reg_addr,reg_val)) {
+        return codec_i2c_err_QUEUE_FULL;
+    }
+    return codec_i2c_wait();
+}
+
+void codec_i2c_setup(void)
+{
+    NVIC_DisableIRQ(I2C2_EV_IRQn);
+    NVIC_DisableIRQ(I2C2_ER_IRQn);
+    /* Anything left in the queue is meaningless after a reset */
+    txn_head = 0;
+    txn_tail = 0;
+    state = codec_i2c_state_IDLE;
+    failed_since_wait = 0;
+    /* The cycle counter times out transactions */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    /* Enable GPIOB, I2C2 clock */
+    RCC->APB1ENR |= RCC_APB1ENR_I2C2EN;
+    RCC->AHB1ENR |= RCC_AHB1ENR_GPIOBEN | RCC_AHB1ENR_GPIOCEN;
+    /* Reset I2C clock */
+    RCC->APB1RSTR |= RCC_APB1RSTR_I2C2RST;
+    RCC->APB1RSTR &= ~RCC_APB1RSTR_I2C2RST;
+    /* Enable CE pin to set codec's address */
+    GPIOC->MODER &= ~(0x3 << (2 * 13));
+    /* Set to output */
+    GPIOC->MODER |= (0x1 << (2 * 13));
+    /* Set to Open/Drain */
+//    GPIOC->OTYPER |= (0x1 << 13);
+    /* High speed (?) */
+    GPIOC->OSPEEDR &= ~(0x3 << (2* 13));
+    GPIOC->OSPEEDR |= (0x2 << (2* 13));
+    /* Pull down */
+    GPIOC->PUPDR &= ~(0x3 << (2 * 13));
+    GPIOC->PUPDR |= (0x2 << (2 * 13));
+    /* Set low */
+    GPIOC->ODR &= ~(0x1 << 13);
+    /* Enable I2C2 Pins, set to AF */
+    /* PB10,PB11 */
+    GPIOB->MODER &= ~((0x3 << (2* 10)) | (0x3 << (2*11)));
+    GPIOB->MODER |= ((0x2 << (2* 10)) | (0x2 << (2*11)));
+    /* High speed (?) */
+    GPIOB->OSPEEDR &= ~((0x3 << (2* 10)) | (0x3 << (2*11)));
+    GPIOB->OSPEEDR |= ((0x2 << (2* 10)) | (0x2 << (2*11)));
+    /* I2C Functions are alternate function 4 */
+    GPIOB->AFR[1] &= ~((0xf << (4*2)) | (0xf << (4*3)));
+    GPIOB->AFR[1] |= ((0x4 << (4*2)) | (0x4 << (4*3)));
+    /* Extra Pull-up */
+    GPIOB->PUPDR &= ~((0x3 << (2 * 10)) | (0x3 << (2 * 11)));
+    GPIOB->PUPDR |= ((0x2 << (2 * 10)) | (0x2 << (2 * 11)));
+    /* Open / Drain */
+    GPIOB->OTYPER |= ((0x1 << 10) | (0x1 << 11));
+    periph_init();
+    NVIC_ClearPendingIRQ(I2C2_EV_IRQn);
+    NVIC_ClearPendingIRQ(I2C2_ER_IRQn);
+    NVIC_EnableIRQ(I2C2_EV_IRQn);
+    NVIC_EnableIRQ(I2C2_ER_IRQn);
+}
+
+void codec_i2c_disable(void)
+{
+    NVIC_DisableIRQ(I2C2_EV_IRQn);
+    NVIC_DisableIRQ(I2C2_ER_IRQn);
+    I2C2->CR2 &= ~(I2C_CR2_ITEVTEN | I2C_CR2_ITERREN | I2C_CR2_ITBUFEN);
+    RCC->APB1ENR &= ~RCC_APB1ENR_I2C2EN;
+}
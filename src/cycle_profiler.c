@@ -0,0 +1,180 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#include <stdint.h>
+#include "cycle_profiler.h"
+#include "audio_setup.h"
+#include "system_init.h"
+
+#ifndef NO_CYCLE_PROFILER
+
+/* Look at these from gdb, e.g.,
+ * p cycle_profiler_stages
+ * p cycle_profiler_sigprocs[0]@cycle_profiler_n_sigprocs
+ * info symbol cycle_profiler_sigprocs[3].sp
+ * to see which sample player (voice) or processor is taking the time. */
+cycle_profiler_stat_t cycle_profiler_stages[cycle_profiler_stage_N];
+cycle_profiler_sigproc_t cycle_profiler_sigprocs[CYCLE_PROFILER_MAX_SIGPROCS];
+int cycle_profiler_n_sigprocs = 0;
+/* The number of cycles available to process one block */
+static uint32_t block_period = 1;
+/* Where the next sigproc to be ticked is expected to be in the table */
+static int sigproc_cursor = 0;
+static uint32_t n_blocks = 0;
+
+static void
+stat_reset(cycle_profiler_stat_t *s)
+{
+    s->last = 0;
+    s->min = UINT32_MAX;
+    s->max = 0;
+    s->avg = 0;
+    s->acc = 0;
+}
+
+static inline void
+stat_update(cycle_profiler_stat_t *s, uint32_t cycles)
+{
+    s->last = cycles;
+    if (cycles < s->min) { s->min = cycles; }
+    if (cycles > s->max) { s->max = cycles; }
+    s->acc += cycles;
+}
+
+static inline void
+stat_latch_avg(cycle_profiler_stat_t *s)
+{
+    s->avg = s->acc / CYCLE_PROFILER_AVG_BLOCKS;
+    s->acc = 0;
+}
+
+void cycle_profiler_reset(void)
+{
+    int n;
+    for (n = 0; n < cycle_profiler_stage_N; n++) {
+        stat_reset(&cycle_profiler_stages[n]);
+    }
+    for (n = 0; n < cycle_profiler_n_sigprocs; n++) {
+        stat_reset(&cycle_profiler_sigprocs[n].stat);
+    }
+    n_blocks = 0;
+}
+
+void cycle_profiler_setup(void)
+{
+    /* Enable the cycle counter */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    block_period = (uint32_t)(((uint64_t)get_SystemCoreClock()
+            * audio_hw_get_block_size(NULL)) / audio_hw_get_sample_rate(NULL));
+    cycle_profiler_reset();
+}
+
+/* Stands in for the tick function of each profiled MMSigProc. The sigChain
+ * ticks its processors in the same order every block, so the entry is almost
+ * always the one at the cursor and no search is needed. */
+static void
+cycle_profiler_sigproc_tick(MMSigProc *sp)
+{
+    int n;
+    uint32_t t0;
+    cycle_profiler_sigproc_t *p = &cycle_profiler_sigprocs[sigproc_cursor];
+    if (p->sp != sp) {
+        for (n = 0; n < cycle_profiler_n_sigprocs; n++) {
+            if (cycle_profiler_sigprocs[n].sp == sp) {
+                break;
+            }
+        }
+        if (n == cycle_profiler_n_sigprocs) {
+            /* Not ours, can't happen unless the tick function was copied */
+            return;
+        }
+        sigproc_cursor = n;
+        p = &cycle_profiler_sigprocs[n];
+    }
+    t0 = cycle_profiler_now();
+    p->tick(sp);
+    stat_update(&p->stat, cycle_profiler_now() - t0);
+    if (++sigproc_cursor >= cycle_profiler_n_sigprocs) {
+        sigproc_cursor = 0;
+    }
+}
+
+/* Replace the tick function of every MMSigProc currently in sc with one that
+ * times it. Call after the signal chain has been set up. */
+void cycle_profiler_attach_sigchain(MMSigChain *sc)
+{
+    MMSigProc *sp = (MMSigProc*)((MMDLList*)&sc->sigProcs)->next;
+    while (sp && (cycle_profiler_n_sigprocs < CYCLE_PROFILER_MAX_SIGPROCS)) {
+        cycle_profiler_sigproc_t *p =
+            &cycle_profiler_sigprocs[cycle_profiler_n_sigprocs];
+        if (sp->tick != cycle_profiler_sigproc_tick) {
+            p->sp = sp;
+            p->tick = sp->tick;
+            stat_reset(&p->stat);
+            sp->tick = cycle_profiler_sigproc_tick;
+            cycle_profiler_n_sigprocs++;
+        }
+        sp = (MMSigProc*)((MMDLList*)sp)->next;
+    }
+    sigproc_cursor = 0;
+}
+
+void cycle_profiler_record(cycle_profiler_stage_t stage, uint32_t cycles)
+{
+    stat_update(&cycle_profiler_stages[stage], cycles);
+}
+
+/* Call once at the end of every block, after cycle_profiler_stage_TOTAL has
+ * been recorded. */
+void cycle_profiler_end_block(void)
+{
+    int n;
+    sigproc_cursor = 0;
+    n_blocks++;
+    if ((n_blocks & (CYCLE_PROFILER_AVG_BLOCKS - 1)) == 0) {
+        for (n = 0; n < cycle_profiler_stage_N; n++) {
+            stat_latch_avg(&cycle_profiler_stages[n]);
+        }
+        for (n = 0; n < cycle_profiler_n_sigprocs; n++) {
+            stat_latch_avg(&cycle_profiler_sigprocs[n].stat);
+        }
+    }
+}
+
+const cycle_profiler_stat_t *
+cycle_profiler_get_stage(cycle_profiler_stage_t stage)
+{
+    return &cycle_profiler_stages[stage];
+}
+
+const cycle_profiler_sigproc_t *
+cycle_profiler_get_sigprocs(int *n)
+{
+    *n = cycle_profiler_n_sigprocs;
+    return cycle_profiler_sigprocs;
+}
+
+uint32_t cycle_profiler_get_block_period(void)
+{
+    return block_period;
+}
+
+/* Average time spent in the audio interrupt as a percentage of the time
+ * between interrupts. */
+float cycle_profiler_get_utilization_avg(void)
+{
+    return 100.f
+        * (float)cycle_profiler_stages[cycle_profiler_stage_TOTAL].avg
+        / (float)block_period;
+}
+
+/* Worst case time spent in the audio interrupt as a percentage of the time
+ * between interrupts. */
+float cycle_profiler_get_utilization_max(void)
+{
+    return 100.f
+        * (float)cycle_profiler_stages[cycle_profiler_stage_TOTAL].max
+        / (float)block_period;
+}
+
+#endif /* NO_CYCLE_PROFILER */
@@ -5,9 +5,11 @@
 #include "i2s_lowlevel.h" 
 #include "stm32f4xx.h"
 #include "audio_hw.h" 
+#include "system_init.h" 
+#include "codec_i2c.h" 
+#include "irq_priorities.h" 
 #include <string.h>
 
-#define CODEC_I2C_TIMEOUT  ((uint32_t)1000000) 
 
 /* Where data to be transferred to CODEC reside */
 static int16_t codecDmaTxBuf[CODEC_DMA_BUF_LEN * 2]
@@ -29,16 +31,32 @@ static unsigned int rate = 0;
 
 static unsigned int i2s_frame_error_flag = 0;
 
+/* Number of times the DMA caught up with the half of the buffer being
+ * processed */
 static unsigned int i2s_dma_buffer_underrun = 0;
+/* Number of times the codec had to be resynchronized after a frame error */
+static unsigned int i2s_n_resyncs = 0;
+/* Global so it can be looked at in gdb */
+i2s_resync_stats_t i2s_resync_stats;
+/* DWT cycle count when the frame error was seen */
+static uint32_t i2s_frame_error_cycles = 0;
+/* The audio block of the last fast resync */
+static uint32_t i2s_last_fast_resync_block = 0;
+static volatile uint32_t i2s_n_blocks = 0;
+/* The half of the buffer the DMA was in after the last block interrupt */
+static volatile uint32_t i2s_dma_half = 0;
+/* Set once the codec configuration has been queued and not yet checked */
+static int i2s_codec_config_pending = 0;
+/* Number of times the codec configuration or power up could not be verified */
+unsigned int i2s_n_codec_config_failures = 0;
 /* Assumes CODEC_DMA_BUF_LEN is a power of 2 */
 #define DMA_NDTR_SIZE_MASK ((uint32_t)((CODEC_DMA_BUF_LEN * 2) - 1))
 
-static void codec_i2c_setup(void);
 static void i2s_correct_frame_error(void);
 extern void i2s_port_setup(uint32_t sr);
-extern void i2s_codec_start(void);
-extern uint32_t codec_format_reg_addr(uint8_t reg_addr, uint16_t reg_val);
+extern int i2s_codec_start(void);
 extern void codec_config_via_i2c(void);
+extern int codec_config_check(void);
 extern void i2s_gpio_disable(void);
 extern void i2s_codec_correct_frame_error(void);
 
@@ -58,6 +76,14 @@ unsigned int audio_hw_get_num_output_channels(void *data) {
     return CODEC_NUM_CHANNELS;
 }
 
+unsigned int i2s_get_n_underruns(void) {
+    return i2s_dma_buffer_underrun;
+}
+
+unsigned int i2s_get_n_resyncs(void) {
+    return i2s_n_resyncs;
+}
+
 /* This assumes i2s is configured as master */
 static int __attribute__((optimize("O0"))) i2s_clock_setup(uint32_t sr)
 {
@@ -113,7 +139,11 @@ static void __attribute__((optimize("O0"))) i2s_error_setup(void)
     GPIOG->ODR &= ~(1 << 9);
     SPI3->CR2 |= SPI_CR2_ERRIE;
     I2S3ext->CR2 |= SPI_CR2_ERRIE;
+    NVIC_SetPriority(SPI3_IRQn,IRQ_PRIORITY_AUDIO);
     NVIC_EnableIRQ(SPI3_IRQn);
+    /* The cycle counter is used to time and bound resynchronization */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 }
 
 /*
@@ -336,7 +366,7 @@ static void i2s_peripherals_disable(void)
     i2s_dma_disable();
     /* TODO when we know what else has been put in conditional links, we fix this too */ 
     /* Disable I2C stuff */
-    RCC->APB1ENR &= ~RCC_APB1ENR_I2C2EN;
+    codec_i2c_disable();
     RCC->AHB1ENR &= ~(RCC_AHB1ENR_GPIOBEN | RCC_AHB1ENR_GPIOCEN);
 
     /* Disable GPIO */
@@ -348,10 +378,17 @@ audio_hw_err_t audio_hw_setup(audio_hw_setup_t *params)
 {
     uint32_t sr = *((uint32_t*)params);
     /* Zero the buffers */
-    memset(codecDmaTxBuf,0,sizeof(int16_t)*CODEC_DMA_BUF_LEN*2);
+    memset(codecDmaTxBuf,0,sizeof(codecDmaTxBuf));
     memset(codecDmaRxBuf,0,sizeof(int16_t)*CODEC_DMA_BUF_LEN*2);
 
-    return i2s_peripherals_setup(sr);
+    if (i2s_peripherals_setup(sr)) {
+        return -1;
+    }
+    /* Start programming the codec, this is carried out by the I2C interrupts
+     * while the rest of the system is set up and checked in audio_hw_start */
+    codec_config_via_i2c();
+    i2s_codec_config_pending = 1;
+    return 0;
    
     /* Audio should now be configured but is not yet enabled (must call
      * audio_hw_start). */
@@ -364,6 +401,8 @@ void i2s_dma_start()
     DMA1_Stream0->CR |= DMA_SxCR_EN;
 
     /* Enable DMA interrupts */
+    NVIC_SetPriority(DMA1_Stream7_IRQn,IRQ_PRIORITY_AUDIO);
+    NVIC_SetPriority(DMA1_Stream0_IRQn,IRQ_PRIORITY_AUDIO);
     NVIC_EnableIRQ(DMA1_Stream7_IRQn);
     NVIC_EnableIRQ(DMA1_Stream0_IRQn);
 
@@ -378,11 +417,33 @@ void i2s_dma_start()
     while(!((DMA1_Stream7->CR & DMA_SxCR_EN) && (DMA1_Stream0->CR & DMA_SxCR_EN)));
 }
 
+/* Finish programming the codec, retrying once if it could not be verified. If
+ * it still can't be, start anyway so that the pedal doesn't hang, the failure
+ * is counted in i2s_n_codec_config_failures. */
+static void i2s_codec_config_finish(void)
+{
+    int tries;
+    for (tries = 0; tries < 2; tries++) {
+        if (!i2s_codec_config_pending) {
+            codec_config_via_i2c();
+        }
+        i2s_codec_config_pending = 0;
+        if ((codec_i2c_wait() == codec_i2c_err_NONE)
+                && (codec_config_check() == 0)) {
+            return;
+        }
+    }
+    i2s_n_codec_config_failures++;
+}
+
 static void i2s_audio_start()
 {
-    codec_config_via_i2c();
+    i2s_codec_config_finish();
     i2s_dma_start();
-    i2s_codec_start();
+    if (i2s_codec_start()) {
+        /* Counted like a configuration that couldn't be verified */
+        i2s_n_codec_config_failures++;
+    }
 }
 
 audio_hw_err_t audio_hw_start(audio_hw_setup_t *params)
@@ -394,6 +455,33 @@ audio_hw_err_t audio_hw_start(audio_hw_setup_t *params)
     return 0;
 }
 
+/* The number of input frames the DMA has received since audio was started,
+ * to the frame. Can be called from any interrupt. */
+uint32_t i2s_get_sample_position(void)
+{
+    uint32_t n_blocks, half, pos;
+    do {
+        n_blocks = i2s_n_blocks;
+        half = i2s_dma_half;
+        pos = ((uint32_t)(CODEC_DMA_BUF_LEN * 2) - i2s_dma_get_ndtr())
+            & DMA_NDTR_SIZE_MASK;
+    } while (n_blocks != i2s_n_blocks);
+    if ((pos / CODEC_DMA_BUF_LEN) != half) {
+        /* The DMA has passed the half way point or the end but the block
+         * interrupt hasn't happened yet */
+        n_blocks++;
+    }
+    return n_blocks * (CODEC_DMA_BUF_LEN / CODEC_NUM_CHANNELS)
+        + (pos % CODEC_DMA_BUF_LEN) / CODEC_NUM_CHANNELS;
+}
+
+/* The position (as returned by i2s_get_sample_position) of the first input
+ * frame of the block being processed. */
+uint32_t i2s_get_block_sample(void)
+{
+    return (i2s_n_blocks - 1) * (CODEC_DMA_BUF_LEN / CODEC_NUM_CHANNELS);
+}
+
 void DMA1_Stream0_IRQHandler(void)
 {
     NVIC_ClearPendingIRQ(DMA1_Stream0_IRQn);
@@ -414,6 +502,7 @@ void DMA1_Stream0_IRQHandler(void)
         DMA1->LIFCR |= DMA_LIFCR_CTCIF0;
         codecDmaTxPtr = codecDmaTxBuf + CODEC_DMA_BUF_LEN;
         codecDmaRxPtr = codecDmaRxBuf + CODEC_DMA_BUF_LEN;
+        i2s_dma_half = 0;
     }
     /* If half of transfer complete on stream 0 (peripheral to memory), set
      * current rx pointer to beginning of the buffer */
@@ -422,17 +511,25 @@ void DMA1_Stream0_IRQHandler(void)
         DMA1->LIFCR |= DMA_LIFCR_CHTIF0;
         codecDmaTxPtr = codecDmaTxBuf;
         codecDmaRxPtr = codecDmaRxBuf;
+        i2s_dma_half = 1;
     }
     audiohwio.in = codecDmaRxPtr;
     audiohwio.out = codecDmaTxPtr;
+    i2s_n_blocks++;
     if (i2s_frame_error_flag) {
         i2s_frame_error_flag = 0;
         i2s_correct_frame_error();
+        audiohwio.in = codecDmaRxPtr;
+        audiohwio.out = codecDmaTxPtr;
+        ndtr = i2s_dma_get_ndtr();
+        /* The streams may have been restarted from the beginning */
+        i2s_dma_half = (((uint32_t)(CODEC_DMA_BUF_LEN * 2) - ndtr)
+                & DMA_NDTR_SIZE_MASK) / CODEC_DMA_BUF_LEN;
     }
     audio_hw_io(&audiohwio);
     ndtr = (ndtr - i2s_dma_get_ndtr()) & DMA_NDTR_SIZE_MASK;
     if (ndtr > CODEC_DMA_BUF_LEN) {
-        i2s_dma_buffer_underrun = 1;
+        i2s_dma_buffer_underrun++;
     }
 }
 
@@ -450,174 +547,146 @@ void DMA1_Stream7_IRQHandler(void)
     }
 }
 
-static void i2s_correct_frame_error(void)
+/* Wait until (reg & mask) == val for at most I2S_RESYNC_TIMEOUT_CYCLES.
+ * Returns 0 if it happened, -1 if it timed out. */
+static int i2s_wait_reg(volatile uint32_t *reg, uint32_t mask, uint32_t val)
 {
-        i2s_codec_correct_frame_error();
-        i2s_peripherals_disable();
-        i2s_peripherals_setup(rate);
-        i2s_audio_start();
+    uint32_t t0 = DWT->CYCCNT;
+    while ((*reg & mask) != val) {
+        if ((DWT->CYCCNT - t0) > I2S_RESYNC_TIMEOUT_CYCLES) {
+            return -1;
+        }
+    }
+    return 0;
 }
 
-void SPI3_IRQHandler (void)
+static int i2s_wait_reg16(volatile uint16_t *reg, uint16_t mask, uint16_t val)
 {
-    NVIC_ClearPendingIRQ(SPI3_IRQn);
-    /* Disable SPI interrupts */
-    NVIC_DisableIRQ(SPI3_IRQn);
-    uint32_t i2s3ext_sr = I2S3ext->SR;
-    static volatile uint32_t num_i2s3ext = 0;
-    /* Check frame error */
-    if (i2s3ext_sr & 0x100) {
-        num_i2s3ext++;
-        i2s_frame_error_flag = 1;
+    uint32_t t0 = DWT->CYCCNT;
+    while ((*reg & mask) != val) {
+        if ((DWT->CYCCNT - t0) > I2S_RESYNC_TIMEOUT_CYCLES) {
+            return -1;
+        }
     }
-    /* Enable SPI interrupts */
-    NVIC_EnableIRQ(SPI3_IRQn);
+    return 0;
 }
 
-static int codec_i2c_check_flags(uint32_t flags)
+/* Wait until the stream has at most ndtr transfers left for at most
+ * I2S_RESYNC_TIMEOUT_CYCLES. Returns 0 if it did, -1 if it timed out. */
+static int i2s_wait_ndtr(DMA_Stream_TypeDef *stream, uint32_t ndtr)
 {
-    uint32_t tmp;
-    tmp = (I2C2->SR1 << 16);
-    tmp |= (I2C2->SR2);
-    if ((tmp & flags) == flags) {
-        return 1;
+    uint32_t t0 = DWT->CYCCNT;
+    while (stream->NDTR > ndtr) {
+        if ((DWT->CYCCNT - t0) > I2S_RESYNC_TIMEOUT_CYCLES) {
+            return -1;
+        }
     }
     return 0;
 }
 
-static void codec_i2c_swrst(void)
+/* Realign the I2S3ext slave receiver to the word select line and restart both
+ * DMA streams from the beginning of their buffers, leaving the I2S master, the
+ * clocks and the codec running. Returns 0 on success or -1 if something didn't
+ * happen in time, in which case the caller should do the full reset. */
+static int i2s_fast_resync(void)
 {
-    I2C2->CR1 |= I2C_CR1_SWRST;
-    while (codec_i2c_check_flags(0x00c00000));
-    I2C2->CR1 &= ~I2C_CR1_SWRST;
+    /* Stop the streams and the slave */
+    DMA1_Stream7->CR &= ~DMA_SxCR_EN;
+    DMA1_Stream0->CR &= ~DMA_SxCR_EN;
+    I2S3ext->I2SCFGR &= ~SPI_I2SCFGR_I2SE;
+    if (i2s_wait_reg(&DMA1_Stream7->CR, DMA_SxCR_EN, 0)
+            || i2s_wait_reg(&DMA1_Stream0->CR, DMA_SxCR_EN, 0)) {
+        return -1;
+    }
+    /* Flush what the slave received before it was disabled */
+    (void)I2S3ext->DR;
+    (void)I2S3ext->SR;
+    /* Play silence until the first block is computed rather than whatever was
+     * left in the buffer. */
+    memset(codecDmaTxBuf,0,sizeof(codecDmaTxBuf));
+    /* Rewind the streams and clear their flags */
+    DMA1->HIFCR |= 0x0f400000;
+    DMA1->LIFCR |= 0x0000003d;
+    DMA1_Stream7->NDTR = (uint32_t)(CODEC_DMA_BUF_LEN * 2);
+    DMA1_Stream0->NDTR = (uint32_t)(CODEC_DMA_BUF_LEN * 2);
+    DMA1_Stream0->CR |= DMA_SxCR_EN;
+    /* Enable the slave while word select is high (see STM32F429 errata) */
+    if (i2s_wait_reg(&GPIOA->IDR, (1 << 15), 0)
+            || i2s_wait_reg(&GPIOA->IDR, (1 << 15), (1 << 15))) {
+        return -1;
+    }
+    I2S3ext->I2SCFGR |= SPI_I2SCFGR_I2SE;
+    /* Start transmitting on the left channel so the channels aren't swapped */
+    if (i2s_wait_reg16(&SPI3->SR, SPI_SR_TXE | SPI_SR_CHSIDE, SPI_SR_TXE)) {
+        return -1;
+    }
+    DMA1_Stream7->CR |= DMA_SxCR_EN;
+    /* Check the slave gets a frame without error. The RX stream reads DR as
+     * soon as RXNE is set, so watch the stream move instead of RXNE. */
+    if (i2s_wait_ndtr(DMA1_Stream0,
+                (uint32_t)(CODEC_DMA_BUF_LEN * 2 - CODEC_NUM_CHANNELS))
+            || (I2S3ext->SR & (SPI_SR_OVR | 0x100))
+            || (DMA1->LISR & (DMA_LISR_TEIF0 | DMA_LISR_DMEIF0))) {
+        return -1;
+    }
+    /* The streams start at the first half, so the next block to compute is the
+     * second half. */
+    codecDmaTxPtr = codecDmaTxBuf + CODEC_DMA_BUF_LEN;
+    codecDmaRxPtr = codecDmaRxBuf + CODEC_DMA_BUF_LEN;
+    return 0;
 }
 
-void codec_prog_reg_i2c(uint8_t addr,
-                               uint8_t reg_addr,
-                               uint16_t reg_val)
+static void i2s_full_resync(void)
 {
-    /* Send start condition */
-    I2C2->CR1 |= I2C_CR1_START;
-    /* Wait for start condition */
-    while (!codec_i2c_check_flags(0x00010001));
-    /* Send address */
-    I2C2->DR = addr;
-    /* Wait for ADDR bit to be set */
-    while (!codec_i2c_check_flags(0x00020000));
-    uint32_t byte1, byte2;
-    byte1 = codec_format_reg_addr(reg_addr,reg_val);
-    byte2 = (uint8_t)(reg_val & 0xff);
-    /* Wait for I2C to finish transmitting */
-    while(!codec_i2c_check_flags(0x00800000));
-    I2C2->DR = byte1;
-    /* Wait for I2C to finish transmitting */
-    while(!codec_i2c_check_flags(0x00800000));
-    I2C2->DR = byte2;
-    /* Wait for I2C to finish transmitting */
-    while(!codec_i2c_check_flags(0x00800000));
-    /* Send stop bit */
-    I2C2->CR1 |= I2C_CR1_STOP;
-    /* Wait while I2C busy */
-    while(codec_i2c_check_flags(0x00000002));
+        i2s_codec_correct_frame_error();
+        i2s_peripherals_disable();
+        i2s_peripherals_setup(rate);
+        i2s_audio_start();
 }
 
-void codec_read_reg_i2c(uint8_t addr,
-                               uint8_t reg_addr,
-                               uint16_t *reg_val)
+static void i2s_correct_frame_error(void)
 {
-    /* Write 1 byte (register address) */
-    /* Send start condition */
-    I2C2->CR1 |= I2C_CR1_START;
-    /* Wait for start condition */
-    while (!codec_i2c_check_flags(0x00010001));
-    /* Send address */
-    I2C2->DR = addr;
-    /* Wait for ADDR bit to be set */
-    while (!codec_i2c_check_flags(0x00020000));
-    uint32_t byte1;
-    byte1 = codec_format_reg_addr(reg_addr,*reg_val);
-    /* Wait for I2C to finish transmitting */
-    while(!codec_i2c_check_flags(0x00800000));
-    I2C2->DR = byte1;
-    /* Wait for I2C to finish transmitting */
-    while(!codec_i2c_check_flags(0x00800000));
-    /* Send stop bit */
-    I2C2->CR1 |= I2C_CR1_STOP;
-    /* Wait while I2C busy */
-    while(codec_i2c_check_flags(0x00000002));
-    // Enable acknowledge
-    I2C2->CR1 |= I2C_CR1_ACK;
-    /* Send start condition */
-    I2C2->CR1 |= I2C_CR1_START;
-    /* Wait for start condition */
-    while (!codec_i2c_check_flags(0x00010001));
-    /* Send address, set read bit */
-    I2C2->DR = addr | 0x1;
-    /* Wait for receive buffer not empty*/
-    while (!codec_i2c_check_flags(0x00400000));
-    /* Set ACK high */
-    I2C2->CR1 |= I2C_CR1_ACK;
-    /* Read in value */
-    *reg_val = (int16_t)(I2C2->DR);
-    /* Set ACK low */
-    I2C2->CR1 &= ~I2C_CR1_ACK;
-    /* Stop transmission */
-    I2C2->CR1 = (I2C2->CR1 | I2C_CR1_STOP);
+        uint32_t samples;
+        i2s_n_resyncs++;
+        /* If the last fast resync didn't hold, don't try again */
+        if (((i2s_n_blocks - i2s_last_fast_resync_block)
+                    > I2S_RESYNC_ESCALATE_BLOCKS)
+                && (i2s_fast_resync() == 0)) {
+            i2s_resync_stats.n_fast++;
+            i2s_last_fast_resync_block = i2s_n_blocks;
+        } else {
+            i2s_full_resync();
+            i2s_resync_stats.n_full++;
+        }
+        /* Time from the frame error to audio running again */
+        samples = (uint32_t)(((uint64_t)(DWT->CYCCNT - i2s_frame_error_cycles)
+                    * rate) / get_SystemCoreClock());
+        i2s_resync_stats.last_samples = samples;
+        if (samples > i2s_resync_stats.max_samples) {
+            i2s_resync_stats.max_samples = samples;
+        }
 }
 
-static void codec_i2c_setup(void)
+void i2s_get_resync_stats(i2s_resync_stats_t *stats)
 {
-    /* Enable GPIOB, I2C2 clock */
-    RCC->APB1ENR |= RCC_APB1ENR_I2C2EN;
-    RCC->AHB1ENR |= RCC_AHB1ENR_GPIOBEN | RCC_AHB1ENR_GPIOCEN;
-    /* Reset I2C clock */
-    RCC->APB1RSTR |= RCC_APB1RSTR_I2C2RST;
-    RCC->APB1RSTR &= ~RCC_APB1RSTR_I2C2RST;
-    /* Enable CE pin to set codec's address */
-    GPIOC->MODER &= ~(0x3 << (2 * 13));
-    /* Set to output */
-    GPIOC->MODER |= (0x1 << (2 * 13));
-    /* Set to Open/Drain */
-//    GPIOC->OTYPER |= (0x1 << 13);
-    /* High speed (?) */
-    GPIOC->OSPEEDR &= ~(0x3 << (2* 13));
-    GPIOC->OSPEEDR |= (0x2 << (2* 13));
-    /* Pull down */
-    GPIOC->PUPDR &= ~(0x3 << (2 * 13));
-    GPIOC->PUPDR |= (0x2 << (2 * 13));
-    /* Set low */
-    GPIOC->ODR &= ~(0x1 << 13);
-    /* Enable I2C2 Pins, set to AF */
-    /* PB10,PB11 */
-    GPIOB->MODER &= ~((0x3 << (2* 10)) | (0x3 << (2*11)));
-    GPIOB->MODER |= ((0x2 << (2* 10)) | (0x2 << (2*11)));
-    /* High speed (?) */
-    GPIOB->OSPEEDR &= ~((0x3 << (2* 10)) | (0x3 << (2*11)));
-    GPIOB->OSPEEDR |= ((0x2 << (2* 10)) | (0x2 << (2*11)));
-    /* I2C Functions are alternate function 4 */
-    GPIOB->AFR[1] &= ~((0xf << (4*2)) | (0xf << (4*3)));
-    GPIOB->AFR[1] |= ((0x4 << (4*2)) | (0x4 << (4*3)));
-    /* Extra Pull-up */
-    GPIOB->PUPDR &= ~((0x3 << (2 * 10)) | (0x3 << (2 * 11)));
-    GPIOB->PUPDR |= ((0x2 << (2 * 10)) | (0x2 << (2 * 11)));
-    /* Open / Drain */
-    GPIOB->OTYPER |= ((0x1 << 10) | (0x1 << 11));
-    /* Disable peripheral */
-    I2C2->CR1 &= ~I2C_CR1_PE;
-    /* Reset peripheral */
-    I2C2->CR1 |= I2C_CR1_SWRST;
-    I2C2->CR1 &= ~I2C_CR1_SWRST;
-    /* Set clock equal to APB1 clock */
-    I2C2->CR2 &= ~(0x1f);
-    I2C2->CR2 |= (uint32_t)45; /* 45Mhz */
-    /* Set up rise time based on clock and codec's I2C characteristics. */
-    I2C2->TRISE &= ~(0xf3);
-    /* no more than 14 clocks fit into the minimum rise time */
-    I2C2->TRISE |= (uint32_t)14; /* See p. 853 STM32F429 reference manual. */
-    /* Set clock control register (see p. 852 ibid)*/
-    I2C2->CCR = (uint32_t)452; /* SCL is about 50Khz */
-    /* Enable acknowledge */
-//    I2C2->CR1 |= I2C_CR1_ACK;
-    /* Enable peripheral */
-    I2C2->CR1 |= I2C_CR1_PE;
+    *stats = i2s_resync_stats;
+}
+
+void SPI3_IRQHandler (void)
+{
+    NVIC_ClearPendingIRQ(SPI3_IRQn);
+    /* Disable SPI interrupts */
+    NVIC_DisableIRQ(SPI3_IRQn);
+    uint32_t i2s3ext_sr = I2S3ext->SR;
+    static volatile uint32_t num_i2s3ext = 0;
+    /* Check frame error */
+    if (i2s3ext_sr & 0x100) {
+        num_i2s3ext++;
+        if (!i2s_frame_error_flag) {
+            i2s_frame_error_cycles = DWT->CYCCNT;
+        }
+        i2s_frame_error_flag = 1;
+    }
+    /* Enable SPI interrupts */
+    NVIC_EnableIRQ(SPI3_IRQn);
 }
@@ -0,0 +1,13 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#include "stm32f4xx.h" 
+#include "irq_priorities.h" 
+
+/* Call before any interrupt is enabled */
+void irq_priorities_setup(void)
+{
+    int irq;
+    for (irq = 0; irq <= DMA2D_IRQn; irq++) {
+        NVIC_SetPriority((IRQn_Type)irq,IRQ_PRIORITY_DEFAULT);
+    }
+}
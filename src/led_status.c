@@ -4,22 +4,10 @@
 #include "synth_control.h" 
 #include "leds.h"
 
-#define FBK_MODE_INDICATOR_PERIOD 0.125
-#define FMI_ROLLOVER ((int)(FBK_MODE_INDICATOR_PERIOD / ((float)BUFFER_SIZE/CODEC_SAMPLE_RATE)))
-
-struct fbk_mode_indicator {
-    /*
-    Stuff for a flashing indicator
-    how far we've counted
-    */
-    int cnt;
-    /* at what point to change the indicator state */
-    int roll_over;
-    /* indicator state */
-    int indicator_state;
-};
-
-static struct fbk_mode_indicator fbk_mode_indicator = {0,FMI_ROLLOVER,0};
+/* Feedback of all notes is shown by blinking: on for 4 pattern steps (128ms),
+ * off for 4 */
+#define FBK_MODE_INDICATOR_PATTERN 0x0f
+#define FBK_MODE_INDICATOR_PATTERN_STEPS 8
 
 static void
 fbk_mode_indicator_update(void)
@@ -30,36 +18,49 @@ fbk_mode_indicator_update(void)
             led5_reset();
             return;
         case 1:
+            leds_set_pattern(leds_LED5,LEDS_PATTERN_SOLID,1);
             led5_set();
             return;
         case 2:
-            fbk_mode_indicator.cnt++;
-            if (fbk_mode_indicator.cnt >= fbk_mode_indicator.roll_over) {
-                fbk_mode_indicator.indicator_state = 1 - fbk_mode_indicator.indicator_state;
-                fbk_mode_indicator.cnt = 0;
-            }
-            if (fbk_mode_indicator.indicator_state) {
-                led5_set();
-            } else {
-                led5_reset();
-            }
+            leds_set_pattern(leds_LED5,
+                    FBK_MODE_INDICATOR_PATTERN,
+                    FBK_MODE_INDICATOR_PATTERN_STEPS);
+            led5_set();
+            return;
+    }
+}
+
+/* Lit for the first part of each measure */
+static void
+measure_indicator_update(void)
+{
+    float phase = scheduler_get_measure_phase();
+    if ((phase >= 0) && (phase < (1. / MEASURE_LED_LENGTH_SCALAR))) {
+        leds_set_brightness(MEASURE_LED,LEDS_PWM_STEPS);
+    } else {
+        leds_set_brightness(MEASURE_LED,0);
     }
 }
 
+/* This only says what the LEDs should show, they are changed by the LED DMA
+ * interrupt if this is different from before (see leds.c). */
 void led_status_update(void)
 {
     SynthControlPosMode pm;
+    measure_indicator_update();
     pm = synth_control_get_posMode_curParams();
     if (pm == SynthControlPosMode_UNI){
         sched_advance_mode_t sam;
         sam = scheduler_get_advance_mode();
         switch (sam) {
             case sched_advance_mode_INTERNAL:
+                leds_set_pattern(leds_LED5,LEDS_PATTERN_SOLID,1);
                 led1_set();
                 led3_reset();
                 led5_reset();
                 break;
             case sched_advance_mode_MIDI:
+                leds_set_pattern(leds_LED5,LEDS_PATTERN_SOLID,1);
                 led1_reset();
                 led3_set();
                 led5_reset();
@@ -1,6 +1,87 @@
 /* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
 
+#include <string.h>
 #include "leds.h" 
+#include "irq_priorities.h"
+
+typedef struct {
+    /* 0 to LEDS_PWM_STEPS */
+    volatile uint32_t brightness;
+    /* bit n says whether the LED is on in step n of the pattern */
+    volatile uint32_t pattern;
+    /* the number of steps in the pattern (1 to 32) */
+    volatile uint32_t n_steps;
+    /* which port table and pin */
+    uint32_t frame;
+    uint32_t pin;
+} leds_state_t;
+
+static leds_state_t leds_states[leds_N] = {
+    { 0, LEDS_PATTERN_SOLID, 1, LED1_FRAME, LED1_PORT_PIN },
+    { 0, LEDS_PATTERN_SOLID, 1, LED3_FRAME, LED3_PORT_PIN },
+    { 0, LEDS_PATTERN_SOLID, 1, LED5_FRAME, LED5_PORT_PIN },
+    { 0, LEDS_PATTERN_SOLID, 1, LED7_FRAME, LED7_PORT_PIN },
+};
+
+/* The words written to each port's BSRR, two halves of LEDS_HALF_LEN */
+static uint32_t leds_frames[LEDS_N_FRAMES][LEDS_HALF_LEN*2];
+/* The number of table halves that still have to be rewritten because an LED
+ * changed */
+static volatile uint32_t leds_n_dirty_halves = 0;
+/* Counts table halves since starting, for the patterns */
+static uint32_t leds_n_halves = 0;
+
+/* Write one half of the tables from the LEDs' states */
+static void leds_fill_half(uint32_t half)
+{
+    uint32_t f, n, s, step = leds_n_halves / LEDS_PATTERN_STEP_HALVES;
+    uint32_t duty[leds_N];
+    for (n = 0; n < leds_N; n++) {
+        duty[n] = ((leds_states[n].pattern >> (step % leds_states[n].n_steps))
+                & 0x1) ? leds_states[n].brightness : 0;
+    }
+    for (f = 0; f < LEDS_N_FRAMES; f++) {
+        uint32_t *words = &leds_frames[f][half*LEDS_HALF_LEN];
+        /* Write one PWM period and repeat it */
+        for (s = 0; s < LEDS_PWM_STEPS; s++) {
+            uint32_t word = 0;
+            for (n = 0; n < leds_N; n++) {
+                if (leds_states[n].frame != f) {
+                    continue;
+                }
+                /* set the pin if still in the on part, otherwise reset */
+                word |= 0x1 << (leds_states[n].pin + ((s < duty[n]) ? 0 : 16));
+            }
+            words[s] = word;
+        }
+        for (s = 1; s < LEDS_PERIODS_PER_HALF; s++) {
+            memcpy(&words[s*LEDS_PWM_STEPS], words,
+                    sizeof(uint32_t)*LEDS_PWM_STEPS);
+        }
+    }
+}
+
+static void leds_dma_setup(DMA_Stream_TypeDef *stream,
+                           uint32_t channel,
+                           uint32_t *frame,
+                           GPIO_TypeDef *port)
+{
+    stream->CR = 0;
+    while (stream->CR & DMA_SxCR_EN);
+    /* channel, very high priority, 32-bit memory and peripheral, increment
+     * memory, circular, memory to peripheral */
+    stream->CR = (channel << 25)
+        | DMA_SxCR_PL_0 | DMA_SxCR_PL_1
+        | DMA_SxCR_MSIZE_1
+        | DMA_SxCR_PSIZE_1
+        | DMA_SxCR_MINC
+        | DMA_SxCR_CIRC
+        | DMA_SxCR_DIR_0;
+    /* BSRRL is the first half of the 32-bit BSRR */
+    stream->PAR = (uint32_t)&port->BSRRL;
+    stream->M0AR = (uint32_t)frame;
+    stream->NDTR = LEDS_HALF_LEN*2;
+}
 
 void leds_setup(void)
 {
@@ -26,6 +107,102 @@ void leds_setup(void)
     LED_DISCO_GREEN_PORT->MODER &= ~(0x3 << LED_DISCO_GREEN_PORT_PIN*2);
     LED_DISCO_GREEN_PORT->MODER |= (0x1 << LED_DISCO_GREEN_PORT_PIN*2);
 #endif  
+
+    /* All off */
+    leds_fill_half(0);
+    leds_fill_half(1);
+    /* DMA2 because only it can get to the GPIO ports. Stream 1 channel 7 is
+     * requested by TIM8 updating, stream 2 channel 7 by TIM8 compare 1. */
+    RCC->AHB1ENR |= RCC_AHB1ENR_DMA2EN;
+    leds_dma_setup(DMA2_Stream1,7,leds_frames[0],LEDS_FRAME0_PORT);
+    /* Interrupt when each half has been written so it can be updated */
+    DMA2_Stream1->CR |= DMA_SxCR_HTIE | DMA_SxCR_TCIE;
+    DMA2->LIFCR = 0x00000f40;
+    DMA2_Stream1->CR |= DMA_SxCR_EN;
+#if (LEDS_N_FRAMES > 1)
+    leds_dma_setup(DMA2_Stream2,7,leds_frames[1],LEDS_FRAME1_PORT);
+    DMA2->LIFCR = 0x003d0000;
+    DMA2_Stream2->CR |= DMA_SxCR_EN;
+#endif  
+    /* Updating the frames can wait for the audio */
+    NVIC_SetPriority(DMA2_Stream1_IRQn,IRQ_PRIORITY_DEFAULT);
+    NVIC_EnableIRQ(DMA2_Stream1_IRQn);
+
+    /* TIM8 counts at 180MHz and updates LEDS_PWM_STEPS times per PWM period */
+    RCC->APB2ENR |= RCC_APB2ENR_TIM8EN;
+    TIM8->CR1 = 0;
+    TIM8->PSC = 0;
+    TIM8->ARR = (180000000 / (LEDS_PWM_FREQ * LEDS_PWM_STEPS)) - 1;
+    /* Compare 1 matches at the start of each count, the same time as the
+     * update, so both streams are requested together */
+    TIM8->CCR1 = 0;
+    TIM8->DIER = TIM_DIER_UDE
+#if (LEDS_N_FRAMES > 1)
+        | TIM_DIER_CC1DE
+#endif  
+        ;
+    TIM8->CR1 = TIM_CR1_CEN;
+}
+
+/* The half of the table that was just written by the DMA is updated if an LED
+ * changed or a pattern went to its next step. */
+void DMA2_Stream1_IRQHandler(void)
+{
+    NVIC_ClearPendingIRQ(DMA2_Stream1_IRQn);
+    uint32_t lisr = DMA2->LISR, half;
+    if (lisr & DMA_LISR_TCIF1) {
+        DMA2->LIFCR = DMA_LIFCR_CTCIF1;
+        half = 1;
+    } else if (lisr & DMA_LISR_HTIF1) {
+        DMA2->LIFCR = DMA_LIFCR_CHTIF1;
+        half = 0;
+    } else {
+        DMA2->LIFCR = DMA_LIFCR_CTEIF1 | DMA_LIFCR_CDMEIF1 | DMA_LIFCR_CFEIF1;
+        return;
+    }
+    leds_n_halves++;
+    if ((leds_n_halves % LEDS_PATTERN_STEP_HALVES) == 0) {
+        /* Both halves need the pattern's next step */
+        leds_n_dirty_halves = 2;
+    }
+    if (leds_n_dirty_halves) {
+        leds_n_dirty_halves--;
+        leds_fill_half(half);
+    }
+}
+
+/* These just change what the DMA interrupt will write, so they can be called
+ * from anywhere. */
+void leds_set_brightness(leds_led_t led, uint32_t brightness)
+{
+    if (brightness > LEDS_PWM_STEPS) {
+        brightness = LEDS_PWM_STEPS;
+    }
+    if (leds_states[led].brightness != brightness) {
+        leds_states[led].brightness = brightness;
+        leds_n_dirty_halves = 2;
+    }
+}
+
+uint32_t leds_get_brightness(leds_led_t led)
+{
+    return leds_states[led].brightness;
+}
+
+/* The LED is lit in step n of the pattern if bit n of pattern is set. Each
+ * step lasts LEDS_PATTERN_STEP_HALVES table halves and there are n_steps (1 to
+ * 32) steps before it repeats. */
+void leds_set_pattern(leds_led_t led, uint32_t pattern, uint32_t n_steps)
+{
+    if ((n_steps == 0) || (n_steps > 32)) {
+        n_steps = 32;
+    }
+    if ((leds_states[led].pattern != pattern)
+            || (leds_states[led].n_steps != n_steps)) {
+        leds_states[led].n_steps = n_steps;
+        leds_states[led].pattern = pattern;
+        leds_n_dirty_halves = 2;
+    }
 }
 
 void led_disco_green_set(void)
@@ -51,60 +228,64 @@ void led_disco_green_tog(void)
 
 void led1_set(void)
 {
-    LED1_PORT->ODR |= 0x1 << LED1_PORT_PIN;
+    leds_set_brightness(leds_LED1,LEDS_PWM_STEPS);
 }
-    
+
 void led1_reset(void)
 {
-    LED1_PORT->ODR &= ~(0x1 << LED1_PORT_PIN);
+    leds_set_brightness(leds_LED1,0);
 }
 
 void led1_tog(void)
 {
-    LED1_PORT->ODR ^= 0x1 << LED1_PORT_PIN;
+    leds_set_brightness(leds_LED1,
+            leds_get_brightness(leds_LED1) ? 0 : LEDS_PWM_STEPS);
 }
 
 void led3_set(void)
 {
-    LED3_PORT->ODR |= 0x1 << LED3_PORT_PIN;
+    leds_set_brightness(leds_LED3,LEDS_PWM_STEPS);
 }
-    
+
 void led3_reset(void)
 {
-    LED3_PORT->ODR &= ~(0x1 << LED3_PORT_PIN);
+    leds_set_brightness(leds_LED3,0);
 }
 
 void led3_tog(void)
 {
-    LED3_PORT->ODR ^= 0x1 << LED3_PORT_PIN;
+    leds_set_brightness(leds_LED3,
+            leds_get_brightness(leds_LED3) ? 0 : LEDS_PWM_STEPS);
 }
 
 void led5_set(void)
 {
-    LED5_PORT->ODR |= 0x1 << LED5_PORT_PIN;
+    leds_set_brightness(leds_LED5,LEDS_PWM_STEPS);
 }
-    
+
 void led5_reset(void)
 {
-    LED5_PORT->ODR &= ~(0x1 << LED5_PORT_PIN);
+    leds_set_brightness(leds_LED5,0);
 }
 
 void led5_tog(void)
 {
-    LED5_PORT->ODR ^= 0x1 << LED5_PORT_PIN;
+    leds_set_brightness(leds_LED5,
+            leds_get_brightness(leds_LED5) ? 0 : LEDS_PWM_STEPS);
 }
 
 void led7_set(void)
 {
-    LED7_PORT->ODR |= 0x1 << LED7_PORT_PIN;
+    leds_set_brightness(leds_LED7,LEDS_PWM_STEPS);
 }
-    
+
 void led7_reset(void)
 {
-    LED7_PORT->ODR &= ~(0x1 << LED7_PORT_PIN);
+    leds_set_brightness(leds_LED7,0);
 }
 
 void led7_tog(void)
 {
-    LED7_PORT->ODR ^= 0x1 << LED7_PORT_PIN;
+    leds_set_brightness(leds_LED7,
+            leds_get_brightness(leds_LED7) ? 0 : LEDS_PWM_STEPS);
 }
@@ -0,0 +1,139 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#include "load_governor.h"
+#include "signal_chain.h"
+#include "poly_management.h"
+
+static load_governor_config_t config = {
+    .shed_pct = LOAD_GOVERNOR_SHED_PCT,
+    .restore_pct = LOAD_GOVERNOR_RESTORE_PCT,
+    .shed_blocks = LOAD_GOVERNOR_SHED_BLOCKS,
+    .hold_blocks = LOAD_GOVERNOR_HOLD_BLOCKS,
+    .restore_blocks = LOAD_GOVERNOR_RESTORE_BLOCKS,
+    .reduced_voices = LOAD_GOVERNOR_REDUCED_VOICES
+};
+
+static load_governor_level_t level = load_governor_level_FULL;
+/* Blocks since the level last changed */
+static uint32_t blocks_since_change = 0;
+/* Consecutive blocks over the shed threshold */
+static uint32_t busy_blocks = 0;
+/* Consecutive blocks under the restore threshold */
+static uint32_t quiet_blocks = 0;
+/* Number of times a level was shed, for looking at in gdb */
+uint32_t load_governor_n_sheds = 0;
+
+/* Do what is needed to go from level-1 to level */
+static void
+shed(load_governor_level_t lvl)
+{
+    switch (lvl) {
+        case load_governor_level_LINEAR_INTERP:
+            signal_chain_set_interp(MMInterpMethod_LINEAR);
+            break;
+        case load_governor_level_FEWER_VOICES:
+            pm_set_max_voices(config.reduced_voices);
+            break;
+        case load_governor_level_NO_FEEDBACK:
+            signal_chain_feedback_path_bypass(1);
+            break;
+        default:
+            break;
+    }
+}
+
+/* Undo what shed(lvl) did */
+static void
+restore(load_governor_level_t lvl)
+{
+    switch (lvl) {
+        case load_governor_level_LINEAR_INTERP:
+            signal_chain_set_interp(MMInterpMethod_CUBIC);
+            break;
+        case load_governor_level_FEWER_VOICES:
+            pm_set_max_voices(NUM_NOTES);
+            break;
+        case load_governor_level_NO_FEEDBACK:
+            signal_chain_feedback_path_bypass(0);
+            break;
+        default:
+            break;
+    }
+}
+
+void load_governor_setup(void)
+{
+    while (level > load_governor_level_FULL) {
+        restore(level);
+        level--;
+    }
+    blocks_since_change = 0;
+    busy_blocks = 0;
+    quiet_blocks = 0;
+}
+
+/* The highest level that can be shed to now */
+static load_governor_level_t
+max_level(void)
+{
+    if (wtr.state == MMWavTabRecorderState_RECORDING) {
+        return load_governor_level_NO_FEEDBACK - 1;
+    }
+    return load_governor_level_N - 1;
+}
+
+void load_governor_set_config(load_governor_config_t *c)
+{
+    config = *c;
+    if (level >= load_governor_level_FEWER_VOICES) {
+        pm_set_max_voices(config.reduced_voices);
+    }
+}
+
+/* Call once per block from the audio interrupt with the number of cycles the
+ * last block took and the number of cycles available per block. */
+void load_governor_update(uint32_t block_cycles, uint32_t block_period)
+{
+    /* 64-bit so that a block that ran very long does not overflow */
+    uint64_t load = (uint64_t)block_cycles * 100;
+    blocks_since_change++;
+    /* A recording was started, give it the feedback path back */
+    while (level > max_level()) {
+        restore(level);
+        level--;
+        blocks_since_change = 0;
+    }
+    if (load > (uint64_t)config.shed_pct * block_period) {
+        quiet_blocks = 0;
+        busy_blocks++;
+        /* Only shed if the load stays high, and give the last change time to
+         * show its effect before shedding more */
+        if ((busy_blocks >= config.shed_blocks)
+                && (blocks_since_change >= config.hold_blocks)
+                && (level < max_level())) {
+            level++;
+            shed(level);
+            load_governor_n_sheds++;
+            blocks_since_change = 0;
+            busy_blocks = 0;
+        }
+    } else if (load < (uint64_t)config.restore_pct * block_period) {
+        busy_blocks = 0;
+        quiet_blocks++;
+        if ((quiet_blocks >= config.restore_blocks)
+                && (level > load_governor_level_FULL)) {
+            restore(level);
+            level--;
+            quiet_blocks = 0;
+            blocks_since_change = 0;
+        }
+    } else {
+        busy_blocks = 0;
+        quiet_blocks = 0;
+    }
+}
+
+load_governor_level_t load_governor_get_level(void)
+{
+    return level;
+}
@@ -19,6 +19,17 @@
 #include "timers.h" 
 #include "synth_midi_control.h" 
 #include "startup_polling.h" 
+#include "cycle_profiler.h" 
+#include "load_governor.h" 
+#include "xrun_history.h" 
+#include "recording_flash.h" 
+#include "midi_bulk.h" 
+#include "telemetry.h" 
+#include "midi_clock_out.h" 
+#include "irq_priorities.h" 
+#ifdef DSP_BENCH
+#include "dsp_bench.h" 
+#endif
 
 #if defined(RAM_INTEGRITY_TEST) || defined(RAM_INTEGRITY_TEST2) || defined(RAM_INTEGRITY_TEST3)
 #include "fmc.h"
@@ -58,12 +69,18 @@ debug_ram_integrity_read_write(void)
 
 #define INITIAL_COUNT 1000000L 
 
+/* CPU cycles from the start of main until the audio is started and how many of
+ * those SampleTable_init took. Look at these from gdb. */
+uint32_t main_boot_cycles = 0;
+uint32_t main_sample_table_init_cycles = 0;
+
 int main (void)
 {
 #ifdef RAM_INTEGRITY_TEST
     debug_ram_integrity();
 #endif 
 #ifdef AUDIO_HW_TEST_THROUGHPUT 
+    irq_priorities_setup();
     if (audio_setup(NULL)) {
         THROW_ERR("Error setting up audio.");
     }
@@ -71,20 +88,37 @@ int main (void)
     while(1) {
     }
 #else
+    /* Before anything else uses the stack */
+    telemetry_stack_paint();
+    /* Count cycles to time the boot */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    uint32_t t_boot = DWT->CYCCNT;
+    /* Before any interrupt is enabled */
+    irq_priorities_setup();
     if (audio_setup(NULL)) {
         THROW_ERR("Error setting up audio.");
     }
     if (midi_setup(NULL)) {
         THROW_ERR("Error setting up MIDI.");
     }
+    uint32_t t_tables = DWT->CYCCNT;
     SampleTable_init();
+    main_sample_table_init_cycles = DWT->CYCCNT - t_tables;
+    /* Put back the recording saved in flash, if there is one */
+    recording_flash_restore();
     signal_chain_setup();
+#ifdef DSP_BENCH
+    /* Time the DSP kernels and stop, see test/dsp_bench.c */
+    dsp_bench_run();
+    while (1);
+#endif
     synth_control_setup();
     scheduler_setup();
     leds_setup();
     timers_setup();
     switches_setup();
-    adc_setup_dma_scan(adc_mode_1SHOT);
+    adc_setup_dma_scan(adc_mode_TIM);
     adc_channel_setup();
     synth_adc_control_setup();
     adc_start_conversion();
@@ -95,7 +129,17 @@ int main (void)
     sc_presets_init(reset_request,&midi_channel);
     synth_switch_control_setup();
     synth_midi_control_setup(midi_channel);
+    cycle_profiler_setup();
+    cycle_profiler_attach_sigchain(&sigChain);
+    load_governor_setup();
+    xrun_history_setup();
+    midi_bulk_setup();
+    telemetry_setup();
+    midi_clock_out_setup();
+    main_boot_cycles = DWT->CYCCNT - t_boot;
     audio_start();
+    /* Clear the playing table if nothing was restored into it */
+    SampleTable_zero_start();
 #ifdef RAM_INTEGRITY_TEST2
     debug_ram_integrity();
 #endif 
@@ -106,6 +150,12 @@ int main (void)
     timers_enable();
 #endif
     while(1) {
+        /* Compress and save a recording when asked to */
+        recording_flash_poll();
+        /* Send and load presets and send the sound over MIDI */
+        midi_bulk_poll();
+        /* Send the load of the audio interrupt when turned on */
+        telemetry_poll();
     }
 #endif /* AUDIO_HW_TEST_THROUGHPUT */
     return(0);
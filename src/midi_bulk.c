@@ -0,0 +1,363 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#include <string.h>
+#include "midi_bulk.h"
+#include "midi_sysex.h"
+#include "uart_midi_lowlevel.h"
+#include "synth_control_presets.h"
+#include "wavetables.h"
+#include "audio_setup.h"
+#include "system_init.h"
+#include "stm32f4xx.h"
+
+/* Room left in the transmit queue for the replies sent by the audio
+ * interrupt, the longest being the deadline miss history */
+#define MIDI_BULK_TX_RESERVE 320
+/* Bytes a message with n bytes of payload takes: F0, the IDs, the command,
+ * the packed payload and F7 */
+#define MIDI_BULK_MSG_SIZE(n) (5 + MIDI_SYSEX_PACKED_LEN(n))
+/* Payload sizes of the other messages */
+#define MIDI_BULK_END_SIZE 18
+#define MIDI_BULK_ACK_SIZE 6
+
+#if (3 + MIDI_SYSEX_PACKED_LEN(MIDI_BULK_DATA_HDR_SIZE \
+        + MIDI_BULK_PACKET_SIZE)) > MIDI_SYSEX_RX_BUF_SIZE
+#error "A bulk data packet doesn't fit in MIDI_SYSEX_RX_BUF_SIZE."
+#endif
+
+typedef enum {
+    midi_bulk_state_IDLE,
+    midi_bulk_state_DUMP,
+    midi_bulk_state_LOAD,
+} midi_bulk_state_t;
+
+midi_bulk_stats_t midi_bulk_stats;
+
+static midi_sysex_handler_t mb_handlers[3];
+/* The message waiting for midi_bulk_poll, still packed. Filled by the audio
+ * interrupt. */
+static uint8_t mb_rx_cmd;
+static uint8_t mb_rx_buf[MIDI_SYSEX_RX_BUF_SIZE];
+static uint32_t mb_rx_len = 0;
+static volatile int mb_rx_full = 0;
+/* An acknowledgement that didn't fit in the transmit queue yet. No more
+ * messages are handled until it is sent. */
+static uint8_t mb_ack[MIDI_BULK_ACK_SIZE];
+static int mb_ack_pending = 0;
+
+static midi_bulk_state_t mb_state = midi_bulk_state_IDLE;
+static midi_bulk_what_t mb_what;
+static midi_bulk_status_t mb_status;
+/* Bytes sent or loaded so far, the total and their sum */
+static uint32_t mb_offset, mb_total, mb_sum;
+/* Cycles since the transfer started, counted in midi_bulk_poll because
+ * transfers take longer than the cycle counter takes to wrap */
+static uint64_t mb_cycles;
+static uint32_t mb_last_time = 0;
+/* The sound being sent */
+static const MMSample *mb_area;
+/* A packet being made or taken apart, the unpacked bytes never outnumber the
+ * packed ones */
+static uint8_t mb_packet[MIDI_SYSEX_RX_BUF_SIZE];
+
+static uint8_t *
+put_le(uint8_t *buf, uint32_t val, int nbytes)
+{
+    while (nbytes--) {
+        *buf++ = val & 0xff;
+        val >>= 8;
+    }
+    return buf;
+}
+
+static uint32_t
+get_le(const uint8_t *buf, int nbytes)
+{
+    uint32_t val = 0;
+    while (nbytes--) {
+        val = (val << 8) | buf[nbytes];
+    }
+    return val;
+}
+
+static int
+mb_send(uint8_t cmd, const uint8_t *payload, uint32_t len)
+{
+    if (midi_hw_get_tx_space()
+            < (int)(MIDI_BULK_MSG_SIZE(len) + MIDI_BULK_TX_RESERVE)) {
+        return -1;
+    }
+    if (midi_sysex_send(cmd,payload,len)) {
+        return -1;
+    }
+    midi_bulk_stats.wire_bytes += MIDI_BULK_MSG_SIZE(len);
+    return 0;
+}
+
+static void
+mb_send_ack(midi_bulk_what_t what, midi_bulk_status_t status)
+{
+    uint8_t *ptr = mb_ack;
+    *ptr++ = what;
+    *ptr++ = status;
+    put_le(ptr,mb_offset,4);
+    mb_ack_pending = mb_send(midi_sysex_cmd_BULK_ACK,mb_ack,
+                             MIDI_BULK_ACK_SIZE) ? 1 : 0;
+}
+
+static uint32_t
+mb_ms(void)
+{
+    return (uint32_t)(mb_cycles / (get_SystemCoreClock() / 1000));
+}
+
+static void
+mb_start(midi_bulk_state_t state, midi_bulk_what_t what, uint32_t total)
+{
+    mb_state = state;
+    mb_what = what;
+    mb_status = midi_bulk_status_OK;
+    mb_offset = 0;
+    mb_total = total;
+    mb_sum = 0;
+    mb_cycles = 0;
+    midi_bulk_stats.wire_bytes = 0;
+}
+
+static void
+mb_finish(midi_bulk_status_t status)
+{
+    midi_bulk_stats.data_bytes = mb_offset;
+    midi_bulk_stats.ms = mb_ms();
+    midi_bulk_stats.bytes_per_sec = midi_bulk_stats.ms ?
+        (uint32_t)((uint64_t)mb_offset * 1000 / midi_bulk_stats.ms) : 0;
+    midi_bulk_stats.status = status;
+    mb_state = midi_bulk_state_IDLE;
+}
+
+/* Fills mb_packet with the next n bytes of what is being dumped. Returns -1
+ * if they can't be had. */
+static int
+mb_dump_fill(uint8_t *dest, uint32_t n)
+{
+    uint32_t i;
+    switch (mb_what) {
+        case midi_bulk_what_PRESETS:
+            return sc_presets_read_bank(mb_offset,dest,n);
+        case midi_bulk_what_SAMPLE:
+            /* If the table is now the one that is recorded into, what is
+             * there isn't the sound anymore */
+            if (recordingSound->area == mb_area) {
+                return -1;
+            }
+            for (i = 0; i < n; i += 2) {
+                int32_t x = (int32_t)(mb_area[(mb_offset + i) / 2] * 32767.f);
+                x = x > 32767 ? 32767 : (x < -32768 ? -32768 : x);
+                dest = put_le(dest,(uint32_t)x,2);
+            }
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+/* Sends as many packets of the dump as fit in the transmit queue, then the
+ * end of the dump. */
+static void
+mb_dump_next(void)
+{
+    uint32_t n;
+    uint8_t *ptr;
+    while (mb_offset < mb_total) {
+        n = mb_total - mb_offset;
+        if (n > MIDI_BULK_PACKET_SIZE) {
+            n = MIDI_BULK_PACKET_SIZE;
+        }
+        /* Check first so the packet isn't made for nothing */
+        if (midi_hw_get_tx_space() < (int)(MIDI_BULK_MSG_SIZE(
+                        MIDI_BULK_DATA_HDR_SIZE + n) + MIDI_BULK_TX_RESERVE)) {
+            return;
+        }
+        ptr = mb_packet;
+        *ptr++ = mb_what;
+        ptr = put_le(ptr,mb_offset,4);
+        if (mb_dump_fill(ptr,n)) {
+            mb_status = midi_bulk_status_FAILED;
+            break;
+        }
+        if (mb_send(midi_sysex_cmd_BULK_DATA,mb_packet,
+                    MIDI_BULK_DATA_HDR_SIZE + n)) {
+            return;
+        }
+        while (n--) {
+            mb_sum += *ptr++;
+            mb_offset++;
+        }
+    }
+    ptr = mb_packet;
+    *ptr++ = mb_what;
+    *ptr++ = mb_status;
+    ptr = put_le(ptr,mb_offset,4);
+    ptr = put_le(ptr,mb_sum,4);
+    ptr = put_le(ptr,mb_ms(),4);
+    ptr = put_le(ptr,mb_what == midi_bulk_what_SAMPLE ?
+            audio_hw_get_sample_rate(NULL) : 0,4);
+    if (mb_send(midi_sysex_cmd_BULK_END,mb_packet,MIDI_BULK_END_SIZE)) {
+        return;
+    }
+    mb_finish(mb_status);
+}
+
+static void
+mb_dump_request(midi_bulk_what_t what)
+{
+    if (mb_state != midi_bulk_state_IDLE) {
+        mb_send_ack(what,midi_bulk_status_BUSY);
+        return;
+    }
+    switch (what) {
+        case midi_bulk_what_PRESETS:
+            mb_start(midi_bulk_state_DUMP,what,sc_presets_get_bank_size());
+            break;
+        case midi_bulk_what_SAMPLE:
+            mb_start(midi_bulk_state_DUMP,what,
+                     ((MMArray*)theSound->wavtab)->length * 2);
+            mb_area = theSound->area;
+            break;
+        default:
+            mb_send_ack(what,midi_bulk_status_UNSUPPORTED);
+            break;
+    }
+}
+
+static void
+mb_load_data(midi_bulk_what_t what, uint32_t offset,
+             const uint8_t *data, uint32_t n)
+{
+    if (what != midi_bulk_what_PRESETS) {
+        mb_send_ack(what,midi_bulk_status_UNSUPPORTED);
+        return;
+    }
+    if (mb_state == midi_bulk_state_DUMP) {
+        mb_send_ack(what,midi_bulk_status_BUSY);
+        return;
+    }
+    /* A packet at 0 (re)starts the load */
+    if (offset == 0) {
+        mb_start(midi_bulk_state_LOAD,what,sc_presets_get_bank_size());
+    }
+    if ((mb_state != midi_bulk_state_LOAD) || (offset != mb_offset)
+            || sc_presets_write_bank(offset,data,n)) {
+        /* The acknowledgement says where to carry on from */
+        mb_send_ack(what,midi_bulk_status_BAD_OFFSET);
+        return;
+    }
+    mb_offset += n;
+    while (n--) {
+        mb_sum += *data++;
+    }
+    mb_send_ack(what,midi_bulk_status_OK);
+}
+
+static void
+mb_load_end(midi_bulk_what_t what, uint32_t total, uint32_t sum)
+{
+    midi_bulk_status_t status = midi_bulk_status_OK;
+    if ((mb_state != midi_bulk_state_LOAD) || (what != mb_what)) {
+        mb_send_ack(what,midi_bulk_status_FAILED);
+        return;
+    }
+    if ((total != mb_offset) || (total != mb_total) || (sum != mb_sum)) {
+        status = midi_bulk_status_BAD_CHECKSUM;
+    } else if (sc_presets_store_bank()) {
+        status = midi_bulk_status_FAILED;
+    }
+    mb_finish(status);
+    mb_send_ack(what,status);
+}
+
+static void
+mb_handle_msg(void)
+{
+    uint32_t len = midi_sysex_unpack7(mb_rx_buf,mb_rx_len,mb_packet);
+    if (len < 1) {
+        return;
+    }
+    switch (mb_rx_cmd) {
+        case midi_sysex_cmd_BULK_DUMP_REQUEST:
+            mb_dump_request(mb_packet[0]);
+            break;
+        case midi_sysex_cmd_BULK_DATA:
+            if (len >= MIDI_BULK_DATA_HDR_SIZE) {
+                mb_load_data(mb_packet[0],get_le(mb_packet + 1,4),
+                             mb_packet + MIDI_BULK_DATA_HDR_SIZE,
+                             len - MIDI_BULK_DATA_HDR_SIZE);
+            }
+            break;
+        case midi_sysex_cmd_BULK_END:
+            if (len >= 10) {
+                mb_load_end(mb_packet[0],get_le(mb_packet + 2,4),
+                            get_le(mb_packet + 6,4));
+            }
+            break;
+        default:
+            break;
+    }
+    midi_bulk_stats.wire_bytes += mb_rx_len + 5;
+}
+
+/* Called from the audio interrupt. Only keeps the message, it is handled by
+ * midi_bulk_poll. */
+static void
+sysex_bulk(void *data, const uint8_t *payload, uint32_t len)
+{
+    if (mb_rx_full) {
+        midi_bulk_stats.dropped++;
+        return;
+    }
+    mb_rx_cmd = ((midi_sysex_handler_t*)data)->cmd;
+    memcpy(mb_rx_buf,payload,len);
+    mb_rx_len = len;
+    mb_rx_full = 1;
+}
+
+void midi_bulk_setup(void)
+{
+    static const uint8_t cmds[] = {
+        midi_sysex_cmd_BULK_DUMP_REQUEST,
+        midi_sysex_cmd_BULK_DATA,
+        midi_sysex_cmd_BULK_END,
+    };
+    uint32_t n;
+    for (n = 0; n < sizeof(cmds); n++) {
+        mb_handlers[n] = (midi_sysex_handler_t) {
+            .cmd = cmds[n],
+            .func = sysex_bulk,
+            .data = &mb_handlers[n],
+        };
+        midi_sysex_handler_add(&mb_handlers[n]);
+    }
+    mb_last_time = DWT->CYCCNT;
+}
+
+/* Call this from the main loop. Handles the message that came and sends the
+ * next packets of a dump. */
+void midi_bulk_poll(void)
+{
+    uint32_t now = DWT->CYCCNT;
+    mb_cycles += now - mb_last_time;
+    mb_last_time = now;
+    if (mb_ack_pending) {
+        if (mb_send(midi_sysex_cmd_BULK_ACK,mb_ack,MIDI_BULK_ACK_SIZE)) {
+            return;
+        }
+        mb_ack_pending = 0;
+    }
+    if (mb_rx_full) {
+        mb_handle_msg();
+        mb_rx_full = 0;
+    }
+    if (mb_state == midi_bulk_state_DUMP) {
+        mb_dump_next();
+    }
+}
@@ -0,0 +1,185 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#include "midi_clock_out.h"
+#include "uart_midi_lowlevel.h"
+#include "scheduling.h"
+#include "audio_setup.h"
+#include "stm32f4xx.h"
+#include "irq_priorities.h"
+
+/* A clock waiting to be sent. start is non-zero if a start should be sent
+ * with it. */
+typedef struct {
+    uint32_t time;
+    uint32_t start;
+} midi_clock_out_tick_t;
+
+static volatile int midi_clock_out_enabled = 0;
+/* Whether the scheduler was playing measures last block */
+static int midi_clock_out_was_running = 0;
+/* TIM5's count when the audio interrupt started */
+static uint32_t midi_clock_out_block_time = 0;
+/* Filled by the audio interrupt, emptied by the TIM5 interrupt */
+static midi_clock_out_tick_t midi_clock_out_queue[MIDI_CLOCK_OUT_QUEUE_SIZE];
+static volatile uint32_t midi_clock_out_head = 0, midi_clock_out_tail = 0;
+static uint32_t midi_clock_out_last_sent = 0;
+static int midi_clock_out_have_last = 0;
+
+midi_clock_out_stats_t midi_clock_out_stats;
+
+void midi_clock_out_setup(void)
+{
+    RCC->APB1ENR |= RCC_APB1ENR_TIM5EN;
+    /* Free running 32-bit count, the clock counts at a rate of
+     * 90MHz/(TIM5->PSC + 1) */
+    TIM5->PSC = (uint16_t)(90000000 / MIDI_CLOCK_OUT_TIMER_HZ - 1);
+    TIM5->ARR = 0xffffffff;
+    /* Load the prescaler */
+    TIM5->EGR = TIM_EGR_UG;
+    TIM5->SR = 0;
+    TIM5->CR1 = TIM_CR1_CEN;
+    /* So the clock can interrupt the audio interrupt */
+    NVIC_SetPriority(TIM5_IRQn,IRQ_PRIORITY_MIDI_OUT);
+    NVIC_EnableIRQ(TIM5_IRQn);
+}
+
+/* Called from the audio interrupt when control change 69 is received */
+void midi_clock_out_set_enabled(int enabled)
+{
+    if (enabled && !midi_clock_out_enabled) {
+        /* Send a start with the next measure if one is already playing */
+        midi_clock_out_was_running = 0;
+        midi_clock_out_have_last = 0;
+        midi_clock_out_stats = (midi_clock_out_stats_t){0};
+    } else if (!enabled && midi_clock_out_enabled
+            && midi_clock_out_was_running) {
+        midi_hw_send_realtime(MIDI_HW_RT_STOP);
+    }
+    midi_clock_out_enabled = enabled;
+}
+
+int midi_clock_out_get_enabled(void)
+{
+    return midi_clock_out_enabled;
+}
+
+/* Set the compare to the next clock, with interrupts disabled. If it's already
+ * due the interrupt happens right away. */
+static void midi_clock_out_arm(void)
+{
+    uint32_t time = midi_clock_out_queue[midi_clock_out_tail
+        & (MIDI_CLOCK_OUT_QUEUE_SIZE - 1)].time;
+    TIM5->CCR1 = time;
+    TIM5->SR = ~TIM_SR_CC1IF;
+    if ((int32_t)(time - TIM5->CNT) <= 0) {
+        TIM5->EGR = TIM_EGR_CC1G;
+    }
+    TIM5->DIER |= TIM_DIER_CC1IE;
+}
+
+/* Call first thing in the audio interrupt, the clocks are timed from here */
+void midi_clock_out_mark_block(void)
+{
+    midi_clock_out_block_time = TIM5->CNT;
+}
+
+/* Call from the audio interrupt after the scheduler has been advanced. Queues
+ * the clocks that fell in this block. */
+void midi_clock_out_block(void)
+{
+    uint32_t offsets[MIDI_CLOCK_OUT_MAX_PER_BLOCK],
+             block_size = audio_hw_get_block_size(NULL),
+             sample_rate = audio_hw_get_sample_rate(NULL),
+             head = midi_clock_out_head,
+             primask;
+    int n, n_offsets, running, start = 0;
+    if (!midi_clock_out_enabled) {
+        return;
+    }
+    running = scheduler_get_measure_phase() >= 0;
+    if (running && !midi_clock_out_was_running) {
+        start = 1;
+    } else if (!running && midi_clock_out_was_running) {
+        midi_hw_send_realtime(MIDI_HW_RT_STOP);
+    }
+    midi_clock_out_was_running = running;
+    n_offsets = scheduler_get_clock_offsets(offsets,
+                                            MIDI_CLOCK_OUT_MAX_PER_BLOCK);
+    for (n = 0; n < n_offsets; n++) {
+        if ((head - midi_clock_out_tail) == MIDI_CLOCK_OUT_QUEUE_SIZE) {
+            midi_clock_out_stats.missed++;
+            continue;
+        }
+        midi_clock_out_queue[head & (MIDI_CLOCK_OUT_QUEUE_SIZE - 1)] =
+            (midi_clock_out_tick_t) {
+                .time = midi_clock_out_block_time
+                    + (uint32_t)((uint64_t)(block_size + offsets[n])
+                        * MIDI_CLOCK_OUT_TIMER_HZ / sample_rate),
+                /* The measure started at the end of the block, which is the
+                 * last clock */
+                .start = start && (n == (n_offsets - 1))
+            };
+        head++;
+    }
+    if (head == midi_clock_out_head) {
+        return;
+    }
+    primask = __get_PRIMASK();
+    __disable_irq();
+    midi_clock_out_head = head;
+    if (!(TIM5->DIER & TIM_DIER_CC1IE)) {
+        midi_clock_out_arm();
+    }
+    __set_PRIMASK(primask);
+}
+
+/* Sends the clock that is due and waits for the next one */
+void TIM5_IRQHandler(void)
+{
+    uint32_t now = TIM5->CNT, late, interval;
+    midi_clock_out_tick_t *t;
+    NVIC_ClearPendingIRQ(TIM5_IRQn);
+    if (!(TIM5->SR & TIM_SR_CC1IF)) {
+        return;
+    }
+    TIM5->SR = ~TIM_SR_CC1IF;
+    if (midi_clock_out_tail == midi_clock_out_head) {
+        TIM5->DIER &= ~TIM_DIER_CC1IE;
+        return;
+    }
+    t = &midi_clock_out_queue[midi_clock_out_tail
+        & (MIDI_CLOCK_OUT_QUEUE_SIZE - 1)];
+    if ((int32_t)(t->time - now) > 0) {
+        /* Not due yet, the compare will happen again */
+        return;
+    }
+    if (t->start) {
+        midi_hw_send_realtime(MIDI_HW_RT_START);
+    }
+    midi_hw_send_realtime(MIDI_HW_RT_CLOCK);
+    late = now - t->time;
+    if (late > midi_clock_out_stats.late_max_us) {
+        midi_clock_out_stats.late_max_us = late;
+    }
+    interval = now - midi_clock_out_last_sent;
+    if (midi_clock_out_have_last
+            && (interval < MIDI_CLOCK_OUT_MAX_INTERVAL_US)) {
+        midi_clock_out_stats.interval_us = interval;
+        if ((midi_clock_out_stats.interval_min_us == 0)
+                || (interval < midi_clock_out_stats.interval_min_us)) {
+            midi_clock_out_stats.interval_min_us = interval;
+        }
+        if (interval > midi_clock_out_stats.interval_max_us) {
+            midi_clock_out_stats.interval_max_us = interval;
+        }
+    }
+    midi_clock_out_last_sent = now;
+    midi_clock_out_have_last = 1;
+    midi_clock_out_stats.clocks++;
+    midi_clock_out_tail++;
+    if (midi_clock_out_tail == midi_clock_out_head) {
+        TIM5->DIER &= ~TIM_DIER_CC1IE;
+    } else {
+        midi_clock_out_arm();
+    }
+}
@@ -1,8 +1,15 @@
 /* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
 
 #include "midi_setup.h" 
+#include "scheduling.h" 
+#include "synth_midi_control.h" 
+#include "midi_clock_out.h" 
+#include "midi_util.h" 
 
 MIDI_Router_Standard midiRouter;
+midi_thru_stats_t midi_thru_stats;
+
+static volatile int midi_thru_enabled = 0;
 
 int midi_setup(void *data)
 {
@@ -10,7 +17,70 @@ int midi_setup(void *data)
     return(midi_hw_setup(NULL));
 }
 
+/* Called from the audio interrupt when control change 70 is received */
+void midi_thru_set_enabled(int enabled)
+{
+    if (enabled && !midi_thru_enabled) {
+        midi_thru_stats = (midi_thru_stats_t){0};
+    }
+    midi_thru_enabled = enabled;
+}
+
+/* Send a received message out again. It is queued whole so it isn't split by
+ * anything else being sent. Real-time messages go ahead of the queue, except
+ * the clock, start and stop if the clock is being sent from here. */
+static void midi_thru(MIDIMsg *msg)
+{
+    int n, len = midi_util_msg_length(msg->data[0]);
+    uint32_t latency;
+    midi_hw_tx_t tx;
+    if (len == 0) {
+        return;
+    }
+    latency = (DWT->CYCCNT - midi_hw_get_msg_time())
+        + midi_hw_get_tx_wait_cycles();
+    if (len == 1) {
+        if (midi_clock_out_get_enabled()
+                && ((msg->data[0] == (char)MIDI_HW_RT_CLOCK)
+                    || (msg->data[0] == (char)MIDI_HW_RT_START)
+                    || (msg->data[0] == (char)MIDI_HW_RT_CONTINUE)
+                    || (msg->data[0] == (char)MIDI_HW_RT_STOP))) {
+            return;
+        }
+        if (midi_hw_send_realtime(msg->data[0])) {
+            midi_thru_stats.dropped++;
+            return;
+        }
+    } else {
+        if (midi_hw_tx_begin(&tx,len)) {
+            midi_thru_stats.dropped++;
+            return;
+        }
+        for (n = 0; n < len; n++) {
+            midi_hw_tx_put(&tx,msg->data[n]);
+        }
+        midi_hw_tx_end(&tx);
+    }
+    midi_thru_stats.msgs++;
+    midi_thru_stats.latency = latency;
+    /* Moves an eighth of the way each message */
+    midi_thru_stats.latency_avg += ((int32_t)(latency
+                - midi_thru_stats.latency_avg)) / 8;
+    if (latency > midi_thru_stats.latency_max) {
+        midi_thru_stats.latency_max = latency;
+    }
+}
+
 void midi_hw_process_msg(MIDIMsg *msg)
 {
-    MIDI_Router_handleMsg(&midiRouter.router, msg);
+    if (midi_thru_enabled) {
+        midi_thru(msg);
+    }
+    /* Notes and clocks from the message happen at the sample it arrived at */
+    scheduler_set_event_offset(midi_hw_get_msg_offset());
+    /* Control changes are looked up directly, the rest go to the router */
+    if (!synth_midi_control_handle_cc(msg)) {
+        MIDI_Router_handleMsg(&midiRouter.router, msg);
+    }
+    scheduler_set_event_offset(0);
 }
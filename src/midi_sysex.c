@@ -0,0 +1,127 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#include <stddef.h>
+#include "midi_sysex.h"
+#include "uart_midi_lowlevel.h"
+
+static midi_sysex_handler_t *handlers = NULL;
+static uint8_t rx_buf[MIDI_SYSEX_RX_BUF_SIZE];
+static uint32_t rx_len = 0;
+/* Set if the message being received didn't fit in rx_buf */
+static int rx_overflow = 0;
+
+void midi_sysex_handler_add(midi_sysex_handler_t *h)
+{
+    h->next = handlers;
+    handlers = h;
+}
+
+/* Pack len 8-bit bytes into 7-bit bytes. Returns the number of bytes written
+ * to out, which is MIDI_SYSEX_PACKED_LEN(len). */
+uint32_t midi_sysex_pack7(const uint8_t *in, uint32_t len, uint8_t *out)
+{
+    uint32_t n, m, written = 0;
+    for (n = 0; n < len; n += 7) {
+        uint8_t *msbs = out++;
+        *msbs = 0;
+        written++;
+        for (m = 0; (m < 7) && ((n + m) < len); m++) {
+            *msbs |= ((in[n + m] >> 7) & 0x1) << m;
+            *out++ = in[n + m] & 0x7f;
+            written++;
+        }
+    }
+    return written;
+}
+
+/* Undo midi_sysex_pack7. len is the number of packed bytes. Returns the number
+ * of bytes written to out. */
+uint32_t midi_sysex_unpack7(const uint8_t *in, uint32_t len, uint8_t *out)
+{
+    uint32_t n, m, written = 0;
+    for (n = 0; n < len; n += 8) {
+        uint8_t msbs = in[n];
+        for (m = 1; (m < 8) && ((n + m) < len); m++) {
+            *out++ = (in[n + m] & 0x7f) | (((msbs >> (m - 1)) & 0x1) << 7);
+            written++;
+        }
+    }
+    return written;
+}
+
+/* Send a message with command cmd, packing len bytes of payload. The whole
+ * message is queued or nothing is; returns -1 if there wasn't room. Interrupts
+ * are disabled while it is queued so it can be called from the main loop and
+ * the audio interrupt without the messages being interleaved. */
+int midi_sysex_send(uint8_t cmd, const uint8_t *payload, uint32_t len)
+{
+    uint8_t buf[8];
+    uint32_t n, m, i;
+    midi_hw_tx_t tx;
+    /* Reserving the whole message keeps anything sent from an interrupt from
+     * landing in the middle of it */
+    if (midi_hw_tx_begin(&tx,4 + MIDI_SYSEX_PACKED_LEN(len) + 1)) {
+        return -1;
+    }
+    midi_hw_tx_put(&tx,MIDI_SYSEX_START);
+    midi_hw_tx_put(&tx,MIDI_SYSEX_MANUFACTURER_ID);
+    midi_hw_tx_put(&tx,MIDI_SYSEX_DEVICE_ID);
+    midi_hw_tx_put(&tx,cmd & 0x7f);
+    for (n = 0; n < len; n += 7) {
+        m = midi_sysex_pack7(payload + n,
+                             ((len - n) > 7) ? 7 : (len - n),
+                             buf);
+        for (i = 0; i < m; i++) {
+            midi_hw_tx_put(&tx,buf[i]);
+        }
+    }
+    midi_hw_tx_put(&tx,MIDI_SYSEX_END);
+    midi_hw_tx_end(&tx);
+    return 0;
+}
+
+static void
+dispatch(void)
+{
+    midi_sysex_handler_t *h = handlers;
+    if ((rx_len < 3)
+            || (rx_buf[0] != MIDI_SYSEX_MANUFACTURER_ID)
+            || (rx_buf[1] != MIDI_SYSEX_DEVICE_ID)) {
+        /* Not for us */
+        return;
+    }
+    while (h) {
+        if (h->cmd == rx_buf[2]) {
+            h->func(h->data, rx_buf + 3, rx_len - 3);
+        }
+        h = h->next;
+    }
+}
+
+/* These are called by the MIDI parser as a system exclusive message is
+ * received. Status bytes (F0, F7) are not stored. */
+void midi_hw_signal_sysex_start(char byte)
+{
+    rx_len = 0;
+    rx_overflow = 0;
+}
+
+void midi_hw_send_sysex_byte(char byte)
+{
+    if ((uint8_t)byte & 0x80) {
+        return;
+    }
+    if (rx_len >= MIDI_SYSEX_RX_BUF_SIZE) {
+        rx_overflow = 1;
+        return;
+    }
+    rx_buf[rx_len++] = (uint8_t)byte;
+}
+
+void midi_hw_send_sysex_end(char byte)
+{
+    if (!rx_overflow) {
+        dispatch();
+    }
+    rx_len = 0;
+}
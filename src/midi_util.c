@@ -6,3 +6,36 @@ float midi_util_map_midpoint_exact(float mdata, float x0, float x1)
     return (m - x0) * (mdata / 64.) + x0;
 }
 
+/* The same for a 14-bit value, 8192 maps exactly to the midpoint */
+float midi_util_map_midpoint_exact_14bit(float mdata, float x0, float x1)
+{
+    float m = (x0 + x1)* 0.5;
+    if (mdata == 8192) { return m; }
+    if (mdata > 8192) { return (x1 - m) * (mdata - 8192) / 8191. + m; }
+    return (m - x0) * (mdata / 8192.) + x0;
+}
+
+
+/* The number of bytes in a message starting with this status byte, or 0 if it
+ * isn't a status byte or the message doesn't have a fixed length (system
+ * exclusive) */
+int midi_util_msg_length(char status)
+{
+    unsigned char s = (unsigned char)status;
+    if (s < 0x80) { return 0; }
+    if (s < 0xc0) { return 3; }
+    if (s < 0xe0) { return 2; }
+    if (s < 0xf0) { return 3; }
+    switch (s) {
+        case 0xf1:
+        case 0xf3:
+            return 2;
+        case 0xf2:
+            return 3;
+        case 0xf6:
+            return 1;
+        default:
+            /* Real-time messages */
+            return (s >= 0xf8) ? 1 : 0;
+    }
+}
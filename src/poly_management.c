@@ -8,6 +8,10 @@ uint32_t voiceAllocator = 0xffffffff;
 
 MMPolyManager *pvm;
 
+/* New notes are only given voices below this number. Lowered by the load
+ * governor to limit the number of simultaneous voices. */
+static int max_voices = NUM_NOTES;
+
 void poly_management_setup(void)
 {
     /* Make poly voice manager */
@@ -39,7 +43,7 @@ void pm_claim_params_from_allocator(void *allocator, void *params)
 int pm_get_next_free_voice_number(void)
 {
     int n;
-    for (n = 0; n < NUM_NOTES; n++) {
+    for (n = 0; n < max_voices; n++) {
         if ((voiceAllocator >> n) & 0x1) {
             return n;
         }
@@ -47,6 +51,34 @@ int pm_get_next_free_voice_number(void)
     return -1; /* no voices free */
 }
 
+/* Limit the number of voices new notes can be given. Voices already playing
+ * above the limit are left to finish. */
+void pm_set_max_voices(int n)
+{
+    if (n < 1) {
+        n = 1;
+    }
+    if (n > NUM_NOTES) {
+        n = NUM_NOTES;
+    }
+    max_voices = n;
+}
+
+int pm_get_max_voices(void)
+{
+    return max_voices;
+}
+
+/* The number of voices currently playing */
+int pm_get_n_busy_voices(void)
+{
+    int n, n_busy = 0;
+    for (n = 0; n < NUM_NOTES; n++) {
+        n_busy += (~voiceAllocator >> n) & 0x1;
+    }
+    return n_busy;
+}
+
 /* Call the function voice_cb on each busy voice. This implementation will pass
  * a pointer to a value of type int to voice_cb */
 void pm_do_for_each_busy_voice(void *allocator, void (*voice_cb)(void *params))
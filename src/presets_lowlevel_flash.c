@@ -1,17 +1,371 @@
 /* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
 
-/* Implementation of preset recalling when the standard i/o functionality is
- * available like fwrite fread etc. */
+/* Presets are kept in flash as a log of records spread over two sectors. A
+ * record holds some bytes of the storage and where they go, so storing one
+ * preset only programs a few hundred bytes at the end of the log. When the
+ * current sector is full, the other sector is erased, the whole storage is
+ * written into it as records and then its header is written with a sequence
+ * number one more than the full sector's. At boot the sector with a valid
+ * header and the larger sequence number is the current one and its records
+ * are replayed in order. A record that was only partly written when the power
+ * went has a bad CRC and is skipped. */
 #include "presets_lowlevel.h"
 #include "flash_commanding.h" 
-#include <stdlib.h> 
-#include <stdio.h> 
+#include "stm32f4xx.h" 
 #include <string.h> 
 
-/* There's no need to initialize flash really. */
+#define PRESETS_LOG_SECTOR_MAGIC 0x50524c47
+#define PRESETS_LOG_RECORD_MAGIC 0x5052
+#define PRESETS_LOG_VERSION 1
+/* The most bytes of the storage held by one record */
+#define PRESETS_LOG_MAX_PAYLOAD 512
+/* The most regions waiting to be stored. If there are more, the whole storage
+ * is stored instead. */
+#define PRESETS_LOG_MAX_PENDING 8
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    /* ~seq */
+    uint32_t seq_inv;
+    uint32_t version;
+} presets_log_sector_hdr_t;
+
+typedef struct {
+    /* PRESETS_LOG_RECORD_MAGIC << 16 | the number of bytes held */
+    uint32_t magic_len;
+    uint32_t seq;
+    /* where the bytes go in the storage */
+    uint32_t offset;
+    /* CRC of the words above and the bytes */
+    uint32_t crc;
+} presets_log_record_hdr_t;
+
+/* Bytes taken in flash by a record holding len bytes */
+#define PRESETS_LOG_RECORD_SIZE(len) \
+    (sizeof(presets_log_record_hdr_t) + (((len) + 3) & ~0x3))
+
+typedef enum {
+    presets_log_state_IDLE,
+    presets_log_state_APPEND,
+    presets_log_state_GC_ERASE,
+    presets_log_state_GC_COPY,
+    presets_log_state_GC_HEADER,
+} presets_log_state_t;
+
+typedef struct {
+    uint32_t offset;
+    uint32_t len;
+} presets_log_region_t;
+
+static const uint32_t presets_log_sectors[2] = {
+    FLASH_PRESETS_SECTOR0,
+    FLASH_PRESETS_SECTOR1,
+};
+static const uint32_t presets_log_addrs[2] = {
+    FLASH_PRESETS_SECTOR0_ADDR,
+    FLASH_PRESETS_SECTOR1_ADDR,
+};
+
+/* The storage in RAM, records are made from this when they are programmed */
+static const uint8_t *presets_log_image = NULL;
+static uint32_t presets_log_image_size = 0;
+/* Non-zero if a sector had a valid header at boot or has one since */
+static int presets_log_valid = 0;
+/* The sector records are added to */
+static int presets_log_cur = 1;
+static uint32_t presets_log_sector_seq = 0;
+static uint32_t presets_log_record_seq = 0;
+/* Where the next record goes in the current sector */
+static uint32_t presets_log_write_pos = 0;
+/* Non-zero if no more records should go in the current sector */
+static int presets_log_full = 1;
+/* Regions of the storage still to be stored, in the order asked for */
+static presets_log_region_t presets_log_pending[PRESETS_LOG_MAX_PENDING];
+static uint32_t presets_log_n_pending = 0;
+static presets_log_state_t presets_log_state = presets_log_state_IDLE;
+/* How much of the storage has been copied during garbage collection and
+ * where in the new sector the next record goes */
+static uint32_t presets_log_gc_pos = 0;
+static uint32_t presets_log_gc_write_pos = 0;
+static flash_cmd_t presets_log_cmd;
+/* What is being programmed, it has to stay put until done */
+static uint32_t presets_log_staging[(sizeof(presets_log_record_hdr_t)
+        + PRESETS_LOG_MAX_PAYLOAD) / 4];
+
+static uint32_t presets_log_lock(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    return primask;
+}
+
+static void presets_log_unlock(uint32_t primask)
+{
+    if (!primask) {
+        __enable_irq();
+    }
+}
+
+static uint32_t presets_log_crc(const presets_log_record_hdr_t *rec,
+                                const uint32_t *payload,
+                                uint32_t len)
+{
+    uint32_t n;
+    CRC->CR = CRC_CR_RESET;
+    CRC->DR = rec->magic_len;
+    CRC->DR = rec->seq;
+    CRC->DR = rec->offset;
+    for (n = 0; n < (len + 3) / 4; n++) {
+        CRC->DR = payload[n];
+    }
+    return CRC->DR;
+}
+
+static int presets_log_sector_valid(int sector)
+{
+    const presets_log_sector_hdr_t *hdr =
+        (const presets_log_sector_hdr_t*)presets_log_addrs[sector];
+    return (hdr->magic == PRESETS_LOG_SECTOR_MAGIC)
+        && (hdr->seq_inv == ~hdr->seq)
+        && (hdr->version == PRESETS_LOG_VERSION);
+}
+
+/* Hops from record to record in the sector, copying the bytes of those with a
+ * good CRC into dest if it isn't NULL. Returns where the records end. Sets
+ * *torn if what follows the last record isn't erased flash, in which case
+ * nothing more can be added to the sector. */
+static uint32_t presets_log_scan(int sector,
+                                 uint8_t *dest,
+                                 uint32_t size,
+                                 int *torn)
+{
+    uint32_t pos = sizeof(presets_log_sector_hdr_t);
+    *torn = 0;
+    while ((pos + sizeof(presets_log_record_hdr_t))
+            <= FLASH_PRESETS_SECTOR_SIZE) {
+        const presets_log_record_hdr_t *rec =
+            (const presets_log_record_hdr_t*)(presets_log_addrs[sector] + pos);
+        const uint32_t *payload = (const uint32_t*)(rec + 1);
+        uint32_t len = rec->magic_len & 0xffff;
+        if (rec->magic_len == 0xffffffff) {
+            /* Erased, the end of the log */
+            break;
+        }
+        if (((rec->magic_len >> 16) != PRESETS_LOG_RECORD_MAGIC)
+                || (len > PRESETS_LOG_MAX_PAYLOAD)
+                || ((pos + PRESETS_LOG_RECORD_SIZE(len))
+                    > FLASH_PRESETS_SECTOR_SIZE)) {
+            /* Can't tell where the next record would be */
+            *torn = 1;
+            break;
+        }
+        if (presets_log_crc(rec,payload,len) == rec->crc) {
+            if (dest && ((rec->offset + len) <= size)) {
+                memcpy(dest + rec->offset,payload,len);
+            }
+            presets_log_record_seq = rec->seq;
+        }
+        pos += PRESETS_LOG_RECORD_SIZE(len);
+    }
+    return pos;
+}
+
+/* Call with interrupts disabled */
+static void presets_log_add_pending(uint32_t offset, uint32_t len)
+{
+    uint32_t n;
+    for (n = 0; n < presets_log_n_pending; n++) {
+        if ((offset >= presets_log_pending[n].offset)
+                && ((offset + len) <= (presets_log_pending[n].offset
+                        + presets_log_pending[n].len))) {
+            /* Will already be stored */
+            return;
+        }
+    }
+    if (presets_log_n_pending == PRESETS_LOG_MAX_PENDING) {
+        /* Rather than dropping one, store everything */
+        presets_log_pending[0].offset = 0;
+        presets_log_pending[0].len = presets_log_image_size;
+        presets_log_n_pending = 1;
+        return;
+    }
+    presets_log_pending[presets_log_n_pending].offset = offset;
+    presets_log_pending[presets_log_n_pending].len = len;
+    presets_log_n_pending++;
+}
+
+static void presets_log_done(flash_cmd_t *cmd, int err);
+
+static void presets_log_submit(flash_cmd_type_t type,
+                               uint32_t addr,
+                               uint32_t size)
+{
+    presets_log_cmd.type = type;
+    presets_log_cmd.sector = presets_log_sectors[presets_log_cur ^ 1];
+    presets_log_cmd.addr = addr;
+    presets_log_cmd.src = presets_log_staging;
+    presets_log_cmd.size = size;
+    presets_log_cmd.done = presets_log_done;
+    flash_cmd_submit(&presets_log_cmd);
+}
+
+/* Copies len bytes of the storage into a record and starts programming it at
+ * addr. Returns the size of the record. */
+static uint32_t presets_log_program_record(uint32_t addr,
+                                           uint32_t offset,
+                                           uint32_t len)
+{
+    presets_log_record_hdr_t *rec =
+        (presets_log_record_hdr_t*)presets_log_staging;
+    uint32_t *payload = (uint32_t*)(rec + 1);
+    if (len % 4) {
+        payload[len / 4] = 0;
+    }
+    memcpy(payload,presets_log_image + offset,len);
+    rec->magic_len = (PRESETS_LOG_RECORD_MAGIC << 16) | len;
+    rec->seq = ++presets_log_record_seq;
+    rec->offset = offset;
+    rec->crc = presets_log_crc(rec,payload,len);
+    presets_log_submit(flash_cmd_type_PROGRAM,addr,PRESETS_LOG_RECORD_SIZE(len));
+    return PRESETS_LOG_RECORD_SIZE(len);
+}
+
+/* Starts storing the next pending region if nothing is being stored. Call with
+ * interrupts disabled. */
+static void presets_log_next(void)
+{
+    uint32_t len, offset;
+    if ((presets_log_state != presets_log_state_IDLE)
+            || (presets_log_n_pending == 0)) {
+        return;
+    }
+    len = presets_log_pending[0].len;
+    if (len > PRESETS_LOG_MAX_PAYLOAD) {
+        len = PRESETS_LOG_MAX_PAYLOAD;
+    }
+    if ((!presets_log_full) && ((presets_log_write_pos
+                    + PRESETS_LOG_RECORD_SIZE(len))
+                <= FLASH_PRESETS_SECTOR_SIZE)) {
+        offset = presets_log_pending[0].offset;
+        presets_log_pending[0].offset += len;
+        presets_log_pending[0].len -= len;
+        if (presets_log_pending[0].len == 0) {
+            presets_log_n_pending--;
+            memmove(&presets_log_pending[0],&presets_log_pending[1],
+                    sizeof(presets_log_region_t)*presets_log_n_pending);
+        }
+        presets_log_state = presets_log_state_APPEND;
+        presets_log_write_pos += presets_log_program_record(
+                presets_log_addrs[presets_log_cur] + presets_log_write_pos,
+                offset,len);
+        return;
+    }
+    /* Start garbage collection by erasing the other sector */
+    presets_log_state = presets_log_state_GC_ERASE;
+    presets_log_submit(flash_cmd_type_ERASE,0,0);
+}
+
+/* Something went wrong with the flash. Everything is stored in the other
+ * sector the next time something is stored. */
+static void presets_log_fail(void)
+{
+    presets_log_full = 1;
+    presets_log_add_pending(0,presets_log_image_size);
+    presets_log_state = presets_log_state_IDLE;
+}
+
+/* Called from the flash interrupts when each erase or program is done */
+static void presets_log_done(flash_cmd_t *cmd, int err)
+{
+    uint32_t primask = presets_log_lock();
+    uint32_t len;
+    int other = presets_log_cur ^ 1;
+    if (err) {
+        presets_log_fail();
+        presets_log_unlock(primask);
+        return;
+    }
+    switch (presets_log_state) {
+        case presets_log_state_APPEND:
+            presets_log_state = presets_log_state_IDLE;
+            break;
+        case presets_log_state_GC_ERASE:
+            /* Everything is going to be copied */
+            presets_log_n_pending = 0;
+            presets_log_gc_pos = 0;
+            presets_log_gc_write_pos = sizeof(presets_log_sector_hdr_t);
+            presets_log_state = presets_log_state_GC_COPY;
+            /* Fall through */
+        case presets_log_state_GC_COPY:
+            if (presets_log_gc_pos < presets_log_image_size) {
+                len = presets_log_image_size - presets_log_gc_pos;
+                if (len > PRESETS_LOG_MAX_PAYLOAD) {
+                    len = PRESETS_LOG_MAX_PAYLOAD;
+                }
+                presets_log_gc_write_pos += presets_log_program_record(
+                        presets_log_addrs[other] + presets_log_gc_write_pos,
+                        presets_log_gc_pos,len);
+                presets_log_gc_pos += len;
+            } else {
+                /* The header goes last so the sector is only used once
+                 * everything is in it */
+                presets_log_sector_hdr_t *hdr =
+                    (presets_log_sector_hdr_t*)presets_log_staging;
+                hdr->magic = PRESETS_LOG_SECTOR_MAGIC;
+                hdr->seq = presets_log_sector_seq + 1;
+                hdr->seq_inv = ~hdr->seq;
+                hdr->version = PRESETS_LOG_VERSION;
+                presets_log_state = presets_log_state_GC_HEADER;
+                presets_log_submit(flash_cmd_type_PROGRAM,
+                        presets_log_addrs[other],
+                        sizeof(presets_log_sector_hdr_t));
+            }
+            break;
+        case presets_log_state_GC_HEADER:
+            presets_log_cur = other;
+            presets_log_sector_seq++;
+            presets_log_write_pos = presets_log_gc_write_pos;
+            presets_log_full = 0;
+            presets_log_valid = 1;
+            presets_log_state = presets_log_state_IDLE;
+            break;
+        default:
+            break;
+    }
+    presets_log_next();
+    presets_log_unlock(primask);
+}
+
+/* Finds the current sector and the end of its log. */
 presets_lowlevel_err_t presets_lowlevel_init(presets_lowlevel_handle_t
         **handle,void *opt)
 {
+    int n, torn;
+    RCC->AHB1ENR |= RCC_AHB1ENR_CRCEN;
+    presets_log_valid = 0;
+    for (n = 0; n < 2; n++) {
+        if (presets_log_sector_valid(n)) {
+            uint32_t seq =
+                ((const presets_log_sector_hdr_t*)presets_log_addrs[n])->seq;
+            if ((!presets_log_valid) || (seq > presets_log_sector_seq)) {
+                presets_log_cur = n;
+                presets_log_sector_seq = seq;
+                presets_log_valid = 1;
+            }
+        }
+    }
+    if (presets_log_valid) {
+        presets_log_write_pos = presets_log_scan(presets_log_cur,NULL,0,&torn);
+        presets_log_full = torn;
+    } else {
+        /* Nothing stored yet or still the storage written all at once into
+         * the second sector by older firmware. This is kept until the first
+         * store has written the log into the first sector. */
+        presets_log_cur = 1;
+        presets_log_sector_seq = 0;
+        presets_log_full = 1;
+    }
     return(0);
 }
 
@@ -20,26 +374,48 @@ presets_lowlevel_err_t presets_lowlevel_init(presets_lowlevel_handle_t
 presets_lowlevel_err_t presets_lowlevel_read(presets_lowlevel_handle_t *handle,
         void *dest, uint32_t size, void *opt)
 {
+    int torn;
     if (size % 4) {
         return(-1);
     }
-    /* Each datum read is a mulitple of 4 bytes so we divide by 4 to get the
-     * number of reads needed */
-    size /= 4;
-    uint32_t *ptr = (uint32_t*)FLASH_START_ADDR;
-    uint32_t *dest_ptr = (uint32_t*)dest;
-    while (size--) {
-        *dest_ptr++ = *ptr++;
+    if (presets_log_valid) {
+        memset(dest,0,size);
+        presets_log_scan(presets_log_cur,(uint8_t*)dest,size,&torn);
+    } else {
+        memcpy(dest,(const void*)presets_log_addrs[1],size);
     }
     return(0);
 }
 
-presets_lowlevel_err_t presets_lowlevel_write(presets_lowlevel_handle_t *handle,
-        void *src, uint32_t size, void *opt)
+presets_lowlevel_err_t presets_lowlevel_update(presets_lowlevel_handle_t *handle,
+        void *src, uint32_t size, uint32_t offset, uint32_t len, void *opt)
 {
-    if (size % 4) {
-        return (-1);
+    uint32_t primask, n_records;
+    if ((size % 4) || ((offset + len) > size)) {
+        return(-1);
+    }
+    n_records = (size + PRESETS_LOG_MAX_PAYLOAD - 1) / PRESETS_LOG_MAX_PAYLOAD;
+    if ((sizeof(presets_log_sector_hdr_t) + size
+                + n_records*sizeof(presets_log_record_hdr_t))
+            > FLASH_PRESETS_SECTOR_SIZE) {
+        /* Wouldn't fit in a sector */
+        return(-1);
     }
-    flash_request_write(src,size);
+    /* Records are whole words */
+    len += offset % 4;
+    offset -= offset % 4;
+    len = (len + 3) & ~0x3;
+    primask = presets_log_lock();
+    presets_log_image = (const uint8_t*)src;
+    presets_log_image_size = size;
+    presets_log_add_pending(offset,len);
+    presets_log_next();
+    presets_log_unlock(primask);
     return(0);
 }
+
+presets_lowlevel_err_t presets_lowlevel_write(presets_lowlevel_handle_t *handle,
+        void *src, uint32_t size, void *opt)
+{
+    return presets_lowlevel_update(handle,src,size,0,size,opt);
+}
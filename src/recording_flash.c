@@ -0,0 +1,409 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#include "recording_flash.h"
+#include "flash_commanding.h"
+#include "wavetables.h"
+#include "audio_setup.h"
+#include "xrun_history.h"
+#include "stm32f4xx.h"
+
+#define RECORDING_FLASH_MAGIC 0x52454331
+#define RECORDING_FLASH_VERSION 1
+
+/* Written at FLASH_RECORDING_ADDR after all the blocks, so a save that didn't
+ * finish is never restored. */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t n_samples;
+    /* ~n_samples */
+    uint32_t n_samples_inv;
+    uint32_t samplerate;
+    uint32_t n_blocks;
+    uint32_t reserved[2];
+} recording_flash_header_t;
+
+#define RECORDING_FLASH_DATA_ADDR \
+    (FLASH_RECORDING_ADDR + sizeof(recording_flash_header_t))
+#define RECORDING_FLASH_BUF_SIZE \
+    (RECORDING_FLASH_BLOCKS_PER_BUF * RECORDING_FLASH_BLOCK_SIZE)
+
+#if (RECORDING_FLASH_BLOCK_SIZE % FLASH_ACCESS_SIZE)
+#error "RECORDING_FLASH_BLOCK_SIZE must be a multiple of FLASH_ACCESS_SIZE."
+#endif
+
+typedef struct {
+    int32_t predictor;
+    int32_t index;
+} recording_flash_adpcm_t;
+
+static const int8_t ima_index_table[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+static const int16_t ima_step_table[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+    19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+    130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+    5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+recording_flash_stats_t recording_flash_stats;
+
+static volatile recording_flash_state_t rf_state = recording_flash_state_IDLE;
+static volatile int rf_save_requested = 0;
+/* What is being saved */
+static const MMSample *rf_area;
+static uint32_t rf_n_samples;
+static uint32_t rf_n_blocks;
+static uint32_t rf_next_block;
+static uint32_t rf_end_addr;
+static uint32_t rf_write_addr;
+static uint32_t rf_erase_sector;
+static recording_flash_adpcm_t rf_adpcm;
+static uint32_t rf_start_cycles;
+static uint32_t rf_start_xruns;
+/* Set if a flash command failed or the table being saved started being
+ * recorded into */
+static volatile int rf_failed;
+/* For the erases and the header */
+static flash_cmd_t rf_cmd;
+static volatile uint32_t rf_cmd_busy;
+static recording_flash_header_t rf_header;
+/* Compressed while the other is being programmed */
+static uint32_t rf_bufs[2][RECORDING_FLASH_BUF_SIZE/4];
+static flash_cmd_t rf_buf_cmds[2];
+static volatile uint32_t rf_buf_busy[2];
+
+static uint8_t recording_flash_adpcm_encode(recording_flash_adpcm_t *s,
+                                            int32_t sample)
+{
+    int32_t step = ima_step_table[s->index],
+            diff = sample - s->predictor,
+            vpdiff = step >> 3;
+    uint8_t code = 0;
+    if (diff < 0) {
+        code = 8;
+        diff = -diff;
+    }
+    if (diff >= step) {
+        code |= 4;
+        diff -= step;
+        vpdiff += step;
+    }
+    step >>= 1;
+    if (diff >= step) {
+        code |= 2;
+        diff -= step;
+        vpdiff += step;
+    }
+    step >>= 1;
+    if (diff >= step) {
+        code |= 1;
+        vpdiff += step;
+    }
+    s->predictor += (code & 8) ? -vpdiff : vpdiff;
+    s->predictor = s->predictor > 32767 ? 32767 :
+        (s->predictor < -32768 ? -32768 : s->predictor);
+    s->index += ima_index_table[code];
+    s->index = s->index < 0 ? 0 : (s->index > 88 ? 88 : s->index);
+    return code;
+}
+
+static int32_t recording_flash_adpcm_decode(recording_flash_adpcm_t *s,
+                                            uint8_t code)
+{
+    int32_t step = ima_step_table[s->index],
+            vpdiff = step >> 3;
+    if (code & 4) {
+        vpdiff += step;
+    }
+    if (code & 2) {
+        vpdiff += step >> 1;
+    }
+    if (code & 1) {
+        vpdiff += step >> 2;
+    }
+    s->predictor += (code & 8) ? -vpdiff : vpdiff;
+    s->predictor = s->predictor > 32767 ? 32767 :
+        (s->predictor < -32768 ? -32768 : s->predictor);
+    s->index += ima_index_table[code];
+    s->index = s->index < 0 ? 0 : (s->index > 88 ? 88 : s->index);
+    return s->predictor;
+}
+
+/* Compresses n samples (at most RECORDING_FLASH_BLOCK_SAMPLES, the rest of
+ * the block is silence) into a block. */
+static void recording_flash_compress_block(recording_flash_adpcm_t *s,
+                                           const MMSample *src,
+                                           uint32_t n,
+                                           uint8_t *dest)
+{
+    uint32_t i;
+    uint8_t *nibbles = dest + 4;
+    dest[0] = (uint8_t)(s->predictor & 0xff);
+    dest[1] = (uint8_t)((s->predictor >> 8) & 0xff);
+    dest[2] = (uint8_t)s->index;
+    dest[3] = 0;
+    for (i = 0; i < RECORDING_FLASH_BLOCK_SAMPLES; i += 2) {
+        int32_t x0 = 0, x1 = 0;
+        if (i < n) {
+            x0 = (int32_t)(src[i] * 32767.f);
+        }
+        if ((i + 1) < n) {
+            x1 = (int32_t)(src[i + 1] * 32767.f);
+        }
+        x0 = x0 > 32767 ? 32767 : (x0 < -32768 ? -32768 : x0);
+        x1 = x1 > 32767 ? 32767 : (x1 < -32768 ? -32768 : x1);
+        nibbles[i/2] = recording_flash_adpcm_encode(s,x0)
+            | (recording_flash_adpcm_encode(s,x1) << 4);
+    }
+}
+
+/* Returns non-zero if the block wasn't written by recording_flash_compress_block */
+static int recording_flash_decompress_block(const uint8_t *src,
+                                            uint32_t n,
+                                            MMSample *dest)
+{
+    uint32_t i;
+    recording_flash_adpcm_t s;
+    const uint8_t *nibbles = src + 4;
+    s.predictor = (int16_t)(src[0] | (src[1] << 8));
+    s.index = src[2];
+    if (s.index > 88) {
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        uint8_t code = (i & 0x1) ? (nibbles[i/2] >> 4) : (nibbles[i/2] & 0xf);
+        dest[i] = (MMSample)recording_flash_adpcm_decode(&s,code)
+            * (1.f / 32768.f);
+    }
+    return 0;
+}
+
+/* The first address after the sector */
+static uint32_t recording_flash_sector_end(uint32_t sector)
+{
+    /* Sector 16 is 64KB, the others 128KB */
+    return FLASH_RECORDING_ADDR + 0x10000 + (sector - 16) * 0x20000;
+}
+
+static void recording_flash_cmd_done(flash_cmd_t *cmd, int err)
+{
+    if (err) {
+        rf_failed = 1;
+    }
+    *(volatile uint32_t*)cmd->data = 0;
+}
+
+static void recording_flash_submit(flash_cmd_t *cmd,
+                                   volatile uint32_t *busy,
+                                   flash_cmd_type_t type,
+                                   uint32_t sector,
+                                   uint32_t addr,
+                                   const void *src,
+                                   uint32_t size)
+{
+    cmd->type = type;
+    cmd->sector = sector;
+    cmd->addr = addr;
+    cmd->src = src;
+    cmd->size = size;
+    cmd->done = recording_flash_cmd_done;
+    cmd->data = (void*)busy;
+    *busy = 1;
+    flash_cmd_submit(cmd);
+}
+
+/* Asks for the sound being played to be saved. Can be called from anywhere.
+ * Returns -1 if a save is already going on. */
+int recording_flash_save(void)
+{
+    if ((rf_state != recording_flash_state_IDLE) || rf_save_requested) {
+        return -1;
+    }
+    rf_save_requested = 1;
+    return 0;
+}
+
+recording_flash_state_t recording_flash_get_state(void)
+{
+    return rf_state;
+}
+
+static void recording_flash_finish(int failed)
+{
+    recording_flash_stats.save_failed = failed;
+    recording_flash_stats.save_cycles = DWT->CYCCNT - rf_start_cycles;
+    recording_flash_stats.save_xruns = xrun_history_get_count()
+        - rf_start_xruns;
+    rf_state = recording_flash_state_IDLE;
+}
+
+static void recording_flash_start(void)
+{
+    rf_area = theSound->area;
+    rf_n_samples = ((MMArray*)theSound->wavtab)->length;
+    rf_n_blocks = (rf_n_samples + RECORDING_FLASH_BLOCK_SAMPLES - 1)
+        / RECORDING_FLASH_BLOCK_SAMPLES;
+    rf_end_addr = RECORDING_FLASH_DATA_ADDR
+        + rf_n_blocks * RECORDING_FLASH_BLOCK_SIZE;
+    rf_start_cycles = DWT->CYCCNT;
+    rf_start_xruns = xrun_history_get_count();
+    rf_failed = 0;
+    recording_flash_stats.compress_cycles = 0;
+    recording_flash_stats.compress_samples = 0;
+    if ((rf_n_samples == 0) || (rf_end_addr > FLASH_RECORDING_END_ADDR)) {
+        recording_flash_finish(1);
+        return;
+    }
+    rf_erase_sector = FLASH_RECORDING_FIRST_SECTOR;
+    rf_state = recording_flash_state_ERASING;
+    recording_flash_submit(&rf_cmd,&rf_cmd_busy,flash_cmd_type_ERASE,
+            rf_erase_sector,0,NULL,0);
+}
+
+/* Compresses as many blocks as fit in buffer b and has them programmed */
+static void recording_flash_fill_buf(uint32_t b)
+{
+    uint32_t n, size = 0, t_start = DWT->CYCCNT;
+    uint8_t *dest = (uint8_t*)rf_bufs[b];
+    for (n = 0; (n < RECORDING_FLASH_BLOCKS_PER_BUF)
+            && (rf_next_block < rf_n_blocks); n++) {
+        uint32_t first = rf_next_block * RECORDING_FLASH_BLOCK_SAMPLES,
+                 len = rf_n_samples - first;
+        if (len > RECORDING_FLASH_BLOCK_SAMPLES) {
+            len = RECORDING_FLASH_BLOCK_SAMPLES;
+        }
+        recording_flash_compress_block(&rf_adpcm,rf_area + first,len,
+                dest + size);
+        recording_flash_stats.compress_samples += len;
+        size += RECORDING_FLASH_BLOCK_SIZE;
+        rf_next_block++;
+    }
+    recording_flash_stats.compress_cycles += DWT->CYCCNT - t_start;
+    /* If the table is now the one that is recorded into, what was just
+     * compressed might not be the sound anymore */
+    if (recordingSound->area == rf_area) {
+        rf_failed = 1;
+        return;
+    }
+    recording_flash_submit(&rf_buf_cmds[b],&rf_buf_busy[b],
+            flash_cmd_type_PROGRAM,0,rf_write_addr,rf_bufs[b],size);
+    rf_write_addr += size;
+}
+
+/* Call this from the main loop. It does the compressing and starts the flash
+ * commands. */
+void recording_flash_poll(void)
+{
+    uint32_t b;
+    switch (rf_state) {
+        case recording_flash_state_IDLE:
+            if (rf_save_requested) {
+                rf_save_requested = 0;
+                recording_flash_start();
+            }
+            break;
+        case recording_flash_state_ERASING:
+            if (rf_cmd_busy) {
+                break;
+            }
+            if (rf_failed) {
+                recording_flash_finish(1);
+                break;
+            }
+            if (recording_flash_sector_end(rf_erase_sector) < rf_end_addr) {
+                rf_erase_sector++;
+                recording_flash_submit(&rf_cmd,&rf_cmd_busy,
+                        flash_cmd_type_ERASE,rf_erase_sector,0,NULL,0);
+                break;
+            }
+            rf_next_block = 0;
+            rf_write_addr = RECORDING_FLASH_DATA_ADDR;
+            rf_adpcm.predictor = 0;
+            rf_adpcm.index = 0;
+            rf_state = recording_flash_state_WRITING;
+            /* Fall through */
+        case recording_flash_state_WRITING:
+            for (b = 0; b < 2; b++) {
+                if ((!rf_buf_busy[b]) && (!rf_failed)
+                        && (rf_next_block < rf_n_blocks)) {
+                    recording_flash_fill_buf(b);
+                }
+            }
+            if (rf_buf_busy[0] || rf_buf_busy[1]) {
+                break;
+            }
+            if (rf_failed) {
+                recording_flash_finish(1);
+                break;
+            }
+            if (rf_next_block < rf_n_blocks) {
+                break;
+            }
+            rf_header = (recording_flash_header_t) {
+                .magic = RECORDING_FLASH_MAGIC,
+                .version = RECORDING_FLASH_VERSION,
+                .n_samples = rf_n_samples,
+                .n_samples_inv = ~rf_n_samples,
+                .samplerate = audio_hw_get_sample_rate(NULL),
+                .n_blocks = rf_n_blocks,
+            };
+            rf_state = recording_flash_state_HEADER;
+            recording_flash_submit(&rf_cmd,&rf_cmd_busy,
+                    flash_cmd_type_PROGRAM,0,FLASH_RECORDING_ADDR,
+                    &rf_header,sizeof(recording_flash_header_t));
+            break;
+        case recording_flash_state_HEADER:
+            if (!rf_cmd_busy) {
+                recording_flash_finish(rf_failed);
+            }
+            break;
+    }
+}
+
+/* Call at boot after SampleTable_init. Decompresses the saved recording, if
+ * there is one, into the sound that will be played. Returns -1 if there was
+ * none. */
+int recording_flash_restore(void)
+{
+    const recording_flash_header_t *hdr =
+        (const recording_flash_header_t*)FLASH_RECORDING_ADDR;
+    const uint8_t *src = (const uint8_t*)RECORDING_FLASH_DATA_ADDR;
+    uint32_t n, restored = 0, t_start = DWT->CYCCNT;
+    if ((hdr->magic != RECORDING_FLASH_MAGIC)
+            || (hdr->version != RECORDING_FLASH_VERSION)
+            || (hdr->n_samples_inv != ~hdr->n_samples)
+            || (hdr->n_samples == 0)
+            || (hdr->n_samples > soundSampleMaxLength)
+            || (hdr->samplerate != audio_hw_get_sample_rate(NULL))
+            || (hdr->n_blocks != ((hdr->n_samples
+                        + RECORDING_FLASH_BLOCK_SAMPLES - 1)
+                    / RECORDING_FLASH_BLOCK_SAMPLES))) {
+        return -1;
+    }
+    for (n = 0; n < hdr->n_blocks; n++) {
+        uint32_t first = n * RECORDING_FLASH_BLOCK_SAMPLES,
+                 len = hdr->n_samples - first;
+        if (len > RECORDING_FLASH_BLOCK_SAMPLES) {
+            len = RECORDING_FLASH_BLOCK_SAMPLES;
+        }
+        if (recording_flash_decompress_block(src,len,theSound->area + first)) {
+            /* Keep what was good */
+            break;
+        }
+        restored += len;
+        src += RECORDING_FLASH_BLOCK_SIZE;
+    }
+    ((MMArray*)theSound->wavtab)->length = restored;
+    recording_flash_stats.restore_samples = restored;
+    recording_flash_stats.restore_cycles = DWT->CYCCNT - t_start;
+    return 0;
+}
@@ -54,6 +54,7 @@ struct __NoteOnEvent {
     int pitch_idx;      /* The index in the pitch table. Used when busses specify the pitch. */
     int swing_idx;      /* The index in the swing table. */
     SynthControlPitchMode pitch_mode;
+    uint32_t start_offset; /* The sample in the block it should start at */
 };
 
 /* Event that schedules other notes to play. */
@@ -65,27 +66,69 @@ struct __NoteSchedEvent {
     MMSample pitch_offset;
     MMSample amplitude_scalar;
     SynthControlPitchMode pitch_mode;
-};
-
-/* Event that turns off LED indicating measure pulse */
-struct __MeasureLEDOffEvent {
-    MMEvent head;
-    MeasureLEDOffEventListNode *parent;
-    int active;
+    uint32_t start_offset; /* Passed on to the notes played right away */
 };
 
 MMSeq *sequence;
 NoteOnEventListNode noteOnEventListHead[NUM_NOTE_PARAM_SETS];
 NoteSchedEventListNode noteSchedEventListHead;
-MeasureLEDOffEventListNode measureLEDOffEventListHead;
 
 static void NoteOnEvent_happen(MMEvent *event);
 static void NoteSchedEvent_happen(MMEvent *event);
-static void MeasureLEDOffEvent_happen(MMEvent *event);
 static void RecordStartEvent_happen(MMEvent *event);
 static MMTime sched_time_one_frame(void);
 
 static sched_advance_mode_t sched_advance_mode = sched_advance_mode_INTERNAL;
+/* The sample in the block at which events happening now should start, set
+ * while a MIDI message (e.g., a clock) is being handled */
+static uint32_t sched_event_offset = 0;
+
+/* Notes asked for by scheduler_one_shot, played once the scheduler is
+ * advanced so they use the parameters published for the block */
+typedef struct {
+    MMSample pitch_offset;
+    MMSample amplitude;
+    SynthControlPitchMode pitch_mode;
+    uint32_t start_offset;
+} sched_one_shot_t;
+static sched_one_shot_t sched_one_shots[SCHED_MAX_ONE_SHOTS];
+static int sched_n_one_shots = 0;
+
+/* The number of events scheduled that haven't happened yet */
+static int sched_n_pending_events = 0;
+/* When the current measure started and whether there is one */
+static MMTime sched_measure_start = 0;
+static int sched_measure_running = 0;
+/* The scheduler time MIDI clocks are sent relative to, the start of the first
+ * measure since the scheduler was last turned on */
+static MMTime sched_clock_ref = 0;
+/* The scheduler time before and after the last block when it is advanced
+ * internally */
+static MMTime sched_block_start = 0, sched_block_end = 0;
+
+int scheduler_get_n_pending_events(void)
+{
+    return sched_n_pending_events;
+}
+
+/* How far through the current measure the scheduler is, from 0 to 1, or -1 if
+ * no measure is being played (the scheduler is off). */
+float scheduler_get_measure_phase(void)
+{
+    MMTime elapsed;
+    if (!sched_measure_running) {
+        return -1;
+    }
+    elapsed = MMSeq_getCurrentTime(sequence) - sched_measure_start;
+    return (float)elapsed
+        / (float)(SYNTH_CONTROL_DEFAULT_EVENTDELTABEATS * SCHED_BEAT_RES);
+}
+
+/* Called when the scheduler is turned off */
+void scheduler_measure_stop(void)
+{
+    sched_measure_running = 0;
+}
 
 sched_advance_mode_t scheduler_get_advance_mode(void)
 {
@@ -113,10 +156,10 @@ void scheduler_setup(void)
         MMDLList_init(&noteOnEventListHead[n]);
     }
     MMDLList_init(&noteSchedEventListHead);
-    MMDLList_init(&measureLEDOffEventListHead);
 }
 
-NoteOnEvent *NoteOnEvent_new(int active,
+static void NoteOnEvent_init(NoteOnEvent *ev,
+        int active,
         int parameterSet,
         int numRepeats,
         int repeatIndex,
@@ -127,10 +170,6 @@ NoteOnEvent *NoteOnEvent_new(int active,
         int pitch_idx,
         int swing_idx)
 {
-    NoteOnEvent *ev = (NoteOnEvent*)malloc(sizeof(NoteOnEvent));
-    if (!ev) {
-        return NULL;
-    }
     ((MMEvent*)ev)->happen = NoteOnEvent_happen;
     ev->active = active;
     ev->parameterSet = parameterSet;
@@ -145,6 +184,35 @@ NoteOnEvent *NoteOnEvent_new(int active,
     ev->parent = NULL;
     /* Default pitch mode is to look at the bus. */
     ev->pitch_mode = SynthControlPitchMode_BUS;
+    ev->start_offset = 0;
+}
+
+NoteOnEvent *NoteOnEvent_new(int active,
+        int parameterSet,
+        int numRepeats,
+        int repeatIndex,
+        MMSample currentFade,
+        MMSample currentPosition,
+        MMSample currentPitch,
+        MMSample pitchOffset,
+        int pitch_idx,
+        int swing_idx)
+{
+    NoteOnEvent *ev = (NoteOnEvent*)malloc(sizeof(NoteOnEvent));
+    if (!ev) {
+        return NULL;
+    }
+    NoteOnEvent_init(ev,
+            active,
+            parameterSet,
+            numRepeats,
+            repeatIndex,
+            currentFade,
+            currentPosition,
+            currentPitch,
+            pitchOffset,
+            pitch_idx,
+            swing_idx);
     return ev;
 }
 
@@ -170,6 +238,7 @@ NoteSchedEvent *NoteSchedEvent_new(int active)
     ev->amplitude_scalar = 1.;
     /* Default pitch mode is to look at the bus. */
     ev->pitch_mode = SynthControlPitchMode_BUS;
+    ev->start_offset = sched_event_offset;
     return ev;
 }
 
@@ -193,34 +262,9 @@ void NoteSchedEvent_set_one_shot(NoteSchedEvent *nse, int one_shot)
     nse->one_shot = one_shot;
 }
 
-MeasureLEDOffEvent *MeasureLEDOffEvent_new(int active)
-{
-    MeasureLEDOffEvent *ev = (MeasureLEDOffEvent*)malloc(sizeof(MeasureLEDOffEvent));
-    if (!ev) {
-        return NULL;
-    }
-    ((MMEvent*)ev)->happen = MeasureLEDOffEvent_happen;
-    ev->active = active;
-    ev->parent = NULL;
-    return ev;
-}
-
-void schedule_measureLEDOff_event(uint64_t timeFromNow, MeasureLEDOffEvent *ev)
+void scheduler_set_event_offset(uint32_t offset)
 {
-    if (!ev) {
-        return;
-    }
-    ev->parent = (MeasureLEDOffEventListNode*)malloc(sizeof(MeasureLEDOffEventListNode));
-    if (!ev->parent) {
-        free(ev);
-        return;
-    }
-    MMDLList_init(ev->parent);
-    ev->parent->child = ev;
-    MMDLList_insertAfter((MMDLList*)&measureLEDOffEventListHead,
-            (MMDLList*)ev->parent);
-    MMSeq_scheduleEvent(sequence, (MMEvent*)ev,
-            MMSeq_getCurrentTime(sequence) + timeFromNow);
+    sched_event_offset = offset;
 }
 
 void schedule_noteOn_event(uint64_t timeFromNow, NoteOnEvent *ev)
@@ -239,6 +283,7 @@ void schedule_noteOn_event(uint64_t timeFromNow, NoteOnEvent *ev)
             (MMDLList*)ev->parent);
     MMSeq_scheduleEvent(sequence, (MMEvent*)ev,
             MMSeq_getCurrentTime(sequence) + timeFromNow);
+    sched_n_pending_events++;
 }
 
 void schedule_noteSched_event(uint64_t timeFromNow, NoteSchedEvent *ev)
@@ -256,6 +301,7 @@ void schedule_noteSched_event(uint64_t timeFromNow, NoteSchedEvent *ev)
     MMDLList_insertAfter((MMDLList*)&noteSchedEventListHead,(MMDLList*)ev->parent);
     MMSeq_scheduleEvent(sequence, (MMEvent*)ev,
             MMSeq_getCurrentTime(sequence) + timeFromNow);
+    sched_n_pending_events++;
 }
 
 void schedule_RecordStartEvent(
@@ -266,6 +312,7 @@ void schedule_RecordStartEvent(
     MMSeq_scheduleEvent(sequence,
                         (MMEvent*)ev,
                         MMSeq_getCurrentTime(sequence) + timeFromNow);
+    sched_n_pending_events++;
 }
 
 void schedule_RecordStartEvent_next_frame(RecordStartEvent *ev)
@@ -287,167 +334,256 @@ static int short_release_allowed(NoteOnEvent *noe)
             && (noteParamSets[noe->parameterSet].sustainTime == 1);
 }
 
+/* Start the note and schedule its next repeat. Doesn't free noe, so it can be
+ * one that was never scheduled. */
+static void NoteOnEvent_play(NoteOnEvent *noe)
+{
+    /* If numRepeats greater than 0, schedule the note to occur again. The
+     * number of repeats should never be greater than 0 for an event of note
+     * 0 */
+    MMSample _next_pitch;
+    int _next_repeat_idx, _cur_param_set, _next_pitch_idx, _next_swing_idx;
+    _cur_param_set = noe->parameterSet;
+    _next_repeat_idx = noe->repeatIndex + 1;
+    _next_swing_idx = (noe->swing_idx + 1) % SYNTH_CONTROL_SWING_TABLE_SIZE;
+    switch (noe->pitch_mode) {
+        case SynthControlPitchMode_ABSOLUTE:
+            _next_pitch_idx = _next_repeat_idx % SYNTH_CONTROL_PITCH_TABLE_SIZE;
+            _next_pitch =  noteParamSets[_cur_param_set].pitches[_next_pitch_idx]
+                + noteParamSets[_cur_param_set].fine_pitches[_next_pitch_idx];
+            break;
+        case SynthControlPitchMode_RELATIVE:
+            _next_pitch_idx = _next_repeat_idx % SYNTH_CONTROL_PITCH_TABLE_SIZE;
+            _next_pitch =  noe->currentPitch 
+                + (noteParamSets[_cur_param_set].pitches[_next_pitch_idx]
+                    + noteParamSets[_cur_param_set].fine_pitches[_next_pitch_idx]);
+            break;
+        case SynthControlPitchMode_BUS:
+            _next_pitch_idx = _next_repeat_idx % SYNTH_CONTROL_PITCH_TABLE_SIZE;
+            break;
+    }
+    if (noe->numRepeats > 0) {
+        schedule_noteOn_event(
+                (noteParamSets[noe->parameterSet].eventDeltaBeats
+                 * noteParamSets[noe->parameterSet].swing[_next_swing_idx])
+                 * SCHED_BEAT_RES,
+                NoteOnEvent_new(1,
+                    noe->parameterSet,
+                    noe->numRepeats - 1,
+                    _next_repeat_idx,
+                    noe->currentFade 
+                        * noteParamSets[noe->parameterSet].fadeRate,
+                    MM_fwrap(noe->currentPosition
+                        + noteParamSets[noe->parameterSet].positionStride,
+                        0,1),
+                     _next_pitch,
+                     noe->pitchOffset,
+                     _next_pitch_idx,
+                     _next_swing_idx)
+                     );
+    }
+    MMSample voiceNum = pm_get_next_free_voice_number();
+    if (voiceNum != -1 && 
+            ((noteParamSets[noe->parameterSet].amplitude
+                * noe->currentFade) > SCHEDULING_AMP_FLOOR)
+            /* Nothing to play in an empty table */
+            && (MMArray_get_length(theSound->wavtab) > 0)) { 
+        /* there is a voice free */
+        pm_claim_params_from_allocator((void*)&voiceAllocator,
+                (void*)&voiceNum);
+        ((MMEnvedSamplePlayer*)&spsps[(int)voiceNum])->onDone =
+            autorelease_on_done;
+        MMEnvedSamplePlayerTwoBus_set_out_bus(
+                &spsps_2bus_wrappers[(int)voiceNum],
+                NULL);
+        if ((noe->parameterSet == 0) && (synth_control_get_feedbackState() == 1)) {
+            MMEnvedSamplePlayerTwoBus_set_out_bus(
+                    &spsps_2bus_wrappers[(int)voiceNum],
+                    signal_chain_get_n1fbBus());
+        }
+            
+        MMTrapEnvedSamplePlayer_noteOnStruct no;
+        no.note = voiceNum;
+        no.amplitude = noe->currentFade * noteParamSets[noe->parameterSet].initialFade;
+        no.p_gain = &noteParamSets[noe->parameterSet].amplitude; 
+        no.index = MM_fwrap(
+            noteParamSets[noe->parameterSet].startPoint + noe->currentPosition,
+            0,1) * MMArray_get_length(theSound->wavtab);
+        /* These times are in seconds */
+        float sustainTimeSeconds = noteParamSets[noe->parameterSet].sustainTime
+                * (MMSample)MMArray_get_length(theSound->wavtab)
+                / (MMSample)audio_hw_get_sample_rate(NULL),
+            attackTime = sustainTimeSeconds
+                * noteParamSets[noe->parameterSet].attackTime,
+              releaseTime = sustainTimeSeconds
+                * noteParamSets[noe->parameterSet].releaseTime;
+        no.attackTime = MIN(
+            MAX(attackTime,
+                SYNTH_CONTROL_MIN_ATTACK_TIME),
+                SYNTH_CONTROL_MAX_ATTACK_TIME);
+        no.releaseTime = MIN(
+            MAX(releaseTime,
+                SYNTH_CONTROL_MIN_RELEASE_TIME),
+                SYNTH_CONTROL_MAX_RELEASE_TIME);
+        /* So this value should also be in seconds dipshit */
+        no.sustainTime = sustainTimeSeconds - no.attackTime - no.releaseTime;
+        no.samples = theSound->wavtab;
+        MMWavTab_inc_n_players(theSound->wavtab);
+        /* Notes started by a MIDI message are given its offset when
+         * created, notes that come due on a MIDI clock take the clock's */
+        uint32_t start_offset = noe->start_offset ?
+            noe->start_offset : sched_event_offset;
+        signal_chain_voice_delay((int)voiceNum,start_offset);
+        if (noe->pitch_mode == SynthControlPitchMode_BUS) {
+            no.p_rate = &noteParamSets[noe->parameterSet].rate_busses[
+                    noe->pitch_idx];
+            no.rate = MMCC_et12_rate(noe->pitchOffset
+                    + SYNTH_CONTROL_PITCH_OFFSET);
+            MMTrapEnvedSamplePlayer_noteOn_pRate(
+                    &spsps[(int)voiceNum], &no);
+        } else {
+            no.rate = MMCC_et12_rate(
+                    synth_control_clip_valid_pitch(
+                        noe->currentPitch
+                        + noe->pitchOffset));
+            MMTrapEnvedSamplePlayer_noteOn_Rate(
+                    &spsps[(int)voiceNum], &no);
+        }
+    }
+}
+
 static void NoteOnEvent_happen(MMEvent *event)
 {
     NoteOnEvent *noe = (NoteOnEvent*)event;
     /* only play if event is active */
     if (noe->active == 1) {
-        /* If numRepeats greater than 0, schedule the note to occur again. The
-         * number of repeats should never be greater than 0 for an event of note
-         * 0 */
-        MMSample _next_pitch;
-        int _next_repeat_idx, _cur_param_set, _next_pitch_idx, _next_swing_idx;
-        _cur_param_set = noe->parameterSet;
-        _next_repeat_idx = noe->repeatIndex + 1;
-        _next_swing_idx = (noe->swing_idx + 1) % SYNTH_CONTROL_SWING_TABLE_SIZE;
-        switch (noe->pitch_mode) {
-            case SynthControlPitchMode_ABSOLUTE:
-                _next_pitch_idx = _next_repeat_idx % SYNTH_CONTROL_PITCH_TABLE_SIZE;
-                _next_pitch =  noteParamSets[_cur_param_set].pitches[_next_pitch_idx]
-                    + noteParamSets[_cur_param_set].fine_pitches[_next_pitch_idx];
-                break;
-            case SynthControlPitchMode_RELATIVE:
-                _next_pitch_idx = _next_repeat_idx % SYNTH_CONTROL_PITCH_TABLE_SIZE;
-                _next_pitch =  noe->currentPitch 
-                    + (noteParamSets[_cur_param_set].pitches[_next_pitch_idx]
-                        + noteParamSets[_cur_param_set].fine_pitches[_next_pitch_idx]);
-                break;
-            case SynthControlPitchMode_BUS:
-                _next_pitch_idx = _next_repeat_idx % SYNTH_CONTROL_PITCH_TABLE_SIZE;
-                break;
-        }
-        if (noe->numRepeats > 0) {
-            schedule_noteOn_event(
-                    (noteParamSets[noe->parameterSet].eventDeltaBeats
-                     * noteParamSets[noe->parameterSet].swing[_next_swing_idx])
-                     * SCHED_BEAT_RES,
-                    NoteOnEvent_new(1,
-                        noe->parameterSet,
-                        noe->numRepeats - 1,
-                        _next_repeat_idx,
-                        noe->currentFade 
-                            * noteParamSets[noe->parameterSet].fadeRate,
-                        MM_fwrap(noe->currentPosition
-                            + noteParamSets[noe->parameterSet].positionStride,
-                            0,1),
-                         _next_pitch,
-                         noe->pitchOffset,
-                         _next_pitch_idx,
-                         _next_swing_idx)
-                         );
-        }
-        MMSample voiceNum = pm_get_next_free_voice_number();
-        if (voiceNum != -1 && 
-                ((noteParamSets[noe->parameterSet].amplitude
-                    * noe->currentFade) > SCHEDULING_AMP_FLOOR)) { 
-            /* there is a voice free */
-            pm_claim_params_from_allocator((void*)&voiceAllocator,
-                    (void*)&voiceNum);
-            ((MMEnvedSamplePlayer*)&spsps[(int)voiceNum])->onDone =
-                autorelease_on_done;
-            MMEnvedSamplePlayerTwoBus_set_out_bus(
-                    &spsps_2bus_wrappers[(int)voiceNum],
-                    NULL);
-            if ((noe->parameterSet == 0) && (synth_control_get_feedbackState() == 1)) {
-                MMEnvedSamplePlayerTwoBus_set_out_bus(
-                        &spsps_2bus_wrappers[(int)voiceNum],
-                        signal_chain_get_n1fbBus());
-            }
-                
-            MMTrapEnvedSamplePlayer_noteOnStruct no;
-            no.note = voiceNum;
-            no.amplitude = noe->currentFade * noteParamSets[noe->parameterSet].initialFade;
-            no.p_gain = &noteParamSets[noe->parameterSet].amplitude; 
-            no.index = MM_fwrap(
-                noteParamSets[noe->parameterSet].startPoint + noe->currentPosition,
-                0,1) * MMArray_get_length(theSound->wavtab);
-            /* These times are in seconds */
-            float sustainTimeSeconds = noteParamSets[noe->parameterSet].sustainTime
-                    * (MMSample)MMArray_get_length(theSound->wavtab)
-                    / (MMSample)audio_hw_get_sample_rate(NULL),
-                attackTime = sustainTimeSeconds
-                    * noteParamSets[noe->parameterSet].attackTime,
-                  releaseTime = sustainTimeSeconds
-                    * noteParamSets[noe->parameterSet].releaseTime;
-            no.attackTime = MIN(
-                MAX(attackTime,
-                    SYNTH_CONTROL_MIN_ATTACK_TIME),
-                    SYNTH_CONTROL_MAX_ATTACK_TIME);
-            no.releaseTime = MIN(
-                MAX(releaseTime,
-                    SYNTH_CONTROL_MIN_RELEASE_TIME),
-                    SYNTH_CONTROL_MAX_RELEASE_TIME);
-            /* So this value should also be in seconds dipshit */
-            no.sustainTime = sustainTimeSeconds - no.attackTime - no.releaseTime;
-            no.samples = theSound->wavtab;
-            MMWavTab_inc_n_players(theSound->wavtab);
-            if (noe->pitch_mode == SynthControlPitchMode_BUS) {
-                no.p_rate = &noteParamSets[noe->parameterSet].rate_busses[
-                        noe->pitch_idx];
-                no.rate = MMCC_et12_rate(noe->pitchOffset
-                        + SYNTH_CONTROL_PITCH_OFFSET);
-                MMTrapEnvedSamplePlayer_noteOn_pRate(
-                        &spsps[(int)voiceNum], &no);
-            } else {
-                no.rate = MMCC_et12_rate(
-                        synth_control_clip_valid_pitch(
-                            noe->currentPitch
-                            + noe->pitchOffset));
-                MMTrapEnvedSamplePlayer_noteOn_Rate(
-                        &spsps[(int)voiceNum], &no);
-            }
-        }
+        NoteOnEvent_play(noe);
     }
     MMDLList_remove((MMDLList*)noe->parent);
     free(noe->parent);
     free(event);
+    sched_n_pending_events--;
 }
 
-static void NoteSchedEvent_happen(MMEvent *event)
+/* Start a note for each parameter set whose turn it is (all of them if
+ * one_shot). Those with no offset are played right away without being
+ * scheduled, only those that come later and their repeats are. */
+static void sched_start_notes(int one_shot,
+                              MMSample amplitude_scalar,
+                              MMSample pitch_offset,
+                              SynthControlPitchMode pitch_mode,
+                              uint32_t start_offset)
 {
-    NoteSchedEvent *nse = (NoteSchedEvent*)event;
-    if (nse->active == 1) {
-        /* Schedule notes */
-        int n;
-        for (n = 0; n < NUM_NOTE_PARAM_SETS; n++) {
-            if ((noteOnEventCount[n]
-                    >= noteParamSets[n].intermittency) 
-                || (nse->one_shot == 1)) {
-                noteOnEventCount[n] = 0;
+    int n;
+    for (n = 0; n < NUM_NOTE_PARAM_SETS; n++) {
+        if ((noteOnEventCount[n]
+                >= noteParamSets[n].intermittency) 
+            || (one_shot == 1)) {
+            noteOnEventCount[n] = 0;
+            if (noteParamSets[n].offsetBeats == 0) {
+                /* Played right away, so at the same sample */
+                NoteOnEvent noe;
+                NoteOnEvent_init(&noe,
+                            1,
+                            n,
+                            noteParamSets[n].numRepeats,
+                            0,
+                            amplitude_scalar,
+                            noteParamSets[n].noteStrideAcc,
+                            noteParamSets[n].pitches[0]
+                                + noteParamSets[n].fine_pitches[0],
+                            pitch_offset,
+                            0,
+                            0);
+                noe.pitch_mode = pitch_mode;
+                noe.start_offset = start_offset;
+                NoteOnEvent_play(&noe);
+            } else {
                 NoteOnEvent *noe = NoteOnEvent_new(1,
                             n,
                             noteParamSets[n].numRepeats,
                             0,
-                            nse->amplitude_scalar,
+                            amplitude_scalar,
                             noteParamSets[n].noteStrideAcc,
                             noteParamSets[n].pitches[0]
                                 + noteParamSets[n].fine_pitches[0],
-                            nse->pitch_offset,
+                            pitch_offset,
                             0,
                             0);
-                noe->pitch_mode = nse->pitch_mode;
+                if (noe) {
+                    noe->pitch_mode = pitch_mode;
+                }
                 schedule_noteOn_event(
                         noteParamSets[n].offsetBeats
                         * SCHED_BEAT_RES,
                         noe);
-                noteParamSets[n].noteStrideAcc = MM_fwrap(
-                    noteParamSets[n].noteStrideAcc + noteParamSets[n].noteStride,
-                    0,1);
-            } else {
-                noteOnEventCount[n] += 1;
             }
+            noteParamSets[n].noteStrideAcc = MM_fwrap(
+                noteParamSets[n].noteStrideAcc + noteParamSets[n].noteStride,
+                0,1);
+        } else {
+            noteOnEventCount[n] += 1;
         }
+    }
+}
+
+/* Play a note on each parameter set in this block, at the sample of the MIDI
+ * message being handled if there is one. Nothing is allocated for the notes
+ * with no offset, see sched_start_notes. */
+void scheduler_one_shot(MMSample pitch_offset,
+                        MMSample amplitude,
+                        SynthControlPitchMode pitch_mode)
+{
+    if (sched_n_one_shots == SCHED_MAX_ONE_SHOTS) {
+        return;
+    }
+    sched_one_shots[sched_n_one_shots++] = (sched_one_shot_t) {
+        .pitch_offset = pitch_offset,
+        .amplitude = amplitude,
+        .pitch_mode = pitch_mode,
+        .start_offset = sched_event_offset
+    };
+}
+
+static void sched_play_one_shots(void)
+{
+    int n;
+    for (n = 0; n < sched_n_one_shots; n++) {
+        sched_start_notes(1,
+                          sched_one_shots[n].amplitude,
+                          sched_one_shots[n].pitch_offset,
+                          sched_one_shots[n].pitch_mode,
+                          sched_one_shots[n].start_offset);
+    }
+    sched_n_one_shots = 0;
+}
+
+static void NoteSchedEvent_happen(MMEvent *event)
+{
+    NoteSchedEvent *nse = (NoteSchedEvent*)event;
+    if (nse->active == 1) {
+        sched_start_notes(nse->one_shot,
+                          nse->amplitude_scalar,
+                          nse->pitch_offset,
+                          nse->pitch_mode,
+                          nse->start_offset);
         if (nse->one_shot == 0) {
+            NoteSchedEvent *next = NoteSchedEvent_new(1);
+            if (next) {
+                /* It gets the offset of whatever makes it happen */
+                next->start_offset = 0;
+            }
             schedule_noteSched_event(SYNTH_CONTROL_DEFAULT_EVENTDELTABEATS
                     * SCHED_BEAT_RES,
-                    NoteSchedEvent_new(1));
-            /* Turn on LED */
-            MEASURE_LED_SET();
-            /* Schedule measure LED off event to turn off the measure indicating LED
-             * */
-            schedule_measureLEDOff_event(SYNTH_CONTROL_DEFAULT_EVENTDELTABEATS
-                    * SCHED_BEAT_RES / MEASURE_LED_LENGTH_SCALAR,
-                    MeasureLEDOffEvent_new(1));
+                    next);
+            /* A new measure starts now (the measure LED follows this) */
+            if (!sched_measure_running) {
+                /* Later measures are a whole number of beats after this one
+                 * so the clocks stay lined up with them */
+                sched_clock_ref = MMSeq_getCurrentTime(sequence);
+            }
+            sched_measure_start = MMSeq_getCurrentTime(sequence);
+            sched_measure_running = 1;
             /* If scheduled recording enabled, stop the previous recording and start
              * a new one. It is always okay to stop the recording, because the
              * scheduleRecording flag is set when recording is turned off in the
@@ -475,22 +611,14 @@ static void NoteSchedEvent_happen(MMEvent *event)
     MMDLList_remove((MMDLList*)((NoteSchedEvent*)event)->parent);
     free(((NoteSchedEvent*)event)->parent);
     free(event);
-}
-
-static void MeasureLEDOffEvent_happen(MMEvent *event)
-{
-    if (((MeasureLEDOffEvent*)event)->active == 1) {
-       MEASURE_LED_RESET();
-    } 
-    MMDLList_remove((MMDLList*)((MeasureLEDOffEvent*)event)->parent);
-    free(((MeasureLEDOffEvent*)event)->parent);
-    free(event);
+    sched_n_pending_events--;
 }
 
 static void RecordStartEvent_happen(MMEvent *event)
 {
     synth_control_record_start_helper();
     free(event);
+    sched_n_pending_events--;
 }
  
 static MMTime
@@ -507,9 +635,43 @@ void scheduler_incTimeAndDoEvents(void)
     assert(sequence);
 #endif
     if (scheduler_get_advance_mode() == sched_advance_mode_INTERNAL) {
+        sched_block_start = MMSeq_getCurrentTime(sequence);
         MMSeq_incTime(sequence,sched_time_one_frame());
+        sched_block_end = MMSeq_getCurrentTime(sequence);
+        sched_play_one_shots();
         MMSeq_doAllCurrentEvents(sequence);
+    } else {
+        sched_block_start = sched_block_end;
+        /* Notes played directly don't wait for the next MIDI clock */
+        sched_play_one_shots();
+    }
+}
+
+/* Where the MIDI clocks (24 per beat) fall in the last block, as samples from
+ * the start of the block, earliest first. A clock at the very end of the block
+ * is at the block size. Puts at most max in offsets and returns how many there
+ * are. There are none if the scheduler isn't being advanced internally. */
+int scheduler_get_clock_offsets(uint32_t *offsets, int max)
+{
+    const MMTime tick = SCHED_BEAT_RES / 24;
+    MMTime len = sched_block_end - sched_block_start, t;
+    uint64_t block_size = audio_hw_get_block_size(NULL);
+    int64_t since_ref;
+    int n = 0;
+    if (len == 0) {
+        return 0;
+    }
+    /* The first clock after the start of the block */
+    since_ref = (int64_t)(sched_block_start - sched_clock_ref) % (int64_t)tick;
+    if (since_ref < 0) {
+        since_ref += tick;
     }
+    t = sched_block_start - since_ref + tick;
+    while ((t <= sched_block_end) && (n < max)) {
+        offsets[n++] = (uint32_t)((t - sched_block_start) * block_size / len);
+        t += tick;
+    }
+    return n;
 }
 
 /* Like scheduler_incTimeAndDoEvents but increments one the clock 1/24 of a
@@ -564,12 +726,3 @@ void set_noteSchedEvents_inactive(NoteSchedEventListNode *head)
         head = (NoteSchedEventListNode*)((MMDLList*)head)->next;
     }
 }
-
-/* See set_noteSchedEvents_active for tips. */
-void set_measureLEDOffEvents_inactive(MeasureLEDOffEventListNode *head)
-{
-    while (head) {
-        head->child->active = 0;
-        head = (MeasureLEDOffEventListNode*)((MMDLList*)head)->next;
-    }
-}
@@ -27,6 +27,28 @@ static MMBusMerger fbBusMerger, n1fbBusMerger;
 /* The amount feedback is faded out */
 static const float fbScaleBusConst_val = .99;
 
+/* The last few blocks the recorder was given, so that a recording can be
+ * started from a moment that has already passed (see
+ * signal_chain_recorder_preroll). */
+static MMSample recorder_preroll[SIG_CHAIN_RECORDER_PREROLL_LEN];
+static uint32_t recorder_preroll_idx = 0;
+
+/* How many samples into the block each voice starts, see
+ * signal_chain_voice_delay. */
+struct voice_delay {
+    uint32_t delay;
+    /* The voice adds to outBus instead of writing over it */
+    int sums;
+};
+static struct voice_delay voice_delays[NUM_NOTES];
+/* What was on the busses before the voice being delayed was ticked */
+static MMSample voice_delay_out_before[BUFFER_SIZE];
+static MMSample voice_delay_n1fb_before[BUFFER_SIZE];
+/* What the delayed voices put past the end of the block, added to the start of
+ * the next one */
+static MMSample voice_delay_out_carry[BUFFER_SIZE];
+static MMSample voice_delay_n1fb_carry[BUFFER_SIZE];
+
 #ifdef SIG_CHAIN_FILL_BUF_ONES
 /* Instead of recording what comes in the input, just send 1s to the recorder. */
 MMSigConst fillOnesSigConst;
@@ -118,6 +140,104 @@ void n1_fbk_signal_gate_pass(void)
     signal_gate_set_state(n1_fbk_signal_gate,1);
 }
 
+static void recorder_preroll_fun(MMBus *bus, void *aux)
+{
+    memcpy(&recorder_preroll[recorder_preroll_idx],
+            bus->data,
+            sizeof(MMSample)*bus->size);
+    recorder_preroll_idx = (recorder_preroll_idx + bus->size)
+        % SIG_CHAIN_RECORDER_PREROLL_LEN;
+}
+
+/* Put the n samples that came into the recorder before the current block at
+ * the beginning of the recording and continue recording after them. Call just
+ * after starting the recorder. Returns the number of samples put there, which
+ * is at most SIG_CHAIN_RECORDER_PREROLL_LEN. */
+uint32_t signal_chain_recorder_preroll(uint32_t n)
+{
+    uint32_t i, src;
+    if (n > SIG_CHAIN_RECORDER_PREROLL_LEN) {
+        n = SIG_CHAIN_RECORDER_PREROLL_LEN;
+    }
+    if (n > wtr.maxLength) {
+        n = wtr.maxLength;
+    }
+    src = recorder_preroll_idx + SIG_CHAIN_RECORDER_PREROLL_LEN - n;
+    for (i = 0; i < n; i++) {
+        MMWavTab_get(wtr.buffer,i) =
+            recorder_preroll[(src + i) % SIG_CHAIN_RECORDER_PREROLL_LEN];
+    }
+    wtr.currentIndex = n;
+    return n;
+}
+
+/* Goes before the voice in the chain, keeps what is on the busses so what the
+ * voice adds can be taken out again. */
+static void voice_delay_before_fun(MMBus *bus, void *aux)
+{
+    struct voice_delay *vd = aux;
+    if (!vd->delay) {
+        return;
+    }
+    if (vd->sums) {
+        memcpy(voice_delay_out_before,bus->data,sizeof(MMSample)*bus->size);
+    } else {
+        memset(voice_delay_out_before,0,sizeof(MMSample)*bus->size);
+    }
+    memcpy(voice_delay_n1fb_before,n1fbBus->data,
+           sizeof(MMSample)*n1fbBus->size);
+}
+
+/* Goes after the voice in the chain, moves what the voice added vd->delay
+ * samples later, the samples past the end of the block going into the next
+ * one. The voice that writes the bus (the first) also adds in what was carried
+ * from the last block. */
+static void voice_delay_after_fun(MMBus *bus, void *aux)
+{
+    struct voice_delay *vd = aux;
+    MMSample *out = bus->data, *n1fb = n1fbBus->data, x;
+    uint32_t n, m, size = bus->size;
+    if (vd->delay) {
+        /* Leave what the voice added in the before buffers */
+        for (n = 0; n < size; n++) {
+            x = out[n];
+            out[n] = voice_delay_out_before[n];
+            voice_delay_out_before[n] = x - voice_delay_out_before[n];
+            x = n1fb[n];
+            n1fb[n] = voice_delay_n1fb_before[n];
+            voice_delay_n1fb_before[n] = x - voice_delay_n1fb_before[n];
+        }
+    }
+    if (!vd->sums) {
+        for (n = 0; n < size; n++) {
+            out[n] += voice_delay_out_carry[n];
+            n1fb[n] += voice_delay_n1fb_carry[n];
+        }
+        memset(voice_delay_out_carry,0,sizeof(voice_delay_out_carry));
+        memset(voice_delay_n1fb_carry,0,sizeof(voice_delay_n1fb_carry));
+    }
+    if (vd->delay) {
+        for (n = 0, m = vd->delay; m < size; n++, m++) {
+            out[m] += voice_delay_out_before[n];
+            n1fb[m] += voice_delay_n1fb_before[n];
+        }
+        for (m = 0; n < size; n++, m++) {
+            voice_delay_out_carry[m] += voice_delay_out_before[n];
+            voice_delay_n1fb_carry[m] += voice_delay_n1fb_before[n];
+        }
+    }
+}
+
+/* Makes the voice sound delay samples later than it plays, for as long as it
+ * plays. A note started at the beginning of the block can then be heard from
+ * the sample in the block it was meant to start at, with its envelope and
+ * sound starting there too. delay must be less than the block size. Call from
+ * the audio interrupt, when the voice is started. */
+void signal_chain_voice_delay(int voice, uint32_t delay)
+{
+    voice_delays[voice].delay = delay < BUFFER_SIZE ? delay : 0;
+}
+
 void n1_fbk_signal_gate_block(void)
 {
     signal_gate_set_state(n1_fbk_signal_gate,0);
@@ -238,6 +358,65 @@ void signal_chain_setup(void)
     MMSigConst_init(&fillOnesSigConst,inBus,1,MMSigConst_doSum_FALSE);
     MMSigProc_insertBefore(&wtr,&fillOnesSigConst);
 #endif  
+    /* Keep what the recorder sees whether it is recording or not */
+    memset(recorder_preroll,0,sizeof(recorder_preroll));
+    MMBusProc *recorder_preroll_bus_proc = MMBusProc_new(inBus,recorder_preroll_fun,NULL);
+    MMSigProc_insertBefore(&wtr,recorder_preroll_bus_proc);
+    /* Put the voice delays right around each voice, last so nothing goes
+     * between them */
+    for (i = 0; i < NUM_NOTES; i++) {
+        voice_delays[i] = (struct voice_delay) {
+            .delay = 0,
+            .sums = i != (NUM_NOTES-1)
+        };
+        MMSigProc_insertBefore((MMSigProc*)&spsps[i],
+            MMBusProc_new(outBus,voice_delay_before_fun,&voice_delays[i]));
+        MMSigProc_insertAfter((MMSigProc*)&spsps[i],
+            MMBusProc_new(outBus,voice_delay_after_fun,&voice_delays[i]));
+    }
+}
+
+/* Set the interpolation method of all the sample players. */
+void signal_chain_set_interp(MMInterpMethod interp)
+{
+    int n;
+    for (n = 0; n < NUM_NOTES; n++) {
+        MMEnvedSamplePlayer_getSamplePlayerSigProc(
+                (MMEnvedSamplePlayer*)&spsps[n]).interp = interp;
+    }
+}
+
+/* The feedback path runs from fbBusSplitter to n1fbBusMerger in the signal
+ * chain. If bypass is non-zero, this whole segment is unlinked from the chain
+ * so it costs nothing, otherwise it is linked back in after fbOnNode. While it
+ * is bypassed neither the output nor N1 reach the recorder, so don't bypass it
+ * while recording. Must be called from the audio interrupt (or with it
+ * disabled). */
+void signal_chain_feedback_path_bypass(int bypass)
+{
+    static int bypassed = 0;
+    MMDLList *head = (MMDLList*)&fbBusSplitter,
+             *tail = (MMDLList*)&n1fbBusMerger;
+    if (bypass == bypassed) {
+        return;
+    }
+    if (bypass) {
+        head->prev->next = tail->next;
+        if (tail->next) {
+            tail->next->prev = head->prev;
+        }
+    } else {
+        MMDLList *after = (MMDLList*)fbOnNode;
+        /* What is left on the busses is from before the bypass */
+        memset(fbBus->data,0,sizeof(MMSample)*fbBus->size*fbBus->channels);
+        tail->next = after->next;
+        if (after->next) {
+            after->next->prev = tail;
+        }
+        head->prev = after;
+        after->next = head;
+    }
+    bypassed = bypass;
 }
 
 MMBus *
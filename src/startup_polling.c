@@ -124,6 +124,7 @@ void supo_get_preset_reset_rqst(int *request)
         debounce_event.time_rem = SUPO_RESET_DEBOUNCE_TIME_MS;
         debounce_event.active = 1;
         debounce_wait_flag = 1;
+        timer_events_add_event(&debounce_event);
         while (debounce_wait_flag);
         /* reset leds */
         led1_reset();
@@ -2,6 +2,7 @@
 
 #include "switch_control.h" 
 #include <stddef.h> 
+#include <string.h> 
 
 /* Functions for looking at a GPIO port and calling functions on the value */
 #ifdef SWITCH_CONTROL_DEBUG
@@ -21,22 +22,64 @@
  #define switch_control_tog_prime_pin()     aux_led1_tog()
 #endif /* SWITCH_CONTROL_DEBUG */ 
 
+/* Controls called every time */
 static switch_control_t * _switch_controls = NULL;
+/* Controls only called when a switch they watch changes */
+static switch_control_t * _watching_switch_controls = NULL;
+
+static int switch_control_is_watching(switch_control_t *sc)
+{
+    uint32_t w, watch = 0;
+    for (w = 0; w < SWITCHES_N_WORDS; w++) {
+        watch |= sc->watch[w];
+    }
+    return watch != 0;
+}
 
 void switch_control_do_all(void)
 {
     switch_control_t *tmp;
+    uint32_t w, changes[SWITCHES_N_WORDS];
     tmp = _switch_controls;
     while (tmp) {
         tmp->func(tmp);
         tmp = tmp->next;
     }
+    if (!switches_scan(changes)) {
+        return;
+    }
+    tmp = _watching_switch_controls;
+    while (tmp) {
+        for (w = 0; w < SWITCHES_N_WORDS; w++) {
+            if (tmp->watch[w] & changes[w]) {
+                tmp->func(tmp);
+                break;
+            }
+        }
+        tmp = tmp->next;
+    }
 }
 
+/* Call after switch_control_watch. */
 void switch_control_add(switch_control_t *sc)
 {
-    sc->next = _switch_controls;
-    _switch_controls = sc;
+    if (switch_control_is_watching(sc)) {
+        sc->next = _watching_switch_controls;
+        _watching_switch_controls = sc;
+    } else {
+        sc->next = _switch_controls;
+        _switch_controls = sc;
+    }
+}
+
+/* Have sc's function called only when bit db_bit of the switches_debounced
+ * word at db_addr changes (e.g., SW1_TOP_DB_ADDR and SW1_TOP_DB_BIT). Can be
+ * called more than once to watch more switches. */
+void switch_control_watch(switch_control_t *sc,
+                          volatile uint32_t *db_addr,
+                          uint32_t db_bit)
+{
+    sc->watch[db_addr - switches_debounced] |= 0x1 << db_bit;
 }
 
 void switch_control_init(switch_control_t *sc,
@@ -49,6 +92,7 @@ void switch_control_init(switch_control_t *sc,
     sc->port_bit = port_bit;
     sc->func = func;
     sc->data = data;
+    memset(sc->watch,0,sizeof(sc->watch));
     sc->next = NULL;
 }
 
@@ -193,6 +237,28 @@ static void switch_control_debounce_func_c(switch_control_t *sc)
     }
 }
 
+/* Called when the debounced pin has changed, calls the function if it is now
+ * pressed. */
+static void switch_control_debounce_func_press(switch_control_t *sc)
+{
+    switch_debouncer_t *sd = (switch_debouncer_t*)sc->data;
+    if (sd->get_pin_state(sd)) {
+        sd->func(sd);
+    }
+    sd->reset_req_state(sd);
+}
+
+/* Called when the debounced pin has changed, calls the function if it is now
+ * released (it must have been pressed for it to have changed). */
+static void switch_control_debounce_func_release(switch_control_t *sc)
+{
+    switch_debouncer_t *sd = (switch_debouncer_t*)sc->data;
+    if (!sd->get_pin_state(sd)) {
+        sd->func(sd);
+    }
+    sd->reset_req_state(sd);
+}
+
 static uint32_t get_mom_req_state(switch_debouncer_t *sd)
 {
     mom_state_t* data = (mom_state_t*)sd->data;
@@ -242,10 +308,21 @@ void switch_control_debounce_init(switch_control_t *sc,
         case switch_debouncer_style_C:
             func = switch_control_debounce_func_c;
             break;
+        case switch_debouncer_style_PRESS:
+            func = switch_control_debounce_func_press;
+            break;
+        case switch_debouncer_style_RELEASE:
+            func = switch_control_debounce_func_release;
+            break;
     }
     switch_control_init(sc,
                         (volatile uint32_t*)NULL,
                         0,
                         func,
                         (void*)sd);
+    if ((sty == switch_debouncer_style_PRESS)
+            || (sty == switch_debouncer_style_RELEASE)) {
+        mom_state_t *state = (mom_state_t*)sd->data;
+        switch_control_watch(sc,state->pin_state_addr,state->pin_state_bit);
+    }
 }
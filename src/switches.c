@@ -2,31 +2,131 @@
 
 #include <stddef.h> 
 #include "switches.h" 
-
-static uint32_t (*sw_get_state_funcs[]) (void) = {
-    fsw1_get_state,
-    fsw2_get_state,
-    sw1_top_get_state,
-    sw1_btm_get_state,
-    sw2_top_get_state,
-    sw2_btm_get_state,
-    sw3_top_get_state,
-    sw3_btm_get_state,
-    sw4_top_get_state,
-    sw4_btm_get_state,
-    sw5_top_get_state,
-    sw5_btm_get_state,
-    sw6_top_get_state,
-    sw6_btm_get_state,
-    sw7_top_get_state,
-    sw7_btm_get_state,
-    sw8_top_get_state,
-    sw8_btm_get_state,
-    /* On BOARD_V1, expsw_get_state always returns 0, so it's okay to call */
-    expsw_get_state,
-    NULL
+#include "i2s_lowlevel.h" 
+
+/* Debounced switch states, packed like the scans (see switches.h) */
+volatile uint32_t switches_debounced[SWITCHES_N_WORDS];
+/* The bits of the words that are switches */
+static uint32_t switches_mask[SWITCHES_N_WORDS];
+/* Bit 0 and bit 1 of a 2-bit counter for each bit of the words, counting the
+ * consecutive scans in which the bit differed from its debounced state */
+static uint32_t switches_vcnt0[SWITCHES_N_WORDS];
+static uint32_t switches_vcnt1[SWITCHES_N_WORDS];
+
+/* Where each switch is in the words, in the same order as the defines in
+ * switches.h */
+static const struct {
+    uint8_t word;
+    uint8_t bit;
+} switches_db_bits[] = {
+    { SWITCHES_GPIOB_WORD, FSW1_DB_BIT },
+    { SWITCHES_GPIOE_WORD, FSW2_DB_BIT },
+    { SWITCHES_GPIOG_WORD, SW1_TOP_DB_BIT },
+    { SWITCHES_GPIOG_WORD, SW1_BTM_DB_BIT },
+    { SWITCHES_GPIOD_WORD, SW2_TOP_DB_BIT },
+    { SWITCHES_GPIOD_WORD, SW2_BTM_DB_BIT },
+    { SWITCHES_GPIOD_WORD, SW3_TOP_DB_BIT },
+    { SWITCHES_GPIOB_WORD, SW3_BTM_DB_BIT },
+    { SWITCHES_GPIOB_WORD, SW4_TOP_DB_BIT },
+    { SWITCHES_GPIOB_WORD, SW4_BTM_DB_BIT },
+    { SWITCHES_GPIOB_WORD, SW5_TOP_DB_BIT },
+    { SWITCHES_GPIOD_WORD, SW5_BTM_DB_BIT },
+    { SWITCHES_GPIOD_WORD, SW6_TOP_DB_BIT },
+    { SWITCHES_GPIOD_WORD, SW6_BTM_DB_BIT },
+    { SWITCHES_GPIOD_WORD, SW7_TOP_DB_BIT },
+    { SWITCHES_GPIOC_WORD, SW7_BTM_DB_BIT },
+    { SWITCHES_GPIOB_WORD, SW8_TOP_DB_BIT },
+    { SWITCHES_GPIOC_WORD, SW8_BTM_DB_BIT },
+#if defined(BOARD_V2)
+    { SWITCHES_GPIOF_WORD, EXPSW_DB_BIT },
+#endif /* defined(BOARD_V2) */
 };
 
+#define SWITCHES_N_DB_BITS (sizeof(switches_db_bits)/sizeof(switches_db_bits[0]))
+
+/* Read each port once */
+static void switches_read(uint32_t *words)
+{
+    words[SWITCHES_GPIOB_WORD] = (GPIOB->IDR & 0xffff)
+        | ((GPIOC->IDR & 0xffff) << SWITCHES_GPIOC_SHIFT);
+    words[SWITCHES_GPIOD_WORD] = (GPIOD->IDR & 0xffff)
+        | ((GPIOE->IDR & 0xffff) << SWITCHES_GPIOE_SHIFT);
+    words[SWITCHES_GPIOF_WORD] = (GPIOF->IDR & 0xffff)
+        | ((GPIOG->IDR & 0xffff) << SWITCHES_GPIOG_SHIFT);
+}
+
+/* Read all the switches and debounce them all at once with vertical counters:
+ * a bit of switches_debounced changes once the switch has read differently for
+ * SWITCHES_DEBOUNCE_SCANS consecutive scans. The bits that changed are written
+ * to changes (SWITCHES_N_WORDS long). Returns non-zero if any did. */
+uint32_t switches_scan(uint32_t *changes)
+{
+    uint32_t w, delta, any = 0, sample[SWITCHES_N_WORDS];
+    switches_read(sample);
+    for (w = 0; w < SWITCHES_N_WORDS; w++) {
+        delta = (sample[w] ^ switches_debounced[w]) & switches_mask[w];
+        /* Counters of bits that are the same as their debounced state are
+         * reset, the others incremented */
+        switches_vcnt1[w] = (switches_vcnt1[w] ^ switches_vcnt0[w]) & delta;
+        switches_vcnt0[w] = ~switches_vcnt0[w] & delta;
+        /* Those that rolled over to 0 have changed */
+        changes[w] = delta & ~(switches_vcnt0[w] | switches_vcnt1[w]);
+        switches_debounced[w] ^= changes[w];
+        any |= changes[w];
+    }
+    return any;
+}
+
+/* The last unconfirmed press of each footswitch */
+static volatile switches_edge_t switches_edges[switches_edge_N];
+/* CPU cycles from the last edge taken to when it was taken (global so it can
+ * be looked at in gdb) */
+volatile uint32_t switches_edge_latency_cycles = 0;
+
+static uint32_t switches_edge_max_age(void)
+{
+    return SWITCHES_EDGE_MAX_AGE_BLOCKS * audio_hw_get_block_size(NULL);
+}
+
+/* Called by the EXTI interrupts on a falling edge. Only the first edge of a
+ * press is kept: edges while the switch is debounced as pressed are release
+ * bounces and those after the first are press bounces. */
+static void switches_edge_capture(switches_edge_sw_t sw,
+                                  uint32_t db_word,
+                                  uint32_t db_bit)
+{
+    volatile switches_edge_t *e = &switches_edges[sw];
+    uint32_t sample;
+    if (!((switches_debounced[db_word] >> db_bit) & 0x1)) {
+        return;
+    }
+    sample = i2s_get_sample_position();
+    if (e->pending && ((sample - e->sample) <= switches_edge_max_age())) {
+        return;
+    }
+    e->cycles = DWT->CYCCNT;
+    e->sample = sample;
+    e->pending = 1;
+}
+
+/* Call once the debouncing has confirmed the switch was pressed. Copies the
+ * timestamp of the edge that started the press into edge and returns 0, or
+ * returns -1 if there is no recent edge. */
+int switches_take_edge(switches_edge_sw_t sw, switches_edge_t *edge)
+{
+    volatile switches_edge_t *e = &switches_edges[sw];
+    if (!e->pending) {
+        return -1;
+    }
+    *edge = *e;
+    e->pending = 0;
+    if ((i2s_get_sample_position() - edge->sample) > switches_edge_max_age()) {
+        return -1;
+    }
+    switches_edge_latency_cycles = DWT->CYCCNT - edge->cycles;
+    return 0;
+}
+
 /* This is for all momentary switches. The name fsw... is historical. This
  * pseudo-register is set when a momentary switch is pressed the first time, and
  * reset the second time. It can be passed to functions expecting a register.
@@ -131,7 +231,24 @@ void switches_setup(void)
         pin++;
     }
 
+    /* Start debouncing from the switches' current positions */
+    uint32_t w, n, sample[SWITCHES_N_WORDS];
+    for (w = 0; w < SWITCHES_N_WORDS; w++) {
+        switches_mask[w] = 0;
+        switches_vcnt0[w] = 0;
+        switches_vcnt1[w] = 0;
+    }
+    for (n = 0; n < SWITCHES_N_DB_BITS; n++) {
+        switches_mask[switches_db_bits[n].word] |= 0x1 << switches_db_bits[n].bit;
+    }
+    switches_read(sample);
+    for (w = 0; w < SWITCHES_N_WORDS; w++) {
+        switches_debounced[w] = sample[w] & switches_mask[w];
+    }
+
     sw_toggle_states = 0;
+    switches_edges[switches_edge_FSW1].pending = 0;
+    switches_edges[switches_edge_FSW2].pending = 0;
     /* enable SYSCFG */
     RCC->APB2ENR        |= RCC_APB2ENR_SYSCFGEN;
     /* set up EXTI interrupts */
@@ -185,6 +302,8 @@ void FSW1_IRQ_HANDLER (void)
     NVIC_ClearPendingIRQ(FSW1_IRQ_N);
     if (FSW1_EXTI->PR & (0x1 << FSW1_PORT_PIN)) {
         FSW1_EXTI->PR |= 0x1 << FSW1_PORT_PIN;
+        switches_edge_capture(switches_edge_FSW1,
+                SWITCHES_GPIOB_WORD, FSW1_DB_BIT);
         sw_toggle_states |= (0x1 << FSW1_TOG_PORT_PIN);
     }
 }
@@ -195,6 +314,8 @@ void FSW2_IRQ_HANDLER (void)
     NVIC_ClearPendingIRQ(FSW2_IRQ_N);
     if (FSW2_EXTI->PR & (0x1 << FSW2_PORT_PIN)) {
         FSW2_EXTI->PR |= 0x1 << FSW2_PORT_PIN;
+        switches_edge_capture(switches_edge_FSW2,
+                SWITCHES_GPIOE_WORD, FSW2_DB_BIT);
         sw_toggle_states |= (0x1 << FSW2_TOG_PORT_PIN);
     }
 }
@@ -218,6 +339,8 @@ void MSW1_TOP_FSW2_IRQ_HANDLER (void)
     }
     if (MSW1_TOP_FSW2_EXTI->PR & (0x1 << FSW2_PORT_PIN)) {
         MSW1_TOP_FSW2_EXTI->PR |= 0x1 << FSW2_PORT_PIN;
+        switches_edge_capture(switches_edge_FSW2,
+                SWITCHES_GPIOE_WORD, FSW2_DB_BIT);
         sw_toggle_states |= (0x1 << FSW2_TOG_PORT_PIN);
     }
 }
@@ -356,9 +479,14 @@ uint32_t expsw_get_state(void)
  * in the same order as the order of the defines in switches.h. */
 void get_switch_states(uint32_t *states)
 {
-    uint32_t (**fun) (void);
-    for (fun = sw_get_state_funcs; *fun != NULL; fun++) {
-        *states = (*(*fun))();
-        states++;
+    uint32_t n, sample[SWITCHES_N_WORDS];
+    switches_read(sample);
+    for (n = 0; n < SWITCHES_N_DB_BITS; n++) {
+        *states++ = (sample[switches_db_bits[n].word]
+                >> switches_db_bits[n].bit) & 0x1;
     }
+#if defined(BOARD_V1)
+    /* On BOARD_V1, expsw_get_state always returns 0 */
+    *states = expsw_get_state();
+#endif /* defined(BOARD_V1) */
 }
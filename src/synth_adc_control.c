@@ -59,7 +59,8 @@ synth_adc_obj_init(struct synth_adc_obj_t *sao,
         adc_channel_init(&sao->channel,
                 adc_data_starts[data_start_idx],
                 adc_raw_value_strides[data_start_idx],
-                ADC_AVG_SIZE);
+                ADC_AVG_SIZE,
+                adc_scan_counts[data_start_idx]);
         adc_channel_do_set_init(&sao->do_set,
                 &sao->channel,
                 func,
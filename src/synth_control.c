@@ -37,7 +37,12 @@ static int num_fbk_presses = 0;
 int noteOnEventCount[NUM_NOTE_PARAM_SETS];
 
 /* Stuff that could be saved */
-NoteParamSet                noteParamSets[NUM_NOTE_PARAM_SETS];
+static NoteParamSet         noteParamSetsBufs[2][NUM_NOTE_PARAM_SETS];
+NoteParamSet                *noteParamSets = noteParamSetsBufs[0];
+NoteParamSet                *noteParamSetsStaging = noteParamSetsBufs[1];
+/* Non-zero while the staging sets are being written somewhere that could be
+ * interrupted by the audio block */
+static volatile int         noteParamSetsWriting = 0;
 /* The tempo before tempo scaling has been applied */
 static float                tempoBPM_prescale; 
 /* The tempo representing how often notes are scheduled, etc. */
@@ -132,8 +137,8 @@ void synth_control_set_envelopeTime(float envelopeTime_param,
     audio, so the maxmimum attack and release are 0.5 and minimum are 0 (so that
     their sum never excede 1) */
     env_map_attack_release_f(
-            &noteParamSets[note_param_idx].attackTime,
-            &noteParamSets[note_param_idx].releaseTime,
+            &noteParamSetsStaging[note_param_idx].attackTime,
+            &noteParamSetsStaging[note_param_idx].releaseTime,
             envelopeTime_param,
             0,
             0.5,
@@ -158,7 +163,7 @@ void synth_control_set_sustainTime(float sustainTime_param,
     /* Sustain time is relative to length of recording, so here just 0-1.
      * It is scaled this way so that the length selection is more precise for
      * short lengths and less precise for longer ones */
-    noteParamSets[note_param_idx].sustainTime
+    noteParamSetsStaging[note_param_idx].sustainTime
         = powf(2.,-7.*(1 - sustainTime_param));
 }
 
@@ -194,8 +199,14 @@ void synth_control_tempoNudge(float tempoNudge_param)
      * is some scalar. The value is negated so if K < 1, the tempo is slower and
      * K > 1 the tempo is faster */
     MMSample K =  1.05 - tempoNudge_param * 0.1;
+    size_t len = ((MMArray*)theSound->wavtab)->length;
+    /* An empty table is taken as a full table of silence, which is what it
+     * becomes once it has been zeroed (see SampleTable_zero_start) */
+    if (len == 0) {
+        len = soundSampleMaxLength;
+    }
     float _tempoBPM = 60. * (MMSample)audio_hw_get_sample_rate(NULL) 
-            / ((MMSample)((MMArray*)theSound->wavtab)->length * K);
+            / ((MMSample)len * K);
     set_tempoBPM_prescale(_tempoBPM);
     apply_tempo_scale();
 }
@@ -267,7 +278,7 @@ static void update_fade_rates(int note_param_idx);
 
 void synth_control_set_numRepeats(int numRepeats_param, int note_params_idx)
 {
-    noteParamSets[note_params_idx].numRepeats = numRepeats_param;
+    noteParamSetsStaging[note_params_idx].numRepeats = numRepeats_param;
     update_fade_rates(note_params_idx);
 }
 
@@ -289,9 +300,9 @@ void synth_control_set_pitch(float pitch_param,
                              int note_params_idx)
 {
     MMSample _tmp = pitch_param - 60 + SYNTH_CONTROL_PITCH_OFFSET;
-    noteParamSets[note_params_idx].pitches[which_pitch] = _tmp;
-    _tmp = MMCC_et12_rate(_tmp + noteParamSets[note_params_idx].fine_pitches[which_pitch]);
-    noteParamSets[note_params_idx].rate_busses[which_pitch] = mm_q8_24_t_from_MMSample(_tmp);
+    noteParamSetsStaging[note_params_idx].pitches[which_pitch] = _tmp;
+    _tmp = MMCC_et12_rate(_tmp + noteParamSetsStaging[note_params_idx].fine_pitches[which_pitch]);
+    noteParamSetsStaging[note_params_idx].rate_busses[which_pitch] = mm_q8_24_t_from_MMSample(_tmp);
 }
 
 void synth_control_set_pitch_curParams(float pitch_param)
@@ -307,7 +318,7 @@ void synth_control_set_pitch_chrom(float pitch_param,
                                    int which_pitch,
                                    int note_params_idx)
 {
-    noteParamSets[note_params_idx].pitches[which_pitch]
+    noteParamSetsStaging[note_params_idx].pitches[which_pitch]
         = -12 + 24 * pitch_param;
 }
 
@@ -337,11 +348,11 @@ void synth_control_set_pitch_chrom_quant(float param,
         _tmp = SYNTH_CONTROL_PITCH_CHROM_MIN;
     }
     _tmp += SYNTH_CONTROL_PITCH_OFFSET;
-    noteParamSets[note_params_idx].pitches[which_pitch]
+    noteParamSetsStaging[note_params_idx].pitches[which_pitch]
         = _tmp;
     /* Compute Q8_24 value */
-    _tmp = MMCC_et12_rate(_tmp + noteParamSets[note_params_idx].fine_pitches[which_pitch]);
-    noteParamSets[note_params_idx].rate_busses[which_pitch] = mm_q8_24_t_from_MMSample(_tmp);
+    _tmp = MMCC_et12_rate(_tmp + noteParamSetsStaging[note_params_idx].fine_pitches[which_pitch]);
+    noteParamSetsStaging[note_params_idx].rate_busses[which_pitch] = mm_q8_24_t_from_MMSample(_tmp);
 }
 
 void synth_control_set_pitch_chrom_quant_curParams(float param)
@@ -351,6 +362,24 @@ void synth_control_set_pitch_chrom_quant_curParams(float param)
             synth_control_get_editingWhichParams());
 }
 
+/* Set the fine pitch in semitones */
+static void set_fine_pitch(float _tmp,
+                           int which_pitch,
+                           int note_param_idx)
+{
+    if (_tmp > SYNTH_CONTROL_PITCH_FINE_MAX) {
+        _tmp = SYNTH_CONTROL_PITCH_FINE_MAX;
+    }
+    if (_tmp < SYNTH_CONTROL_PITCH_FINE_MIN) {
+        _tmp = SYNTH_CONTROL_PITCH_FINE_MIN;
+    }
+    noteParamSetsStaging[note_param_idx].fine_pitches[which_pitch]
+        = _tmp;
+    /* Compute Q8_24 value */
+    _tmp = MMCC_et12_rate(_tmp + noteParamSetsStaging[note_param_idx].pitches[which_pitch]);
+    noteParamSetsStaging[note_param_idx].rate_busses[which_pitch] = mm_q8_24_t_from_MMSample(_tmp);
+}
+
 /* expects input to be in [0,1] */
 void synth_control_set_pitch_fine_quant(float param, 
                                         int which_pitch,
@@ -363,17 +392,20 @@ void synth_control_set_pitch_fine_quant(float param,
             * param)
             * SYNTH_CONTROL_PITCH_FINE_QUANT 
             + SYNTH_CONTROL_PITCH_FINE_MIN;
-    if (_tmp > SYNTH_CONTROL_PITCH_FINE_MAX) {
-        _tmp = SYNTH_CONTROL_PITCH_FINE_MAX;
-    }
-    if (_tmp < SYNTH_CONTROL_PITCH_FINE_MIN) {
-        _tmp = SYNTH_CONTROL_PITCH_FINE_MIN;
-    }
-    noteParamSets[note_param_idx].fine_pitches[which_pitch]
-        = _tmp;
-    /* Compute Q8_24 value */
-    _tmp = MMCC_et12_rate(_tmp + noteParamSets[note_param_idx].pitches[which_pitch]);
-    noteParamSets[note_param_idx].rate_busses[which_pitch] = mm_q8_24_t_from_MMSample(_tmp);
+    set_fine_pitch(_tmp,which_pitch,note_param_idx);
+}
+
+/* Like synth_control_set_pitch_fine_quant but not rounded to a cent, for
+ * controls with more resolution */
+void synth_control_set_pitch_fine(float param,
+                                  int which_pitch,
+                                  int note_param_idx)
+{
+    set_fine_pitch(param * (SYNTH_CONTROL_PITCH_FINE_MAX
+                            - SYNTH_CONTROL_PITCH_FINE_MIN)
+                    + SYNTH_CONTROL_PITCH_FINE_MIN,
+                   which_pitch,
+                   note_param_idx);
 }
 
 void synth_control_set_pitch_fine_curParams(float param)
@@ -390,7 +422,7 @@ void synth_control_pitch_control(void *data_, float pitch_param)
 
 void synth_control_set_startPoint(float startPoint_param, int note_params_idx)
 {
-    noteParamSets[note_params_idx].startPoint
+    noteParamSetsStaging[note_params_idx].startPoint
         = startPoint_param;
 }
 
@@ -402,7 +434,7 @@ void synth_control_set_startPoint_curParams(float startPoint_param)
 
 void synth_control_set_positionStride(float positionStride_param, int note_params_idx)
 {
-    noteParamSets[note_params_idx].positionStride
+    noteParamSetsStaging[note_params_idx].positionStride
         = positionStride_param * SYNTH_CONTROL_POS_STRIDE_SCALE 
             - SYNTH_CONTROL_POS_STRIDE_OFFSET;
 }
@@ -415,7 +447,7 @@ void synth_control_set_positionStride_curParams(float positionStride_param)
 
 void synth_control_set_noteStride(float noteStride_param, int note_params_idx)
 {
-    noteParamSets[note_params_idx].noteStride
+    noteParamSetsStaging[note_params_idx].noteStride
         = noteStride_param * SYNTH_CONTROL_POS_STRIDE_SCALE 
             - SYNTH_CONTROL_POS_STRIDE_OFFSET;
 }
@@ -437,7 +469,7 @@ void synth_control_set_eventDelta_quant(float eventDeltaBeats_param, int note_pa
     if (_tmp < 0) {
         _tmp = 0;
     }
-    noteParamSets[note_params_idx].eventDeltaBeats
+    noteParamSetsStaging[note_params_idx].eventDeltaBeats
         = eventDelta_quant_table[_tmp];
 }
 
@@ -453,7 +485,7 @@ void synth_control_set_eventDelta_free(float eventDeltaBeats_param, int note_par
     if (idx >= TABLES_DELTA_TIME_FREE_LEN) {
         idx = TABLES_DELTA_TIME_FREE_LEN - 1;
     }
-    noteParamSets[note_params_idx].eventDeltaBeats = tables_delta_time_free[idx];
+    noteParamSetsStaging[note_params_idx].eventDeltaBeats = tables_delta_time_free[idx];
 }
 
 void synth_control_set_eventDelta_free_curParams(float eventDeltaBeats_param)
@@ -470,6 +502,42 @@ void synth_control_reset_noteOnEventCounts(void)
     }
 }
 
+/* Called each block before the scheduler so that what the controls wrote to the
+ * staging parameter sets is used for the whole block. The pointers are
+ * swapped, so however much was written, this takes the same time. Skipped if
+ * the staging sets are still being written. */
+void synth_control_publish_param_sets(void)
+{
+    NoteParamSet *_tmp;
+    uint32_t _n;
+    if (noteParamSetsWriting) {
+        return;
+    }
+    /* The stride accumulators are changed by the scheduler, not the controls,
+     * so they are kept */
+    for (_n = 0; _n < NUM_NOTE_PARAM_SETS; _n++) {
+        noteParamSetsStaging[_n].noteStrideAcc = noteParamSets[_n].noteStrideAcc;
+    }
+    _tmp = noteParamSets;
+    noteParamSets = noteParamSetsStaging;
+    noteParamSetsStaging = _tmp;
+    /* The controls carry on from what is now being used */
+    memcpy(noteParamSetsStaging,noteParamSets,
+            sizeof(NoteParamSet)*NUM_NOTE_PARAM_SETS);
+}
+
+/* Put around writing many staging parameters where the audio block could
+ * interrupt, so only all or none of them are published. */
+void synth_control_param_sets_write_begin(void)
+{
+    noteParamSetsWriting++;
+}
+
+void synth_control_param_sets_write_end(void)
+{
+    noteParamSetsWriting--;
+}
+
 void synth_control_set_intermittency_idx(unsigned int idx, int note_params_idx)
 {
     uint32_t _idx = idx;
@@ -479,7 +547,7 @@ void synth_control_set_intermittency_idx(unsigned int idx, int note_params_idx)
     if (_idx < 0) {
         _idx = 0;
     }
-    noteParamSets[note_params_idx].intermittency = intermittency_table[_idx];
+    noteParamSetsStaging[note_params_idx].intermittency = intermittency_table[_idx];
     /* Reset all events' event count so that all sequences has same phase, no
      * matter when intermittency was set */
     synth_control_reset_noteOnEventCounts();
@@ -517,7 +585,7 @@ void synth_control_eventDeltaBeats_control(void *data_, float eventDeltaBeats_pa
 
 void synth_control_set_offset(float offset_param, int note_params_idx)
 {
-    noteParamSets[note_params_idx].offsetBeats
+    noteParamSetsStaging[note_params_idx].offsetBeats
         = offset_param;
 }
 
@@ -533,6 +601,33 @@ void synth_control_noteDeltaFromBuffer_control(void *data_,
     noteDeltaFromBuffer = (int)noteDeltaFromBuffer_param;
 }
 
+/* The input sample position (see i2s_get_sample_position) of the footswitch
+ * press that is starting or stopping the recording, if record_edge_valid */
+static uint32_t record_edge_sample = 0;
+static int record_edge_valid = 0;
+
+/* Call just before synth_control_record_tog to have the recording start or
+ * stop at sample rather than at the beginning of the current block. */
+void synth_control_set_record_edge(uint32_t sample)
+{
+    record_edge_sample = sample;
+    record_edge_valid = 1;
+}
+
+/* The number of samples between the edge and the next sample the recorder
+ * gets or 0 if there is no edge. */
+static uint32_t synth_control_record_edge_lateness(void)
+{
+    int32_t late;
+    if (!record_edge_valid) {
+        return 0;
+    }
+    record_edge_valid = 0;
+    late = (int32_t)(i2s_get_block_sample() - SIG_CHAIN_INPUT_LAG
+            - record_edge_sample);
+    return late > 0 ? (uint32_t)late : 0;
+}
+
 /* Called when you want to turn recording off, but not switch buffers, do
  * windowing, etc. This is done when auto record is turned off so that the last
  * completed recording can still be used. */
@@ -552,6 +647,13 @@ void synth_control_record_stop_helper(scrsh_source_t origin)
     if (wtr.state == MMWavTabRecorderState_STOPPED) {
         return;
     }
+    if (origin == scrsh_source_USER) {
+        /* Remove what was recorded after the footswitch was pressed */
+        uint32_t late = synth_control_record_edge_lateness();
+        if (late < wtr.currentIndex) {
+            wtr.currentIndex -= late;
+        }
+    }
     /* Set the length to the index the recorder got to */
     ((MMArray*)wtr.buffer)->length =
         wtr.currentIndex;
@@ -608,24 +710,28 @@ void synth_control_record_stop_helper(scrsh_source_t origin)
         }
         if (feedbackState >= 2) {
             int n;
-            noteParamSets[0].pitches[0] = SYNTH_CONTROL_DEFAULT_PITCH;
-            noteParamSets[0].fine_pitches[0] = SYNTH_CONTROL_DEFAULT_FINEPITCH;
-            noteParamSets[0].rate_busses[0] = SYNTH_CONTROL_DEFAULT_RATEBUSRATE;
-            noteParamSets[0].amplitude = 1.;
+            noteParamSetsStaging[0].pitches[0] = SYNTH_CONTROL_DEFAULT_PITCH;
+            noteParamSetsStaging[0].fine_pitches[0] = SYNTH_CONTROL_DEFAULT_FINEPITCH;
+            noteParamSetsStaging[0].rate_busses[0] = SYNTH_CONTROL_DEFAULT_RATEBUSRATE;
+            noteParamSetsStaging[0].amplitude = 1.;
             /* Only turn down other notes if in R=B mode and all notes fed back */
             if ((feedbackState == 2) && (_recMode == SynthControlRecMode_REC_LEN_1_BEAT)) {
                 for (n = 1; n < NUM_NOTE_PARAM_SETS; n++) {
-                    noteParamSets[n].amplitude = 0;
+                    noteParamSetsStaging[n].amplitude = 0;
                 }
             }
-            noteParamSets[0].sustainTime = 1.;
-            noteParamSets[0].intermittency = 0;
-            noteParamSets[0].offsetBeats = 0;
-            noteParamSets[0].startPoint = 0;
-            noteParamSets[0].attackTime = 0;
-            noteParamSets[0].releaseTime = 0;
+            noteParamSetsStaging[0].sustainTime = 1.;
+            noteParamSetsStaging[0].intermittency = 0;
+            noteParamSetsStaging[0].offsetBeats = 0;
+            noteParamSetsStaging[0].startPoint = 0;
+            noteParamSetsStaging[0].attackTime = 0;
+            noteParamSetsStaging[0].releaseTime = 0;
         }
     }
+    /* The playing table might still be being zeroed (see
+     * SampleTable_zero_start). Stop that so the zeros don't go into it once
+     * it is recorded into. */
+    SampleTable_zero_stop();
     /* Swap the playing and the recording sounds */
     /* Advance the playing and recording sounds along the ring */
     theSound = theSound->next;
@@ -634,8 +740,9 @@ void synth_control_record_stop_helper(scrsh_source_t origin)
 
 void synth_control_record_start_helper(void)
 {
-    /* Only allow recording if wavtable is not being played */
-    if (recordingSound->wavtab->n_players != 0) {
+    /* Only allow recording if wavtable is not being played or zeroed */
+    if ((recordingSound->wavtab->n_players != 0)
+            || SampleTable_zeroing(recordingSound->wavtab)) {
         return;
     }
     /* Set to max length so it would be possible to record all the way to
@@ -646,6 +753,8 @@ void synth_control_record_start_helper(void)
     wtr.buffer = recordingSound->wavtab;
     wtr.currentIndex = 0;
     wtr.state = MMWavTabRecorderState_RECORDING;
+    /* Start from when the footswitch was pressed */
+    signal_chain_recorder_preroll(synth_control_record_edge_lateness());
 }
 
 void synth_control_record_stop(void)
@@ -720,6 +829,8 @@ void synth_control_record_tog(void)
     } else if (wtr.state == MMWavTabRecorderState_STOPPED) {
         synth_control_record_start();
     }
+    /* If it wasn't used, don't let it be used by a later start or stop */
+    record_edge_valid = 0;
 }
 
 void synth_control_feedback_control(uint32_t feedback_param)
@@ -759,9 +870,9 @@ static void synth_control_reset_aux_note_gains(void)
 {
     int n;
     for (n = 1; n < NUM_NOTE_PARAM_SETS; n++) {
-        noteParamSets[n].amplitude = SYNTH_CONTROL_DEFAULT_AMPLITUDE_AUXNOTE;
+        noteParamSetsStaging[n].amplitude = SYNTH_CONTROL_DEFAULT_AMPLITUDE_AUXNOTE;
     }
-    noteParamSets[0].amplitude = SYNTH_CONTROL_DEFAULT_AMPLITUDE;
+    noteParamSetsStaging[0].amplitude = SYNTH_CONTROL_DEFAULT_AMPLITUDE;
 }
 
 /* Calling this sets stride to 0 (no position advancement) */
@@ -859,11 +970,8 @@ static void schedulerState_off_helper(void *data)
     /* Disactivate the noteSchedEvents */
     set_noteSchedEvents_inactive(
             (NoteSchedEventListNode*)MMDLList_getNext(&noteSchedEventListHead));
-    /* Disactivate measure LED off events */
-    set_measureLEDOffEvents_inactive(
-            (MeasureLEDOffEventListNode*)MMDLList_getNext(&measureLEDOffEventListHead));
-    /* Turn off LED */
-    MEASURE_LED_RESET();
+    /* No more measures (turns off the measure LED) */
+    scheduler_measure_stop();
     /* Turn off all playing notes */
     pm_do_for_each_busy_voice(&voiceAllocator,free_playing_spsp_voice);
     schedulerState = 0;
@@ -944,9 +1052,9 @@ void synth_control_set_wet(float gain_param, int note_params_idx)
     gain_param = SYNTH_CONTROL_MIN_GAIN 
         + (SYNTH_CONTROL_MAX_GAIN - SYNTH_CONTROL_MIN_GAIN)*gain_param;
     if (gain_param < SYNTH_CONTROL_GAIN_THRESH) {
-        noteParamSets[note_params_idx].amplitude = 0.;
+        noteParamSetsStaging[note_params_idx].amplitude = 0.;
     } else {
-        noteParamSets[note_params_idx].amplitude =
+        noteParamSetsStaging[note_params_idx].amplitude =
             powf(10.,gain_param / 20.);
     }
 }
@@ -961,7 +1069,7 @@ void synth_control_set_fade(float gain_param, int num_repeats, int note_params_i
 {
     /* This sets the amplitude scaling at the last repeat */
     gain_param = powf(gain_param,1./((float)(num_repeats+1)));
-    noteParamSets[note_params_idx].fadeRate = gain_param;
+    noteParamSetsStaging[note_params_idx].fadeRate = gain_param;
 }
 
 void synth_control_set_fade_curParams(float gain_param, int num_repeats)
@@ -973,18 +1081,18 @@ void synth_control_set_fade_curParams(float gain_param, int num_repeats)
 
 void synth_control_set_fade_rate(float rate, int note_params_idx)
 {
-    noteParamSets[note_params_idx].fadeRate = rate;
+    noteParamSetsStaging[note_params_idx].fadeRate = rate;
 }
 
 static void
 update_fade_rates(int note_params_idx)
 {
-    int numRepeats = noteParamSets[note_params_idx].numRepeats;
-    float amp_last_echo = noteParamSets[note_params_idx].ampLastEcho,
+    int numRepeats = noteParamSetsStaging[note_params_idx].numRepeats;
+    float amp_last_echo = noteParamSetsStaging[note_params_idx].ampLastEcho,
           fade_rate = numRepeats == 0 ? 1 : powf(amp_last_echo,1./numRepeats),
           initial_fade = fade_rate <= 1 ? 1. : 1./amp_last_echo;
-    noteParamSets[note_params_idx].initialFade = initial_fade;
-    noteParamSets[note_params_idx].fadeRate = fade_rate;
+    noteParamSetsStaging[note_params_idx].initialFade = initial_fade;
+    noteParamSetsStaging[note_params_idx].fadeRate = fade_rate;
 }
     
 
@@ -998,7 +1106,7 @@ void synth_control_set_ampLastEcho(float gain_param, int note_params_idx)
     } else {
         amp_last_echo = powf(10,(2*gain_param*60.f - 60.f)/20.f);
     }
-    noteParamSets[note_params_idx].ampLastEcho = amp_last_echo;
+    noteParamSetsStaging[note_params_idx].ampLastEcho = amp_last_echo;
     update_fade_rates(note_params_idx);
 }
 
@@ -1106,7 +1214,7 @@ void synth_control_reset_param_sets(NoteParamSet *param_sets, int size)
 
 static void synth_control_reset_aux_note_all_params(void)
 {
-    synth_control_reset_param_sets(noteParamSets,NUM_NOTE_PARAM_SETS);
+    synth_control_reset_param_sets(noteParamSetsStaging,NUM_NOTE_PARAM_SETS);
 }
 
 void synth_control_reset_global_params(void)
@@ -1129,6 +1237,7 @@ void synth_control_reset_global_params(void)
 void synth_control_setup(void)
 {
     synth_control_reset_param_sets(noteParamSets,NUM_NOTE_PARAM_SETS);
+    synth_control_reset_param_sets(noteParamSetsStaging,NUM_NOTE_PARAM_SETS);
     synth_control_reset_global_params();
     HannWindowTable_init(REC_LOOP_FADE_TIME_S * 2.);
     synth_control_fbk_tog_setup();
@@ -1350,9 +1459,9 @@ void synth_control_pitch_reset_tog(void)
     } else {
         _n = synth_control_get_editingWhichParams();
         for (_m = 0; _m < SYNTH_CONTROL_PITCH_TABLE_SIZE; _m++) {
-            noteParamSets[_n].pitches[_m] = SYNTH_CONTROL_DEFAULT_PITCH;
-            noteParamSets[_n].fine_pitches[_m] = SYNTH_CONTROL_DEFAULT_FINEPITCH;
-            noteParamSets[_n].rate_busses[_m] = SYNTH_CONTROL_DEFAULT_RATEBUSRATE;
+            noteParamSetsStaging[_n].pitches[_m] = SYNTH_CONTROL_DEFAULT_PITCH;
+            noteParamSetsStaging[_n].fine_pitches[_m] = SYNTH_CONTROL_DEFAULT_FINEPITCH;
+            noteParamSetsStaging[_n].rate_busses[_m] = SYNTH_CONTROL_DEFAULT_RATEBUSRATE;
         }
     }
 }
@@ -1360,18 +1469,14 @@ void synth_control_pitch_reset_tog(void)
 void synth_control_one_shot(MMSample pitch,
                             MMSample amplitude)
 {
-    /* schedule 1st event which is initially active */
-    NoteSchedEvent *nse;
-    nse = NoteSchedEvent_new(1);
-    if (!nse) {
+    if (recording_exists == 0) {
         return;
     }
-    NoteSchedEvent_set_pitch_offset(nse,pitch);
-//    NoteSchedEvent_set_pitch_mode(nse,SynthControlPitchMode_ABSOLUTE);
-    NoteSchedEvent_set_pitch_mode(nse,SynthControlPitchMode_BUS);
-    NoteSchedEvent_set_amplitude_scalar(nse,amplitude);
-    NoteSchedEvent_set_one_shot(nse,1);
-    noteSched_scheduling_helper(nse);
+    /* Reset note stride accumulator. */
+    synth_control_reset_noteStrideAcc();
+    /* Notes with no offset start in this block, only later ones and repeats
+     * are scheduled */
+    scheduler_one_shot(pitch,amplitude,SynthControlPitchMode_BUS);
 }
 
 void synth_control_note_on(int parameterSet,
@@ -1386,7 +1491,8 @@ void synth_control_note_on(int parameterSet,
     }
     MMSample voiceNum = pm_get_next_free_voice_number();
     if (voiceNum != -1 && 
-            (noteParamSets[parameterSet].amplitude > SCHEDULING_AMP_FLOOR)) { 
+            (noteParamSets[parameterSet].amplitude > SCHEDULING_AMP_FLOOR)
+            && (MMArray_get_length(theSound->wavtab) > 0)) { 
         /* there is a voice free */
         pm_claim_params_from_allocator((void*)&voiceAllocator,
                 (void*)&voiceNum);
@@ -1455,8 +1561,8 @@ void synth_control_set_swing(float param,
         n = TABLES_N_SWING_SETS - 1;
     }
     TABLES_SWING_PTS_LOOKUP(n,
-                            &noteParamSets[idx].swing[0],
-                            &noteParamSets[idx].swing[1]);
+                            &noteParamSetsStaging[idx].swing[0],
+                            &noteParamSetsStaging[idx].swing[1]);
 }
 
 void synth_control_set_swing_curParams(float param)
@@ -4,8 +4,10 @@
 #include "presets_lowlevel.h"
 #include "switches.h" 
 #include <string.h> 
+#include <stddef.h> 
 #include "leds.h" 
 #include "synth_midi_control.h" 
+#include "stm32f4xx.h" 
 
 typedef struct __SCPreset {
     NoteParamSet                 noteParamSets[NUM_NOTE_PARAM_SETS];
@@ -21,6 +23,16 @@ typedef struct __SCStorage {
 
 static presets_lowlevel_handle_t *scpresets_handle;
 static SCStorage scstorage;
+/* A bank being loaded over MIDI, only put in scstorage once it is all there
+ * and checked (see sc_presets_store_bank) */
+static SCStorage scstorage_load;
+
+static void sc_presets_store_midi_channel(void)
+{
+    presets_lowlevel_update(scpresets_handle,(void*)&scstorage,
+            sizeof(scstorage),offsetof(SCStorage,midi_channel),
+            sizeof(scstorage.midi_channel),NULL);
+}
 
 /* File is a file in which to store presets. This will obviously depend on the
  * implementation.
@@ -33,7 +45,7 @@ static SCStorage scstorage;
  * midi channel, otherwise the last default will be loaded. */
 void sc_presets_init(int reset_request, int *midi_channel)
 {
-    /* (The flash implementation requires no initialization) */
+    /* Finds where the presets are in flash */
     presets_lowlevel_init(&scpresets_handle,NULL);
     presets_lowlevel_read(scpresets_handle,(void*)&scstorage,
             sizeof(scstorage),NULL);
@@ -49,8 +61,7 @@ void sc_presets_init(int reset_request, int *midi_channel)
         scstorage.midi_channel = *midi_channel;
         /* Store new midi_channel */
         if (reset_request != 2) {
-            presets_lowlevel_write(scpresets_handle,(void*)&scstorage,
-                    sizeof(scstorage),NULL);
+            sc_presets_store_midi_channel();
         }
     } else {
         *midi_channel = scstorage.midi_channel;
@@ -60,8 +71,7 @@ void sc_presets_init(int reset_request, int *midi_channel)
             *midi_channel = 0;
             scstorage.midi_channel = *midi_channel;
             /* Store new midi_channel */
-            presets_lowlevel_write(scpresets_handle,(void*)&scstorage,
-                    sizeof(scstorage),NULL);
+            sc_presets_store_midi_channel();
         }
     }
     /* If both footswitches down on startup, set presets to default values. This
@@ -88,12 +98,14 @@ void sc_presets_store(int npreset)
     if (npreset > NUM_SYNTH_CONTROL_PRESETS) {
         npreset = NUM_SYNTH_CONTROL_PRESETS - 1;
     }
-    memcpy(scstorage.scpresets[npreset].noteParamSets,noteParamSets,
+    memcpy(scstorage.scpresets[npreset].noteParamSets,noteParamSetsStaging,
             sizeof(NoteParamSet)*NUM_NOTE_PARAM_SETS);
     scstorage.scpresets[npreset].tempoBPM = synth_control_get_tempoBPM(); 
-    /* Store every time, because program could be terminated at any moment */
-    presets_lowlevel_write(scpresets_handle,(void*)&scstorage,
-            sizeof(scstorage),NULL);
+    /* Store every time, because program could be terminated at any moment.
+     * Only this preset is appended to the log in flash. */
+    presets_lowlevel_update(scpresets_handle,(void*)&scstorage,
+            sizeof(scstorage),offsetof(SCStorage,scpresets[npreset]),
+            sizeof(SCPreset),NULL);
 }
 
 void sc_presets_recall(int npreset)
@@ -104,8 +116,11 @@ void sc_presets_recall(int npreset)
     if (npreset > NUM_SYNTH_CONTROL_PRESETS) {
         npreset = NUM_SYNTH_CONTROL_PRESETS - 1;
     }
-    /* No need to load from file, this is done only on initialization */
-    memcpy(noteParamSets,scstorage.scpresets[npreset].noteParamSets,sizeof(NoteParamSet)*NUM_NOTE_PARAM_SETS);
+    /* No need to load from file, this is done only on initialization. The
+     * preset is used from the next block on, all at once. */
+    synth_control_param_sets_write_begin();
+    memcpy(noteParamSetsStaging,scstorage.scpresets[npreset].noteParamSets,sizeof(NoteParamSet)*NUM_NOTE_PARAM_SETS);
+    synth_control_param_sets_write_end();
     /* Reset event counts so intermittency off all notes always has same phase
      * */
     synth_control_reset_noteOnEventCounts();
@@ -114,3 +129,55 @@ void sc_presets_recall(int npreset)
         synth_control_set_tempoBPM_absolute(scstorage.scpresets[npreset].tempoBPM); 
     }
 }
+
+uint32_t sc_presets_get_bank_size(void)
+{
+    return sizeof(SCStorage);
+}
+
+/* Copy len bytes of the bank starting offset bytes in. The audio interrupt
+ * stores presets into the bank so this is done with interrupts disabled, keep
+ * len small. Returns -1 if that is past the end of the bank. */
+int sc_presets_read_bank(uint32_t offset, void *dest, uint32_t len)
+{
+    uint32_t primask;
+    if ((offset > sizeof(SCStorage)) || (len > (sizeof(SCStorage) - offset))) {
+        return -1;
+    }
+    primask = __get_PRIMASK();
+    __disable_irq();
+    memcpy(dest,(uint8_t*)&scstorage + offset,len);
+    __set_PRIMASK(primask);
+    return 0;
+}
+
+/* Like sc_presets_read_bank but copies into a bank being loaded. Nothing
+ * written changes the presets until sc_presets_store_bank. */
+int sc_presets_write_bank(uint32_t offset, const void *src, uint32_t len)
+{
+    if ((offset > sizeof(SCStorage)) || (len > (sizeof(SCStorage) - offset))) {
+        return -1;
+    }
+    memcpy((uint8_t*)&scstorage_load + offset,src,len);
+    return 0;
+}
+
+/* Make the bank loaded with sc_presets_write_bank the presets and store it in
+ * flash. Returns -1 and leaves the presets as they were if the bank doesn't
+ * look like one. Only call once the whole bank is written and checked. */
+int sc_presets_store_bank(void)
+{
+    uint32_t primask;
+    if ((scstorage_load.first_read != SCP_FIRST_READ_KW)
+            || (scstorage_load.midi_channel < 0)
+            || (scstorage_load.midi_channel >= 16)) {
+        return -1;
+    }
+    primask = __get_PRIMASK();
+    __disable_irq();
+    memcpy(&scstorage,&scstorage_load,sizeof(SCStorage));
+    __set_PRIMASK(primask);
+    presets_lowlevel_write(scpresets_handle,(void*)&scstorage,
+            sizeof(scstorage),NULL);
+    return 0;
+}
@@ -63,11 +63,11 @@ static int switch_control_get_tristate(switch_control_t *sc)
         static synth_switch_control_t _switch_control;\
         static type _last_state;\
         volatile uint32_t *_sw_addrs[] = {\
-            sw ## _TOP_ADDR,\
-            sw ## _BTM_ADDR};\
+            sw ## _TOP_DB_ADDR,\
+            sw ## _BTM_DB_ADDR};\
         uint32_t _sw_pins[] = {\
-            sw ## _TOP_PORT_PIN,\
-            sw ## _BTM_PORT_PIN};\
+            sw ## _TOP_DB_BIT,\
+            sw ## _BTM_DB_BIT};\
         /* Note that the following function sets the _sw_addrs and _sw_pins\
          * of the parent class! */\
         switch_control_init((switch_control_t*)&_switch_control,\
@@ -95,6 +95,11 @@ static int switch_control_get_tristate(switch_control_t *sc)
                 _last_state = c1;\
                 break;\
         }\
+        /* Only called when either pin changes */\
+        switch_control_watch((switch_control_t*)&_switch_control,\
+                _sw_addrs[0],_sw_pins[0]);\
+        switch_control_watch((switch_control_t*)&_switch_control,\
+                _sw_addrs[1],_sw_pins[1]);\
         switch_control_add((switch_control_t*)&_switch_control);\
     }
 
@@ -113,8 +118,8 @@ static int switch_control_get_tristate(switch_control_t *sc)
         static mom_state_t mom_state = {\
             sw ## _TOG_ADDR,\
             sw ## _TOG_PORT_PIN,\
-            sw ## _ADDR,\
-            sw ## _PORT_PIN\
+            sw ## _DB_ADDR,\
+            sw ## _DB_BIT\
         };\
         static switch_debouncer_t debouncer;\
         static switch_control_t control;\
@@ -185,20 +190,28 @@ SYNTH_SWITCH_SETUP(SynthControlGainMode,
         SynthControlGainMode_FADE,
         SynthControlGainMode_WET,
         SynthControlGainMode_FBKHOLD); 
-SYNTH_SWITCH_CONTROL_TOG(record);
-/* Footswitches use debounce method C */
-SYNTH_SWITCH_SETUP_TOG(record,FSW1,switch_debouncer_style_C);
+/* The recording starts or stops at the sample the footswitch was pressed */
+void synth_switch_control_record_tog_func(switch_debouncer_t *sd)
+{
+    switches_edge_t edge;
+    if (switches_take_edge(switches_edge_FSW1,&edge) == 0) {
+        synth_control_set_record_edge(edge.sample);
+    }
+    synth_control_record_tog();
+}
+/* Footswitches act when pressed (like debounce method C) */
+SYNTH_SWITCH_SETUP_TOG(record,FSW1,switch_debouncer_style_PRESS);
 SYNTH_SWITCH_CONTROL_TOG(schedulerState);
-SYNTH_SWITCH_SETUP_TOG(schedulerState,FSW2,switch_debouncer_style_C);
-/* Otherwise use debounce method B */
+SYNTH_SWITCH_SETUP_TOG(schedulerState,FSW2,switch_debouncer_style_PRESS);
+/* Otherwise act when released (like debounce method B) */
 SYNTH_SWITCH_CONTROL_TOG(presetRecall);
-SYNTH_SWITCH_SETUP_TOG(presetRecall,MSW3_TOP,switch_debouncer_style_B);
+SYNTH_SWITCH_SETUP_TOG(presetRecall,MSW3_TOP,switch_debouncer_style_RELEASE);
 SYNTH_SWITCH_CONTROL_TOG(presetStore);
-SYNTH_SWITCH_SETUP_TOG(presetStore,MSW3_BTM,switch_debouncer_style_B);
+SYNTH_SWITCH_SETUP_TOG(presetStore,MSW3_BTM,switch_debouncer_style_RELEASE);
 SYNTH_SWITCH_CONTROL_TOG(fbk);
-SYNTH_SWITCH_SETUP_TOG(fbk,MSW7_TOP,switch_debouncer_style_B);
+SYNTH_SWITCH_SETUP_TOG(fbk,MSW7_TOP,switch_debouncer_style_RELEASE);
 SYNTH_SWITCH_CONTROL_TOG(pitch_reset);
-SYNTH_SWITCH_SETUP_TOG(pitch_reset,MSW1_TOP,switch_debouncer_style_B);
+SYNTH_SWITCH_SETUP_TOG(pitch_reset,MSW1_TOP,switch_debouncer_style_RELEASE);
 
 void synth_switch_control_setup(void)
 {
@@ -9,6 +9,7 @@
 #include <time.h>
 #include <sys/time.h>
 #include <sys/times.h>
+#include "syscalls.h"
 
 
 /* Variables */
@@ -68,11 +69,12 @@ int _write(int file, char *ptr, int len)
 	return len;
 }
 
+extern char _end;
+extern char _eheap;
+static char *heap_end;
+
 caddr_t _sbrk(int incr)
 {
-	extern char _end;
-    extern char _eheap;
-	static char *heap_end;
 	char *prev_heap_end;
 
 	if (heap_end == 0)
@@ -90,6 +92,13 @@ caddr_t _sbrk(int incr)
 	return (caddr_t) prev_heap_end;
 }
 
+/* Bytes of heap given out so far. The heap never shrinks so this is also its
+ * high-water mark. */
+uint32_t syscalls_get_heap_used(void)
+{
+	return heap_end ? (uint32_t)(heap_end - &_end) : 0;
+}
+
 int _close(int file)
 {
 	return -1;
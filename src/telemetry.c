@@ -0,0 +1,196 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#include "telemetry.h"
+#include "midi_sysex.h"
+#include "poly_management.h"
+#include "scheduling.h"
+#include "xrun_history.h"
+#include "load_governor.h"
+#include "syscalls.h"
+#include "audio_setup.h"
+#include "system_init.h"
+#include "stm32f4xx.h"
+
+/* Written below the stack at boot. The stack has been as deep as the lowest
+ * word that isn't this anymore. */
+#define TELEMETRY_STACK_PAINT 0x5354434b
+/* Left alone below the stack pointer when painting */
+#define TELEMETRY_STACK_MARGIN 64
+/* MIDI clocks further apart than this are taken as the clock having stopped
+ * and started again */
+#define TELEMETRY_MIDI_CLOCK_MAX_US 1000000
+
+/* From the linker script, the stack grows down to just above the heap */
+extern char _eheap;
+extern char _estack;
+#define TELEMETRY_STACK_BOTTOM \
+    ((uint32_t*)(((uint32_t)&_eheap + 4) & ~0x3))
+#define TELEMETRY_STACK_TOP \
+    ((uint32_t*)(((uint32_t)&_estack + 1) & ~0x3))
+
+static volatile int telemetry_enabled = 0;
+static uint32_t telemetry_blocks_per_frame = 1;
+/* The counts being kept by the audio interrupt */
+static telemetry_frame_t telemetry_acc;
+static uint32_t telemetry_acc_cycles = 0;
+static uint32_t telemetry_acc_blocks = 0;
+static uint32_t telemetry_last_clock_time = 0;
+static int telemetry_have_last_clock = 0;
+/* The counts of the last period, waiting for telemetry_poll */
+static telemetry_frame_t telemetry_ready;
+static volatile int telemetry_ready_full = 0;
+
+static uint8_t *
+put_le(uint8_t *buf, uint32_t val, int nbytes)
+{
+    while (nbytes--) {
+        *buf++ = val & 0xff;
+        val >>= 8;
+    }
+    return buf;
+}
+
+/* Call first thing in main so the deepest the stack gets can be found */
+void telemetry_stack_paint(void)
+{
+    uint32_t *p = TELEMETRY_STACK_BOTTOM,
+             *end = (uint32_t*)((__get_MSP() - TELEMETRY_STACK_MARGIN) & ~0x3);
+    while (p < end) {
+        *p++ = TELEMETRY_STACK_PAINT;
+    }
+}
+
+/* The most bytes of stack used since boot. Looks through the whole stack, so
+ * call from the main loop. */
+uint32_t telemetry_get_stack_used(void)
+{
+    const uint32_t *p = TELEMETRY_STACK_BOTTOM,
+                   *top = TELEMETRY_STACK_TOP;
+    while ((p < top) && (*p == TELEMETRY_STACK_PAINT)) {
+        p++;
+    }
+    return (uint32_t)((const uint8_t*)top - (const uint8_t*)p);
+}
+
+void telemetry_setup(void)
+{
+    telemetry_blocks_per_frame = TELEMETRY_PERIOD_MS
+        * audio_hw_get_sample_rate(NULL)
+        / (1000 * audio_hw_get_block_size(NULL));
+    if (telemetry_blocks_per_frame == 0) {
+        telemetry_blocks_per_frame = 1;
+    }
+}
+
+/* Called from the audio interrupt when control change 68 is received */
+void telemetry_set_enabled(int enabled)
+{
+    if (enabled && !telemetry_enabled) {
+        telemetry_acc_blocks = 0;
+        telemetry_acc.midi_clocks = 0;
+        telemetry_have_last_clock = 0;
+    }
+    telemetry_enabled = enabled;
+}
+
+/* Call at the end of every block with the cycles it took and the cycles
+ * available. Every TELEMETRY_PERIOD_MS what was counted is handed to
+ * telemetry_poll. If it hasn't taken the last ones yet they are dropped, which
+ * is what keeps the rate down if the MIDI output can't keep up. */
+void telemetry_end_block(uint32_t block,
+                         uint32_t cycles,
+                         uint32_t block_period)
+{
+    telemetry_frame_t *f = &telemetry_acc;
+    uint16_t voices, events;
+    if (!telemetry_enabled) {
+        return;
+    }
+    voices = pm_get_n_busy_voices();
+    events = scheduler_get_n_pending_events();
+    if (telemetry_acc_blocks == 0) {
+        f->cycles_min = f->cycles_max = cycles;
+        f->voices_max = voices;
+        f->sched_events_max = events;
+        telemetry_acc_cycles = 0;
+    }
+    f->cycles_min = cycles < f->cycles_min ? cycles : f->cycles_min;
+    f->cycles_max = cycles > f->cycles_max ? cycles : f->cycles_max;
+    f->voices_max = voices > f->voices_max ? voices : f->voices_max;
+    f->sched_events_max = events > f->sched_events_max ?
+        events : f->sched_events_max;
+    telemetry_acc_cycles += cycles;
+    if (++telemetry_acc_blocks < telemetry_blocks_per_frame) {
+        return;
+    }
+    f->block = block;
+    f->cycles_avg = telemetry_acc_cycles / telemetry_acc_blocks;
+    f->block_period = block_period;
+    f->voices = voices;
+    f->sched_events = events;
+    if (!telemetry_ready_full) {
+        telemetry_ready = *f;
+        telemetry_ready_full = 1;
+    }
+    telemetry_acc_blocks = 0;
+    f->midi_clocks = 0;
+}
+
+/* Call when a MIDI clock is received with the cycle count it was received at.
+ * Called from the audio interrupt, like telemetry_end_block. */
+void telemetry_midi_clock(uint32_t time)
+{
+    telemetry_frame_t *f = &telemetry_acc;
+    uint32_t us;
+    if (!telemetry_enabled) {
+        return;
+    }
+    if (telemetry_have_last_clock) {
+        us = (uint32_t)((uint64_t)(time - telemetry_last_clock_time) * 1000000
+                / get_SystemCoreClock());
+        if (us < TELEMETRY_MIDI_CLOCK_MAX_US) {
+            if ((f->midi_clocks == 0) || (us < f->midi_clock_min)) {
+                f->midi_clock_min = us;
+            }
+            if ((f->midi_clocks == 0) || (us > f->midi_clock_max)) {
+                f->midi_clock_max = us;
+            }
+            f->midi_clocks++;
+        }
+    }
+    telemetry_last_clock_time = time;
+    telemetry_have_last_clock = 1;
+}
+
+/* Call this from the main loop. Sends the counts of the last period if there
+ * are some. */
+void telemetry_poll(void)
+{
+    static uint8_t buf[TELEMETRY_PAYLOAD_SIZE];
+    uint8_t *ptr = buf;
+    telemetry_frame_t f;
+    if (!telemetry_ready_full) {
+        return;
+    }
+    f = telemetry_ready;
+    telemetry_ready_full = 0;
+    *ptr++ = TELEMETRY_VERSION;
+    *ptr++ = load_governor_get_level();
+    ptr = put_le(ptr,f.block,4);
+    ptr = put_le(ptr,f.cycles_min,4);
+    ptr = put_le(ptr,f.cycles_avg,4);
+    ptr = put_le(ptr,f.cycles_max,4);
+    ptr = put_le(ptr,f.block_period,4);
+    ptr = put_le(ptr,f.voices,2);
+    ptr = put_le(ptr,f.voices_max,2);
+    ptr = put_le(ptr,f.sched_events,2);
+    ptr = put_le(ptr,f.sched_events_max,2);
+    ptr = put_le(ptr,syscalls_get_heap_used(),4);
+    ptr = put_le(ptr,telemetry_get_stack_used(),4);
+    ptr = put_le(ptr,xrun_history_get_count(),4);
+    ptr = put_le(ptr,f.midi_clocks,2);
+    ptr = put_le(ptr,f.midi_clocks ? f.midi_clock_min : 0,4);
+    ptr = put_le(ptr,f.midi_clocks ? f.midi_clock_max : 0,4);
+    /* If there's no room this one is skipped */
+    midi_sysex_send(midi_sysex_cmd_TELEMETRY,buf,ptr - buf);
+}
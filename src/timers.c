@@ -5,7 +5,16 @@
 #include "timers.h" 
 #include "leds.h" 
 
+/* The events waiting to time out, in the order they will. Each one's delta is
+ * relative to the one before it so a tick only has to look at the first one.
+ * Only the TIM7 interrupt touches this list. */
 static timer_event_t *timer_events = NULL;
+/* Events added but not yet put in the list by the TIM7 interrupt */
+static timer_event_t * volatile timer_events_added = NULL;
+#ifdef TIMERS_TICKLESS
+/* What TIM7's auto-reload register was last set to */
+static uint32_t timers_tickless_arr = 0;
+#endif
 
 int timers_get_state(void)
 {
@@ -35,12 +44,20 @@ static void timer_event_on_timeout_test(timer_event_t *ev)
 void timers_setup(void)
 {
     RCC->APB1ENR |= RCC_APB1ENR_TIM7EN;
+#ifdef TIMERS_TICKLESS
+    /* counts at 10KHz, the clock counts at a rate of 90MHz/(TIM7->PSC + 1) */
+    TIM7->PSC = (uint16_t)8999;
+    timers_tickless_arr = TIMERS_TICKLESS_MAX_TICKS
+        * TIMERS_TICKLESS_COUNTS_PER_TICK - 1;
+    TIM7->ARR = (uint16_t)timers_tickless_arr;
+#else
     /* increments at 22.5 MHz with APB1 clock of 45MHz and a timer prescalar of
      * 2 (see clock tree). In other words, the clock counts at a rate of
      * 90MHz/(TIM7->PSC + 1) */
     TIM7->PSC = (uint16_t)3;
     /* overflows every millisecond with above increment frequecy */
     TIM7->ARR = (uint16_t)22500;
+#endif
     /* enable interrupt */
     TIM7->DIER = TIM_DIER_UIE;
     /* attach ISRs */
@@ -61,68 +78,166 @@ void timers_setup(void)
 
 }
 
-/* Note that this will replace ev->next with timer_events. */
+/* Have ev time out ev->time_rem ticks from now (if ev->active). If ev was
+ * already added, it is moved. This doesn't stop the timer, the event is put in
+ * the list by the TIM7 interrupt so this can be called from anywhere, but the
+ * same event should not be added from two places at once. To cancel an event,
+ * set ev->active to 0. */
 void timer_events_add_event(timer_event_t *ev)
 {
-    int _timstate;
-    _timstate = timers_get_state();
-    /* If timer on, disable */
-    if (_timstate) {
-        timers_disable();
-    }
-    if (ev) {
-        timer_event_t *tmp = timer_events;
-        timer_events = ev;
-        ev->next = tmp;
-    }
-    /* If timers were on, enable */
-    if (_timstate) {
-        timers_enable();
+    timer_event_t *head;
+    if (!ev || ev->add_pending) {
+        return;
     }
+    ev->add_pending = 1;
+    do {
+        head = (timer_event_t*)__LDREXW((volatile uint32_t*)&timer_events_added);
+        ev->add_next = head;
+    } while (__STREXW((uint32_t)ev, (volatile uint32_t*)&timer_events_added));
+#ifdef TIMERS_TICKLESS
+    /* Have TIM7 reprogrammed in case ev is sooner than what it's waiting for */
+    NVIC_SetPendingIRQ(TIM7_IRQn);
+#endif
 }
 
 void timer_event_init(timer_event_t *ev)
 {
     ev->next = NULL;
+    ev->add_next = NULL;
     ev->active = 0;
     ev->time_rem = 0;
     ev->on_timeout = NULL;
     ev->data = NULL;
+    ev->delta = 0;
+    ev->queued = 0;
+    ev->add_pending = 0;
 }
 
-static void timer_events_dec_all(timer_event_t *ev)
+static void timer_events_remove(timer_event_t *ev)
 {
-    while (ev != NULL) {
-        if (ev->active && (ev->time_rem > 0)) {
-            (ev->time_rem)--;
+    timer_event_t **ptr = &timer_events;
+    while (*ptr) {
+        if (*ptr == ev) {
+            *ptr = ev->next;
+            if (ev->next) {
+                ev->next->delta += ev->delta;
+            }
+            ev->queued = 0;
+            return;
         }
-        ev = ev->next;
+        ptr = &((*ptr)->next);
     }
 }
 
-/* the ev->on_timeout function is responsible for setting ev->active to 0 if
- * repeat callings of on_timeout are unwanted */
-static void timer_events_check_all(timer_event_t *ev)
+/* Put ev in the list so it times out after ev->time_rem ticks. Like before,
+ * an event with time_rem 0 times out on the next tick. */
+static void timer_events_insert(timer_event_t *ev)
 {
-    while (ev != NULL) {
-        if (ev->active && TIMER_EVENT_TIMED_OUT(ev) && ev->on_timeout) {
-            ev->on_timeout(ev);
-        } 
+    timer_event_t **ptr = &timer_events;
+    uint32_t delta = ev->time_rem ? ev->time_rem : 1;
+    while (*ptr && ((*ptr)->delta <= delta)) {
+        delta -= (*ptr)->delta;
+        ptr = &((*ptr)->next);
+    }
+    if (*ptr) {
+        (*ptr)->delta -= delta;
+    }
+    ev->delta = delta;
+    ev->next = *ptr;
+    *ptr = ev;
+    ev->queued = 1;
+}
+
+/* Put the events that were added in the list */
+static void timer_events_take_added(void)
+{
+    timer_event_t *ev;
+    do {
+        ev = (timer_event_t*)__LDREXW((volatile uint32_t*)&timer_events_added);
+    } while (__STREXW(0, (volatile uint32_t*)&timer_events_added));
+    while (ev) {
+        timer_event_t *add_next = ev->add_next;
+        if (ev->queued) {
+            timer_events_remove(ev);
+        }
+        ev->add_pending = 0;
+        if (ev->active) {
+            timer_events_insert(ev);
+        }
+        ev = add_next;
+    }
+}
+
+/* Count down ticks and time out the events that are due. Only the first
+ * events in the list are looked at. The ev->on_timeout function is
+ * responsible for setting ev->active to 0 if repeat callings of on_timeout
+ * are unwanted, otherwise it is called again after ev->time_rem ticks. */
+static void timer_events_advance(uint32_t ticks)
+{
+    timer_event_t *ev = timer_events;
+    while (ev && ticks) {
+        uint32_t d = ev->delta < ticks ? ev->delta : ticks;
+        ev->delta -= d;
+        ticks -= d;
+        if (ev->delta) {
+            break;
+        }
         ev = ev->next;
     }
+    while (timer_events && (timer_events->delta == 0)) {
+        ev = timer_events;
+        timer_events = ev->next;
+        ev->queued = 0;
+        /* Cancelled events are just dropped */
+        if (ev->active && ev->on_timeout) {
+            ev->on_timeout(ev);
+        }
+        if (ev->active && !ev->add_pending) {
+            timer_events_insert(ev);
+        }
+    }
+}
+
+#ifdef TIMERS_TICKLESS
+/* Have TIM7 interrupt when the first event in the list is due */
+static void timers_tickless_program(void)
+{
+    uint32_t ticks = TIMERS_TICKLESS_MAX_TICKS;
+    if (timer_events && (timer_events->delta < ticks)) {
+        ticks = timer_events->delta;
+    }
+    timers_tickless_arr = ticks * TIMERS_TICKLESS_COUNTS_PER_TICK - 1;
+    TIM7->ARR = (uint16_t)timers_tickless_arr;
 }
+#endif
 
 void TIM7_IRQHandler(void)
 {
     NVIC_ClearPendingIRQ(TIM7_IRQn);
-    uint16_t tmp;
+#ifdef TIMERS_TICKLESS
+    uint32_t counts;
     if (TIM7->SR & TIM_SR_UIF) {
         TIM7->SR &= ~TIM_SR_UIF;
-        tmp = TIM7->CNT;
-        timer_events_dec_all(timer_events);
-        timer_events_check_all(timer_events);
+        /* The counter has started again from 0, what it counted since
+         * belongs to the next wait */
+        counts = timers_tickless_arr + 1;
+    } else {
+        /* An event was added, count what has passed of this wait and start
+         * again, keeping the part of a tick */
+        counts = TIM7->CNT;
+        TIM7->CNT = counts % TIMERS_TICKLESS_COUNTS_PER_TICK;
+    }
+    timer_events_advance(counts / TIMERS_TICKLESS_COUNTS_PER_TICK);
+    timer_events_take_added();
+    timers_tickless_program();
+#else
+    if (TIM7->SR & TIM_SR_UIF) {
+        TIM7->SR &= ~TIM_SR_UIF;
+        timer_events_take_added();
+        timer_events_advance(1);
 #ifdef TIMER_TEST
         led_disco_green_tog();
 #endif  
     }
+#endif
 }
@@ -2,9 +2,55 @@
 
 #include "uart_midi_lowlevel.h"
 #include "system_init.h" 
+#include "irq_priorities.h" 
 
 static char midiBuffer[MIDI_BUF_SIZE];
 static int MIDIlastIndex = 0;
+/* Where the DMA had got to in midiBuffer and the cycle count when the last
+ * byte before there was received. Added by the DMA half and full transfer
+ * interrupts and the USART idle line interrupt, taken by
+ * midi_hw_process_input. */
+typedef struct {
+    uint32_t pos;
+    uint32_t time;
+} midi_rx_mark_t;
+static midi_rx_mark_t midiRxMarks[MIDI_RX_MARKS];
+static volatile uint32_t midiRxMarkHead = 0;
+static uint32_t midiRxMarkTail = 0;
+/* Cycles it takes to receive one byte (a start bit, 8 data bits and a stop
+ * bit) */
+static uint32_t midiByteCycles = 1;
+/* Cycle count when midi_hw_process_input was last called */
+static uint32_t midiLastProcessTime = 0;
+/* Sample in the block at which the message being handled takes effect and
+ * the cycle count when its last byte was received */
+static uint32_t midiMsgOffset = 0;
+static uint32_t midiMsgTime = 0;
+/* Bytes waiting to be sent, see midi_hw_tx_begin. Producers reserve room by
+ * moving midiTxReserve and what they have written is published by moving
+ * midiTxCommit. The DMA sends from midiTxTail up to midiTxCommit,
+ * midiTxDmaLen bytes at a time. No producer waits for another or disables
+ * interrupts. */
+static char midiTxBuffer[MIDI_TX_BUF_SIZE];
+static volatile uint32_t midiTxReserve = 0, midiTxCommit = 0, midiTxTail = 0;
+/* The number of producers writing */
+static volatile uint32_t midiTxWriters = 0;
+/* Non-zero while the DMA is sending or being started */
+static volatile uint32_t midiTxBusy = 0;
+static uint32_t midiTxDmaLen = 0;
+/* Real-time messages waiting to go ahead of the queue, a bit for each of
+ * midi_hw_rt_bytes, lowest bit first, and when each was asked for */
+static const char midi_hw_rt_bytes[MIDI_HW_NUM_RT] = {
+    MIDI_HW_RT_START,
+    MIDI_HW_RT_CONTINUE,
+    MIDI_HW_RT_CLOCK,
+    MIDI_HW_RT_STOP,
+};
+static volatile uint32_t midiTxRtPending = 0;
+static uint32_t midiTxRtTime[MIDI_HW_NUM_RT];
+static char midiTxRtByte;
+
+midi_hw_tx_stats_t midi_hw_tx_stats;
 
 midi_hw_err_t midi_hw_setup(midi_hw_setup_t *params)
 {
@@ -24,16 +70,34 @@ midi_hw_err_t midi_hw_setup(midi_hw_setup_t *params)
     GPIOD->OSPEEDR &= ~GPIO_OSPEEDER_OSPEEDR6;
     
     GPIOD->OSPEEDR |= 0x3 << (2*6);
+    /* Setup GPIOD5 for transmitting, same as GPIOD6 but push-pull output */
+    GPIOD->AFR[0] &= ~(0xf << (4*5));
+    GPIOD->AFR[0] |= (0x7 << (4*5));
+    GPIOD->MODER &= ~GPIO_MODER_MODER5;
+    GPIOD->MODER |= 0x2 << (2*5);
+    GPIOD->OTYPER &= ~GPIO_OTYPER_OT_5;
+    GPIOD->PUPDR &= ~GPIO_PUPDR_PUPDR5;
+    GPIOD->OSPEEDR |= 0x3 << (2*5);
     /* Setup USART2
      * baudrate = MIDI_BAUD_RATE
      * DIV = (CPU_FREQ / AHB_PRESCALAR / APB1_PRESCALAR)/(MIDI_BAUD_RATE)
-     * setup to receive and enable
-     * enable DMA mode for reception */
+     * setup to receive, transmit and enable
+     * enable DMA mode for reception and transmission */
 //    USART2->BRR = 180000000 / 1 / 4 / MIDI_BAUD_RATE;
     USART2->BRR = get_SystemCoreClock() / get_AHBPresc() 
         / get_APBPresc(1) / MIDI_BAUD_RATE;
-    USART2->CR1 = 0x2004;
-    USART2->CR3 = 0x40;
+    USART2->CR1 = 0x200c;
+    USART2->CR3 = USART_CR3_DMAR | USART_CR3_DMAT;
+    /* Interrupt when the line goes idle after receiving, which is just after
+     * the last byte of a message */
+    USART2->CR1 |= USART_CR1_IDLEIE;
+    NVIC_SetPriority(USART2_IRQn,IRQ_PRIORITY_MIDI_IN);
+    NVIC_EnableIRQ(USART2_IRQn);
+    midiByteCycles = get_SystemCoreClock() / MIDI_BAUD_RATE * 10;
+    /* The cycle counter timestamps the bytes */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    midiLastProcessTime = DWT->CYCCNT;
     /* Setup DMA
      * Channel 4
      * peripheral = USART2->DR
@@ -49,17 +113,43 @@ midi_hw_err_t midi_hw_setup(midi_hw_setup_t *params)
      * no FIFO (triggers when 1/4 full)
      * single memory burst 
      * single peripheral burst
+     * half and full transfer interrupts
      */
     DMA1_Stream5->CR = (0x4 << 25) 
         | (0x2 << 16) 
         | (0x1 << 10)
-        | (0x1 << 8);
+        | (0x1 << 8)
+        | DMA_SxCR_HTIE
+        | DMA_SxCR_TCIE;
     DMA1_Stream5->PAR = (uint32_t)&USART2->DR;
     DMA1_Stream5->M0AR = (uint32_t)midiBuffer;
     DMA1_Stream5->NDTR = (uint16_t)MIDI_BUF_SIZE;
     DMA1_Stream5->FCR &= ~0x3;
+    DMA1->HIFCR = DMA_HIFCR_CHTIF5 | DMA_HIFCR_CTCIF5;
+    NVIC_SetPriority(DMA1_Stream5_IRQn,IRQ_PRIORITY_MIDI_IN);
+    NVIC_EnableIRQ(DMA1_Stream5_IRQn);
     /* Enable DMA */
     DMA1_Stream5->CR |= 0x1;
+    /* Setup transmit DMA, started by midi_hw_send_bytes
+     * Channel 4
+     * peripheral = USART2->DR
+     * dir = memory to peripheral
+     * enable memory inc
+     * peripheral and memory size is byte
+     * low priority
+     * no FIFO
+     * transfer complete interrupt
+     */
+    DMA1_Stream6->CR = (0x4 << 25)
+        | (0x1 << 10)
+        | (0x1 << 6)
+        | DMA_SxCR_TCIE;
+    DMA1_Stream6->PAR = (uint32_t)&USART2->DR;
+    DMA1_Stream6->FCR &= ~0x3;
+    DMA1->HIFCR = DMA_HIFCR_CTCIF6 | DMA_HIFCR_CHTIF6 | DMA_HIFCR_CTEIF6
+        | DMA_HIFCR_CDMEIF6 | DMA_HIFCR_CFEIF6;
+    NVIC_SetPriority(DMA1_Stream6_IRQn,IRQ_PRIORITY_MIDI_OUT);
+    NVIC_EnableIRQ(DMA1_Stream6_IRQn);
     return(0);
 }
 
@@ -68,41 +158,338 @@ midi_hw_err_t midi_hw_cleanup(midi_hw_cleanup_t *params)
 	return 0;
 }
 
+/* Note where the DMA has got to and when. time is when the last byte was
+ * received. Called from the receive interrupts, which have the same priority,
+ * higher than the audio's so the time is taken when the byte comes in. */
+static void midi_rx_mark(uint32_t time)
+{
+    uint32_t head = midiRxMarkHead;
+    midiRxMarks[head & (MIDI_RX_MARKS - 1)] = (midi_rx_mark_t) {
+        .pos = MIDI_BUF_SIZE - MIDI_DMA_STRUCT->NDTR,
+        .time = time
+    };
+    /* The mark is written before it is given to midi_hw_process_input */
+    __DMB();
+    midiRxMarkHead = head + 1;
+}
+
+/* Parse the bytes from MIDIlastIndex up to pos, the last of which was received
+ * at time. The bytes before it arrived a byte time apart. */
+static void midi_rx_parse(uint32_t pos, uint32_t time)
+{
+    uint32_t n_bytes, end, samples_per_byte, offset;
+    n_bytes = (pos + MIDI_BUF_SIZE - MIDIlastIndex) % MIDI_BUF_SIZE;
+    if (n_bytes == 0) {
+        return;
+    }
+    /* The time of the first byte in samples since the last call, in 16.16
+     * fixed point, and the samples between bytes */
+    time -= (n_bytes - 1) * midiByteCycles;
+    offset = (int32_t)(time - midiLastProcessTime) > 0 ?
+        (uint32_t)(((uint64_t)(time - midiLastProcessTime)
+                    * audio_hw_get_sample_rate(NULL) << 16)
+                / get_SystemCoreClock()) : 0;
+    samples_per_byte = (uint32_t)(((uint64_t)audio_hw_get_sample_rate(NULL)
+                * 10 << 16) / MIDI_BAUD_RATE);
+    /* Parse it as at most two contiguous runs so the index doesn't have to
+     * wrap for each byte */
+    while (n_bytes) {
+        end = MIDIlastIndex + n_bytes;
+        if (end > MIDI_BUF_SIZE) {
+            end = MIDI_BUF_SIZE;
+        }
+        n_bytes -= end - MIDIlastIndex;
+        const char *b = midiBuffer + MIDIlastIndex,
+                   *b_end = midiBuffer + end;
+        while (b < b_end) {
+            midiMsgOffset = offset >> 16;
+            if (midiMsgOffset >= audio_hw_get_block_size(NULL)) {
+                midiMsgOffset = audio_hw_get_block_size(NULL) - 1;
+            }
+            midiMsgTime = time;
+            midi_hw_process_byte(*b++);
+            offset += samples_per_byte;
+            time += midiByteCycles;
+        }
+        MIDIlastIndex = end % MIDI_BUF_SIZE;
+    }
+}
+
+/* Handles the bytes received since the last call. They are given to the
+ * parser with the time each was received, so that a message received a number
+ * of samples after the last call takes effect that many samples into this
+ * block. Messages are applied one block later than they arrive, but always
+ * one block later. */
 void midi_hw_process_input(midi_hw_process_t *params)
 {
-    /*
-    if (!MIDITimeToProcessBuffer) {
+    uint32_t head = midiRxMarkHead,
+             /* Marks taken so far are all before this position */
+             pos = (MIDI_BUF_SIZE - MIDI_DMA_STRUCT->NDTR) % MIDI_BUF_SIZE,
+             now = DWT->CYCCNT;
+    if ((head - midiRxMarkTail) > MIDI_RX_MARKS) {
+        /* Marks were overwritten, the times of the bytes will be off */
+        midiRxMarkTail = head - MIDI_RX_MARKS;
+    }
+    /* Read the marks only after the head */
+    __DMB();
+    while (midiRxMarkTail != head) {
+        midi_rx_mark_t *m = &midiRxMarks[midiRxMarkTail++ & (MIDI_RX_MARKS - 1)];
+        uint32_t m_pos = m->pos % MIDI_BUF_SIZE;
+        /* Skip marks for bytes that were already parsed */
+        if (((m_pos + MIDI_BUF_SIZE - MIDIlastIndex) % MIDI_BUF_SIZE)
+                <= ((pos + MIDI_BUF_SIZE - MIDIlastIndex) % MIDI_BUF_SIZE)) {
+            midi_rx_parse(m_pos, m->time);
+        }
+    }
+    /* Bytes of a message still being received haven't been marked yet, they
+     * are given the time now */
+    midi_rx_parse(pos, now);
+    midiMsgOffset = 0;
+    midiLastProcessTime = now;
+}
+
+/* The sample in the current block at which the message being handled should
+ * take effect. Only meaningful while midi_hw_process_input is running. */
+uint32_t midi_hw_get_msg_offset(void)
+{
+    return midiMsgOffset;
+}
+
+/* The cycle count when the last byte of the message being handled was
+ * received. Only meaningful while midi_hw_process_input is running. */
+uint32_t midi_hw_get_msg_time(void)
+{
+    return midiMsgTime;
+}
+
+/* Add v to *p without locking. Returns the new value. */
+static uint32_t midi_tx_atomic_add(volatile uint32_t *p, uint32_t v)
+{
+    uint32_t x;
+    do {
+        x = __LDREXW(p) + v;
+    } while (__STREXW(x,p));
+    return x;
+}
+
+static void midi_tx_atomic_clear(volatile uint32_t *p, uint32_t mask)
+{
+    do {
+    } while (__STREXW(__LDREXW(p) & ~mask,p));
+}
+
+/* Start the DMA sending a waiting real-time byte. Returns 0 if there was
+ * none. */
+static int midi_tx_start_rt(void)
+{
+    uint32_t pending = midiTxRtPending, bit;
+    if (!pending) {
+        return 0;
+    }
+    bit = __builtin_ctz(pending);
+    midi_tx_atomic_clear(&midiTxRtPending,1 << bit);
+    midiTxRtByte = midi_hw_rt_bytes[bit];
+    midi_hw_tx_stats.rt_wait_cycles = DWT->CYCCNT - midiTxRtTime[bit];
+    if (midi_hw_tx_stats.rt_wait_cycles
+            > midi_hw_tx_stats.rt_wait_cycles_max) {
+        midi_hw_tx_stats.rt_wait_cycles_max = midi_hw_tx_stats.rt_wait_cycles;
+    }
+    midiTxDmaLen = 0;
+    DMA1_Stream6->M0AR = (uint32_t)&midiTxRtByte;
+    DMA1_Stream6->NDTR = 1;
+    DMA1_Stream6->CR |= DMA_SxCR_EN;
+    return 1;
+}
+
+/* Start the DMA sending at most MIDI_TX_MAX_RUN of the published bytes, not
+ * past the end of the buffer. Returns 0 if there were none. */
+static int midi_tx_start_run(void)
+{
+    uint32_t tail = midiTxTail & (MIDI_TX_BUF_SIZE - 1),
+             n = midiTxCommit - midiTxTail;
+    if (n == 0) {
+        return 0;
+    }
+    if (n > (MIDI_TX_BUF_SIZE - tail)) {
+        n = MIDI_TX_BUF_SIZE - tail;
+    }
+    if (n > MIDI_TX_MAX_RUN) {
+        n = MIDI_TX_MAX_RUN;
+    }
+    midiTxDmaLen = n;
+    DMA1_Stream6->M0AR = (uint32_t)(midiTxBuffer + tail);
+    DMA1_Stream6->NDTR = n;
+    DMA1_Stream6->CR |= DMA_SxCR_EN;
+    return 1;
+}
+
+/* Start the DMA if it isn't already sending and there is something to send,
+ * real-time bytes first. Whoever sets midiTxBusy owns the DMA until it is
+ * done, so this can be called from anywhere. */
+static void midi_tx_start(void)
+{
+    while (1) {
+        do {
+            if (__LDREXW(&midiTxBusy)) {
+                /* It will look for more when it's done */
+                __CLREX();
+                return;
+            }
+        } while (__STREXW(1,&midiTxBusy));
+        if (midi_tx_start_rt() || midi_tx_start_run()) {
+            return;
+        }
+        midiTxBusy = 0;
+        /* Something could have come after looking and before letting go */
+        if ((!midiTxRtPending) && (midiTxCommit == midiTxTail)) {
+            return;
+        }
+    }
+}
+
+/* A producer is done writing. The last one still writing publishes
+ * everything reserved, which is all written by then because producers that
+ * interrupted it finished before it carried on. */
+static void midi_tx_writer_done(void)
+{
+    uint32_t r, c;
+    if (midi_tx_atomic_add(&midiTxWriters,(uint32_t)-1)) {
         return;
     }
-    MIDITimeToProcessBuffer = 0;
-    */
-    int length = MIDI_DMA_STRUCT->NDTR;
-    int topIndex = MIDI_BUF_SIZE - length;
-    if (topIndex < MIDIlastIndex) {
-        topIndex += MIDI_BUF_SIZE;
+    r = midiTxReserve;
+    /* Something that interrupts here could publish more, so only move
+     * forward */
+    do {
+        c = __LDREXW(&midiTxCommit);
+        if ((int32_t)(r - c) <= 0) {
+            __CLREX();
+            return;
+        }
+    } while (__STREXW(r,&midiTxCommit));
+}
+
+/* Reserve n bytes at the end of the queue. Exactly n bytes must then be put
+ * with midi_hw_tx_put and midi_hw_tx_end called. Messages written this way
+ * are never interleaved, even if written from different interrupts. Returns
+ * -1 if there isn't room, in which case nothing needs to be done. */
+int midi_hw_tx_begin(midi_hw_tx_t *tx, uint32_t n)
+{
+    uint32_t r;
+    midi_tx_atomic_add(&midiTxWriters,1);
+    do {
+        r = __LDREXW(&midiTxReserve);
+        if ((MIDI_TX_BUF_SIZE - (r - midiTxTail)) < n) {
+            __CLREX();
+            midi_tx_writer_done();
+            return -1;
+        }
+    } while (__STREXW(r + n,&midiTxReserve));
+    tx->pos = r;
+    tx->end = r + n;
+    return 0;
+}
+
+void midi_hw_tx_put(midi_hw_tx_t *tx, char byte)
+{
+    if (tx->pos != tx->end) {
+        midiTxBuffer[tx->pos++ & (MIDI_TX_BUF_SIZE - 1)] = byte;
     }
-    int numItems = topIndex - MIDIlastIndex;
-    while (numItems--) {
-            midi_hw_process_byte(midiBuffer[MIDIlastIndex]);
-        /* increase last index so the function starts at the correct point next
-         * interrupt */
-        MIDIlastIndex = (MIDIlastIndex + 1) % MIDI_BUF_SIZE; 
+}
+
+void midi_hw_tx_end(midi_hw_tx_t *tx)
+{
+    midi_tx_writer_done();
+    midi_tx_start();
+}
+
+/* Queue n bytes to be sent. Either all of the bytes are queued or, if there
+ * isn't room for all of them, none of them are and -1 is returned, so that
+ * messages are never sent partially. Returns 0 on success. */
+int midi_hw_send_bytes(const char *bytes, int n)
+{
+    midi_hw_tx_t tx;
+    if (midi_hw_tx_begin(&tx,n)) {
+        return -1;
+    }
+    while (n--) {
+        midi_hw_tx_put(&tx,*bytes++);
+    }
+    midi_hw_tx_end(&tx);
+    return 0;
+}
+
+/* Send a system real-time message ahead of what is queued. It waits at most
+ * for the DMA to finish the MIDI_TX_MAX_RUN bytes it is sending. Only clock,
+ * start, continue and stop go ahead, the others are queued. Returns -1 if the
+ * same message is still waiting to be sent. */
+int midi_hw_send_realtime(char byte)
+{
+    uint32_t bit;
+    for (bit = 0; bit < MIDI_HW_NUM_RT; bit++) {
+        if (midi_hw_rt_bytes[bit] == byte) {
+            break;
+        }
+    }
+    if (bit == MIDI_HW_NUM_RT) {
+        return midi_hw_send_bytes(&byte,1);
+    }
+    if (midiTxRtPending & (1 << bit)) {
+        midi_hw_tx_stats.rt_dropped++;
+        return -1;
     }
+    midiTxRtTime[bit] = DWT->CYCCNT;
+    do {
+    } while (__STREXW(__LDREXW(&midiTxRtPending) | (1 << bit),
+                      &midiTxRtPending));
+    midi_tx_start();
+    return 0;
 }
 
-/* These do nothing as sysex is not implemented */
-void midi_hw_signal_sysex_start(char byte)
+/* Number of bytes that can currently be queued */
+int midi_hw_get_tx_space(void)
 {
-    /* Prevent from getting optimized away. */
-    asm("");
+    return MIDI_TX_BUF_SIZE - (midiTxReserve - midiTxTail);
 }
 
-void midi_hw_send_sysex_byte(char byte)
+/* Roughly how long a message queued now would wait before it started being
+ * sent, in cycles */
+uint32_t midi_hw_get_tx_wait_cycles(void)
 {
-    asm("");
+    return (midiTxReserve - midiTxTail) * midiByteCycles;
 }
 
-void midi_hw_send_sysex_end(char byte)
+void DMA1_Stream5_IRQHandler(void)
 {
-    asm("");
+    uint32_t now = DWT->CYCCNT;
+    NVIC_ClearPendingIRQ(DMA1_Stream5_IRQn);
+    if (DMA1->HISR & (DMA_HISR_HTIF5 | DMA_HISR_TCIF5)) {
+        DMA1->HIFCR = DMA_HIFCR_CHTIF5 | DMA_HIFCR_CTCIF5;
+        midi_rx_mark(now);
+    }
+}
+
+/* A run of bytes has been sent, send the next if there is one */
+void DMA1_Stream6_IRQHandler(void)
+{
+    NVIC_ClearPendingIRQ(DMA1_Stream6_IRQn);
+    if (DMA1->HISR & DMA_HISR_TCIF6) {
+        DMA1->HIFCR = DMA_HIFCR_CTCIF6;
+        midiTxTail += midiTxDmaLen;
+        midiTxDmaLen = 0;
+        midiTxBusy = 0;
+        midi_tx_start();
+    }
+}
+
+void USART2_IRQHandler(void)
+{
+    uint32_t now = DWT->CYCCNT;
+    NVIC_ClearPendingIRQ(USART2_IRQn);
+    if (USART2->SR & USART_SR_IDLE) {
+        /* Cleared by reading SR then DR. The line is idle so the DMA has
+         * already taken the last byte. */
+        (void)USART2->DR;
+        /* The line has been idle for one byte time since the last byte */
+        midi_rx_mark(now - midiByteCycles);
+    }
 }
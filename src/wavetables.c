@@ -9,6 +9,17 @@
 #include "mm_windows.h" 
 #include "fmc.h"
 #include "err.h" 
+#include "stm32f4xx.h" 
+
+#define SAMPLE_TABLE_ZERO_DMA DMA2_Stream7 
+#define SAMPLE_TABLE_ZERO_DMA_IRQHandler DMA2_Stream7_IRQHandler
+#define SAMPLE_TABLE_ZERO_DMA_IRQn DMA2_Stream7_IRQn
+#define DMA_HISR_TCIF() DMA_HISR_TCIF ## 7 
+#define DMA_HIFCR_CTCIF() DMA_HIFCR_CTCIF ## 7 
+#define DMA_HISR_TEIF() DMA_HISR_TEIF ## 7 
+#define DMA_HIFCR_CTEIF() DMA_HIFCR_CTEIF ## 7 
+/* Most 32-bit words one DMA transfer can zero */
+#define SAMPLE_TABLE_ZERO_CHUNK 0xfffc 
 
 MMWavTab WaveTable;
 MMWavTab soundSample;
@@ -23,10 +34,23 @@ MMSample     *hannWindowTable;
 size_t       hannWindowTableLength;
 size_t       zeroxSearchMaxLength;
 static WavTabAreaPair wtaps[NUM_SAMPLE_TABLES];
+#ifndef HOST_BUILD
+/* The table being zeroed by SampleTable_zero_start, where the zeroing has got
+ * to and where it ends. */
+static MMWavTab *zeroTable = NULL;
+static uint32_t *zeroNext = NULL;
+static uint32_t *zeroEnd = NULL;
+/* Where the DMA reads the zeros from */
+static const uint32_t zeroWord = 0;
+#endif /* HOST_BUILD */
 #ifdef WAVETABLES_IN_SRAM
  #define SRAM_WAVETABLE_SIZE 32000/4
     MMSample sramSampleTableData[NUM_SAMPLE_TABLES*SRAM_WAVETABLE_SIZE]
         __attribute__((section(".big_data")));
+#elif defined(HOST_BUILD)
+    /* There's no SDRAM in the host build (see "make host") */
+    static MMSample hostSampleTableData[NUM_SAMPLE_TABLES
+        * SAMPLE_TABLE_LENGTH_SEC * CODEC_SAMPLE_RATE];
 #endif /* WAVETABLES_IN_SRAM */
 
 
@@ -40,6 +64,11 @@ void SampleTable_init(void)
         ((MMArray*)&sampleTable[n])->length = SRAM_WAVETABLE_SIZE;
         sampleTableAreas[n] = ((MMSample*)sramSampleTableData)
             + ((MMArray*)&sampleTable[n])->length*n;
+#elif defined(HOST_BUILD)
+        ((MMArray*)&sampleTable[n])->length = SAMPLE_TABLE_LENGTH_SEC 
+            * CODEC_SAMPLE_RATE;
+        sampleTableAreas[n] = hostSampleTableData
+            + ((MMArray*)&sampleTable[n])->length*n;
 #else
         ((MMArray*)&sampleTable[n])->length = SAMPLE_TABLE_LENGTH_SEC 
             * sampleTable[n].samplerate;
@@ -52,8 +81,11 @@ void SampleTable_init(void)
         }
 #endif /* WAVETABLES_IN_SRAM */
         ((MMArray*)&sampleTable[n])->data = sampleTableAreas[n];
-        memset(((MMArray*)&sampleTable[n])->data,0,
-                sizeof(MMSample) * ((MMArray*)&sampleTable[n])->length);
+        /* The areas are not cleared here, that took most of the boot time.
+         * The length of each table is how much of it holds samples and
+         * nothing past it is read, so an empty table has length 0. The
+         * recorder gets its room from soundSampleMaxLength. */
+        ((MMArray*)&sampleTable[n])->length = 0;
         /* Make ring of WavTabAreaPairs */
         wtaps[n].wavtab = &sampleTable[n];
         wtaps[n].area   = sampleTableAreas[n];
@@ -65,14 +97,139 @@ void SampleTable_init(void)
     }
     theSound = &wtaps[0];
     recordingSound = wtaps[0].next;
-#ifdef WAVETABLES_IN_SRAM
+#if defined(WAVETABLES_IN_SRAM)
     soundSampleMaxLength = SRAM_WAVETABLE_SIZE;
+#elif defined(HOST_BUILD)
+    soundSampleMaxLength = SAMPLE_TABLE_LENGTH_SEC * CODEC_SAMPLE_RATE;
 #else
     soundSampleMaxLength = SAMPLE_TABLE_LENGTH_SEC 
         * audio_hw_get_sample_rate(NULL);
 #endif /* WAVETABLES_IN_SRAM */
 }
 
+#ifdef HOST_BUILD
+
+/* Nothing else is running so the table is just cleared */
+void SampleTable_zero_start(void)
+{
+    if (MMArray_get_length(theSound->wavtab) != 0) {
+        return;
+    }
+    memset(theSound->area, 0, soundSampleMaxLength * sizeof(MMSample));
+    ((MMArray*)theSound->wavtab)->length = soundSampleMaxLength;
+}
+
+void SampleTable_zero_stop(void)
+{
+}
+
+int SampleTable_zeroing(MMWavTab *table)
+{
+    return 0;
+}
+
+#else
+
+static void zero_dma_start_chunk(void)
+{
+    uint32_t n = zeroEnd - zeroNext;
+    if (n > SAMPLE_TABLE_ZERO_CHUNK) {
+        n = SAMPLE_TABLE_ZERO_CHUNK;
+    }
+    SAMPLE_TABLE_ZERO_DMA->CR &= ~DMA_SxCR_EN;
+    while (SAMPLE_TABLE_ZERO_DMA->CR & DMA_SxCR_EN);
+    DMA2->HIFCR = DMA_HIFCR_CTCIF() | DMA_HIFCR_CTEIF();
+    /* Set peripheral address to the zero */
+    SAMPLE_TABLE_ZERO_DMA->PAR = (uint32_t)&zeroWord;
+    /* Set memory address to where the zeroing has got to */
+    SAMPLE_TABLE_ZERO_DMA->M0AR = (uint32_t)zeroNext;
+    SAMPLE_TABLE_ZERO_DMA->NDTR = n;
+    zeroNext += n;
+    SAMPLE_TABLE_ZERO_DMA->CR |= DMA_SxCR_EN;
+}
+
+/* If nothing was put into the playing table (e.g., by recording_flash_restore)
+ * it is zeroed by DMA and then made its full length, so it plays silence like
+ * it did before. This runs while the audio is running. Until it is done the
+ * table has length 0 and no notes are started. */
+void SampleTable_zero_start(void)
+{
+    if (MMArray_get_length(theSound->wavtab) != 0) {
+        return;
+    }
+    zeroTable = theSound->wavtab;
+    zeroNext = (uint32_t*)theSound->area;
+    zeroEnd = zeroNext + soundSampleMaxLength;
+    /* Turn on DMA2 clock */
+    RCC->AHB1ENR |= RCC_AHB1ENR_DMA2EN;
+    /* Reset control register */
+    SAMPLE_TABLE_ZERO_DMA->CR = 0x00000000;
+    while (SAMPLE_TABLE_ZERO_DMA->CR & DMA_SxCR_EN);
+    /* Set to channel 0, low priority so the other streams go first, memory
+     * and peripheral datum size 32-bits, transfer complete interrupt
+     * enable, memory increment, no peripheral (zero) increment. */
+    SAMPLE_TABLE_ZERO_DMA->CR |= (0 << 25)
+        | (0x0 << 16)
+        | (0x2 << 13)
+        | (0x2 << 11)
+        | (0x1 << 4)
+        | (0x2 << 6) /* memory to memory transfer */
+        | DMA_SxCR_MINC
+        | (0x0 << 23) /* no burst */
+        | (0x0 << 21) /* no burst */
+        | DMA_SxCR_TEIE; /* Transfer error interrupt enable */
+    SAMPLE_TABLE_ZERO_DMA->FCR &= ~DMA_SxFCR_FTH;
+    /* Set FIFO threshold to 1/4 */
+    SAMPLE_TABLE_ZERO_DMA->FCR |= (0x0 << 0);
+    NVIC_EnableIRQ(SAMPLE_TABLE_ZERO_DMA_IRQn);
+    zero_dma_start_chunk();
+}
+
+/* Stop zeroing, e.g., because the table is going to be recorded into. The
+ * table is left empty. Call from the audio interrupt or with it disabled. */
+void SampleTable_zero_stop(void)
+{
+    if (!zeroTable) {
+        return;
+    }
+    NVIC_DisableIRQ(SAMPLE_TABLE_ZERO_DMA_IRQn);
+    SAMPLE_TABLE_ZERO_DMA->CR &= ~DMA_SxCR_EN;
+    while (SAMPLE_TABLE_ZERO_DMA->CR & DMA_SxCR_EN);
+    DMA2->HIFCR = DMA_HIFCR_CTCIF() | DMA_HIFCR_CTEIF();
+    NVIC_ClearPendingIRQ(SAMPLE_TABLE_ZERO_DMA_IRQn);
+    zeroTable = NULL;
+    NVIC_EnableIRQ(SAMPLE_TABLE_ZERO_DMA_IRQn);
+}
+
+/* Returns non-zero while table is being zeroed */
+int SampleTable_zeroing(MMWavTab *table)
+{
+    return (zeroTable != NULL) && (zeroTable == table);
+}
+
+void SAMPLE_TABLE_ZERO_DMA_IRQHandler(void)
+{
+    NVIC_ClearPendingIRQ(SAMPLE_TABLE_ZERO_DMA_IRQn);
+    uint32_t hisr = DMA2->HISR;
+    if (hisr & (DMA_HISR_TCIF() | DMA_HISR_TEIF())) {
+        /* Clear interrupt */
+        DMA2->HIFCR = DMA_HIFCR_CTCIF() | DMA_HIFCR_CTEIF();
+        if ((zeroNext < zeroEnd) && !(hisr & DMA_HISR_TEIF())) {
+            zero_dma_start_chunk();
+            return;
+        }
+        SAMPLE_TABLE_ZERO_DMA->CR &= ~DMA_SxCR_EN;
+        /* If it failed the table is left empty */
+        if (!(hisr & DMA_HISR_TEIF())
+                && (MMArray_get_length(zeroTable) == 0)) {
+            ((MMArray*)zeroTable)->length = soundSampleMaxLength;
+        }
+        zeroTable = NULL;
+    }
+}
+
+#endif /* HOST_BUILD */
+
 void HannWindowTable_init(MMSample len_sec)
 {
     size_t N = (MMSample)audio_hw_get_sample_rate(NULL) * len_sec;
@@ -0,0 +1,140 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#include <string.h>
+#include "xrun_history.h"
+#include "i2s_lowlevel.h"
+#include "flash_commanding.h"
+#include "poly_management.h"
+#include "scheduling.h"
+#include "midi_sysex.h"
+
+/* Global so they can be read with gdb */
+volatile xrun_history_entry_t xrun_history[XRUN_HISTORY_SIZE];
+/* Total number of entries ever recorded, the newest is at
+ * xrun_history[(xrun_history_count - 1) % XRUN_HISTORY_SIZE] */
+volatile uint32_t xrun_history_count = 0;
+
+static unsigned int last_n_underruns = 0;
+static unsigned int last_n_resyncs = 0;
+static uint32_t last_isr_cycles = 0;
+static midi_sysex_handler_t request_handler;
+static midi_sysex_handler_t clear_handler;
+
+static void
+record(uint32_t block, uint32_t isr_cycles, uint32_t flags)
+{
+    volatile xrun_history_entry_t *e =
+        &xrun_history[xrun_history_count & (XRUN_HISTORY_SIZE - 1)];
+    e->block = block;
+    e->isr_cycles = isr_cycles;
+    e->active_voices = pm_get_n_busy_voices();
+    e->sched_events = scheduler_get_n_pending_events();
+    e->flags = flags;
+    xrun_history_count++;
+}
+
+/* Call at the end of every block with the number of the block, the cycles it
+ * took, the cycles available and any flags the caller knows about (e.g.,
+ * XRUN_FLAG_REENTERED). If block_period is 0 the deadline isn't checked. */
+void xrun_history_end_block(uint32_t block,
+                            uint32_t isr_cycles,
+                            uint32_t block_period,
+                            uint32_t flags)
+{
+    unsigned int n_underruns = i2s_get_n_underruns(),
+                 n_resyncs = i2s_get_n_resyncs();
+    if (flash_state & FLASH_CMD_BUSY) {
+        flags |= XRUN_FLAG_FLASH_BUSY;
+    }
+    if (n_resyncs != last_n_resyncs) {
+        flags |= XRUN_FLAG_CODEC_RESYNC;
+        last_n_resyncs = n_resyncs;
+    }
+    if (n_underruns != last_n_underruns) {
+        /* The DMA interrupt checks for an underrun after this function has
+         * returned, so this was the previous block's. */
+        record(block - 1, last_isr_cycles,
+                XRUN_FLAG_DMA_UNDERRUN | (flags & ~XRUN_FLAG_MISSES));
+        last_n_underruns = n_underruns;
+    }
+    if (block_period && (isr_cycles > block_period)) {
+        flags |= XRUN_FLAG_DEADLINE;
+    }
+    if (flags & XRUN_FLAG_MISSES) {
+        record(block, isr_cycles, flags);
+    }
+    last_isr_cycles = isr_cycles;
+}
+
+uint32_t xrun_history_get_count(void)
+{
+    return xrun_history_count;
+}
+
+/* Get the entry n_back entries before the newest one (0 is the newest).
+ * Returns -1 if there is no such entry. */
+int xrun_history_get(uint32_t n_back, xrun_history_entry_t *entry)
+{
+    if ((n_back >= xrun_history_count) || (n_back >= XRUN_HISTORY_SIZE)) {
+        return -1;
+    }
+    *entry = xrun_history[(xrun_history_count - 1 - n_back)
+        & (XRUN_HISTORY_SIZE - 1)];
+    return 0;
+}
+
+void xrun_history_clear(void)
+{
+    xrun_history_count = 0;
+}
+
+static uint8_t *
+put_le(uint8_t *buf, uint32_t val, int nbytes)
+{
+    while (nbytes--) {
+        *buf++ = val & 0xff;
+        val >>= 8;
+    }
+    return buf;
+}
+
+/* Reply with the total count followed by the entries, newest first. */
+static void
+sysex_request(void *data, const uint8_t *payload, uint32_t len)
+{
+    static uint8_t buf[4 + XRUN_HISTORY_SIZE * sizeof(xrun_history_entry_t)];
+    uint8_t *ptr = buf;
+    xrun_history_entry_t e;
+    uint32_t n = 0;
+    ptr = put_le(ptr, xrun_history_count, 4);
+    while (xrun_history_get(n++, &e) == 0) {
+        ptr = put_le(ptr, e.block, 4);
+        ptr = put_le(ptr, e.isr_cycles, 4);
+        ptr = put_le(ptr, e.active_voices, 2);
+        ptr = put_le(ptr, e.sched_events, 2);
+        ptr = put_le(ptr, e.flags, 4);
+    }
+    midi_sysex_send(midi_sysex_cmd_XRUN_HISTORY_REPLY, buf, ptr - buf);
+}
+
+static void
+sysex_clear(void *data, const uint8_t *payload, uint32_t len)
+{
+    xrun_history_clear();
+}
+
+void xrun_history_setup(void)
+{
+    last_n_underruns = i2s_get_n_underruns();
+    last_n_resyncs = i2s_get_n_resyncs();
+    request_handler = (midi_sysex_handler_t) {
+        .cmd = midi_sysex_cmd_XRUN_HISTORY_REQUEST,
+        .func = sysex_request,
+    };
+    midi_sysex_handler_add(&request_handler);
+    clear_handler = (midi_sysex_handler_t) {
+        .cmd = midi_sysex_cmd_XRUN_HISTORY_CLEAR,
+        .func = sysex_clear,
+    };
+    midi_sysex_handler_add(&clear_handler);
+}
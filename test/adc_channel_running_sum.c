@@ -0,0 +1,137 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <stdlib.h>
+#include "adc_channel.h"
+
+/* Compares adc_channel_update_running_sum with re-averaging all the values
+ * (adc_channel_update_avg) on a simulated knob: a noisy value that steps to a
+ * new position. The DMA is simulated writing a few scans per block into a
+ * circular buffer (continuous mode) and rewriting the whole buffer (one-shot
+ * mode). Returns non-zero if the two disagree or the running sum rejects noise
+ * worse. */
+
+#define STRIDE 4
+#define N_BLOCKS 400
+#define STEP_BLOCK 100
+#define SETTLE_BLOCKS 50
+/* Scans written per 256-sample block by 4 channels at 480 cycle sample time */
+#define SCANS_PER_BLOCK 45
+#define LEVEL_BEFORE 1000
+#define LEVEL_AFTER 3000
+
+static volatile adc_channel_datatype_t raw[STRIDE * ADC_AVG_SIZE];
+static volatile uint32_t scan_count = 0;
+static uint32_t dma_pos = 0;
+static uint32_t rand_state = 12345;
+
+static int
+noise(void)
+{
+    /* Sum of uniform values, roughly gaussian, standard deviation about 24 */
+    int n, x = 0;
+    for (n = 0; n < 4; n++) {
+        rand_state = rand_state * 1103515245 + 12345;
+        x += (int)((rand_state >> 16) % 41) - 20;
+    }
+    return x;
+}
+
+static void
+dma_write(uint32_t n_scans, int level)
+{
+    while (n_scans--) {
+        int x = level + noise();
+        raw[dma_pos * STRIDE] = (adc_channel_datatype_t)(x < 0 ? 0 :
+                (x > ADC_MAX ? ADC_MAX : x));
+        dma_pos = (dma_pos + 1) % ADC_AVG_SIZE;
+        scan_count++;
+    }
+}
+
+typedef struct {
+    double sum;
+    double sum_sq;
+    uint32_t n;
+} stats_t;
+
+static void
+stats_add(stats_t *s, double x)
+{
+    s->sum += x;
+    s->sum_sq += x * x;
+    s->n++;
+}
+
+static double
+stats_std(stats_t *s)
+{
+    double mean = s->sum / s->n;
+    return sqrt(s->sum_sq / s->n - mean * mean);
+}
+
+static int
+run(const char *name, int one_shot)
+{
+    adc_channel_t avg, running;
+    stats_t raw_stats = {0}, avg_stats = {0}, running_stats = {0};
+    uint32_t block, n_mismatch = 0, n_read = 0, scans_before;
+    int level, failed = 0;
+    dma_pos = 0;
+    scan_count = 0;
+    dma_write(ADC_AVG_SIZE, LEVEL_BEFORE);
+    adc_channel_init(&avg, raw, STRIDE, ADC_AVG_SIZE, &scan_count);
+    avg.update = adc_channel_update_avg;
+    adc_channel_init(&running, raw, STRIDE, ADC_AVG_SIZE, &scan_count);
+    for (block = 0; block < N_BLOCKS; block++) {
+        level = block < STEP_BLOCK ? LEVEL_BEFORE : LEVEL_AFTER;
+        scans_before = running.scans_read;
+        if (one_shot) {
+            /* The DMA starts at the beginning each time */
+            dma_pos = 0;
+            dma_write(ADC_AVG_SIZE, level);
+        } else {
+            dma_write(SCANS_PER_BLOCK, level);
+        }
+        avg.update(&avg);
+        running.update(&running);
+        n_read += scan_count - scans_before;
+        if (avg.cur_val != running.cur_val) {
+            n_mismatch++;
+        }
+        if (block >= (STEP_BLOCK + SETTLE_BLOCKS)) {
+            stats_add(&raw_stats, raw[((dma_pos + ADC_AVG_SIZE - 1)
+                        % ADC_AVG_SIZE) * STRIDE]);
+            stats_add(&avg_stats, avg.cur_val);
+            stats_add(&running_stats, running.cur_val);
+        }
+    }
+    printf("%s:\n", name);
+    printf("  settled value: avg %u running_sum %u (level %d)\n",
+            avg.cur_val, running.cur_val, LEVEL_AFTER);
+    printf("  blocks where they differ: %u\n", n_mismatch);
+    printf("  noise std: raw %f avg %f running_sum %f\n",
+            stats_std(&raw_stats), stats_std(&avg_stats),
+            stats_std(&running_stats));
+    printf("  values read per update: avg %u running_sum %f\n",
+            ADC_AVG_SIZE, (double)n_read / N_BLOCKS);
+    if (n_mismatch
+            || (avg.cur_val != running.cur_val)
+            /* within 4 standard deviations of the average of 128 values */
+            || (abs((int)running.cur_val - LEVEL_AFTER) > 8)
+            || (stats_std(&running_stats) > stats_std(&avg_stats))) {
+        printf("  FAILED\n");
+        failed = 1;
+    }
+    return failed;
+}
+
+int main(void)
+{
+    int failed = 0;
+    failed |= run("continuous", 0);
+    failed |= run("one-shot", 1);
+    return failed;
+}
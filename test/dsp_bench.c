@@ -0,0 +1,250 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+/* Times the DSP kernels of the signal chain on blocks of noise and writes
+ * what each takes per sample as CSV:
+ *
+ *   kernel,block_size,min_per_sample,avg_per_sample,unit
+ *
+ * Built with the host build ("make bench") the unit is ns and the CSV goes to
+ * the file given as the argument (or stdout). Built into the firmware (make
+ * DSP_BENCH=1) the unit is cycles from the DWT counter, main runs the
+ * benchmarks after the signal chain is set up and then halts, and
+ * test/dsp_bench.sh reads the CSV out of dsp_bench_csv with gdb into
+ * /tmp/dsp_bench.csv. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "dsp_bench.h"
+#include "audio_setup.h"
+#include "signal_chain.h"
+#include "wavetables.h"
+#include "signal_gate.h"
+#include "dc_notch_filter.h"
+#include "limiter_ir_af.h"
+#include "mm_busmerger.h"
+#include "mm_busmult.h"
+
+#ifdef HOST_BUILD
+#include <time.h>
+#define DSP_BENCH_UNIT "ns"
+/* Differences of up to about 4 seconds are right */
+static uint32_t dsp_bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+#else
+#include "stm32f4xx.h"
+#define DSP_BENCH_UNIT "cycles"
+#define dsp_bench_now() (DWT->CYCCNT)
+#endif
+
+typedef struct {
+    const char *name;
+    void (*tick)(void);
+    /* Filled with noise before each block, if not NULL */
+    MMSample *buf;
+    /* Called before the kernel is timed, if not NULL */
+    void (*setup)(void);
+} dsp_bench_kernel_t;
+
+char dsp_bench_csv[DSP_BENCH_CSV_SIZE];
+uint32_t dsp_bench_csv_len = 0;
+
+static MMSample dsp_bench_noise[BUFFER_SIZE];
+static MMSample dsp_bench_gain = 1.;
+static MMBus *dsp_bench_bus_a, *dsp_bench_bus_b;
+static MMBusMerger dsp_bench_merger;
+static MMBusMult dsp_bench_mult;
+static audio_hw_sample_t dsp_bench_codec_in[BUFFER_SIZE*CODEC_NUM_CHANNELS],
+                         dsp_bench_codec_out[BUFFER_SIZE*CODEC_NUM_CHANNELS];
+static audio_hw_io_t dsp_bench_io = {
+    .in = dsp_bench_codec_in,
+    .out = dsp_bench_codec_out,
+    .length = BUFFER_SIZE,
+    .nchans_in = CODEC_NUM_CHANNELS,
+    .nchans_out = CODEC_NUM_CHANNELS,
+};
+
+/* The same noise every run, between -1 and 1 */
+static void dsp_bench_fill_noise(MMSample *x, uint32_t n)
+{
+    static uint32_t seed = 1;
+    while (n--) {
+        seed = seed * 1664525 + 1013904223;
+        *x++ = (MMSample)(int32_t)seed / 2147483648.f;
+    }
+}
+
+static void dsp_bench_signal_gate(void)
+{
+    signal_gate_tick(fbk_signal_gate,dsp_bench_noise);
+}
+
+static void dsp_bench_dc_notch(void)
+{
+    dc_notch_filter_1_pole_tick(dc_blocker,dsp_bench_noise);
+}
+
+static void dsp_bench_limiter(void)
+{
+    limiter_ir_af_tick(audio_limiter,dsp_bench_noise);
+}
+
+/* Voice 1 sums into outBus */
+static void dsp_bench_sample_player(void)
+{
+    MMSigProc_tick((MMSigProc*)&spsps[1]);
+}
+
+static void dsp_bench_cubic(void)
+{
+    signal_chain_set_interp(MMInterpMethod_CUBIC);
+}
+
+static void dsp_bench_linear(void)
+{
+    signal_chain_set_interp(MMInterpMethod_LINEAR);
+}
+
+static void dsp_bench_bus_merger(void)
+{
+    MMSigProc_tick((MMSigProc*)&dsp_bench_merger);
+}
+
+static void dsp_bench_bus_mult(void)
+{
+    MMSigProc_tick((MMSigProc*)&dsp_bench_mult);
+}
+
+static void dsp_bench_io_convert(void)
+{
+    audio_io_convert(&dsp_bench_io);
+}
+
+/* Start a voice that plays a table of noise for longer than the benchmark */
+static void dsp_bench_start_voice(void)
+{
+    MMTrapEnvedSamplePlayer_noteOnStruct no;
+    ((MMArray*)theSound->wavtab)->length = audio_hw_get_sample_rate(NULL);
+    dsp_bench_fill_noise(theSound->area,MMArray_get_length(theSound->wavtab));
+    MMEnvedSamplePlayerTwoBus_set_out_bus(&spsps_2bus_wrappers[1],NULL);
+    no.note = 1;
+    no.amplitude = 1.;
+    no.p_gain = &dsp_bench_gain;
+    no.index = 0;
+    no.attackTime = .01;
+    no.releaseTime = .01;
+    no.sustainTime = 1000.;
+    no.samples = theSound->wavtab;
+    /* Not a whole number so it interpolates */
+    no.rate = 1.0123;
+    MMWavTab_inc_n_players(theSound->wavtab);
+    MMTrapEnvedSamplePlayer_noteOn_Rate(&spsps[1],&no);
+}
+
+static void dsp_bench_csv_add(const char *name, uint32_t min, uint32_t avg)
+{
+    /* Per sample to 3 decimal places */
+    uint32_t min_ps = (uint32_t)((uint64_t)min * 1000 / BUFFER_SIZE),
+             avg_ps = (uint32_t)((uint64_t)avg * 1000 / BUFFER_SIZE);
+    int n = snprintf(dsp_bench_csv + dsp_bench_csv_len,
+            DSP_BENCH_CSV_SIZE - dsp_bench_csv_len,
+            "%s,%u,%u.%03u,%u.%03u,%s\n",name,(unsigned)BUFFER_SIZE,
+            (unsigned)(min_ps / 1000),(unsigned)(min_ps % 1000),
+            (unsigned)(avg_ps / 1000),(unsigned)(avg_ps % 1000),
+            DSP_BENCH_UNIT);
+    if ((n > 0) && (dsp_bench_csv_len + n < DSP_BENCH_CSV_SIZE)) {
+        dsp_bench_csv_len += n;
+    }
+}
+
+static void dsp_bench_kernel(dsp_bench_kernel_t *k)
+{
+    uint32_t b, t, dt, min = UINT32_MAX;
+    uint64_t total = 0;
+    if (k->setup) {
+        k->setup();
+    }
+    for (b = 0; b < (DSP_BENCH_WARMUP_BLOCKS + DSP_BENCH_BLOCKS); b++) {
+        if (k->buf) {
+            dsp_bench_fill_noise(k->buf,BUFFER_SIZE);
+        }
+        t = dsp_bench_now();
+        k->tick();
+        dt = dsp_bench_now() - t;
+        if (b < DSP_BENCH_WARMUP_BLOCKS) {
+            continue;
+        }
+        total += dt;
+        if (dt < min) {
+            min = dt;
+        }
+    }
+    dsp_bench_csv_add(k->name,min,(uint32_t)(total / DSP_BENCH_BLOCKS));
+}
+
+/* Called when the results are in dsp_bench_csv, gdb breaks here */
+void __attribute__((noinline)) dsp_bench_done(void)
+{
+    __asm__ volatile ("");
+}
+
+/* Run the benchmarks. The signal chain must be set up (see signal_chain_setup)
+ * and not running. What it plays afterward is not meaningful. */
+void dsp_bench_run(void)
+{
+    int n;
+    dsp_bench_bus_a = MMBus_new(BUFFER_SIZE,1);
+    dsp_bench_bus_b = MMBus_new(BUFFER_SIZE,1);
+    dsp_bench_fill_noise(dsp_bench_bus_a->data,BUFFER_SIZE);
+    MMBusMerger_init(&dsp_bench_merger,dsp_bench_bus_a,dsp_bench_bus_b);
+    MMBusMult_init(&dsp_bench_mult,dsp_bench_bus_a,dsp_bench_bus_b);
+    /* The merger and multiplier write into bus b */
+    dsp_bench_kernel_t kernels[] = {
+        { "signal_gate_tick", dsp_bench_signal_gate, dsp_bench_noise },
+        { "dc_notch_filter_1_pole_tick", dsp_bench_dc_notch, dsp_bench_noise },
+        { "limiter_ir_af_tick", dsp_bench_limiter, dsp_bench_noise },
+        { "sample_player_cubic", dsp_bench_sample_player, outBus->data,
+          dsp_bench_cubic },
+        { "sample_player_linear", dsp_bench_sample_player, outBus->data,
+          dsp_bench_linear },
+        { "bus_merger", dsp_bench_bus_merger, dsp_bench_bus_b->data },
+        { "bus_mult", dsp_bench_bus_mult, dsp_bench_bus_b->data },
+        { "io_convert", dsp_bench_io_convert, outBus->data },
+    };
+    /* Scrambled but the same every run */
+    for (n = 0; n < (BUFFER_SIZE*CODEC_NUM_CHANNELS); n++) {
+        dsp_bench_codec_in[n] = (audio_hw_sample_t)(n * 2654435761u >> 16);
+    }
+    fbk_signal_gate_pass();
+    dsp_bench_start_voice();
+    dsp_bench_csv_len = snprintf(dsp_bench_csv,DSP_BENCH_CSV_SIZE,
+            "kernel,block_size,min_per_sample,avg_per_sample,unit\n");
+    for (n = 0; n < (sizeof(kernels)/sizeof(kernels[0])); n++) {
+        dsp_bench_kernel(&kernels[n]);
+    }
+    signal_chain_set_interp(MMInterpMethod_CUBIC);
+    dsp_bench_done();
+}
+
+#ifdef HOST_BUILD
+int main(int argc, char **argv)
+{
+    FILE *f = stdout;
+    audio_setup(NULL);
+    SampleTable_init();
+    signal_chain_setup();
+    dsp_bench_run();
+    if ((argc > 1) && !(f = fopen(argv[1],"w"))) {
+        perror(argv[1]);
+        return 1;
+    }
+    fwrite(dsp_bench_csv,1,dsp_bench_csv_len,f);
+    if (f != stdout) {
+        fclose(f);
+    }
+    return 0;
+}
+#endif /* HOST_BUILD */
@@ -0,0 +1,15 @@
+# This requires an 856 be plugged in with the debugging dongle and powered,
+# running firmware built with make DSP_BENCH=1
+
+echo "Timing the DSP kernels"
+rm -f /tmp/dsp_bench.csv
+arm-none-eabi-gdb --silent --batch \
+    --command scripts/gdb-load-symbols.script \
+    --command test/dsp_bench.gdb > /dev/null
+
+if [[ -s /tmp/dsp_bench.csv ]]
+then
+    cat /tmp/dsp_bench.csv
+else
+    echo "FAILED"
+fi
@@ -0,0 +1,257 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+/* The tool the golden tests use (see "make test").
+ *
+ *   golden_check loop out.wav
+ *
+ * writes the test loop that is played into the input of each test: 2 seconds
+ * of a bass line, a chord and hi-hats, made with integers so it is the same
+ * on every computer.
+ *
+ *   golden_check compare [-t tolerance] golden.wav out.wav [name]
+ *
+ * compares a rendered WAV file with its golden file. The tolerance is the
+ * least signal to noise ratio in dB that passes, taking the difference as the
+ * noise, or "exact" to pass only if every sample is the same (the default).
+ * Prints one line saying how it went, starting with the name if given, and
+ * exits with 0 if it passed and 1 if not. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#ifndef CODEC_SAMPLE_RATE
+ #define CODEC_SAMPLE_RATE 32000
+#endif
+
+#define GOLDEN_LOOP_SECONDS 2
+/* Length of an eighth note of the loop in samples, 120 BPM */
+#define GOLDEN_LOOP_EIGHTH (CODEC_SAMPLE_RATE / 4)
+
+static uint32_t golden_le32(const unsigned char *b)
+{
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static uint16_t golden_le16(const unsigned char *b)
+{
+    return b[0] | (b[1] << 8);
+}
+
+/* Reads the first channel of a 16-bit PCM WAV file into *samples (allocated).
+ * Returns the number of frames or -1 on error. */
+static long golden_read_wav(const char *path, int16_t **samples)
+{
+    FILE *f;
+    unsigned char hdr[12], chunk[8], fmt[16];
+    uint32_t size;
+    uint16_t channels = 0, bits = 0, format = 0;
+    long n, n_frames = -1;
+    int16_t *frame;
+    if (!(f = fopen(path,"rb"))) {
+        perror(path);
+        return -1;
+    }
+    if ((fread(hdr,1,12,f) != 12) || memcmp(hdr,"RIFF",4)
+            || memcmp(hdr + 8,"WAVE",4)) {
+        fprintf(stderr,"%s: not a WAV file\n",path);
+        goto done;
+    }
+    while (fread(chunk,1,8,f) == 8) {
+        size = golden_le32(chunk + 4);
+        if (!memcmp(chunk,"fmt ",4) && (size >= 16)) {
+            if (fread(fmt,1,16,f) != 16) {
+                break;
+            }
+            format = golden_le16(fmt);
+            channels = golden_le16(fmt + 2);
+            bits = golden_le16(fmt + 14);
+            fseek(f,(size - 16) + (size & 1),SEEK_CUR);
+        } else if (!memcmp(chunk,"data",4)) {
+            if ((format != 1) || (bits != 16) || (channels == 0)) {
+                fprintf(stderr,"%s: only 16-bit PCM is read\n",path);
+                goto done;
+            }
+            n_frames = size / (2 * channels);
+            *samples = malloc(sizeof(int16_t) * (n_frames + 1));
+            frame = malloc(sizeof(int16_t) * channels);
+            for (n = 0; n < n_frames; n++) {
+                if (fread(frame,2 * channels,1,f) != 1) {
+                    break;
+                }
+                (*samples)[n] = frame[0];
+            }
+            n_frames = n;
+            free(frame);
+            goto done;
+        } else {
+            fseek(f,size + (size & 1),SEEK_CUR);
+        }
+    }
+    fprintf(stderr,"%s: no audio found\n",path);
+done:
+    fclose(f);
+    return n_frames;
+}
+
+static void golden_put_le32(FILE *f, uint32_t x)
+{
+    unsigned char b[4] = { x, x >> 8, x >> 16, x >> 24 };
+    fwrite(b,1,4,f);
+}
+
+static void golden_put_le16(FILE *f, uint16_t x)
+{
+    unsigned char b[2] = { x, x >> 8 };
+    fwrite(b,1,2,f);
+}
+
+/* A saw wave of period samples between -amp and amp */
+static int32_t golden_saw(uint32_t n, uint32_t period, int32_t amp)
+{
+    return (int32_t)((n % period) * 2 * amp / period) - amp;
+}
+
+static int golden_loop(const char *path)
+{
+    /* Periods of the notes of the bass line and of the chord (A, C, E) */
+    static const uint32_t bass[8] = { 291, 291, 218, 291, 245, 291, 218, 194 };
+    static const uint32_t chord[3] = { 73, 61, 49 };
+    uint32_t n, k, eighth, pos, seed = 1,
+             n_frames = GOLDEN_LOOP_SECONDS * CODEC_SAMPLE_RATE;
+    int32_t x, env;
+    FILE *f;
+    if (!(f = fopen(path,"wb"))) {
+        perror(path);
+        return 1;
+    }
+    fwrite("RIFF",1,4,f);
+    golden_put_le32(f,36 + n_frames * 2);
+    fwrite("WAVEfmt ",1,8,f);
+    golden_put_le32(f,16);
+    golden_put_le16(f,1);
+    golden_put_le16(f,1);
+    golden_put_le32(f,CODEC_SAMPLE_RATE);
+    golden_put_le32(f,CODEC_SAMPLE_RATE * 2);
+    golden_put_le16(f,2);
+    golden_put_le16(f,16);
+    fwrite("data",1,4,f);
+    golden_put_le32(f,n_frames * 2);
+    for (n = 0; n < n_frames; n++) {
+        eighth = n / GOLDEN_LOOP_EIGHTH;
+        pos = n % GOLDEN_LOOP_EIGHTH;
+        /* Each note dies away linearly over the eighth */
+        env = (int32_t)(GOLDEN_LOOP_EIGHTH - pos);
+        x = golden_saw(n,bass[eighth % 8],6000) * env / GOLDEN_LOOP_EIGHTH;
+        /* The chord on every other eighth */
+        if (eighth & 1) {
+            for (k = 0; k < 3; k++) {
+                x += golden_saw(n,chord[k],2000) * env / GOLDEN_LOOP_EIGHTH;
+            }
+        }
+        /* A hi-hat of noise at the start of each eighth */
+        seed = seed * 1664525 + 1013904223;
+        if (pos < (GOLDEN_LOOP_EIGHTH / 8)) {
+            x += ((int32_t)(seed >> 16) - 32768) / 8
+                * (int32_t)(GOLDEN_LOOP_EIGHTH / 8 - pos)
+                / (GOLDEN_LOOP_EIGHTH / 8);
+        }
+        golden_put_le16(f,(uint16_t)(int16_t)x);
+    }
+    fclose(f);
+    return 0;
+}
+
+static int golden_compare(const char *golden_path,
+                          const char *out_path,
+                          const char *tolerance,
+                          const char *name)
+{
+    int16_t *golden = NULL, *out = NULL;
+    long n, n_golden, n_out, n_diff = 0, first_diff = -1;
+    double signal = 0, noise = 0, snr, min_snr = 0;
+    int32_t d, max_diff = 0, exact = !strcmp(tolerance,"exact"), ret = 1;
+    char *end;
+    if (!exact) {
+        min_snr = strtod(tolerance,&end);
+        if ((end == tolerance) || (*end != '\0')) {
+            fprintf(stderr,"tolerance must be dB or exact, not %s\n",
+                    tolerance);
+            return 1;
+        }
+    }
+    if ((n_golden = golden_read_wav(golden_path,&golden)) < 0) {
+        fprintf(stderr,"%s: no golden file, \"make golden\" makes it\n",
+                name);
+        return 1;
+    }
+    if ((n_out = golden_read_wav(out_path,&out)) < 0) {
+        goto done;
+    }
+    if (n_out != n_golden) {
+        printf("%s: FAILED, %ld samples long, the golden file is %ld\n",name,
+               n_out,n_golden);
+        goto done;
+    }
+    for (n = 0; n < n_golden; n++) {
+        d = (int32_t)out[n] - golden[n];
+        signal += (double)golden[n] * golden[n];
+        noise += (double)d * d;
+        if (d) {
+            n_diff++;
+            if (first_diff < 0) {
+                first_diff = n;
+            }
+        }
+        d = d < 0 ? -d : d;
+        max_diff = d > max_diff ? d : max_diff;
+    }
+    if (!n_diff) {
+        printf("%s: ok, exact\n",name);
+        ret = 0;
+        goto done;
+    }
+    snr = signal > 0 ? 10 * log10(signal / noise) : -INFINITY;
+    ret = exact || (snr < min_snr);
+    printf("%s: %s, SNR %.1f dB, %ld samples differ by up to %d, the first "
+           "at %ld\n",name,ret ? "FAILED" : "ok",snr,n_diff,(int)max_diff,
+           first_diff);
+done:
+    free(golden);
+    free(out);
+    return ret;
+}
+
+static void golden_usage(void)
+{
+    fprintf(stderr,
+        "usage: golden_check loop out.wav\n"
+        "       golden_check compare [-t dB|exact] golden.wav out.wav [name]\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *tolerance = "exact";
+    if ((argc == 3) && !strcmp(argv[1],"loop")) {
+        return golden_loop(argv[2]);
+    }
+    if ((argc < 4) || strcmp(argv[1],"compare")) {
+        golden_usage();
+        return 1;
+    }
+    argc -= 2;
+    argv += 2;
+    if (!strcmp(argv[0],"-t")) {
+        tolerance = argv[1];
+        argc -= 2;
+        argv += 2;
+    }
+    if ((argc != 2) && (argc != 3)) {
+        golden_usage();
+        return 1;
+    }
+    return golden_compare(argv[0],argv[1],tolerance,
+                          argc == 3 ? argv[2] : argv[1]);
+}
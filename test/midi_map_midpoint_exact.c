@@ -30,6 +30,12 @@ static float test_map_midpoint_exact()
     printf("%f\n",map_0_1_pitch_range(midi_util_map_midpoint_exact(63,0,1)));
     printf("%f\n",map_0_1_pitch_range(midi_util_map_midpoint_exact(65,0,1)));
     printf("%f\n",map_0_1_pitch_range(midi_util_map_midpoint_exact(66,0,1)));
+    printf("\n");
+    printf("%f\n",midi_util_map_midpoint_exact_14bit(8192,0,1));
+    printf("%f\n",midi_util_map_midpoint_exact_14bit(16383,0,1));
+    printf("%f\n",midi_util_map_midpoint_exact_14bit(0,0,1));
+    printf("%f\n",midi_util_map_midpoint_exact_14bit(8191,0,1));
+    printf("%f\n",midi_util_map_midpoint_exact_14bit(8193,0,1));
 }
 
 int main(void)
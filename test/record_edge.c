@@ -0,0 +1,78 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+/* Checks that a recording started and stopped with the record footswitch
+ * (FSW1) starts and stops at the samples the footswitch was pressed. An
+ * impulse played into the input after the first press must be in the
+ * recording as far from its start as it was from the press, and the recording
+ * must be as long as the time between the presses. Built with the host build
+ * and run by "make test". */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "host_hal.h"
+#include "signal_chain.h"
+#include "switches.h"
+
+/* Not on a block boundary so a lateness of a whole block shows */
+#define RECORD_EDGE_START       (20 * BUFFER_SIZE + 77)
+#define RECORD_EDGE_IMPULSE     (RECORD_EDGE_START + 4000)
+#define RECORD_EDGE_STOP        (RECORD_EDGE_IMPULSE + 8000)
+#define RECORD_EDGE_PRESS_LEN   800
+#define RECORD_EDGE_N_BLOCKS \
+    ((RECORD_EDGE_STOP + RECORD_EDGE_PRESS_LEN) / BUFFER_SIZE \
+     + SWITCHES_DEBOUNCE_SCANS + 4)
+
+int main(void)
+{
+    audio_hw_sample_t in[BUFFER_SIZE*CODEC_NUM_CHANNELS] = { 0 },
+                      out[BUFFER_SIZE*CODEC_NUM_CHANNELS];
+    MMWavTab *rec = NULL;
+    uint32_t b, n, len, peak = 0;
+    MMSample x, peak_x = 0;
+    uint64_t sample;
+    host_setup(-1,0);
+    if (host_switch_in(RECORD_EDGE_START,"fsw1",1)
+            || host_switch_in(RECORD_EDGE_START + RECORD_EDGE_PRESS_LEN,
+                              "fsw1",0)
+            || host_switch_in(RECORD_EDGE_STOP,"fsw1",1)
+            || host_switch_in(RECORD_EDGE_STOP + RECORD_EDGE_PRESS_LEN,
+                              "fsw1",0)) {
+        fprintf(stderr,"record_edge: couldn't queue the presses\n");
+        return 1;
+    }
+    for (b = 0; b < RECORD_EDGE_N_BLOCKS; b++) {
+        for (n = 0; n < BUFFER_SIZE; n++) {
+            sample = host_get_sample() + n;
+            in[n * CODEC_NUM_CHANNELS] =
+                sample == RECORD_EDGE_IMPULSE ? 16000 : 0;
+        }
+        host_audio_block(in,out);
+        if (!rec && (wtr.state == MMWavTabRecorderState_RECORDING)) {
+            rec = wtr.buffer;
+        }
+    }
+    if (!rec || (wtr.state != MMWavTabRecorderState_STOPPED)) {
+        printf("record_edge: FAILED, the footswitch didn't record\n");
+        return 1;
+    }
+    len = MMArray_get_length(rec);
+    for (n = 0; n < len; n++) {
+        x = MMWavTab_get(rec,n);
+        x = x < 0 ? -x : x;
+        if (x > peak_x) {
+            peak_x = x;
+            peak = n;
+        }
+    }
+    if ((len != (RECORD_EDGE_STOP - RECORD_EDGE_START))
+            || (peak_x == 0)
+            || (peak != (RECORD_EDGE_IMPULSE - RECORD_EDGE_START))) {
+        printf("record_edge: FAILED, %u samples long with the impulse at %u, "
+               "should be %u long with it at %u\n",len,peak,
+               RECORD_EDGE_STOP - RECORD_EDGE_START,
+               RECORD_EDGE_IMPULSE - RECORD_EDGE_START);
+        return 1;
+    }
+    printf("record_edge: ok\n");
+    return 0;
+}
@@ -0,0 +1,302 @@
+/* Copyright (c) 2016 Nicholas Esterer. All rights reserved. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "synth_midi_control.h"
+
+/* Replays every control change number through synth_midi_control_handle_cc
+ * and checks it calls the right synth_control function with the right note and
+ * pitch. Then does the same for the NRPNs, checking that a value is applied
+ * once per block and not again if it didn't change. The synth_control
+ * functions are replaced by ones that record the call. Returns non-zero if
+ * any control is wrong. */
+
+#define CHANNEL 3
+#define VALUE 64
+
+static const char *called_func;
+static int called_note, called_pitch, n_calls;
+
+static void
+record(const char *func, int note, int pitch)
+{
+    if (n_calls++ == 0) {
+        called_func = func;
+        called_note = note;
+        called_pitch = pitch;
+    }
+}
+
+#define STUB_NOTE_PITCH(f,t) \
+    void f(t param, int which_pitch, int note) { record(#f,note,which_pitch); }
+#define STUB_NOTE(f,t) \
+    void f(t param, int note) { record(#f,note,-1); }
+#define STUB_GLOBAL(f,t) \
+    void f(t param) { record(#f,-1,-1); }
+#define STUB_VOID(f) \
+    void f(void) { record(#f,-1,-1); }
+
+STUB_NOTE_PITCH(synth_control_set_pitch_fine_quant,float)
+STUB_NOTE_PITCH(synth_control_set_pitch,float)
+STUB_NOTE_PITCH(synth_control_set_pitch_fine,float)
+STUB_NOTE(synth_control_set_envelopeTime,float)
+STUB_NOTE(synth_control_set_sustainTime,float)
+STUB_NOTE(synth_control_set_wet,float)
+STUB_NOTE(synth_control_set_startPoint,float)
+STUB_NOTE(synth_control_set_positionStride,float)
+STUB_NOTE(synth_control_set_offset,float)
+STUB_NOTE(synth_control_set_ampLastEcho,float)
+STUB_NOTE(synth_control_set_eventDelta_free,float)
+STUB_NOTE(synth_control_set_numRepeats,int)
+STUB_NOTE(synth_control_set_noteStride,float)
+STUB_NOTE(synth_control_set_intermittency_idx,unsigned int)
+STUB_NOTE(synth_control_set_swing,float)
+STUB_GLOBAL(synth_control_set_tempo_coarse_norm,float)
+STUB_GLOBAL(synth_control_set_tempo_fine_norm,float)
+STUB_GLOBAL(synth_control_set_tempo_scale_norm,float)
+STUB_GLOBAL(synth_control_tempoNudge,float)
+STUB_GLOBAL(synth_control_feedback_control,uint32_t)
+STUB_GLOBAL(sc_presets_store,int)
+STUB_GLOBAL(sc_presets_recall,int)
+STUB_VOID(synth_control_record_start)
+STUB_VOID(synth_control_record_stop)
+STUB_VOID(synth_control_schedulerState_on)
+STUB_VOID(synth_control_schedulerState_off)
+STUB_VOID(scheduler_incTimeAndDoEvents_midiclock)
+
+void synth_control_reset_noteStrideAcc_note(int note)
+{
+    record("synth_control_reset_noteStrideAcc_note",note,-1);
+}
+
+void synth_control_set_recMode_onChange(SynthControlRecMode recMode_param,
+                                        SynthControlRecMode *last_recMode_param)
+{
+    record("synth_control_set_recMode_onChange",-1,-1);
+}
+
+int recording_flash_save(void)
+{
+    record("recording_flash_save",-1,-1);
+    return 0;
+}
+
+STUB_GLOBAL(telemetry_set_enabled,int)
+STUB_GLOBAL(midi_clock_out_set_enabled,int)
+STUB_GLOBAL(midi_thru_set_enabled,int)
+void telemetry_midi_clock(uint32_t time) {}
+uint32_t midi_hw_get_msg_time(void) { return 0; }
+
+void synth_control_one_shot(MMSample pitch, MMSample amplitude) {}
+
+MIDI_Router_Standard midiRouter;
+
+void MIDI_Router_addCB(MIDI_Router *router, char type, char chan,
+                       void (*func)(void*,MIDIMsg*), void *data) {}
+
+typedef struct {
+    const char *func;
+    int note;
+    int pitch;
+} expected_t;
+
+#define NOTE_GROUP(note) \
+    { "synth_control_set_pitch_fine_quant", note, 0 }, \
+    { "synth_control_set_pitch_fine_quant", note, 1 }, \
+    { "synth_control_set_pitch_fine_quant", note, 2 }, \
+    { "synth_control_set_envelopeTime", note, -1 }, \
+    { "synth_control_set_sustainTime", note, -1 }, \
+    { "synth_control_set_pitch", note, 0 }, \
+    { "synth_control_set_pitch", note, 1 }, \
+    { "synth_control_set_pitch", note, 2 }, \
+    { "synth_control_set_wet", note, -1 }, \
+    { "synth_control_set_startPoint", note, -1 }, \
+    { "synth_control_set_positionStride", note, -1 }, \
+    { "synth_control_set_offset", note, -1 }, \
+    { "synth_control_set_ampLastEcho", note, -1 }, \
+    { "synth_control_set_eventDelta_free", note, -1 }, \
+    { "synth_control_set_numRepeats", note, -1 }, \
+    { "synth_control_reset_noteStrideAcc_note", note, -1 }, \
+    { "synth_control_set_intermittency_idx", note, -1 }, \
+    { "synth_control_set_swing", note, -1 }
+
+/* What each control change should call with a value of VALUE, NULL for those
+ * that aren't used */
+static const expected_t expected[SYNTH_MIDI_NUM_CCS] = {
+    NOTE_GROUP(0),
+    NOTE_GROUP(1),
+    NOTE_GROUP(2),
+    { "synth_control_set_tempo_coarse_norm", -1, -1 },
+    { "synth_control_set_tempo_fine_norm", -1, -1 },
+    { "synth_control_set_tempo_scale_norm", -1, -1 },
+    { "synth_control_tempoNudge", -1, -1 },
+    { "sc_presets_store", -1, -1 },
+    { "sc_presets_recall", -1, -1 },
+    { "synth_control_record_start", -1, -1 },
+    { "synth_control_schedulerState_on", -1, -1 },
+    { "synth_control_set_recMode_onChange", -1, -1 },
+    { "synth_control_feedback_control", -1, -1 },
+    { "synth_control_set_noteStride", 0, -1 },
+    { "synth_control_set_noteStride", 1, -1 },
+    { "synth_control_set_noteStride", 2, -1 },
+    { "recording_flash_save", -1, -1 },
+    { "telemetry_set_enabled", -1, -1 },
+    { "midi_clock_out_set_enabled", -1, -1 },
+    { "midi_thru_set_enabled", -1, -1 },
+};
+
+typedef struct {
+    uint32_t nrpn;
+    expected_t e;
+} expected_nrpn_t;
+
+#define NRPN_NOTE_GROUP(note) \
+    { note*18 + 0, { "synth_control_set_pitch_fine", note, 0 } }, \
+    { note*18 + 1, { "synth_control_set_pitch_fine", note, 1 } }, \
+    { note*18 + 2, { "synth_control_set_pitch_fine", note, 2 } }, \
+    { note*18 + 9, { "synth_control_set_startPoint", note, -1 } }, \
+    { note*18 + 10, { "synth_control_set_positionStride", note, -1 } }
+
+static const expected_nrpn_t expected_nrpn[] = {
+    NRPN_NOTE_GROUP(0),
+    NRPN_NOTE_GROUP(1),
+    NRPN_NOTE_GROUP(2),
+    { 54, { "synth_control_set_tempo_coarse_norm", -1, -1 } },
+    { 55, { "synth_control_set_tempo_fine_norm", -1, -1 } },
+    { 57, { "synth_control_tempoNudge", -1, -1 } },
+    { 64, { "synth_control_set_noteStride", 0, -1 } },
+    { 65, { "synth_control_set_noteStride", 1, -1 } },
+    { 66, { "synth_control_set_noteStride", 2, -1 } },
+};
+
+static void
+reset_calls(void)
+{
+    called_func = NULL;
+    called_note = called_pitch = -1;
+    n_calls = 0;
+}
+
+static int
+cc(MIDIMsg *msg, int channel, int cc, int value)
+{
+    msg->data[0] = 0xb0 | channel;
+    msg->data[1] = cc;
+    msg->data[2] = value;
+    return synth_midi_control_handle_cc(msg);
+}
+
+static int
+send_cc(MIDIMsg *msg, int channel, int cc_num)
+{
+    reset_calls();
+    return cc(msg,channel,cc_num,VALUE);
+}
+
+static int
+check_call(const char *what, int num, const expected_t *e)
+{
+    if (!called_func || strcmp(called_func,e->func)
+            || (called_note != e->note) || (called_pitch != e->pitch)) {
+        printf("%s %d: expected %s note %d pitch %d, got %s note %d pitch %d\n",
+                what, num, e->func, e->note, e->pitch,
+                called_func ? called_func : "nothing",
+                called_note, called_pitch);
+        return 1;
+    }
+    return 0;
+}
+
+static int
+check_nrpns(MIDIMsg *msg)
+{
+    int n, failed = 0;
+    for (n = 0; n < sizeof(expected_nrpn)/sizeof(expected_nrpn_t); n++) {
+        const expected_nrpn_t *x = &expected_nrpn[n];
+        reset_calls();
+        cc(msg,CHANNEL,SYNTH_MIDI_CC_NRPN_MSB,x->nrpn >> 7);
+        cc(msg,CHANNEL,SYNTH_MIDI_CC_NRPN_LSB,x->nrpn & 0x7f);
+        /* A few values in one block, only the last should be applied */
+        cc(msg,CHANNEL,SYNTH_MIDI_CC_DATA_ENTRY_MSB,0x10);
+        cc(msg,CHANNEL,SYNTH_MIDI_CC_DATA_ENTRY_LSB,0x01);
+        cc(msg,CHANNEL,SYNTH_MIDI_CC_DATA_ENTRY_LSB,0x02);
+        if (n_calls) {
+            printf("NRPN %u: applied before the end of the block\n", x->nrpn);
+            failed = 1;
+        }
+        synth_midi_control_apply_nrpns();
+        if (n_calls != 1) {
+            printf("NRPN %u: applied %d times\n", x->nrpn, n_calls);
+            failed = 1;
+        }
+        failed |= check_call("NRPN",x->nrpn,&x->e);
+        /* The same value again is not applied */
+        reset_calls();
+        cc(msg,CHANNEL,SYNTH_MIDI_CC_DATA_ENTRY_MSB,0x10);
+        cc(msg,CHANNEL,SYNTH_MIDI_CC_DATA_ENTRY_LSB,0x02);
+        synth_midi_control_apply_nrpns();
+        if (n_calls) {
+            printf("NRPN %u: unchanged value applied\n", x->nrpn);
+            failed = 1;
+        }
+    }
+    /* The data entry of a registered parameter (here the pitch bend range)
+     * is ignored, not taken as CC 6 and 38 */
+    reset_calls();
+    cc(msg,CHANNEL,SYNTH_MIDI_CC_RPN_MSB,0);
+    cc(msg,CHANNEL,SYNTH_MIDI_CC_RPN_LSB,0);
+    cc(msg,CHANNEL,SYNTH_MIDI_CC_DATA_ENTRY_MSB,2);
+    cc(msg,CHANNEL,SYNTH_MIDI_CC_DATA_ENTRY_LSB,0);
+    synth_midi_control_apply_nrpns();
+    if (n_calls) {
+        printf("RPN 0: data entry called %s\n", called_func);
+        failed = 1;
+    }
+    cc(msg,CHANNEL,SYNTH_MIDI_CC_RPN_MSB,0x7f);
+    cc(msg,CHANNEL,SYNTH_MIDI_CC_RPN_LSB,0x7f);
+    send_cc(msg,CHANNEL,SYNTH_MIDI_CC_DATA_ENTRY_MSB);
+    failed |= check_call("CC",SYNTH_MIDI_CC_DATA_ENTRY_MSB,
+                         &expected[SYNTH_MIDI_CC_DATA_ENTRY_MSB]);
+    /* Deselecting gives CC 6 back its usual meaning */
+    cc(msg,CHANNEL,SYNTH_MIDI_CC_NRPN_MSB,0x7f);
+    cc(msg,CHANNEL,SYNTH_MIDI_CC_NRPN_LSB,0x7f);
+    send_cc(msg,CHANNEL,SYNTH_MIDI_CC_DATA_ENTRY_MSB);
+    failed |= check_call("CC",SYNTH_MIDI_CC_DATA_ENTRY_MSB,
+                         &expected[SYNTH_MIDI_CC_DATA_ENTRY_MSB]);
+    return failed;
+}
+
+int main (void)
+{
+    int n, failed = 0;
+    /* Allocated so it works however the library lays out the data */
+    MIDIMsg *msg = malloc(sizeof(MIDIMsg) + 3);
+    synth_midi_control_setup(CHANNEL);
+    for (n = 0; n < SYNTH_MIDI_NUM_CCS; n++) {
+        const expected_t *e = &expected[n];
+        if (!send_cc(msg,CHANNEL,n)) {
+            printf("CC %d: not handled\n", n);
+            failed = 1;
+            continue;
+        }
+        if (!e->func) {
+            if (n_calls) {
+                printf("CC %d: unused but called %s\n", n, called_func);
+                failed = 1;
+            }
+            continue;
+        }
+        failed |= check_call("CC",n,e);
+    }
+    failed |= check_nrpns(msg);
+    /* Control changes on other channels are left to the router */
+    if (send_cc(msg,CHANNEL + 1,0) || n_calls) {
+        printf("CC on channel %d handled\n", CHANNEL + 1);
+        failed = 1;
+    }
+    free(msg);
+    printf("%s\n", failed ? "FAILED" : "PASSED");
+    return failed;
+}